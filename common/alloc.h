@@ -281,6 +281,12 @@ bool
 alloc_replace_overlaps_malloc(byte *start, byte *end,
                               malloc_info_t *info INOUT);
 
+/* Returns the bytes of arena space obtained from the OS and the bytes held
+ * in delayed frees, for memory usage reports
+ */
+void
+alloc_replace_get_usage(size_t *capacity OUT, size_t *delayed OUT);
+
 /***************************************************************************
  * CLIENT CALLBACKS
  */
@@ -84,6 +84,7 @@
 #include "asm_utils.h"
 #include "alloc.h"
 #include "alloc_private.h"
+#include "alloc_replace.h"
 #include "heap.h"
 #include "drsymcache.h"
 #include <string.h> /* memcpy */
@@ -352,8 +353,11 @@ static hashtable_t pre_us_table;
  * the header prior to corruption and possible crash).
  */
 
-#ifdef STATISTICS
+/* These two are kept in all builds for alloc_replace_get_usage() */
 static uint heap_capacity;
+static uint delayed_bytes_total;
+
+#ifdef STATISTICS
 static uint peak_heap_capacity;
 static uint num_arenas;
 static uint peak_num_arenas;
@@ -420,7 +424,8 @@ malloc_layer_name(uint flags)
 }
 #endif
 
-static inline void *
+/* Also used by replace.c's native string and memory routines */
+void *
 enter_client_code(void)
 {
     void *drcontext = dr_get_current_drcontext();
@@ -455,7 +460,7 @@ enter_client_code(void)
     return drcontext;
 }
 
-static void
+void
 exit_client_code(void *drcontext, bool in_app_mode)
 {
     byte *final_app_xsp = (byte *)
@@ -958,7 +963,7 @@ arena_init(arena_header_t *arena, arena_header_t *parent)
     arena->magic = HEADER_MAGIC;
     arena->next_arena = NULL;
     arena->prev_free_sz = 0;
-    STATS_ADD(heap_capacity, (uint)(arena->commit_end - (byte *)arena));
+    ATOMIC_ADD32(heap_capacity, (uint)(arena->commit_end - (byte *)arena));
     STATS_PEAK(heap_capacity);
     STATS_INC(num_arenas);
     STATS_PEAK(num_arenas);
@@ -1030,7 +1035,7 @@ arena_extend(arena_header_t *arena, heapsz_t add_size)
         byte *new_brk = set_brk(cur_brk + aligned_add);
         if (new_brk >= cur_brk + add_size) {
             LOG(2, "\tincreased brk from "PFX" to "PFX"\n", cur_brk, new_brk);
-            STATS_ADD(heap_capacity, (uint)(new_brk - cur_brk));
+            ATOMIC_ADD32(heap_capacity, (uint)(new_brk - cur_brk));
             STATS_PEAK(heap_capacity);
             cur_brk = new_brk;
             arena->commit_end = new_brk;
@@ -1051,7 +1056,7 @@ arena_extend(arena_header_t *arena, heapsz_t add_size)
         if (os_large_alloc_extend((byte *)arena, cur_size, new_size
                                   _IF_WINDOWS(arena_page_prot(arena->flags)))) {
             LOG(2, "\textended arena to "PFX"-"PFX"\n", arena, (byte*)arena + new_size);
-            STATS_ADD(heap_capacity, (uint)(new_size - cur_size));
+            ATOMIC_ADD32(heap_capacity, (uint)(new_size - cur_size));
             STATS_PEAK(heap_capacity);
             arena->commit_end = (byte *)arena + new_size;
 #ifdef UNIX /* windows already added whole reservation */
@@ -1235,7 +1240,7 @@ consider_giving_back_memory(arena_header_t *arena, chunk_header_t *tofree)
                 if (new_brk <= cur_brk) {
                     LOG(2, "shrinking brk "PFX"-"PFX" to "PFX"-"PFX"\n",
                         pre_us_brk, cur_brk, pre_us_brk, new_brk);
-                    STATS_ADD(heap_capacity, (int)(new_brk - cur_brk));
+                    ATOMIC_ADD32(heap_capacity, (int)(new_brk - cur_brk));
                     STATS_INC(num_dealloc);
                     heap_region_remove(new_brk, cur_brk, NULL);
                     cur_brk = new_brk;
@@ -1262,7 +1267,7 @@ consider_giving_back_memory(arena_header_t *arena, chunk_header_t *tofree)
                 } else {
                     LOG(2, "de-allocating arena "PFX"-"PFX"\n", sub, sub->reserve_end);
                     prev->next_arena = sub->next_arena;
-                    STATS_ADD(heap_capacity, -(int)(sub->commit_end - (byte *)sub));
+                    ATOMIC_ADD32(heap_capacity, -(int)(sub->commit_end - (byte *)sub));
                     STATS_INC(num_dealloc);
                     STATS_DEC(num_arenas);
                     heap_region_remove((byte *)sub, sub->reserve_end, NULL);
@@ -1372,6 +1377,7 @@ add_to_delay_list(arena_header_t *arena, chunk_header_t *head)
 
     arena->free_list->delayed_chunks++;
     arena->free_list->delayed_bytes += head->alloc_size;
+    ATOMIC_ADD32(delayed_bytes_total, (int)head->alloc_size);
     LOG(3, "%s: updated delayed chunks=%d, bytes="PIFX"\n", __FUNCTION__,
         arena->free_list->delayed_chunks, arena->free_list->delayed_bytes);
 
@@ -1392,6 +1398,7 @@ add_to_delay_list(arena_header_t *arena, chunk_header_t *head)
         ASSERT(arena->free_list->delayed_bytes >= cur->head.alloc_size,
                "delay bytes counter off");
         arena->free_list->delayed_bytes -= cur->head.alloc_size;
+        ATOMIC_ADD32(delayed_bytes_total, -(int)cur->head.alloc_size);
         LOG(3, "%s: updated delayed chunks=%d, bytes="PIFX"\n", __FUNCTION__,
             arena->free_list->delayed_chunks, arena->free_list->delayed_bytes);
 
@@ -2893,6 +2900,11 @@ destroy_Rtl_heap(arena_header_t *arena, dr_mcontext_t *mc, bool free_chunks)
             }
         }
         heap_region_remove((byte *)a, a->reserve_end, mc);
+        if (a == arena) {
+            /* sub-arenas share the main arena's free lists */
+            ATOMIC_ADD32(delayed_bytes_total, -(int)arena->free_list->delayed_bytes);
+        }
+        ATOMIC_ADD32(heap_capacity, -(int)(a->commit_end - (byte *)a));
         arena_free(a);
     }
 }
@@ -4533,6 +4545,16 @@ free_user_data_at_exit(malloc_info_t *info, void *iter_data)
     return true; /* keep iterating */
 }
 
+void
+alloc_replace_get_usage(size_t *capacity OUT, size_t *delayed OUT)
+{
+    /* racy, but this is only for reporting */
+    if (capacity != NULL)
+        *capacity = heap_capacity;
+    if (delayed != NULL)
+        *delayed = delayed_bytes_total;
+}
+
 void
 alloc_replace_exit(void)
 {
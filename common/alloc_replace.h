@@ -37,6 +37,19 @@ byte *
 alloc_replace_orig_brk();
 #endif
 
+/* Called on entry to, and just prior to returning from, a routine that
+ * replaces app code via drwrap_replace_native().  These mark the replacement's
+ * frame pointer slot defined for callstack walks, swap to DR's private state
+ * on Windows (unless in_app_mode is passed to exit_client_code()), finish the
+ * native replacement, and clear the app return address that
+ * drwrap_replace_native_fini() leaves beyond TOS (i#1217).
+ */
+void *
+enter_client_code(void);
+
+void
+exit_client_code(void *drcontext, bool in_app_mode);
+
 /* rest is in malloc_interface_t */
 
 #endif /* _ALLOC_REPLACE_H_ */
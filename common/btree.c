@@ -0,0 +1,769 @@
+/* **********************************************************
+ * Copyright (c) 2014 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/* Dr. Memory: the memory debugger
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* B+ tree interval index.  All intervals live in the leaves, sorted by
+ * base.  An inner node's base[i] is the lowest base in the subtree at
+ * child[i], so a lookup at each level just counts the bases <= the target.
+ * The bases are kept packed in their own array so that count is a linear
+ * scan over one or two cache lines, which beats the branch mispredictions
+ * of a binary search at this fanout.
+ *
+ * We do not rebalance on removal: a node is only freed once it is empty.
+ * Our trees are either built once and then only looked up, or see removals
+ * roughly in proportion to insertions, so the occasional sparse node costs
+ * less than the merging logic would.
+ *
+ * There are no sibling links between leaves, as those would prevent the
+ * path copying used for BTREE_READ_MOSTLY.
+ */
+
+#include "btree.h"
+#include "utils.h"
+
+/* 16 bases fill one cache line on 32-bit and two on 64-bit */
+#define BTREE_FANOUT 16
+
+typedef struct _btree_node_t {
+    /* sorted and packed: only the first count are valid */
+    byte *base[BTREE_FANOUT];
+    uint count;
+    bool leaf;
+    /* for BTREE_READ_MOSTLY: a node from an earlier epoch may be visible to
+     * readers and must be copied before it is modified
+     */
+    uint epoch;
+    union {
+        struct {
+            byte *end[BTREE_FANOUT];
+            void *value[BTREE_FANOUT];
+        } leaf;
+        struct _btree_node_t *child[BTREE_FANOUT];
+    } u;
+} btree_node_t;
+
+/* A node or value that readers may still be looking at */
+typedef struct _btree_retired_t {
+    void *ptr;
+    bool is_node;
+    struct _btree_retired_t *next;
+} btree_retired_t;
+
+struct _btree_t {
+    /* Readers load this once per lookup, so it is only ever written with
+     * a fully built tree beneath it.
+     */
+    btree_node_t * volatile root;
+    uint flags;
+    uint epoch;
+    btree_retired_t *retired;
+    void (*free_value_func)(void *value, void *data);
+    void *free_value_data;
+};
+
+/* Make the new nodes visible before the root that points at them.  x86
+ * does not reorder stores with other stores, so keeping the compiler from
+ * doing so is all we need.
+ */
+#ifdef UNIX
+# define STORE_BARRIER() __asm__ __volatile__("" : : : "memory")
+#else
+# define STORE_BARRIER() _ReadWriteBarrier()
+#endif
+
+static btree_node_t *
+btree_new_node(btree_t *tree, bool leaf)
+{
+    btree_node_t *node = (btree_node_t *)
+        global_alloc(sizeof(*node), HEAPSTAT_RBTREE);
+    node->count = 0;
+    node->leaf = leaf;
+    node->epoch = tree->epoch;
+    return node;
+}
+
+static void
+btree_retire(btree_t *tree, void *ptr, bool is_node)
+{
+    btree_retired_t *r = (btree_retired_t *)
+        global_alloc(sizeof(*r), HEAPSTAT_RBTREE);
+    r->ptr = ptr;
+    r->is_node = is_node;
+    r->next = tree->retired;
+    tree->retired = r;
+}
+
+/* Frees a node that is no longer in the tree.  A node from the current
+ * epoch was created by this write and was never visible to readers.
+ */
+static void
+btree_free_node(btree_t *tree, btree_node_t *node)
+{
+    if (node->epoch != tree->epoch)
+        btree_retire(tree, node, true);
+    else
+        global_free(node, sizeof(*node), HEAPSTAT_RBTREE);
+}
+
+static void
+btree_free_value(btree_t *tree, void *value, bool may_be_visible)
+{
+    if (tree->free_value_func == NULL)
+        return;
+    if (may_be_visible && TEST(BTREE_READ_MOSTLY, tree->flags))
+        btree_retire(tree, value, false);
+    else
+        (tree->free_value_func)(value, tree->free_value_data);
+}
+
+/* Returns a node that the current write may modify: node itself, or a copy
+ * if readers may be looking at node.  The caller must store the result
+ * where node was.
+ */
+static btree_node_t *
+btree_writable(btree_t *tree, btree_node_t *node)
+{
+    btree_node_t *copy;
+    if (node->epoch == tree->epoch)
+        return node;
+    copy = (btree_node_t *) global_alloc(sizeof(*copy), HEAPSTAT_RBTREE);
+    memcpy(copy, node, sizeof(*copy));
+    copy->epoch = tree->epoch;
+    btree_retire(tree, node, true);
+    return copy;
+}
+
+/* Ends a write by installing its root.  For BTREE_READ_MOSTLY we then move
+ * to a new epoch so that the next write copies what this one made visible.
+ */
+static void
+btree_publish(btree_t *tree, btree_node_t *root)
+{
+    if (TEST(BTREE_READ_MOSTLY, tree->flags)) {
+        STORE_BARRIER();
+        tree->root = root;
+        tree->epoch++;
+    } else
+        tree->root = root;
+}
+
+/* Returns the index of the last base <= addr, or -1 if there is none */
+static inline int
+btree_node_search(btree_node_t *node, byte *addr)
+{
+    /* bases are sorted, so this is the same as stopping at the first one
+     * above addr, but without a branch per element
+     */
+    uint i;
+    int num = 0;
+    for (i = 0; i < node->count; i++)
+        num += (node->base[i] <= addr);
+    return num - 1;
+}
+
+/* Finds the interval with the largest base <= addr in the subtree at node */
+static btree_node_t *
+btree_lookup_le(btree_node_t *node, byte *addr, int *idx OUT)
+{
+    int i;
+    if (node == NULL)
+        return NULL;
+    while (true) {
+        i = btree_node_search(node, addr);
+        if (i < 0)
+            return NULL;
+        if (node->leaf) {
+            *idx = i;
+            return node;
+        }
+        node = node->u.child[i];
+    }
+}
+
+/* Finds the interval with the smallest base > addr in the subtree at node */
+static btree_node_t *
+btree_lookup_gt(btree_node_t *node, byte *addr, int *idx OUT)
+{
+    int i = btree_node_search(node, addr);
+    if (node->leaf) {
+        if (i + 1 >= (int) node->count)
+            return NULL;
+        *idx = i + 1;
+        return node;
+    }
+    if (i >= 0) {
+        btree_node_t *res = btree_lookup_gt(node->u.child[i], addr, idx);
+        if (res != NULL)
+            return res;
+    }
+    if (i + 1 >= (int) node->count)
+        return NULL;
+    /* everything in the next subtree is above addr */
+    node = node->u.child[i + 1];
+    while (!node->leaf)
+        node = node->u.child[0];
+    *idx = 0;
+    return node;
+}
+
+void *
+btree_find(btree_t *tree, byte *base)
+{
+    int i;
+    btree_node_t *leaf = btree_lookup_le(tree->root, base, &i);
+    if (leaf != NULL && leaf->base[i] == base)
+        return leaf->u.leaf.value[i];
+    return NULL;
+}
+
+void *
+btree_in_range(btree_t *tree, byte *addr)
+{
+    int i;
+    btree_node_t *leaf = btree_lookup_le(tree->root, addr, &i);
+    if (leaf != NULL && addr < leaf->u.leaf.end[i])
+        return leaf->u.leaf.value[i];
+    return NULL;
+}
+
+void *
+btree_overlaps(btree_t *tree, byte *start, byte *end)
+{
+    int i;
+    btree_node_t *leaf;
+    /* intervals are disjoint, so only the last one starting before end can
+     * reach back to start
+     */
+    if (end == NULL)
+        return NULL;
+    leaf = btree_lookup_le(tree->root, end - 1, &i);
+    if (leaf != NULL && start < leaf->u.leaf.end[i])
+        return leaf->u.leaf.value[i];
+    return NULL;
+}
+
+void *
+btree_next_higher(btree_t *tree, byte *addr)
+{
+    int i;
+    /* read the root once so that both searches see the same tree */
+    btree_node_t *root = tree->root;
+    btree_node_t *leaf = btree_lookup_le(root, addr, &i);
+    if (leaf != NULL && addr < leaf->u.leaf.end[i])
+        return leaf->u.leaf.value[i];
+    if (root == NULL)
+        return NULL;
+    leaf = btree_lookup_gt(root, addr, &i);
+    if (leaf != NULL)
+        return leaf->u.leaf.value[i];
+    return NULL;
+}
+
+void *
+btree_next_lower(btree_t *tree, byte *addr)
+{
+    int i;
+    btree_node_t *leaf = btree_lookup_le(tree->root, addr, &i);
+    if (leaf != NULL)
+        return leaf->u.leaf.value[i];
+    return NULL;
+}
+
+void *
+btree_min(btree_t *tree)
+{
+    btree_node_t *node = tree->root;
+    if (node == NULL)
+        return NULL;
+    while (!node->leaf)
+        node = node->u.child[0];
+    return node->u.leaf.value[0];
+}
+
+void *
+btree_max(btree_t *tree)
+{
+    btree_node_t *node = tree->root;
+    if (node == NULL)
+        return NULL;
+    while (!node->leaf)
+        node = node->u.child[node->count - 1];
+    return node->u.leaf.value[node->count - 1];
+}
+
+/* Inserts at index pos of node, which must be writable, splitting it if it
+ * is full.  For leaves, end and ptr are the interval's end and value; for
+ * inner nodes, ptr is the child.  Returns the new right sibling if node
+ * was split, else NULL.
+ */
+static btree_node_t *
+btree_node_insert_at(btree_t *tree, btree_node_t *node, uint pos,
+                     byte *base, byte *end, void *ptr)
+{
+    btree_node_t *sib = NULL;
+    uint i;
+    if (node->count == BTREE_FANOUT) {
+        uint half = BTREE_FANOUT / 2;
+        sib = btree_new_node(tree, node->leaf);
+        sib->count = BTREE_FANOUT - half;
+        memcpy(sib->base, &node->base[half], sib->count * sizeof(node->base[0]));
+        if (node->leaf) {
+            memcpy(sib->u.leaf.end, &node->u.leaf.end[half],
+                   sib->count * sizeof(node->u.leaf.end[0]));
+            memcpy(sib->u.leaf.value, &node->u.leaf.value[half],
+                   sib->count * sizeof(node->u.leaf.value[0]));
+        } else {
+            memcpy(sib->u.child, &node->u.child[half],
+                   sib->count * sizeof(node->u.child[0]));
+        }
+        node->count = half;
+        if (pos > half) {
+            pos -= half;
+            node = sib;
+        }
+    }
+    for (i = node->count; i > pos; i--) {
+        node->base[i] = node->base[i - 1];
+        if (node->leaf) {
+            node->u.leaf.end[i] = node->u.leaf.end[i - 1];
+            node->u.leaf.value[i] = node->u.leaf.value[i - 1];
+        } else
+            node->u.child[i] = node->u.child[i - 1];
+    }
+    node->base[pos] = base;
+    if (node->leaf) {
+        node->u.leaf.end[pos] = end;
+        node->u.leaf.value[pos] = ptr;
+    } else
+        node->u.child[pos] = (btree_node_t *) ptr;
+    node->count++;
+    return sib;
+}
+
+/* Inserts into the subtree at node, which must be writable.  Returns the
+ * new right sibling if node was split, else NULL.
+ */
+static btree_node_t *
+btree_insert_helper(btree_t *tree, btree_node_t *node, byte *base, byte *end,
+                    void *value)
+{
+    int i = btree_node_search(node, base);
+    btree_node_t *child, *split;
+    if (node->leaf)
+        return btree_node_insert_at(tree, node, i + 1, base, end, value);
+    /* below every base: goes in the first child, which gets a new lowest base */
+    if (i < 0)
+        i = 0;
+    child = btree_writable(tree, node->u.child[i]);
+    node->u.child[i] = child;
+    split = btree_insert_helper(tree, child, base, end, value);
+    node->base[i] = child->base[0];
+    if (split == NULL)
+        return NULL;
+    return btree_node_insert_at(tree, node, i + 1, split->base[0], NULL, split);
+}
+
+void *
+btree_insert(btree_t *tree, byte *base, byte *end, void *value)
+{
+    btree_node_t *root, *split;
+    int i;
+    /* Only the last interval starting at or before our last byte can
+     * overlap us.  For an empty interval we only check for one at the
+     * same base or one that contains it.
+     */
+    btree_node_t *leaf = btree_lookup_le(tree->root, (end > base) ? end - 1 : base, &i);
+    if (leaf != NULL && (leaf->base[i] == base || leaf->u.leaf.end[i] > base))
+        return leaf->u.leaf.value[i];
+
+    if (tree->root == NULL) {
+        root = btree_new_node(tree, true);
+        btree_node_insert_at(tree, root, 0, base, end, value);
+        btree_publish(tree, root);
+        return NULL;
+    }
+    root = btree_writable(tree, tree->root);
+    split = btree_insert_helper(tree, root, base, end, value);
+    if (split != NULL) {
+        btree_node_t *new_root = btree_new_node(tree, false);
+        btree_node_insert_at(tree, new_root, 0, root->base[0], NULL, root);
+        btree_node_insert_at(tree, new_root, 1, split->base[0], NULL, split);
+        root = new_root;
+    }
+    btree_publish(tree, root);
+    return NULL;
+}
+
+/* Removes base from the subtree at node, which must be writable and must
+ * contain base.  Returns the removed value.
+ */
+static void *
+btree_remove_helper(btree_t *tree, btree_node_t *node, byte *base)
+{
+    int i = btree_node_search(node, base);
+    void *value;
+    uint j;
+    ASSERT(i >= 0, "btree inconsistent");
+    if (node->leaf) {
+        ASSERT(node->base[i] == base, "btree inconsistent");
+        value = node->u.leaf.value[i];
+    } else {
+        btree_node_t *child = btree_writable(tree, node->u.child[i]);
+        node->u.child[i] = child;
+        value = btree_remove_helper(tree, child, base);
+        if (child->count > 0) {
+            node->base[i] = child->base[0];
+            return value;
+        }
+        btree_free_node(tree, child);
+    }
+    for (j = i; j + 1 < node->count; j++) {
+        node->base[j] = node->base[j + 1];
+        if (node->leaf) {
+            node->u.leaf.end[j] = node->u.leaf.end[j + 1];
+            node->u.leaf.value[j] = node->u.leaf.value[j + 1];
+        } else
+            node->u.child[j] = node->u.child[j + 1];
+    }
+    node->count--;
+    return value;
+}
+
+bool
+btree_remove(btree_t *tree, byte *base)
+{
+    btree_node_t *root;
+    void *value;
+    int i;
+    /* check first so that a miss does not copy anything */
+    btree_node_t *leaf = btree_lookup_le(tree->root, base, &i);
+    if (leaf == NULL || leaf->base[i] != base)
+        return false;
+    root = btree_writable(tree, tree->root);
+    value = btree_remove_helper(tree, root, base);
+    /* shrink from the top: drop an empty root or one with a single child */
+    while (root != NULL && (root->count == 0 || (!root->leaf && root->count == 1))) {
+        btree_node_t *next = (root->count == 0) ? NULL : root->u.child[0];
+        btree_free_node(tree, root);
+        root = next;
+    }
+    btree_publish(tree, root);
+    btree_free_value(tree, value, true);
+    return true;
+}
+
+void
+btree_bulk_load(btree_t *tree, uint count,
+                void (*get_entry)(void *data, uint i, byte **base OUT,
+                                  byte **end OUT, void **value OUT),
+                void *data)
+{
+    btree_node_t **level;
+    uint num, i;
+    IF_DEBUG(byte *prev_end = NULL;)
+    ASSERT(tree->root == NULL, "bulk load requires an empty tree");
+    if (count == 0)
+        return;
+    num = (count + BTREE_FANOUT - 1) / BTREE_FANOUT;
+    level = (btree_node_t **) global_alloc(num * sizeof(*level), HEAPSTAT_RBTREE);
+    for (i = 0; i < count; i++) {
+        btree_node_t *leaf;
+        uint slot = i % BTREE_FANOUT;
+        if (slot == 0)
+            level[i / BTREE_FANOUT] = btree_new_node(tree, true);
+        leaf = level[i / BTREE_FANOUT];
+        get_entry(data, i, &leaf->base[slot], &leaf->u.leaf.end[slot],
+                  &leaf->u.leaf.value[slot]);
+        ASSERT(leaf->base[slot] >= prev_end, "bulk load entries unsorted or overlap");
+        IF_DEBUG(prev_end = leaf->u.leaf.end[slot];)
+        leaf->count++;
+    }
+    /* each pass replaces the array's nodes with their parents in place */
+    while (num > 1) {
+        uint parents = (num + BTREE_FANOUT - 1) / BTREE_FANOUT;
+        for (i = 0; i < num; i++) {
+            btree_node_t *child = level[i];
+            if (i % BTREE_FANOUT == 0)
+                level[i / BTREE_FANOUT] = btree_new_node(tree, false);
+            btree_node_insert_at(tree, level[i / BTREE_FANOUT], i % BTREE_FANOUT,
+                                 child->base[0], NULL, child);
+        }
+        num = parents;
+    }
+    btree_publish(tree, level[0]);
+    global_free(level, ((count + BTREE_FANOUT - 1) / BTREE_FANOUT) * sizeof(*level),
+                HEAPSTAT_RBTREE);
+}
+
+static bool
+btree_iterate_helper(btree_node_t *node,
+                     bool (*iter_cb)(byte *, byte *, void *, void *), void *iter_data)
+{
+    uint i;
+    for (i = 0; i < node->count; i++) {
+        if (node->leaf) {
+            if (!iter_cb(node->base[i], node->u.leaf.end[i], node->u.leaf.value[i],
+                         iter_data))
+                return false;
+        } else if (!btree_iterate_helper(node->u.child[i], iter_cb, iter_data))
+            return false;
+    }
+    return true;
+}
+
+bool
+btree_iterate(btree_t *tree, bool (*iter_cb)(byte *base, byte *end, void *value,
+                                             void *iter_data),
+              void *iter_data)
+{
+    btree_node_t *root = tree->root;
+    ASSERT(iter_cb != NULL, "invalid params");
+    if (root == NULL)
+        return true;
+    return btree_iterate_helper(root, iter_cb, iter_data);
+}
+
+void
+btree_reclaim(btree_t *tree)
+{
+    btree_retired_t *r, *next;
+    for (r = tree->retired; r != NULL; r = next) {
+        next = r->next;
+        if (r->is_node)
+            global_free(r->ptr, sizeof(btree_node_t), HEAPSTAT_RBTREE);
+        else
+            (tree->free_value_func)(r->ptr, tree->free_value_data);
+        global_free(r, sizeof(*r), HEAPSTAT_RBTREE);
+    }
+    tree->retired = NULL;
+}
+
+static void
+btree_clear_helper(btree_t *tree, btree_node_t *node)
+{
+    uint i;
+    for (i = 0; i < node->count; i++) {
+        if (node->leaf)
+            btree_free_value(tree, node->u.leaf.value[i], false);
+        else
+            btree_clear_helper(tree, node->u.child[i]);
+    }
+    global_free(node, sizeof(*node), HEAPSTAT_RBTREE);
+}
+
+void
+btree_clear(btree_t *tree)
+{
+    btree_reclaim(tree);
+    if (tree->root != NULL)
+        btree_clear_helper(tree, tree->root);
+    tree->root = NULL;
+}
+
+btree_t *
+btree_create(void (*free_value_func)(void *value, void *data), void *free_value_data,
+             uint flags)
+{
+    btree_t *tree = (btree_t *) global_alloc(sizeof(*tree), HEAPSTAT_RBTREE);
+    tree->root = NULL;
+    tree->flags = flags;
+    tree->epoch = 0;
+    tree->retired = NULL;
+    tree->free_value_func = free_value_func;
+    tree->free_value_data = free_value_data;
+    return tree;
+}
+
+void
+btree_destroy(btree_t *tree)
+{
+    ASSERT(tree != NULL, "invalid params");
+    btree_clear(tree);
+    global_free(tree, sizeof(*tree), HEAPSTAT_RBTREE);
+}
+
+/***************************************************************************/
+#ifdef BUILD_UNIT_TESTS
+
+/* Enough intervals for a few levels of inner nodes */
+#define TEST_NUM_INTERVALS 2000
+/* Interval i is [TEST_BASE(i), TEST_BASE(i) + TEST_SIZE), with a gap after it */
+#define TEST_BASE(i) ((byte *)(ptr_uint_t)(0x10000 + (i) * 64))
+#define TEST_SIZE 32
+/* The value of interval i, as values must be non-NULL */
+#define TEST_VALUE(i) ((void *)(ptr_uint_t)((i) + 1))
+
+static uint test_num_freed;
+
+static void
+test_free_value(void *value, void *data)
+{
+    test_num_freed++;
+}
+
+static bool
+test_iterate_cb(byte *base, byte *end, void *value, void *iter_data)
+{
+    uint *count = (uint *) iter_data;
+    EXPECT(base == TEST_BASE(*count) && end == base + TEST_SIZE &&
+           value == TEST_VALUE(*count));
+    (*count)++;
+    return true;
+}
+
+static void
+test_get_entry(void *data, uint i, byte **base OUT, byte **end OUT, void **value OUT)
+{
+    *base = TEST_BASE(i);
+    *end = TEST_BASE(i) + TEST_SIZE;
+    *value = TEST_VALUE(i);
+}
+
+/* Checks every lookup around each interval, given which ones are present */
+static void
+test_btree_lookups(btree_t *tree, bool *present)
+{
+    uint i, count = 0;
+    int first = -1, last = -1, next = -1;
+    for (i = 0; i < TEST_NUM_INTERVALS; i++) {
+        byte *base = TEST_BASE(i);
+        void *value = present[i] ? TEST_VALUE(i) : NULL;
+        if (present[i]) {
+            if (first == -1)
+                first = i;
+            last = i;
+            count++;
+        }
+        EXPECT(btree_find(tree, base) == value);
+        EXPECT(btree_find(tree, base + 1) == NULL);
+        EXPECT(btree_in_range(tree, base) == value);
+        EXPECT(btree_in_range(tree, base + TEST_SIZE - 1) == value);
+        EXPECT(btree_in_range(tree, base + TEST_SIZE) == NULL);
+        EXPECT(btree_overlaps(tree, base + TEST_SIZE, TEST_BASE(i + 1)) == NULL);
+        EXPECT(btree_overlaps(tree, base - 1, base + 1) == value);
+        EXPECT(btree_next_lower(tree, base + TEST_SIZE) == (last == -1 ? NULL :
+                                                            TEST_VALUE(last)));
+    }
+    for (i = TEST_NUM_INTERVALS; i > 0; i--) {
+        /* the first present interval at or after i-1 */
+        if (present[i - 1])
+            next = i - 1;
+        EXPECT(btree_next_higher(tree, TEST_BASE(i - 1)) ==
+               (next == -1 ? NULL : TEST_VALUE(next)));
+    }
+    EXPECT(btree_min(tree) == (first == -1 ? NULL : TEST_VALUE(first)));
+    EXPECT(btree_max(tree) == (last == -1 ? NULL : TEST_VALUE(last)));
+    if (count == TEST_NUM_INTERVALS) {
+        uint visited = 0;
+        EXPECT(btree_iterate(tree, test_iterate_cb, &visited));
+        EXPECT(visited == TEST_NUM_INTERVALS);
+    }
+}
+
+static void
+test_btree_flags(uint flags)
+{
+    btree_t *tree = btree_create(test_free_value, NULL, flags);
+    static bool present[TEST_NUM_INTERVALS];
+    uint i, num_removed = 0;
+
+    test_num_freed = 0;
+    memset(present, 0, sizeof(present));
+    test_btree_lookups(tree, present);
+
+    /* Insert in a scrambled order, so that splits happen all over the tree.
+     * 7 is coprime with the count, so this visits every index once.
+     */
+    for (i = 0; i < TEST_NUM_INTERVALS; i++) {
+        uint j = (i * 7) % TEST_NUM_INTERVALS;
+        EXPECT(btree_insert(tree, TEST_BASE(j), TEST_BASE(j) + TEST_SIZE,
+                            TEST_VALUE(j)) == NULL);
+        present[j] = true;
+    }
+    test_btree_lookups(tree, present);
+
+    /* Overlapping and same-base inserts are rejected without changes */
+    for (i = 0; i < TEST_NUM_INTERVALS; i++) {
+        EXPECT(btree_insert(tree, TEST_BASE(i), TEST_BASE(i) + 1,
+                            (void *)1) == TEST_VALUE(i));
+        EXPECT(btree_insert(tree, TEST_BASE(i) + TEST_SIZE - 1,
+                            TEST_BASE(i) + TEST_SIZE + 1, (void *)1) == TEST_VALUE(i));
+        EXPECT(btree_insert(tree, TEST_BASE(i) - 1,
+                            TEST_BASE(i) + TEST_SIZE + 1, (void *)1) != NULL);
+    }
+    test_btree_lookups(tree, present);
+    EXPECT(test_num_freed == 0);
+
+    /* Remove every third, then check and put them back */
+    for (i = 0; i < TEST_NUM_INTERVALS; i += 3) {
+        EXPECT(btree_remove(tree, TEST_BASE(i)));
+        EXPECT(!btree_remove(tree, TEST_BASE(i)));
+        present[i] = false;
+        num_removed++;
+    }
+    test_btree_lookups(tree, present);
+    if (TEST(BTREE_READ_MOSTLY, flags)) {
+        /* removed values may still be visible to readers until reclaimed */
+        EXPECT(test_num_freed == 0);
+        btree_reclaim(tree);
+    }
+    EXPECT(test_num_freed == num_removed);
+    for (i = 0; i < TEST_NUM_INTERVALS; i += 3) {
+        EXPECT(btree_insert(tree, TEST_BASE(i), TEST_BASE(i) + TEST_SIZE,
+                            TEST_VALUE(i)) == NULL);
+        present[i] = true;
+    }
+    test_btree_lookups(tree, present);
+
+    /* Empty the tree by removal, which frees nodes as they empty */
+    for (i = 0; i < TEST_NUM_INTERVALS; i++) {
+        EXPECT(btree_remove(tree, TEST_BASE(i)));
+        present[i] = false;
+    }
+    btree_reclaim(tree);
+    EXPECT(test_num_freed == num_removed + TEST_NUM_INTERVALS);
+    test_btree_lookups(tree, present);
+
+    /* Bulk load, then clear */
+    test_num_freed = 0;
+    btree_bulk_load(tree, TEST_NUM_INTERVALS, test_get_entry, NULL);
+    for (i = 0; i < TEST_NUM_INTERVALS; i++)
+        present[i] = true;
+    test_btree_lookups(tree, present);
+    btree_clear(tree);
+    EXPECT(test_num_freed == TEST_NUM_INTERVALS);
+    memset(present, 0, sizeof(present));
+    test_btree_lookups(tree, present);
+
+    /* Destroying frees what is left */
+    test_num_freed = 0;
+    btree_bulk_load(tree, TEST_NUM_INTERVALS, test_get_entry, NULL);
+    btree_destroy(tree);
+    EXPECT(test_num_freed == TEST_NUM_INTERVALS);
+}
+
+void
+test_btree(void)
+{
+    test_btree_flags(0);
+    test_btree_flags(BTREE_READ_MOSTLY);
+}
+
+#endif /* BUILD_UNIT_TESTS */
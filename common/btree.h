@@ -0,0 +1,147 @@
+/* **********************************************************
+ * Copyright (c) 2014 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/* Dr. Memory: the memory debugger
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _BTREE_H_
+#define _BTREE_H_
+
+/* Interval index for address ranges implemented as a B+ tree with wide
+ * nodes, so that a lookup touches a few cache lines per level rather than
+ * one node per bit of depth as in a binary tree.  Like redblack.h, assumes
+ * that no intervals in the tree overlap and they are all open at the upper
+ * end.  Each interval carries an opaque value, which is what the lookup
+ * routines return.
+ *
+ * Most users should go through the rb_* interface in redblack.h, which
+ * uses this as its backend when created with RB_TREE_BTREE.
+ */
+
+#include "dr_api.h"
+
+struct _btree_t;
+typedef struct _btree_t btree_t;
+
+/* Flags for btree_create() */
+enum {
+    /* Writers never modify a node that a reader could be looking at: they
+     * copy the path from the root to the leaf they change and then publish
+     * the new root, so lookups can proceed without the caller's lock while
+     * a single writer (serialized by the caller) makes changes.  Replaced
+     * nodes and removed values are not freed until btree_reclaim().
+     */
+    BTREE_READ_MOSTLY = 0x01,
+};
+
+/* Allocate a new, empty tree.  free_value_func, if non-null, is called
+ * with each value and free_value_data when its interval is removed or the
+ * tree is cleared.
+ */
+btree_t *
+btree_create(void (*free_value_func)(void *value, void *data), void *free_value_data,
+             uint flags);
+
+/* Remove all intervals, free all values, and free the tree itself.
+ * There must be no concurrent readers.
+ */
+void
+btree_destroy(btree_t *tree);
+
+/* Remove all intervals and free all values.  There must be no concurrent
+ * readers.
+ */
+void
+btree_clear(btree_t *tree);
+
+/* Frees the nodes and values retired by writers to a BTREE_READ_MOSTLY tree.
+ * It is up to the caller to ensure that no reader still holds a pointer
+ * obtained before the last write.
+ */
+void
+btree_reclaim(btree_t *tree);
+
+/* Adds [base,end) with the given value and returns NULL, unless an existing
+ * interval overlaps it or has the same base, in which case that interval's
+ * value is returned and the tree is not changed.
+ */
+void *
+btree_insert(btree_t *tree, byte *base, byte *end, void *value);
+
+/* Builds the tree from count intervals, which must be sorted by base and
+ * must not overlap.  get_entry is called with each index in order to
+ * retrieve the i-th interval.  The tree must be empty.  The nodes are
+ * packed full, which is ideal for trees that are mostly looked up after
+ * being built.
+ */
+void
+btree_bulk_load(btree_t *tree, uint count,
+                void (*get_entry)(void *data, uint i, byte **base OUT,
+                                  byte **end OUT, void **value OUT),
+                void *data);
+
+/* Removes the interval with base 'base' and frees its value.  Returns
+ * whether it was found.
+ */
+bool
+btree_remove(btree_t *tree, byte *base);
+
+/* Returns the value of the interval with base 'base', or NULL */
+void *
+btree_find(btree_t *tree, byte *base);
+
+/* Returns the value of the interval containing 'addr', or NULL */
+void *
+btree_in_range(btree_t *tree, byte *addr);
+
+/* Returns the value of an interval overlapping [start,end), or NULL */
+void *
+btree_overlaps(btree_t *tree, byte *start, byte *end);
+
+/* Returns the value of the interval with the smallest base such that
+ * addr < its end, or NULL
+ */
+void *
+btree_next_higher(btree_t *tree, byte *addr);
+
+/* Returns the value of the interval with the largest base <= addr, or NULL */
+void *
+btree_next_lower(btree_t *tree, byte *addr);
+
+/* Returns the value of the interval with the lowest base, or NULL */
+void *
+btree_min(btree_t *tree);
+
+/* Returns the value of the interval with the highest base, or NULL */
+void *
+btree_max(btree_t *tree);
+
+/* Calls iter_cb on each interval in order of base until it returns false.
+ * Returns false if iteration was stopped early.
+ */
+bool
+btree_iterate(btree_t *tree, bool (*iter_cb)(byte *base, byte *end, void *value,
+                                             void *iter_data),
+              void *iter_data);
+
+#ifdef BUILD_UNIT_TESTS
+void
+test_btree(void);
+#endif
+
+#endif /* _BTREE_H_ */
@@ -33,6 +33,9 @@
 # include "drsyms.h"
 #endif
 #include "drsyscall.h"
+#ifdef LINUX
+# include "eh_frame.h"
+#endif
 #ifdef UNIX
 # include <string.h>
 # include <errno.h>
@@ -54,6 +57,11 @@ static uint callstack_walks;
 static uint callstacks_symbolized;
 static uint find_next_fp_scans;
 static uint find_next_fp_cache_hits;
+static uint find_next_fp_cache_misses;
+static uint find_next_fp_layout_hits;
+static uint find_next_fp_layout_misses;
+static uint find_next_fp_unwind_hits;
+static uint find_next_fp_unwind_misses;
 static uint find_next_fp_strings;
 static uint find_next_fp_string_structs;
 static uint cstack_is_retaddr_tgt_mismatch;
@@ -67,15 +75,40 @@ static uint cstack_is_retaddr_unseen;
 /* Cached frame pointer values to avoid repeated scans (i#1186) */
 typedef struct _fpscan_cache_entry {
     byte *input_fp;
+    app_pc prior_ra;
     byte *output_fp;
     app_pc retaddr;
 } fpscan_cache_entry;
 
-/* XXX: perhaps this should be based on the max frames, though if someone
- * asks for a ton of frames and optimizes his app with FPO he can't expect
- * great performance.
+/* The per-thread cache is set-associative, indexed by a hash of the input
+ * fp and the prior retaddr, with round-robin replacement within a set.
+ * A single small round-robin cache thrashes on deep recursion and on FPO
+ * code where nearly every frame needs a scan.
+ */
+#define FPSCAN_CACHE_SETS 64 /* must be a power of 2 */
+#define FPSCAN_CACHE_WAYS 4
+#define FPSCAN_CACHE_SET(fp, ra) \
+    (((((ptr_uint_t)(fp)) >> 3) ^ ((ptr_uint_t)(ra))) & (FPSCAN_CACHE_SETS - 1))
+
+/* A shared, read-mostly cache of frame layouts learned from scans in any
+ * thread: the distance from the scan start to the next frame, per prior
+ * retaddr.  The distance is a property of the code (the frame size of the
+ * caller at that call site), not of the thread, so we can share it.  We do
+ * not synchronize: an entry is only trusted if its check field matches, and
+ * a hit is always verified against the stack just like a scan match.
  */
-#define FPSCAN_CACHE_ENTRIES 16
+typedef struct _fplayout_entry_t {
+    app_pc retaddr;
+    ptr_uint_t delta;
+    ptr_uint_t check; /* retaddr ^ delta, to detect torn writes */
+} fplayout_entry_t;
+
+#define FPLAYOUT_CACHE_BITS 12
+#define FPLAYOUT_CACHE_ENTRIES (1 << FPLAYOUT_CACHE_BITS)
+#define FPLAYOUT_CACHE_IDX(ra) \
+    (((ptr_uint_t)(ra) ^ ((ptr_uint_t)(ra) >> FPLAYOUT_CACHE_BITS)) & \
+     (FPLAYOUT_CACHE_ENTRIES - 1))
+static fplayout_entry_t *fplayout_cache;
 
 typedef struct _tls_callstack_t {
     char *errbuf; /* buffer for atomic writes to global logfile */
@@ -90,8 +123,8 @@ typedef struct _tls_callstack_t {
      */
     app_pc stack_lowest_retaddr;
     /* Optimization for FPO-optimized apps */
-    fpscan_cache_entry fpcache[FPSCAN_CACHE_ENTRIES];
-    uint fpcache_idx;
+    fpscan_cache_entry fpcache[FPSCAN_CACHE_SETS][FPSCAN_CACHE_WAYS];
+    byte fpcache_victim[FPSCAN_CACHE_SETS];
 } tls_callstack_t;
 
 static int tls_idx_callstack = -1;
@@ -138,6 +171,19 @@ struct _packed_frame_t {
 } END_PACKED_STRUCTURE;
 typedef struct _packed_frame_t packed_frame_t;
 
+#ifdef LINUX
+/* One mapping of a module using its unwind info.  The same path can be loaded
+ * at several bases at once, all sharing one table of base-relative offsets.
+ * Entries are only freed with their modname_info_t, so walks can read them
+ * without a lock: an unloaded entry has size 0 and is reused by a later load.
+ */
+typedef struct _unwind_load_t {
+    app_pc base;
+    size_t size;
+    struct _unwind_load_t *next;
+} unwind_load_t;
+#endif
+
 /* Hashtable entry is the master entry.  modname_array and full frame field
  * point at same entry.
  */
@@ -159,6 +205,12 @@ typedef struct _modname_info_t {
     bool abort_fp_walk;
     /* i#1310: support user data */
     void *user_data;
+#ifdef LINUX
+    /* Parsed .eh_frame, with offsets from the module base, or NULL */
+    eh_frame_table_t *unwind_table;
+    /* The current loads of this path, keyed by module base */
+    unwind_load_t *unwind_loads;
+#endif
 } modname_info_t;
 
 /* When the number of modules hits the max for our 8-bit index we
@@ -196,11 +248,46 @@ struct _packed_callstack_t {
         packed_frame_t *packed;
         full_frame_t *full;
     } frames;
+    /* If non-NULL, this callstack is shared through a callstack_trie_t and its
+     * frames live only in the trie: is_packed is false and frames.full is NULL.
+     */
+    struct _cstack_trie_node_t *trie_leaf;
 };
 
-/* multiplexing between packed and full frames */
+/* A callstack_trie_t node, holding one frame whose parent is the next outer frame */
+typedef struct _cstack_trie_node_t {
+    /* The key fields come first: the node itself is the hashtable key. */
+    struct _cstack_trie_node_t *parent;
+    /* For a syscall, which is only ever the innermost frame, modname is
+     * MODNAME_INFO_SYSCALL and loc.sysloc is owned by the node.
+     */
+    full_frame_t frame;
+    /* Non-key fields */
+    uint id;
+    uint num_children;
+    /* The shared callstack that ends at this node, if any */
+    packed_callstack_t *pcs;
+} cstack_trie_node_t;
+
+/* Returns frame n of a trie-backed callstack by walking out from its leaf.
+ * Nodes on the path to a live callstack are never pruned and never change
+ * parents, so no lock is needed.
+ */
+static inline full_frame_t *
+pcs_trie_frame(packed_callstack_t *pcs, uint n)
+{
+    cstack_trie_node_t *node = pcs->trie_leaf;
+    ASSERT(n < pcs->num_frames, "invalid frame");
+    for (; n > 0; n--)
+        node = node->parent;
+    return &node->frame;
+}
+
+/* multiplexing between packed, full, and trie frames */
+#define PCS_FULL_FRAME(pcs, n) \
+    ((pcs)->trie_leaf != NULL ? pcs_trie_frame(pcs, n) : &(pcs)->frames.full[n])
 #define PCS_FRAME_LOC(pcs, n) \
-    ((pcs)->is_packed ? (pcs)->frames.packed[n].loc : (pcs)->frames.full[n].loc)
+    ((pcs)->is_packed ? (pcs)->frames.packed[n].loc : PCS_FULL_FRAME(pcs, n)->loc)
 #define PCS_FRAMES(pcs) \
     ((pcs)->is_packed ? (void*)((pcs)->frames.packed) : (void*)((pcs)->frames.full))
 #define PCS_FRAME_SZ(pcs) \
@@ -330,6 +417,14 @@ callstack_init(callstack_options_t *options)
     modtree_lock = dr_mutex_create();
     module_tree = rb_tree_create(NULL);
 
+    if (ops.old_retaddrs_zeroed) {
+        /* The scan caches are only safe when stale retaddrs are zeroed */
+        fplayout_cache = (fplayout_entry_t *)
+            global_alloc(FPLAYOUT_CACHE_ENTRIES * sizeof(*fplayout_cache),
+                         HEAPSTAT_CALLSTACK);
+        memset(fplayout_cache, 0, FPLAYOUT_CACHE_ENTRIES * sizeof(*fplayout_cache));
+    }
+
     if (!TEST(FP_SEARCH_ALLOW_UNSEEN_RETADDR, ops.fp_flags)) {
         hashtable_config_t hashconfig;
         hashtable_init(&retaddr_table, RETADDR_TABLE_HASH_BITS,
@@ -362,6 +457,11 @@ callstack_exit(void)
     dr_mutex_unlock(modtree_lock);
     dr_mutex_destroy(modtree_lock);
 
+    if (fplayout_cache != NULL) {
+        global_free(fplayout_cache, FPLAYOUT_CACHE_ENTRIES * sizeof(*fplayout_cache),
+                    HEAPSTAT_CALLSTACK);
+    }
+
 #ifdef USE_DRSYMS
     IF_WINDOWS(ASSERT(using_private_peb(), "private peb not preserved"));
 #endif
@@ -375,8 +475,12 @@ callstack_dump_statistics(file_t f)
 {
     dr_fprintf(f, "callstack walks: %9u, callstacks symbolized: %8u\n",
                callstack_walks, callstacks_symbolized);
-    dr_fprintf(f, "callstack fp scans: %8u, cache hits: %8u\n",
-               find_next_fp_scans, find_next_fp_cache_hits);
+    dr_fprintf(f, "callstack fp scans: %8u, cache hits: %8u, misses: %8u\n",
+               find_next_fp_scans, find_next_fp_cache_hits, find_next_fp_cache_misses);
+    dr_fprintf(f, "callstack fp layout cache hits: %8u, misses: %8u\n",
+               find_next_fp_layout_hits, find_next_fp_layout_misses);
+    dr_fprintf(f, "callstack unwind info hits: %8u, misses: %8u\n",
+               find_next_fp_unwind_hits, find_next_fp_unwind_misses);
     dr_fprintf(f, "callstack strings: %6u, structs: %6u, target mismatch: %8u\n",
                find_next_fp_strings, find_next_fp_string_structs,
                cstack_is_retaddr_tgt_mismatch);
@@ -1240,14 +1344,88 @@ check_retaddr_targets_frame(app_pc frame_addr, app_pc next_retaddr, bool fp_walk
 }
 
 static void
-fpcache_update(tls_callstack_t *pt, byte *fp_in, byte *fp_out, app_pc retaddr)
+fpcache_update(tls_callstack_t *pt, byte *fp_in, app_pc prior_ra, byte *fp_out,
+               app_pc retaddr)
+{
+    uint set = FPSCAN_CACHE_SET(fp_in, prior_ra);
+    uint way = pt->fpcache_victim[set];
+    pt->fpcache[set][way].input_fp = fp_in;
+    pt->fpcache[set][way].prior_ra = prior_ra;
+    pt->fpcache[set][way].output_fp = fp_out;
+    pt->fpcache[set][way].retaddr = retaddr;
+    pt->fpcache_victim[set] = (way + 1) % FPSCAN_CACHE_WAYS;
+    if (fplayout_cache != NULL && prior_ra != NULL && fp_out >= fp_in) {
+        /* Learn the frame layout for all threads.  A racy write is fine
+         * as the check field will not match a torn entry.
+         */
+        fplayout_entry_t *entry = &fplayout_cache[FPLAYOUT_CACHE_IDX(prior_ra)];
+        ptr_uint_t delta = fp_out - fp_in;
+        if (entry->retaddr != prior_ra || entry->delta != delta) {
+            entry->check = 0;
+            entry->retaddr = prior_ra;
+            entry->delta = delta;
+            entry->check = (ptr_uint_t)prior_ra ^ delta;
+        }
+    }
+}
+
+/* Checks whether fp_out is a valid next frame, with its retaddr slot holding
+ * expect_ra if non-NULL or else a plausible retaddr that calls prior_ra.
+ * Returns the retaddr, or NULL if the candidate does not check out.
+ */
+static app_pc
+fpcache_verify(void *drcontext, byte *fp_out, app_pc expect_ra, app_pc prior_ra)
 {
-    pt->fpcache[pt->fpcache_idx].input_fp = fp_in;
-    pt->fpcache[pt->fpcache_idx].output_fp = fp_out;
-    pt->fpcache[pt->fpcache_idx].retaddr = retaddr;
-    pt->fpcache_idx = (pt->fpcache_idx + 1) % FPSCAN_CACHE_ENTRIES;
+    app_pc ra;
+    if (!safe_read(fp_out + sizeof(app_pc), sizeof(ra), &ra))
+        return NULL;
+    /* i#1231: we don't zero for full mode but we want the cache */
+    if (ops.is_dword_defined != NULL &&
+        !ops.is_dword_defined(drcontext, fp_out + sizeof(app_pc)))
+        return NULL;
+    if (expect_ra != NULL)
+        return (ra == expect_ra) ? ra : NULL;
+    if (!is_retaddr(ra, true/*i#1217*/))
+        return NULL;
+    if (prior_ra != NULL && !TEST(FP_DO_NOT_VERIFY_TARGET_IN_SCAN, ops.fp_flags) &&
+        !check_retaddr_targets_frame(prior_ra, ra, false))
+        return NULL;
+    return ra;
 }
 
+#ifdef LINUX
+/* Returns the frame whose retaddr slot is just below the CFA computed from
+ * prior_ra's unwind info, with sp as the stack pointer at the call site,
+ * or NULL if there is no usable unwind info.
+ */
+static byte *
+find_next_fp_unwind(void *drcontext, byte *sp, app_pc prior_ra)
+{
+    modname_info_t *name_info;
+    unwind_load_t *load;
+    byte *cfa;
+    if (!module_lookup(prior_ra, NULL, NULL, &name_info) ||
+        name_info == NULL || name_info->unwind_table == NULL)
+        return NULL;
+    for (load = name_info->unwind_loads; load != NULL; load = load->next) {
+        if (prior_ra > load->base && prior_ra <= load->base + load->size)
+            break;
+    }
+    if (load == NULL)
+        return NULL;
+    /* Subtract 1 to be inside the call, in case it ends its function */
+    if (!eh_frame_table_cfa(name_info->unwind_table,
+                            prior_ra - 1 - load->base, sp, &cfa))
+        return NULL;
+    if (cfa < sp + sizeof(app_pc))
+        return NULL;
+    /* The retaddr is at cfa - sizeof(app_pc), and we return the slot below
+     * it to match the fp,retaddr pair layout of a frame-pointer walk.
+     */
+    return cfa - 2*sizeof(app_pc);
+}
+#endif
+
 static app_pc
 find_next_fp(void *drcontext, tls_callstack_t *pt, app_pc fp, app_pc prior_ra,
              bool top_frame, app_pc *retaddr/*OUT*/)
@@ -1291,30 +1469,80 @@ find_next_fp(void *drcontext, tls_callstack_t *pt, app_pc fp, app_pc prior_ra,
      * to implement.
      */
     if (ops.old_retaddrs_zeroed) {
+        uint set = FPSCAN_CACHE_SET(orig_fp, prior_ra);
         uint i;
-        for (i = 0; i < FPSCAN_CACHE_ENTRIES; i++) {
-            if (orig_fp == pt->fpcache[i].input_fp) {
-                app_pc ra;
-                if (safe_read(pt->fpcache[i].output_fp + sizeof(app_pc),
-                              sizeof(ra), &ra) &&
-                    ra == pt->fpcache[i].retaddr &&
-                    /* i#1231: we don't zero for full mode but we want the cache */
-                    (ops.is_dword_defined == NULL ||
-                     ops.is_dword_defined(drcontext,
-                                          pt->fpcache[i].output_fp + sizeof(app_pc)))) {
+        for (i = 0; i < FPSCAN_CACHE_WAYS; i++) {
+            fpscan_cache_entry *entry = &pt->fpcache[set][i];
+            if (orig_fp == entry->input_fp && prior_ra == entry->prior_ra) {
+                app_pc ra = fpcache_verify(drcontext, entry->output_fp,
+                                           entry->retaddr, NULL);
+                if (ra != NULL) {
                     if (retaddr != NULL)
                         *retaddr = ra;
                     LOG(4, "find_next_fp: cache hit "PFX" => "PFX", ra="PFX"\n",
-                        orig_fp, pt->fpcache[i].output_fp, ra);
+                        orig_fp, entry->output_fp, ra);
                     /* Make sure we don't clobber this hit on our next miss */
-                    pt->fpcache_idx = (i + 1) % FPSCAN_CACHE_ENTRIES;
+                    if (pt->fpcache_victim[set] == i)
+                        pt->fpcache_victim[set] = (i + 1) % FPSCAN_CACHE_WAYS;
                     STATS_INC(find_next_fp_cache_hits);
-                    return pt->fpcache[i].output_fp;
+                    return entry->output_fp;
                 } else {
-                    pt->fpcache[i].input_fp = NULL; /* invalidate */
+                    entry->input_fp = NULL; /* invalidate */
                 }
             }
         }
+        STATS_INC(find_next_fp_cache_misses);
+    }
+#ifdef LINUX
+    /* Use the module's unwind info to compute the caller's frame directly.
+     * We only do this in the middle of a callstack, where prior_ra identifies
+     * the frame and fp is the stack pointer at the call site: for the top
+     * frame we do not know the precise pc and stack pointer.
+     */
+    if (prior_ra != NULL && !top_frame &&
+        !TEST(FP_DO_NOT_USE_UNWIND_INFO, ops.fp_flags)) {
+        byte *fp_out = find_next_fp_unwind(drcontext, orig_fp, prior_ra);
+        if (fp_out != NULL) {
+            app_pc ra = fpcache_verify(drcontext, fp_out, NULL, NULL);
+            if (ra != NULL) {
+                if (retaddr != NULL)
+                    *retaddr = ra;
+                LOG(4, "find_next_fp: unwind hit "PFX" => "PFX", ra="PFX"\n",
+                    orig_fp, fp_out, ra);
+                STATS_INC(find_next_fp_unwind_hits);
+                if (ops.old_retaddrs_zeroed)
+                    fpcache_update(pt, orig_fp, prior_ra, fp_out, ra);
+                return fp_out;
+            }
+            STATS_INC(find_next_fp_unwind_misses);
+        }
+    }
+#endif
+    if (ops.old_retaddrs_zeroed) {
+        /* Try the frame layout learned by other scans, perhaps in other threads.
+         * We only do this in the middle of a callstack, where prior_ra identifies
+         * the caller's frame.
+         */
+        if (prior_ra != NULL && !top_frame && fplayout_cache != NULL) {
+            fplayout_entry_t layout;
+            layout = fplayout_cache[FPLAYOUT_CACHE_IDX(prior_ra)];
+            if (layout.retaddr == prior_ra &&
+                layout.check == ((ptr_uint_t)prior_ra ^ layout.delta) &&
+                layout.delta < ops.fp_scan_sz) {
+                byte *fp_out = orig_fp + layout.delta;
+                app_pc ra = fpcache_verify(drcontext, fp_out, NULL, prior_ra);
+                if (ra != NULL) {
+                    if (retaddr != NULL)
+                        *retaddr = ra;
+                    LOG(4, "find_next_fp: layout hit "PFX" => "PFX", ra="PFX"\n",
+                        orig_fp, fp_out, ra);
+                    STATS_INC(find_next_fp_layout_hits);
+                    fpcache_update(pt, orig_fp, prior_ra, fp_out, ra);
+                    return fp_out;
+                }
+                STATS_INC(find_next_fp_layout_misses);
+            }
+        }
     }
     /* PR 454536: dr_memory_is_readable() is racy so we use a safe_read().
      * On Windows safe_read() costs 1 system call: perhaps DR should
@@ -1459,14 +1687,14 @@ find_next_fp(void *drcontext, tls_callstack_t *pt, app_pc fp, app_pc prior_ra,
                     /* caller expects fp,ra pair */
                     LOG(4, "find_next_fp "PFX" => "PFX", ra="PFX"\n",
                         orig_fp, sp - sizeof(app_pc), slot1);
-                    fpcache_update(pt, orig_fp, sp - sizeof(app_pc), slot1);
+                    fpcache_update(pt, orig_fp, prior_ra, sp - sizeof(app_pc), slot1);
                     return sp - sizeof(app_pc);
                 }
                 if ((TEST(FP_SEARCH_MATCH_SINGLE_FRAME, ops.fp_flags) &&
                      !match_next_frame)) {
                     LOG(4, "find_next_fp "PFX" => "PFX", ra="PFX"\n",
                         orig_fp, sp, slot1);
-                    fpcache_update(pt, orig_fp, sp, slot1);
+                    fpcache_update(pt, orig_fp, prior_ra, sp, slot1);
                     return sp;
                 }
                 /* Require the next retaddr to be in a module as well, to avoid
@@ -1481,7 +1709,7 @@ find_next_fp(void *drcontext, tls_callstack_t *pt, app_pc fp, app_pc prior_ra,
                 if (parent_ret != NULL && is_retaddr(parent_ret, true/*i#1217*/)) {
                     LOG(4, "find_next_fp "PFX" => "PFX", ra="PFX"\n",
                         orig_fp, sp, slot1);
-                    fpcache_update(pt, orig_fp, sp, slot1);
+                    fpcache_update(pt, orig_fp, prior_ra, sp, slot1);
                     return sp;
                 }
                 match = false;
@@ -1964,13 +2192,14 @@ packed_callstack_frame_modinfo(packed_callstack_t *pcs, uint frame,
     ASSERT(frame < pcs->num_frames, "invalid arg");
     /* modname_idx==0 or modname==NULL is the code for a system call */
     if (!pcs->is_packed) {
-        info = pcs->frames.full[frame].modname;
+        full_frame_t *full = PCS_FULL_FRAME(pcs, frame);
+        info = full->modname;
         if (info == &MODNAME_INFO_SYSCALL) {
             ASSERT(frame == 0, "syscall should only be top frame");
             ASSERT(pcs->first_is_syscall, "flag not set");
             return false;
         }
-        offs = pcs->frames.full[frame].modoffs;
+        offs = full->modoffs;
     } else {
         if (pcs->frames.packed[frame].modname_idx == 0) {
             ASSERT(frame == 0, "syscall should only be top frame");
@@ -2148,7 +2377,8 @@ packed_callstack_free(packed_callstack_t *pcs)
     ASSERT(pcs != NULL, "invalid args");
     refcount = atomic_add32_return_sum((volatile int *)&pcs->refcount, - 1);
     if (refcount == 0) {
-        if (pcs->first_is_syscall) {
+        /* A trie-backed callstack's frames are owned by the trie */
+        if (pcs->first_is_syscall && pcs->trie_leaf == NULL) {
             global_free(PCS_FRAME_LOC(pcs, 0).sysloc, sizeof(syscall_loc_t),
                         HEAPSTAT_CALLSTACK);
         }
@@ -2196,7 +2426,16 @@ packed_callstack_clone(packed_callstack_t *src)
     dst->is_packed = src->is_packed;
     dst->first_is_retaddr = src->first_is_retaddr;
     dst->first_is_syscall = src->first_is_syscall;
-    if (dst->is_packed) {
+    /* dst->trie_leaf stays NULL: a clone always has its own frames */
+    if (src->trie_leaf != NULL) {
+        uint i;
+        ASSERT(!dst->is_packed, "trie-backed callstacks use full frames");
+        dst->frames.full = (full_frame_t *)
+            global_alloc(sizeof(*dst->frames.full) * src->num_frames,
+                         HEAPSTAT_CALLSTACK);
+        for (i = 0; i < src->num_frames; i++)
+            dst->frames.full[i] = *pcs_trie_frame(src, i);
+    } else if (dst->is_packed) {
         dst->frames.packed = (packed_frame_t *)
             global_alloc(sizeof(*dst->frames.packed) * src->num_frames,
                          HEAPSTAT_CALLSTACK);
@@ -2239,22 +2478,20 @@ bool
 packed_callstack_cmp(packed_callstack_t *pcs1, packed_callstack_t *pcs2)
 {
     uint i;
-    if (PCS_FRAMES(pcs1) == NULL) {
-        if (PCS_FRAMES(pcs2) != NULL)
-            return false;
-        return true;
-    }
-    if (PCS_FRAMES(pcs2) == NULL)
-        return false;
     if (pcs1->num_frames != pcs2->num_frames)
         return false;
-    if (!pcs1->first_is_syscall && !pcs2->first_is_syscall &&
+    if (pcs1->num_frames == 0)
+        return true;
+    if (pcs1->trie_leaf != NULL && pcs1->trie_leaf == pcs2->trie_leaf)
+        return true;
+    if (pcs1->trie_leaf == NULL && pcs2->trie_leaf == NULL &&
+        !pcs1->first_is_syscall && !pcs2->first_is_syscall &&
         ((pcs1->is_packed && pcs2->is_packed) ||
          (!pcs1->is_packed && !pcs2->is_packed))) {
         return (memcmp(PCS_FRAMES(pcs1), PCS_FRAMES(pcs2),
                        PCS_FRAME_SZ(pcs1)*pcs1->num_frames) == 0);
     }
-    /* One is packed, the other is not; or, one has a syscall.
+    /* One is packed, the other is not; or, one has a syscall or is in a trie.
      * We have to walk the frames.
      */
     for (i = 0; i < pcs1->num_frames; i++) {
@@ -2284,6 +2521,7 @@ packed_callstack_cmp(packed_callstack_t *pcs1, packed_callstack_t *pcs2)
 void
 packed_callstack_md5(packed_callstack_t *pcs, byte digest[MD5_RAW_BYTES])
 {
+    ASSERT(pcs->trie_leaf == NULL, "trie-backed callstacks have no frames array");
     if (pcs->num_frames == 0) {
         memset(digest, 0, sizeof(digest[0])*MD5_RAW_BYTES);
     } else {
@@ -2295,6 +2533,7 @@ packed_callstack_md5(packed_callstack_t *pcs, byte digest[MD5_RAW_BYTES])
 void
 packed_callstack_crc32(packed_callstack_t *pcs, uint crc[2])
 {
+    ASSERT(pcs->trie_leaf == NULL, "trie-backed callstacks have no frames array");
     crc32_whole_and_half((const char *)PCS_FRAMES(pcs),
                          PCS_FRAME_SZ(pcs)*pcs->num_frames, crc);
 }
@@ -2354,6 +2593,262 @@ packed_callstack_add_to_table(hashtable_t *table, packed_callstack_t *pcs
     return pcs;
 }
 
+/***************************************************************************
+ * CALLSTACK TRIE
+ *
+ * A shared prefix trie of callstacks, with the outermost frame at the root.
+ * Each node has a unique id, so a callstack in the trie is identified by the
+ * id of its leaf.  Once added, a callstack's frames array is freed and its
+ * frames are read from the path to its leaf, so callstacks that share outer
+ * frames store them once.  A node (plus its hashtable entry) is several times
+ * larger than a packed frame, so this only saves space when most frames are
+ * shared by many callstacks; it also replaces hashing and comparing whole
+ * frame arrays with one small-key lookup per frame.
+ */
+
+struct _callstack_trie_t {
+    /* Maps a (parent, frame) key to its node */
+    hashtable_t table;
+    /* Parent of all outermost frames; also the leaf for an empty callstack */
+    cstack_trie_node_t root;
+    uint next_id;
+    uint num_nodes;
+#ifdef STATISTICS
+    uint max_nodes;
+#endif
+};
+
+#define CSTACK_TRIE_HASH_BITS 10
+
+static inline bool
+cstack_trie_node_is_syscall(cstack_trie_node_t *node)
+{
+    return node->frame.modname == &MODNAME_INFO_SYSCALL;
+}
+
+static uint
+cstack_trie_hash(void *key)
+{
+    cstack_trie_node_t *node = (cstack_trie_node_t *) key;
+    ptr_uint_t hash = (ptr_uint_t) node->parent;
+    if (cstack_trie_node_is_syscall(node)) {
+        hash ^= (node->frame.loc.sysloc->sysnum.number << 8) ^
+            node->frame.loc.sysloc->sysnum.secondary;
+    } else
+        hash ^= (ptr_uint_t) node->frame.loc.addr;
+    /* Fold in the high bits, and shift out the low bits of heap addresses */
+    return (uint) (hash ^ (hash >> 4) IF_X64(^ (hash >> 32)));
+}
+
+static bool
+cstack_trie_cmp(void *key1, void *key2)
+{
+    cstack_trie_node_t *n1 = (cstack_trie_node_t *) key1;
+    cstack_trie_node_t *n2 = (cstack_trie_node_t *) key2;
+    if (n1->parent != n2->parent || n1->frame.modname != n2->frame.modname)
+        return false;
+    if (cstack_trie_node_is_syscall(n1)) {
+        /* The aux identifier is a string literal so we compare its address */
+        return (memcmp(n1->frame.loc.sysloc, n2->frame.loc.sysloc,
+                       sizeof(syscall_loc_t)) == 0);
+    }
+    return (n1->frame.loc.addr == n2->frame.loc.addr &&
+            n1->frame.modoffs == n2->frame.modoffs);
+}
+
+static void
+cstack_trie_node_free(void *p)
+{
+    cstack_trie_node_t *node = (cstack_trie_node_t *) p;
+    if (cstack_trie_node_is_syscall(node))
+        global_free(node->frame.loc.sysloc, sizeof(syscall_loc_t), HEAPSTAT_CALLSTACK);
+    global_free(node, sizeof(*node), HEAPSTAT_CALLSTACK);
+}
+
+callstack_trie_t *
+callstack_trie_create(void)
+{
+    callstack_trie_t *trie = (callstack_trie_t *)
+        global_alloc(sizeof(*trie), HEAPSTAT_CALLSTACK);
+    memset(trie, 0, sizeof(*trie));
+    /* The lock is recursive, which alloc_drmem.c relies on */
+    hashtable_init_ex(&trie->table, CSTACK_TRIE_HASH_BITS, HASH_CUSTOM,
+                      false/*!str_dup*/, false/*using external synch*/,
+                      cstack_trie_node_free, cstack_trie_hash, cstack_trie_cmp);
+    /* Id 0 is the root, i.e., the empty callstack */
+    trie->next_id = 1;
+    return trie;
+}
+
+void
+callstack_trie_destroy(callstack_trie_t *trie)
+{
+    uint i;
+    /* There might be callstacks not freed by the app (e.g., leaks) so we
+     * force-free all remaining shared callstacks.  The nodes themselves are
+     * freed by the hashtable.
+     */
+    hashtable_lock(&trie->table);
+    for (i = 0; i < HASHTABLE_SIZE(trie->table.table_bits); i++) {
+        hash_entry_t *he;
+        for (he = trie->table.table[i]; he != NULL; he = he->next) {
+            cstack_trie_node_t *node = (cstack_trie_node_t *) he->payload;
+            if (node->pcs != NULL) {
+                packed_callstack_destroy(node->pcs);
+                node->pcs = NULL;
+            }
+        }
+    }
+    if (trie->root.pcs != NULL)
+        packed_callstack_destroy(trie->root.pcs);
+    DOSTATS({
+        LOG(1, "callstack trie: %u nodes live, %u peak, %u ids\n",
+            trie->num_nodes, trie->max_nodes, trie->next_id);
+    });
+    hashtable_unlock(&trie->table);
+    hashtable_delete_with_stats(&trie->table, "callstack trie");
+    global_free(trie, sizeof(*trie), HEAPSTAT_CALLSTACK);
+}
+
+void
+callstack_trie_lock(callstack_trie_t *trie)
+{
+    hashtable_lock(&trie->table);
+}
+
+void
+callstack_trie_unlock(callstack_trie_t *trie)
+{
+    hashtable_unlock(&trie->table);
+}
+
+/* Caller must hold the trie lock */
+static cstack_trie_node_t *
+cstack_trie_insert(callstack_trie_t *trie, packed_callstack_t *pcs)
+{
+    cstack_trie_node_t *parent = &trie->root;
+    cstack_trie_node_t key;
+    uint i;
+    memset(&key, 0, sizeof(key));
+    /* Walk from the outermost frame inward, extending the trie as we go */
+    for (i = pcs->num_frames; i > 0; i--) {
+        cstack_trie_node_t *node;
+        uint frame = i - 1;
+        modname_info_t *info = NULL;
+        size_t offs = 0;
+        key.parent = parent;
+        /* The frame key is in full_frame_t form regardless of pcs's layout */
+        if (!packed_callstack_frame_modinfo(pcs, frame, &info, &offs))
+            info = (modname_info_t *) &MODNAME_INFO_SYSCALL;
+        key.frame.modname = info;
+        key.frame.modoffs = offs;
+        key.frame.loc = PCS_FRAME_LOC(pcs, frame);
+        node = (cstack_trie_node_t *) hashtable_lookup(&trie->table, (void *)&key);
+        if (node == NULL) {
+            node = (cstack_trie_node_t *)
+                global_alloc(sizeof(*node), HEAPSTAT_CALLSTACK);
+            *node = key;
+            if (cstack_trie_node_is_syscall(node)) {
+                node->frame.loc.sysloc = (syscall_loc_t *)
+                    global_alloc(sizeof(syscall_loc_t), HEAPSTAT_CALLSTACK);
+                *node->frame.loc.sysloc = *key.frame.loc.sysloc;
+            }
+            node->id = trie->next_id++;
+            node->num_children = 0;
+            node->pcs = NULL;
+            hashtable_add(&trie->table, (void *)node, (void *)node);
+            parent->num_children++;
+            trie->num_nodes++;
+#ifdef STATISTICS
+            if (trie->num_nodes > trie->max_nodes)
+                trie->max_nodes = trie->num_nodes;
+#endif
+        }
+        parent = node;
+    }
+    return parent;
+}
+
+/* Frees pcs's own frames now that the trie holds them */
+static void
+packed_callstack_move_to_trie(packed_callstack_t *pcs, cstack_trie_node_t *leaf)
+{
+    if (pcs->first_is_syscall) {
+        global_free(PCS_FRAME_LOC(pcs, 0).sysloc, sizeof(syscall_loc_t),
+                    HEAPSTAT_CALLSTACK);
+    }
+    if (PCS_FRAMES(pcs) != NULL) {
+        global_free(PCS_FRAMES(pcs), PCS_FRAME_SZ(pcs)*pcs->num_frames,
+                    HEAPSTAT_CALLSTACK);
+    }
+    pcs->is_packed = false;
+    pcs->frames.full = NULL;
+    pcs->trie_leaf = leaf;
+}
+
+/* Adds the packed callstack to the trie, assuming the caller is holding the
+ * trie lock.  Like packed_callstack_add_to_table(), returns the shared
+ * callstack, which may not be pcs, with an added reference.  A newly added
+ * pcs gives up its frames array.
+ */
+packed_callstack_t *
+packed_callstack_add_to_trie(callstack_trie_t *trie, packed_callstack_t *pcs
+                             _IF_STATS(uint *callstack_count))
+{
+    cstack_trie_node_t *leaf;
+    ASSERT(pcs->trie_leaf == NULL, "callstack already in a trie");
+    leaf = cstack_trie_insert(trie, pcs);
+    if (leaf->pcs == NULL) {
+        leaf->pcs = pcs;
+        packed_callstack_move_to_trie(pcs, leaf);
+        DOLOG(3, {
+            LOG(3, "@@@ unique callstack #%d id %d\n", *callstack_count, leaf->id);
+            packed_callstack_log(pcs, INVALID_FILE);
+        });
+        STATS_INC(*callstack_count);
+    } else {
+        IF_DEBUG(uint count =) packed_callstack_free(pcs);
+        ASSERT(count == 0, "refcount should be 0");
+        pcs = leaf->pcs;
+    }
+    /* As with the hashtable, the trie holds one reference */
+    packed_callstack_add_ref(pcs);
+    return pcs;
+}
+
+/* Removes the trie's reference to pcs and prunes any nodes that no longer
+ * lead to a callstack.  The caller must hold the trie lock.
+ */
+void
+packed_callstack_remove_from_trie(callstack_trie_t *trie, packed_callstack_t *pcs)
+{
+    cstack_trie_node_t *node = pcs->trie_leaf;
+    ASSERT(node != NULL && node->pcs == pcs, "callstack not in trie");
+    if (node == NULL)
+        return;
+    node->pcs = NULL;
+    IF_DEBUG(uint count =) packed_callstack_free(pcs);
+    ASSERT(count == 0, "trie should hold the final reference");
+    while (node != &trie->root && node->num_children == 0 && node->pcs == NULL) {
+        cstack_trie_node_t *parent = node->parent;
+        /* this frees node */
+        hashtable_remove(&trie->table, (void *)node);
+        ASSERT(parent->num_children > 0, "trie child count mismatch");
+        parent->num_children--;
+        trie->num_nodes--;
+        node = parent;
+    }
+}
+
+/* Returns the unique id of pcs's trie leaf, or 0 if pcs is not in a trie
+ * (0 is also the id of an empty callstack).
+ */
+uint
+packed_callstack_trie_id(packed_callstack_t *pcs)
+{
+    return (pcs->trie_leaf == NULL) ? 0 : pcs->trie_leaf->id;
+}
+
 /***************************************************************************
  * SYMBOLIZED CALLSTACKS
  */
@@ -2515,6 +3010,10 @@ add_new_module(void *drcontext, const module_data_t *info)
         if (ops.module_load != NULL)
             name_info->user_data = ops.module_load(name_info->path, name, info->start);
         name_info->warned_no_syms = false;
+#ifdef LINUX
+        name_info->unwind_table = NULL;
+        name_info->unwind_loads = NULL;
+#endif
         hashtable_add(&modname_table, (void*)name_info->path, (void*)name_info);
         /* We need an entry for every 16M of module size */
         sz = info->end - info->start;
@@ -2555,6 +3054,16 @@ modname_info_free(void *p)
     modname_info_t *info = (modname_info_t *) p;
     if (ops.module_load != NULL)
         ops.module_unload(info->path, info->user_data);
+#ifdef LINUX
+    if (info->unwind_table != NULL)
+        eh_frame_table_destroy(info->unwind_table);
+    while (info->unwind_loads != NULL) {
+        unwind_load_t *next = info->unwind_loads->next;
+        global_free(info->unwind_loads, sizeof(*info->unwind_loads),
+                    HEAPSTAT_HASHTABLE);
+        info->unwind_loads = next;
+    }
+#endif
     if (info->name != NULL)
         global_free((void *)info->name, strlen(info->name) + 1, HEAPSTAT_HASHTABLE);
     if (info->path != NULL)
@@ -2619,6 +3128,67 @@ callstack_module_get_text_bounds(const module_data_t *info, bool loaded,
         }
 }
 
+#ifdef LINUX
+static void
+callstack_module_load_unwind_info(modname_info_t *name_info, const module_data_t *info)
+{
+    eh_frame_table_t *table = NULL;
+    unwind_load_t *load, *free_load = NULL;
+    /* We parse once per path and share the table, whose offsets are
+     * relative to the module base, among all loads of the path.
+     */
+    if (name_info->unwind_table == NULL)
+        table = eh_frame_table_create(info);
+    hashtable_lock(&modname_table);
+    if (table != NULL) {
+        if (name_info->unwind_table == NULL) {
+            name_info->unwind_table = table;
+            table = NULL;
+        }
+    }
+    for (load = name_info->unwind_loads; load != NULL; load = load->next) {
+        if (load->base == info->start)
+            break;
+        if (load->size == 0 && free_load == NULL)
+            free_load = load;
+    }
+    if (load == NULL)
+        load = free_load;
+    if (load == NULL) {
+        load = (unwind_load_t *) global_alloc(sizeof(*load), HEAPSTAT_HASHTABLE);
+        load->size = 0;
+        load->next = name_info->unwind_loads;
+        name_info->unwind_loads = load;
+    }
+    /* Clear the size first so a racing walk never pairs a new base with an
+     * old size.
+     */
+    load->size = 0;
+    load->base = info->start;
+    load->size = info->end - info->start;
+    hashtable_unlock(&modname_table);
+    if (table != NULL) /* lost a race */
+        eh_frame_table_destroy(table);
+}
+
+static void
+callstack_module_unload_unwind_info(const module_data_t *info)
+{
+    modname_info_t *name_info;
+    unwind_load_t *load;
+    hashtable_lock(&modname_table);
+    name_info = (modname_info_t *) hashtable_lookup(&modname_table,
+                                                    (void*)info->full_path);
+    if (name_info != NULL) {
+        for (load = name_info->unwind_loads; load != NULL; load = load->next) {
+            if (load->base == info->start)
+                load->size = 0;
+        }
+    }
+    hashtable_unlock(&modname_table);
+}
+#endif
+
 /* For storing binary callstacks we need to store module names in a shared
  * location to save space and handle unloaded and reloaded modules.
  */
@@ -2627,6 +3197,11 @@ callstack_module_load(void *drcontext, const module_data_t *info, bool loaded)
 {
     modname_info_t *name_info = add_new_module(drcontext, info);
 
+#ifdef LINUX
+    if (!TEST(FP_DO_NOT_USE_UNWIND_INFO, ops.fp_flags) && loaded)
+        callstack_module_load_unwind_info(name_info, info);
+#endif
+
     /* Record DR and DrMem lib bounds.  We assume they are contiguous. */
     if (text_matches_pattern(name_info->name, DYNAMORIO_LIBNAME, FILESYS_CASELESS)) {
         ASSERT(libdr_base == NULL, "duplicate DR lib");
@@ -2682,6 +3257,10 @@ callstack_module_unload(void *drcontext, const module_data_t *info)
     LOG(1, "module unload event: \"%s\" "PFX"-"PFX"\n",
         (dr_module_preferred_name(info) == NULL) ? "" :
         dr_module_preferred_name(info), info->start, info->end);
+#ifdef LINUX
+    if (!TEST(FP_DO_NOT_USE_UNWIND_INFO, ops.fp_flags))
+        callstack_module_unload_unwind_info(info);
+#endif
     dr_mutex_lock(modtree_lock);
 
 #ifdef WINDOWS
@@ -2885,3 +3464,116 @@ syscall_to_loc(app_loc_t *loc, drsys_sysnum_t sysnum, const char *aux)
 }
 
 /* loc_to_pc() and loc_to_print() must be defined by the tool-specific code */
+/***************************************************************************/
+#ifdef BUILD_UNIT_TESTS
+
+#define TEST_CSTACK_NUM 256
+#define TEST_CSTACK_DEPTH 16
+/* Callstacks differ only in their innermost TEST_CSTACK_UNIQUE frames */
+#define TEST_CSTACK_UNIQUE 2
+#define TEST_CSTACK_PC(cs, f) \
+    ((app_pc)(ptr_uint_t)(0x100000 + (f) * 0x10000 + \
+                          ((f) < TEST_CSTACK_UNIQUE ? (cs) * 4 : 0)))
+/* Every so often the innermost frame is a syscall */
+#define TEST_CSTACK_IS_SYSCALL(cs) ((cs) % 64 == 0)
+
+/* Creates callstack cs with non-module packed frames, as
+ * packed_callstack_record() would for code outside any module.
+ */
+static packed_callstack_t *
+test_cstack_create(uint cs)
+{
+    packed_callstack_t *pcs = (packed_callstack_t *)
+        global_alloc(sizeof(*pcs), HEAPSTAT_CALLSTACK);
+    uint f;
+    memset(pcs, 0, sizeof(*pcs));
+    pcs->refcount = 1;
+    pcs->num_frames = TEST_CSTACK_DEPTH;
+    pcs->is_packed = true;
+    pcs->frames.packed = (packed_frame_t *)
+        global_alloc(sizeof(*pcs->frames.packed) * TEST_CSTACK_DEPTH,
+                     HEAPSTAT_CALLSTACK);
+    for (f = 0; f < TEST_CSTACK_DEPTH; f++) {
+        pcs->frames.packed[f].loc.addr = TEST_CSTACK_PC(cs, f);
+        pcs->frames.packed[f].modoffs = MAX_MODOFFS_STORED;
+        pcs->frames.packed[f].modname_idx = MAX_MODNAMES_STORED;
+    }
+    if (TEST_CSTACK_IS_SYSCALL(cs)) {
+        pcs->first_is_syscall = true;
+        pcs->frames.packed[0].modoffs = 0;
+        pcs->frames.packed[0].modname_idx = 0;
+        pcs->frames.packed[0].loc.sysloc = (syscall_loc_t *)
+            global_alloc(sizeof(syscall_loc_t), HEAPSTAT_CALLSTACK);
+        pcs->frames.packed[0].loc.sysloc->sysnum.number = cs;
+        pcs->frames.packed[0].loc.sysloc->sysnum.secondary = 0;
+        pcs->frames.packed[0].loc.sysloc->syscall_aux = "test";
+    }
+    return pcs;
+}
+
+void
+test_callstack_trie(void)
+{
+    callstack_trie_t *trie = callstack_trie_create();
+    static packed_callstack_t *shared[TEST_CSTACK_NUM];
+    size_t flat_bytes = 0;
+    uint i;
+    IF_STATS(uint count = 0;)
+
+    /* Each callstack is added once, and a duplicate resolves to it */
+    for (i = 0; i < TEST_CSTACK_NUM; i++) {
+        packed_callstack_t *pcs = test_cstack_create(i);
+        flat_bytes += sizeof(packed_frame_t) * TEST_CSTACK_DEPTH;
+        shared[i] = packed_callstack_add_to_trie(trie, pcs _IF_STATS(&count));
+        EXPECT(shared[i] == pcs && packed_callstack_refcount(pcs) == 2);
+        EXPECT(pcs->trie_leaf != NULL && pcs->frames.full == NULL);
+        EXPECT(packed_callstack_trie_id(pcs) != 0);
+        pcs = packed_callstack_add_to_trie(trie, test_cstack_create(i)
+                                           _IF_STATS(&count));
+        EXPECT(pcs == shared[i] && packed_callstack_refcount(pcs) == 3);
+    }
+    IF_STATS(EXPECT(count == TEST_CSTACK_NUM);)
+    EXPECT(trie->num_nodes == TEST_CSTACK_DEPTH - TEST_CSTACK_UNIQUE +
+           TEST_CSTACK_NUM * TEST_CSTACK_UNIQUE);
+
+    /* The frames read back through the trie match the originals */
+    for (i = 0; i < TEST_CSTACK_NUM; i++) {
+        packed_callstack_t *flat = test_cstack_create(i);
+        packed_callstack_t *clone = packed_callstack_clone(shared[i]);
+        EXPECT(packed_callstack_cmp(shared[i], flat));
+        EXPECT(packed_callstack_cmp(flat, shared[i]));
+        EXPECT(packed_callstack_hash(shared[i]) == packed_callstack_hash(flat));
+        EXPECT(clone->trie_leaf == NULL && packed_callstack_cmp(clone, flat));
+        EXPECT(PCS_FRAME_LOC(shared[i], TEST_CSTACK_DEPTH - 1).addr ==
+               TEST_CSTACK_PC(i, TEST_CSTACK_DEPTH - 1));
+        if (i > 0) {
+            EXPECT(!packed_callstack_cmp(shared[i], shared[i - 1]));
+            EXPECT(packed_callstack_trie_id(shared[i]) !=
+                   packed_callstack_trie_id(shared[i - 1]));
+        }
+        EXPECT(packed_callstack_free(clone) == 0);
+        EXPECT(packed_callstack_free(flat) == 0);
+    }
+
+    /* With only the innermost frames distinct, the nodes (including their
+     * hashtable entries) take less space than separate frames arrays.
+     */
+    EXPECT(trie->num_nodes * (sizeof(cstack_trie_node_t) + sizeof(hash_entry_t)) <
+           flat_bytes);
+
+    /* Dropping the last references prunes every node */
+    for (i = 0; i < TEST_CSTACK_NUM; i++) {
+        EXPECT(packed_callstack_free(shared[i]) == 2);
+        EXPECT(packed_callstack_free(shared[i]) == 1);
+        packed_callstack_remove_from_trie(trie, shared[i]);
+    }
+    EXPECT(trie->num_nodes == 0);
+
+    /* Destroying force-frees what is left */
+    for (i = 0; i < TEST_CSTACK_NUM; i++) {
+        packed_callstack_add_to_trie(trie, test_cstack_create(i) _IF_STATS(&count));
+    }
+    callstack_trie_destroy(trie);
+}
+
+#endif /* BUILD_UNIT_TESTS */
@@ -165,6 +165,10 @@ enum {
      * that we've already executed.
      */
     FP_SEARCH_ALLOW_UNSEEN_RETADDR    = 0x00010000,
+    /* On Linux, by default we compute the next frame from the module's
+     * .eh_frame unwind information when it is available, before scanning.
+     */
+    FP_DO_NOT_USE_UNWIND_INFO         = 0x00020000,
     FP_SEARCH_AGGRESSIVE              = (FP_SHOW_NON_MODULE_FRAMES |
                                          FP_SEARCH_MATCH_SINGLE_FRAME),
 };
@@ -352,6 +356,40 @@ packed_callstack_t *
 packed_callstack_add_to_table(hashtable_t *table, packed_callstack_t *pcs
                               _IF_STATS(uint *callstack_count));
 
+/* A shared prefix trie of callstacks, rooted at the outermost frame.  A
+ * callstack added to the trie gives up its own frames array and is identified
+ * by its leaf node.  Synchronization is external, via callstack_trie_{,un}lock().
+ * Trie-backed callstacks do not support packed_callstack_md5() or _crc32().
+ */
+struct _callstack_trie_t;
+typedef struct _callstack_trie_t callstack_trie_t;
+
+callstack_trie_t *
+callstack_trie_create(void);
+
+/* force-frees all callstacks still in the trie */
+void
+callstack_trie_destroy(callstack_trie_t *trie);
+
+void
+callstack_trie_lock(callstack_trie_t *trie);
+
+void
+callstack_trie_unlock(callstack_trie_t *trie);
+
+/* add the packed callstack into the trie, assuming the caller is holding the lock */
+packed_callstack_t *
+packed_callstack_add_to_trie(callstack_trie_t *trie, packed_callstack_t *pcs
+                             _IF_STATS(uint *callstack_count));
+
+/* drops the trie's (final) reference, assuming the caller is holding the lock */
+void
+packed_callstack_remove_from_trie(callstack_trie_t *trie, packed_callstack_t *pcs);
+
+/* returns the unique id of pcs in its trie, or 0 if not in a trie */
+uint
+packed_callstack_trie_id(packed_callstack_t *pcs);
+
 /* The user must call this from a DR dr_register_module_load_event() event */
 void
 callstack_module_load(void *drcontext, const module_data_t *info, bool loaded);
@@ -475,4 +513,9 @@ print_symbol(byte *addr, char *buf, size_t bufsz, size_t *sofar,
              bool use_custom_flags, uint custom_flags);
 #endif
 
+#ifdef BUILD_UNIT_TESTS
+void
+test_callstack_trie(void);
+#endif
+
 #endif /* _CALLSTACK_H_ */
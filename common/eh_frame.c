@@ -0,0 +1,1062 @@
+/* **********************************************************
+ * Copyright (c) 2014 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/* Dr. Memory: the memory debugger
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/***************************************************************************
+ * eh_frame.c: ELF .eh_frame call frame information for callstack walking
+ *
+ * We read the .eh_frame of each module in place, through the sorted
+ * FDE table in the PT_GNU_EH_FRAME segment (.eh_frame_hdr), and run each
+ * FDE's CFI program to produce one row per CFA rule change.  We only
+ * track the CFA, not the locations of other registers: the callstack
+ * walker only needs the return address, which on x86 is always just
+ * below the CFA.
+ */
+
+#include "dr_api.h"
+#include "utils.h"
+#include "eh_frame.h"
+#include <elf.h>
+#include <string.h>
+#include <limits.h>
+
+#ifdef X64
+# define ELF_HEADER_TYPE Elf64_Ehdr
+# define ELF_PROGRAM_HEADER_TYPE Elf64_Phdr
+# define DWARF_REG_XSP 7
+#else
+# define ELF_HEADER_TYPE Elf32_Ehdr
+# define ELF_PROGRAM_HEADER_TYPE Elf32_Phdr
+# define DWARF_REG_XSP 4
+#endif
+
+/* Pointer encodings (from the LSB spec) */
+#define DW_EH_PE_absptr   0x00
+#define DW_EH_PE_uleb128  0x01
+#define DW_EH_PE_udata2   0x02
+#define DW_EH_PE_udata4   0x03
+#define DW_EH_PE_udata8   0x04
+#define DW_EH_PE_sleb128  0x09
+#define DW_EH_PE_sdata2   0x0a
+#define DW_EH_PE_sdata4   0x0b
+#define DW_EH_PE_sdata8   0x0c
+#define DW_EH_PE_pcrel    0x10
+#define DW_EH_PE_datarel  0x30
+#define DW_EH_PE_indirect 0x80
+#define DW_EH_PE_omit     0xff
+
+/* CFI opcodes (DWARF 4 section 7.23) */
+#define DW_CFA_advance_loc        0x40
+#define DW_CFA_offset             0x80
+#define DW_CFA_restore            0xc0
+#define DW_CFA_nop                0x00
+#define DW_CFA_set_loc            0x01
+#define DW_CFA_advance_loc1       0x02
+#define DW_CFA_advance_loc2       0x03
+#define DW_CFA_advance_loc4       0x04
+#define DW_CFA_offset_extended    0x05
+#define DW_CFA_restore_extended   0x06
+#define DW_CFA_undefined          0x07
+#define DW_CFA_same_value         0x08
+#define DW_CFA_register           0x09
+#define DW_CFA_remember_state     0x0a
+#define DW_CFA_restore_state      0x0b
+#define DW_CFA_def_cfa            0x0c
+#define DW_CFA_def_cfa_register   0x0d
+#define DW_CFA_def_cfa_offset     0x0e
+#define DW_CFA_def_cfa_expression 0x0f
+#define DW_CFA_expression         0x10
+#define DW_CFA_offset_extended_sf 0x11
+#define DW_CFA_def_cfa_sf         0x12
+#define DW_CFA_def_cfa_offset_sf  0x13
+#define DW_CFA_val_offset         0x14
+#define DW_CFA_val_offset_sf      0x15
+#define DW_CFA_val_expression     0x16
+#define DW_CFA_GNU_args_size      0x2e
+#define DW_CFA_GNU_negative_offset_extended 0x2f
+
+/* A row holds the CFA rule from its start offset until the next row */
+typedef struct _eh_frame_row_t {
+    uint start; /* module offset */
+    int sp_offs; /* CFA = xsp + sp_offs, or EH_FRAME_SP_OFFS_UNKNOWN */
+} eh_frame_row_t;
+
+#define EH_FRAME_SP_OFFS_UNKNOWN INT_MIN
+
+struct _eh_frame_table_t {
+    eh_frame_row_t *rows;
+    uint num_rows;
+    uint capacity;
+};
+
+/* Parsing state for a CIE */
+typedef struct _cie_info_t {
+    ptr_uint_t code_align;
+    ptr_int_t data_align;
+    byte fde_enc;
+    bool has_aug_data;
+    byte *instrs;
+    byte *instrs_end;
+} cie_info_t;
+
+/* The parts of the CFI state that we track */
+typedef struct _cfa_state_t {
+    uint reg;
+    ptr_int_t offs;
+    bool is_expr;
+} cfa_state_t;
+
+#define CFA_STATE_STACK_DEPTH 8
+
+/* Bounds for all of our reads */
+typedef struct _eh_reader_t {
+    byte *start;
+    byte *end;
+    app_pc mod_start;
+} eh_reader_t;
+
+/***************************************************************************
+ * Primitive readers.  All return false if the read would go out of bounds.
+ */
+
+static bool
+read_bytes(eh_reader_t *rd, byte **pc, void *dst, size_t sz)
+{
+    if (*pc < rd->start || *pc + sz > rd->end || *pc + sz < *pc)
+        return false;
+    memcpy(dst, *pc, sz);
+    *pc += sz;
+    return true;
+}
+
+static bool
+read_uleb128(eh_reader_t *rd, byte **pc, ptr_uint_t *val OUT)
+{
+    ptr_uint_t res = 0;
+    uint shift = 0;
+    byte b;
+    do {
+        if (!read_bytes(rd, pc, &b, 1))
+            return false;
+        if (shift < sizeof(res) * 8)
+            res |= ((ptr_uint_t)(b & 0x7f)) << shift;
+        shift += 7;
+    } while (TEST(0x80, b));
+    *val = res;
+    return true;
+}
+
+static bool
+read_sleb128(eh_reader_t *rd, byte **pc, ptr_int_t *val OUT)
+{
+    ptr_int_t res = 0;
+    uint shift = 0;
+    byte b;
+    do {
+        if (!read_bytes(rd, pc, &b, 1))
+            return false;
+        if (shift < sizeof(res) * 8)
+            res |= ((ptr_int_t)(b & 0x7f)) << shift;
+        shift += 7;
+    } while (TEST(0x80, b));
+    if (shift < sizeof(res) * 8 && TEST(0x40, b))
+        res |= -(((ptr_int_t)1) << shift);
+    *val = res;
+    return true;
+}
+
+/* Reads a pointer with the given DW_EH_PE_ encoding.  datarel_base is only
+ * needed for DW_EH_PE_datarel, which is only used in .eh_frame_hdr.
+ */
+static bool
+read_encoded(eh_reader_t *rd, byte **pc, byte enc, byte *datarel_base,
+             ptr_uint_t *val OUT)
+{
+    byte *field = *pc;
+    ptr_uint_t res;
+    if (enc == DW_EH_PE_omit)
+        return false;
+    switch (enc & 0x0f) {
+    case DW_EH_PE_absptr: {
+        app_pc ptr;
+        if (!read_bytes(rd, pc, &ptr, sizeof(ptr)))
+            return false;
+        res = (ptr_uint_t) ptr;
+        break;
+    }
+    case DW_EH_PE_uleb128:
+        if (!read_uleb128(rd, pc, &res))
+            return false;
+        break;
+    case DW_EH_PE_sleb128: {
+        ptr_int_t sval;
+        if (!read_sleb128(rd, pc, &sval))
+            return false;
+        res = (ptr_uint_t) sval;
+        break;
+    }
+    case DW_EH_PE_udata2: {
+        ushort v;
+        if (!read_bytes(rd, pc, &v, sizeof(v)))
+            return false;
+        res = v;
+        break;
+    }
+    case DW_EH_PE_sdata2: {
+        short v;
+        if (!read_bytes(rd, pc, &v, sizeof(v)))
+            return false;
+        res = (ptr_uint_t)(ptr_int_t) v;
+        break;
+    }
+    case DW_EH_PE_udata4: {
+        uint v;
+        if (!read_bytes(rd, pc, &v, sizeof(v)))
+            return false;
+        res = v;
+        break;
+    }
+    case DW_EH_PE_sdata4: {
+        int v;
+        if (!read_bytes(rd, pc, &v, sizeof(v)))
+            return false;
+        res = (ptr_uint_t)(ptr_int_t) v;
+        break;
+    }
+    case DW_EH_PE_udata8:
+    case DW_EH_PE_sdata8: {
+        uint64 v;
+        if (!read_bytes(rd, pc, &v, sizeof(v)))
+            return false;
+        res = (ptr_uint_t) v;
+        break;
+    }
+    default:
+        return false;
+    }
+    switch (enc & 0x70) {
+    case 0:
+        break;
+    case DW_EH_PE_pcrel:
+        res += (ptr_uint_t) field;
+        break;
+    case DW_EH_PE_datarel:
+        if (datarel_base == NULL)
+            return false;
+        res += (ptr_uint_t) datarel_base;
+        break;
+    default:
+        /* textrel, funcrel, and aligned are not used on x86 Linux */
+        return false;
+    }
+    if (TEST(DW_EH_PE_indirect, enc)) {
+        byte *ptr = (byte *) res;
+        if (!read_bytes(rd, &ptr, &res, sizeof(res)))
+            return false;
+    }
+    *val = res;
+    return true;
+}
+
+/* Reads the initial length field of a CIE or FDE.  Returns the end of the
+ * entry, or NULL on error.  A zero length marks the end of .eh_frame.
+ */
+static byte *
+read_entry_length(eh_reader_t *rd, byte **pc, bool *is_64 OUT)
+{
+    uint len32;
+    uint64 len;
+    byte *end;
+    if (!read_bytes(rd, pc, &len32, sizeof(len32)))
+        return NULL;
+    *is_64 = (len32 == 0xffffffff);
+    if (*is_64) {
+        if (!read_bytes(rd, pc, &len, sizeof(len)))
+            return NULL;
+    } else
+        len = len32;
+    if (len == 0 || len > (uint64)(rd->end - *pc))
+        return NULL;
+    end = *pc + len;
+    return end;
+}
+
+/***************************************************************************
+ * Table construction
+ */
+
+static void
+table_add_row(eh_frame_table_t *table, ptr_uint_t addr, const cfa_state_t *state)
+{
+    eh_frame_row_t row;
+    if (addr > UINT_MAX)
+        return;
+    row.start = (uint) addr;
+    if (state == NULL || state->is_expr || state->reg != DWARF_REG_XSP ||
+        state->offs > INT_MAX || state->offs <= EH_FRAME_SP_OFFS_UNKNOWN)
+        row.sp_offs = EH_FRAME_SP_OFFS_UNKNOWN;
+    else
+        row.sp_offs = (int) state->offs;
+    if (table->num_rows > 0) {
+        eh_frame_row_t *last = &table->rows[table->num_rows - 1];
+        if (row.start < last->start) {
+            /* The FDE table is sorted, so this is an overlapping FDE: we keep
+             * the first, to keep our rows sorted for binary search.
+             */
+            LOG(3, "eh_frame: ignoring out-of-order row @"PIFX"\n", row.start);
+            return;
+        }
+        if (row.start == last->start) {
+            *last = row;
+            /* Keep merging in case this now matches its predecessor */
+            if (table->num_rows > 1 &&
+                table->rows[table->num_rows - 2].sp_offs == row.sp_offs)
+                table->num_rows--;
+            return;
+        }
+        if (row.sp_offs == last->sp_offs)
+            return; /* no change in rule */
+    }
+    if (table->num_rows == table->capacity) {
+        uint new_cap = (table->capacity == 0) ? 256 : table->capacity * 2;
+        eh_frame_row_t *new_rows = (eh_frame_row_t *)
+            global_alloc(new_cap * sizeof(*new_rows), HEAPSTAT_CALLSTACK);
+        if (table->rows != NULL) {
+            memcpy(new_rows, table->rows, table->num_rows * sizeof(*new_rows));
+            global_free(table->rows, table->capacity * sizeof(*table->rows),
+                        HEAPSTAT_CALLSTACK);
+        }
+        table->rows = new_rows;
+        table->capacity = new_cap;
+    }
+    table->rows[table->num_rows++] = row;
+}
+
+static bool
+parse_cie(eh_reader_t *rd, byte *cie, cie_info_t *info OUT)
+{
+    byte *pc = cie, *end, *aug_end = NULL;
+    bool is_64;
+    uint64 id;
+    byte version;
+    const char *aug;
+    ptr_uint_t val;
+    memset(info, 0, sizeof(*info));
+    info->fde_enc = DW_EH_PE_absptr;
+    end = read_entry_length(rd, &pc, &is_64);
+    if (end == NULL)
+        return false;
+    if (is_64) {
+        if (!read_bytes(rd, &pc, &id, sizeof(id)))
+            return false;
+    } else {
+        uint id32;
+        if (!read_bytes(rd, &pc, &id32, sizeof(id32)))
+            return false;
+        id = id32;
+    }
+    if (id != 0) /* CIE id is 0 in .eh_frame */
+        return false;
+    if (!read_bytes(rd, &pc, &version, 1) || (version != 1 && version != 3))
+        return false;
+    aug = (const char *) pc;
+    while (pc < end && *pc != '\0')
+        pc++;
+    if (pc >= end)
+        return false;
+    pc++;
+    if (strstr(aug, "eh") != NULL) /* old gcc: skip eh_ptr */
+        pc += sizeof(app_pc);
+    if (!read_uleb128(rd, &pc, &info->code_align) ||
+        !read_sleb128(rd, &pc, &info->data_align))
+        return false;
+    if (version == 1)
+        pc++; /* return address register */
+    else if (!read_uleb128(rd, &pc, &val))
+        return false;
+    if (aug[0] == 'z') {
+        info->has_aug_data = true;
+        if (!read_uleb128(rd, &pc, &val))
+            return false;
+        aug_end = pc + val;
+        for (aug++; *aug != '\0'; aug++) {
+            if (*aug == 'R') {
+                if (!read_bytes(rd, &pc, &info->fde_enc, 1))
+                    return false;
+            } else if (*aug == 'P') {
+                byte penc;
+                if (!read_bytes(rd, &pc, &penc, 1) ||
+                    /* do not follow the indirection to the personality routine */
+                    !read_encoded(rd, &pc, penc & ~DW_EH_PE_indirect, NULL, &val))
+                    return false;
+            } else if (*aug == 'L') {
+                pc++; /* LSDA encoding */
+            } else if (*aug == 'S') {
+                /* signal frame: nothing to parse */
+            } else
+                break; /* unknown: the length lets us skip the rest */
+        }
+        pc = aug_end;
+    } else if (aug[0] != '\0' && strcmp(aug, "eh") != 0)
+        return false; /* unknown augmentation without length */
+    if (pc > end)
+        return false;
+    info->instrs = pc;
+    info->instrs_end = end;
+    return true;
+}
+
+/* Runs the CFI program [pc, end), adding rows to table.  *loc is the current
+ * code address, updated as the program advances.
+ */
+static bool
+run_cfi(eh_reader_t *rd, eh_frame_table_t *table, const cie_info_t *cie,
+        byte *pc, byte *end, ptr_uint_t *loc, cfa_state_t *state,
+        cfa_state_t *stack, uint *stack_depth, bool emit)
+{
+    while (pc < end) {
+        byte op;
+        ptr_uint_t reg, uval, delta = 0;
+        ptr_int_t sval;
+        bool advance = false;
+        if (!read_bytes(rd, &pc, &op, 1))
+            return false;
+        switch (op & 0xc0) {
+        case DW_CFA_advance_loc:
+            delta = (op & 0x3f) * cie->code_align;
+            advance = true;
+            break;
+        case DW_CFA_offset:
+            if (!read_uleb128(rd, &pc, &uval))
+                return false;
+            break;
+        case DW_CFA_restore:
+            break;
+        default:
+            switch (op) {
+            case DW_CFA_nop:
+            case DW_CFA_GNU_args_size:
+                if (op == DW_CFA_GNU_args_size && !read_uleb128(rd, &pc, &uval))
+                    return false;
+                break;
+            case DW_CFA_set_loc:
+                if (!read_encoded(rd, &pc, cie->fde_enc, NULL, &uval))
+                    return false;
+                if (emit)
+                    table_add_row(table, *loc - (ptr_uint_t) rd->mod_start, state);
+                *loc = uval;
+                break;
+            case DW_CFA_advance_loc1: {
+                byte d;
+                if (!read_bytes(rd, &pc, &d, sizeof(d)))
+                    return false;
+                delta = d * cie->code_align;
+                advance = true;
+                break;
+            }
+            case DW_CFA_advance_loc2: {
+                ushort d;
+                if (!read_bytes(rd, &pc, &d, sizeof(d)))
+                    return false;
+                delta = d * cie->code_align;
+                advance = true;
+                break;
+            }
+            case DW_CFA_advance_loc4: {
+                uint d;
+                if (!read_bytes(rd, &pc, &d, sizeof(d)))
+                    return false;
+                delta = d * cie->code_align;
+                advance = true;
+                break;
+            }
+            case DW_CFA_offset_extended:
+            case DW_CFA_register:
+            case DW_CFA_val_offset:
+            case DW_CFA_GNU_negative_offset_extended:
+                if (!read_uleb128(rd, &pc, &reg) || !read_uleb128(rd, &pc, &uval))
+                    return false;
+                break;
+            case DW_CFA_offset_extended_sf:
+            case DW_CFA_val_offset_sf:
+                if (!read_uleb128(rd, &pc, &reg) || !read_sleb128(rd, &pc, &sval))
+                    return false;
+                break;
+            case DW_CFA_restore_extended:
+            case DW_CFA_undefined:
+            case DW_CFA_same_value:
+                if (!read_uleb128(rd, &pc, &reg))
+                    return false;
+                break;
+            case DW_CFA_remember_state:
+                if (*stack_depth >= CFA_STATE_STACK_DEPTH)
+                    return false;
+                stack[(*stack_depth)++] = *state;
+                break;
+            case DW_CFA_restore_state:
+                if (*stack_depth == 0)
+                    return false;
+                *state = stack[--(*stack_depth)];
+                break;
+            case DW_CFA_def_cfa:
+                if (!read_uleb128(rd, &pc, &reg) || !read_uleb128(rd, &pc, &uval))
+                    return false;
+                state->reg = (uint) reg;
+                state->offs = (ptr_int_t) uval;
+                state->is_expr = false;
+                break;
+            case DW_CFA_def_cfa_sf:
+                if (!read_uleb128(rd, &pc, &reg) || !read_sleb128(rd, &pc, &sval))
+                    return false;
+                state->reg = (uint) reg;
+                state->offs = sval * cie->data_align;
+                state->is_expr = false;
+                break;
+            case DW_CFA_def_cfa_register:
+                if (!read_uleb128(rd, &pc, &reg))
+                    return false;
+                state->reg = (uint) reg;
+                state->is_expr = false;
+                break;
+            case DW_CFA_def_cfa_offset:
+                if (!read_uleb128(rd, &pc, &uval))
+                    return false;
+                state->offs = (ptr_int_t) uval;
+                break;
+            case DW_CFA_def_cfa_offset_sf:
+                if (!read_sleb128(rd, &pc, &sval))
+                    return false;
+                state->offs = sval * cie->data_align;
+                break;
+            case DW_CFA_def_cfa_expression:
+                if (!read_uleb128(rd, &pc, &uval))
+                    return false;
+                pc += uval;
+                state->is_expr = true;
+                break;
+            case DW_CFA_expression:
+            case DW_CFA_val_expression:
+                if (!read_uleb128(rd, &pc, &reg) || !read_uleb128(rd, &pc, &uval))
+                    return false;
+                pc += uval;
+                break;
+            default:
+                LOG(2, "eh_frame: unknown CFA opcode 0x%x\n", op);
+                return false;
+            }
+        }
+        if (advance) {
+            if (emit)
+                table_add_row(table, *loc - (ptr_uint_t) rd->mod_start, state);
+            *loc += delta;
+        }
+    }
+    return true;
+}
+
+static bool
+parse_fde(eh_reader_t *rd, eh_frame_table_t *table, byte *fde)
+{
+    byte *pc = fde, *end, *cie_field;
+    bool is_64;
+    uint64 cie_offs;
+    cie_info_t cie;
+    ptr_uint_t pc_begin, pc_range, loc;
+    cfa_state_t state, stack[CFA_STATE_STACK_DEPTH];
+    uint stack_depth = 0;
+    end = read_entry_length(rd, &pc, &is_64);
+    if (end == NULL)
+        return false;
+    cie_field = pc;
+    if (is_64) {
+        if (!read_bytes(rd, &pc, &cie_offs, sizeof(cie_offs)))
+            return false;
+    } else {
+        uint offs32;
+        if (!read_bytes(rd, &pc, &offs32, sizeof(offs32)))
+            return false;
+        cie_offs = offs32;
+    }
+    /* In .eh_frame the CIE pointer is relative to the field itself */
+    if (cie_offs == 0 || cie_offs > (uint64)(cie_field - rd->start))
+        return false;
+    if (!parse_cie(rd, cie_field - cie_offs, &cie))
+        return false;
+    if (!read_encoded(rd, &pc, cie.fde_enc, NULL, &pc_begin) ||
+        !read_encoded(rd, &pc, cie.fde_enc & 0x0f, NULL, &pc_range))
+        return false;
+    if (cie.has_aug_data) {
+        ptr_uint_t aug_len;
+        if (!read_uleb128(rd, &pc, &aug_len))
+            return false;
+        pc += aug_len;
+    }
+    if (pc_begin < (ptr_uint_t) rd->mod_start)
+        return false;
+    memset(&state, 0, sizeof(state));
+    state.reg = DWARF_REG_XSP;
+    loc = pc_begin;
+    /* The CIE's initial instructions cannot advance the location, so we
+     * do not emit rows until the FDE's own instructions.
+     */
+    if (!run_cfi(rd, table, &cie, cie.instrs, cie.instrs_end, &loc, &state,
+                 stack, &stack_depth, false))
+        return false;
+    loc = pc_begin;
+    if (!run_cfi(rd, table, &cie, pc, end, &loc, &state, stack, &stack_depth, true))
+        return false;
+    table_add_row(table, loc - (ptr_uint_t) rd->mod_start, &state);
+    /* Mark the end of this FDE's range, in case of a gap before the next one */
+    table_add_row(table, pc_begin + pc_range - (ptr_uint_t) rd->mod_start, NULL);
+    return true;
+}
+
+/* Locates .eh_frame_hdr via the program headers */
+static byte *
+find_eh_frame_hdr(const module_data_t *info)
+{
+    ELF_HEADER_TYPE *ehdr = (ELF_HEADER_TYPE *) info->start;
+    ELF_PROGRAM_HEADER_TYPE *phdr;
+    ptr_uint_t min_vaddr = (ptr_uint_t) -1, hdr_vaddr = 0;
+    uint i;
+    if (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 ||
+        ehdr->e_phentsize != sizeof(*phdr) ||
+        ehdr->e_phoff + ehdr->e_phnum * sizeof(*phdr) >
+        (ptr_uint_t)(info->end - info->start))
+        return NULL;
+    phdr = (ELF_PROGRAM_HEADER_TYPE *) (info->start + ehdr->e_phoff);
+    for (i = 0; i < ehdr->e_phnum; i++) {
+        if (phdr[i].p_type == PT_LOAD && phdr[i].p_vaddr < min_vaddr)
+            min_vaddr = phdr[i].p_vaddr;
+        else if (phdr[i].p_type == PT_GNU_EH_FRAME)
+            hdr_vaddr = phdr[i].p_vaddr;
+    }
+    if (hdr_vaddr == 0 || min_vaddr == (ptr_uint_t) -1)
+        return NULL;
+    /* The load bias is the difference between the mapped base and the
+     * page-aligned lowest segment address (0 for a non-PIE executable).
+     */
+    return info->start - ALIGN_BACKWARD(min_vaddr, PAGE_SIZE) + hdr_vaddr;
+}
+
+static bool
+parse_eh_frame_hdr(eh_reader_t *rd, eh_frame_table_t *table, byte *hdr)
+{
+    byte *pc = hdr;
+    byte version, ptr_enc, count_enc, table_enc;
+    ptr_uint_t eh_frame, count, i;
+    if (!read_bytes(rd, &pc, &version, 1) || version != 1 ||
+        !read_bytes(rd, &pc, &ptr_enc, 1) ||
+        !read_bytes(rd, &pc, &count_enc, 1) ||
+        !read_bytes(rd, &pc, &table_enc, 1))
+        return false;
+    if (!read_encoded(rd, &pc, ptr_enc, hdr, &eh_frame))
+        return false;
+    /* We need the sorted search table: it's always present from ld's
+     * --eh-frame-hdr, which gcc passes by default.
+     */
+    if (count_enc == DW_EH_PE_omit || table_enc == DW_EH_PE_omit ||
+        !read_encoded(rd, &pc, count_enc, hdr, &count))
+        return false;
+    LOG(2, "eh_frame: hdr "PFX", .eh_frame "PFX", %d FDEs\n", hdr, eh_frame, count);
+    for (i = 0; i < count; i++) {
+        ptr_uint_t initial_loc, fde;
+        /* A row added for an FDE can at most replace the prior last row */
+        uint saved_num_rows = table->num_rows;
+        eh_frame_row_t saved_last;
+        if (saved_num_rows > 0)
+            saved_last = table->rows[saved_num_rows - 1];
+        if (!read_encoded(rd, &pc, table_enc, hdr, &initial_loc) ||
+            !read_encoded(rd, &pc, table_enc, hdr, &fde))
+            return false;
+        if (!parse_fde(rd, table, (byte *) fde)) {
+            /* Just skip this function: we'll fall back to scanning there.
+             * We drop any rows it added before failing, which would otherwise
+             * make the unknown row below look out of order.
+             */
+            LOG(2, "eh_frame: failed to parse FDE "PFX" for "PFX"\n", fde, initial_loc);
+            table->num_rows = saved_num_rows;
+            if (saved_num_rows > 0)
+                table->rows[saved_num_rows - 1] = saved_last;
+            table_add_row(table, initial_loc - (ptr_uint_t) rd->mod_start, NULL);
+        }
+    }
+    return true;
+}
+
+eh_frame_table_t *
+eh_frame_table_create(const module_data_t *info)
+{
+    eh_frame_table_t *table;
+    eh_reader_t rd;
+    byte *hdr;
+    bool ok = false;
+    ASSERT(info->end > info->start, "invalid mod bounds");
+    table = (eh_frame_table_t *) global_alloc(sizeof(*table), HEAPSTAT_CALLSTACK);
+    memset(table, 0, sizeof(*table));
+    rd.start = info->start;
+    rd.end = info->end;
+    rd.mod_start = info->start;
+    /* A non-contiguous module can have unmapped gaps, and a corrupt module
+     * can send us anywhere in it, so we guard all of our reads.
+     */
+    DR_TRY_EXCEPT(dr_get_current_drcontext(), {
+        hdr = find_eh_frame_hdr(info);
+        if (hdr != NULL)
+            ok = parse_eh_frame_hdr(&rd, table, hdr);
+    }, { /* EXCEPT */
+        LOG(1, "eh_frame: fault parsing unwind info for %s\n", info->full_path);
+        ok = false;
+    });
+    if (!ok || table->num_rows == 0) {
+        eh_frame_table_destroy(table);
+        return NULL;
+    }
+    /* Trim to size to save memory */
+    if (table->num_rows < table->capacity) {
+        eh_frame_row_t *rows = (eh_frame_row_t *)
+            global_alloc(table->num_rows * sizeof(*rows), HEAPSTAT_CALLSTACK);
+        memcpy(rows, table->rows, table->num_rows * sizeof(*rows));
+        global_free(table->rows, table->capacity * sizeof(*table->rows),
+                    HEAPSTAT_CALLSTACK);
+        table->rows = rows;
+        table->capacity = table->num_rows;
+    }
+    LOG(1, "eh_frame: %d unwind rows for %s\n", table->num_rows, info->full_path);
+    return table;
+}
+
+void
+eh_frame_table_destroy(eh_frame_table_t *table)
+{
+    if (table->rows != NULL) {
+        global_free(table->rows, table->capacity * sizeof(*table->rows),
+                    HEAPSTAT_CALLSTACK);
+    }
+    global_free(table, sizeof(*table), HEAPSTAT_CALLSTACK);
+}
+
+bool
+eh_frame_table_cfa(eh_frame_table_t *table, size_t modoffs, byte *sp, byte **cfa OUT)
+{
+    /* Binary search for the last row starting at or before modoffs */
+    uint lo = 0, hi = table->num_rows;
+    eh_frame_row_t *row;
+    while (lo < hi) {
+        uint mid = lo + (hi - lo) / 2;
+        if (table->rows[mid].start <= modoffs)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == 0)
+        return false;
+    row = &table->rows[lo - 1];
+    if (row->sp_offs == EH_FRAME_SP_OFFS_UNKNOWN)
+        return false;
+    *cfa = sp + row->sp_offs;
+    return true;
+}
+
+/***************************************************************************
+ * Unit tests
+ *
+ * We build a synthetic module in memory: an ELF header pointing at an
+ * .eh_frame_hdr whose sorted table points at FDEs in an .eh_frame.
+ */
+
+#ifdef BUILD_UNIT_TESTS
+
+# define TEST_MOD_SIZE   0x1000
+# define TEST_HDR_OFFS   0x100
+# define TEST_EH_OFFS    0x200
+# define TEST_NUM_FDES   4
+/* Each FDE covers [start, start + TEST_FDE_SIZE) */
+# define TEST_FDE_SIZE   0x10
+# define TEST_FDE1_START 0x800
+# define TEST_FDE1_SIZE  0x20
+# define TEST_FDE2_START 0x840
+# define TEST_FDE3_START 0x860
+# define TEST_FDE4_START 0x880
+# define TEST_REG_OTHER  (DWARF_REG_XSP - 1)
+
+/* Word-aligned for the ELF headers */
+static ptr_uint_t test_mod_buf[TEST_MOD_SIZE / sizeof(ptr_uint_t)];
+
+static const uint test_fde_start[TEST_NUM_FDES] = {
+    TEST_FDE1_START, TEST_FDE2_START, TEST_FDE3_START, TEST_FDE4_START
+};
+static const uint test_fde_size[TEST_NUM_FDES] = {
+    TEST_FDE1_SIZE, TEST_FDE_SIZE, TEST_FDE_SIZE, TEST_FDE_SIZE
+};
+
+/* For test_lookups(): FDE3 always fails to parse */
+# define TEST_FAILED_NONE 0x4
+# define TEST_FAILED_ALL  0xf
+
+static byte *
+test_emit_u8(byte *pc, byte val)
+{
+    *pc = val;
+    return pc + 1;
+}
+
+static byte *
+test_emit_u32(byte *pc, uint val)
+{
+    memcpy(pc, &val, sizeof(val));
+    return pc + sizeof(val);
+}
+
+/* Fills in the length field at entry, padding the entry with nops to 4 bytes */
+static byte *
+test_end_entry(byte *entry, byte *pc)
+{
+    while (!ALIGNED(pc - entry, 4))
+        pc = test_emit_u8(pc, DW_CFA_nop);
+    test_emit_u32(entry, (uint)(pc - entry - sizeof(uint)));
+    return pc;
+}
+
+/* A CIE with a pc-relative FDE encoding whose initial rule is the CFA just
+ * above the return address.
+ */
+static byte *
+test_emit_cie(byte *pc)
+{
+    byte *entry = pc;
+    pc += sizeof(uint); /* length */
+    pc = test_emit_u32(pc, 0); /* CIE id */
+    pc = test_emit_u8(pc, 1); /* version */
+    pc = test_emit_u8(pc, 'z');
+    pc = test_emit_u8(pc, 'R');
+    pc = test_emit_u8(pc, '\0');
+    pc = test_emit_u8(pc, 1); /* code alignment */
+    pc = test_emit_u8(pc, (byte)(0x80 - sizeof(app_pc))); /* data alignment */
+    pc = test_emit_u8(pc, DWARF_REG_XSP + 1); /* return address register */
+    pc = test_emit_u8(pc, 1); /* augmentation length */
+    pc = test_emit_u8(pc, DW_EH_PE_pcrel | DW_EH_PE_sdata4);
+    pc = test_emit_u8(pc, DW_CFA_def_cfa);
+    pc = test_emit_u8(pc, DWARF_REG_XSP);
+    pc = test_emit_u8(pc, sizeof(app_pc));
+    return test_end_entry(entry, pc);
+}
+
+static byte *
+test_emit_fde(byte *pc, byte *mod, byte *cie, uint start, uint size,
+              const byte *cfi, uint cfi_len)
+{
+    byte *entry = pc;
+    pc += sizeof(uint); /* length */
+    pc = test_emit_u32(pc, (uint)(pc - cie));
+    pc = test_emit_u32(pc, (uint)(mod + start - pc));
+    pc = test_emit_u32(pc, size);
+    pc = test_emit_u8(pc, 0); /* augmentation length */
+    if (cfi_len > 0) {
+        memcpy(pc, cfi, cfi_len);
+        pc += cfi_len;
+    }
+    return test_end_entry(entry, pc);
+}
+
+/* Builds the synthetic module, returning the FDE addresses in fdes */
+static void
+test_build_module(byte *mod, byte *fdes[TEST_NUM_FDES])
+{
+    ELF_HEADER_TYPE *ehdr = (ELF_HEADER_TYPE *) mod;
+    ELF_PROGRAM_HEADER_TYPE *phdr = (ELF_PROGRAM_HEADER_TYPE *) (ehdr + 1);
+    /* CFA = xsp+ptrsz; advance 1; CFA = xsp+16; advance 4; CFA = other reg */
+    static const byte cfi1[] = {
+        DW_CFA_advance_loc | 1, DW_CFA_def_cfa_offset, 16,
+        DW_CFA_advance_loc | 4, DW_CFA_def_cfa_register, TEST_REG_OTHER,
+    };
+    /* advance 2; CFA = an expression, which we don't support */
+    static const byte cfi2[] = {
+        DW_CFA_advance_loc | 2, DW_CFA_def_cfa_expression, 1, 0x96/*DW_OP_nop*/,
+    };
+    /* advance 1; CFA = xsp+24; an invalid opcode, failing the whole FDE */
+    static const byte cfi3[] = {
+        DW_CFA_advance_loc | 1, DW_CFA_def_cfa_offset, 24, 0x3f,
+    };
+    byte *hdr = mod + TEST_HDR_OFFS, *cie, *pc;
+    uint i;
+
+    memset(mod, 0, TEST_MOD_SIZE);
+    memcpy(ehdr->e_ident, ELFMAG, SELFMAG);
+    ehdr->e_phoff = sizeof(*ehdr);
+    ehdr->e_phentsize = sizeof(*phdr);
+    ehdr->e_phnum = 2;
+    phdr[0].p_type = PT_LOAD;
+    phdr[0].p_vaddr = 0;
+    phdr[1].p_type = PT_GNU_EH_FRAME;
+    phdr[1].p_vaddr = TEST_HDR_OFFS;
+
+    pc = mod + TEST_EH_OFFS;
+    cie = pc;
+    pc = test_emit_cie(pc);
+    fdes[0] = pc;
+    pc = test_emit_fde(pc, mod, cie, TEST_FDE1_START, TEST_FDE1_SIZE,
+                       cfi1, sizeof(cfi1));
+    fdes[1] = pc;
+    pc = test_emit_fde(pc, mod, cie, TEST_FDE2_START, TEST_FDE_SIZE,
+                       cfi2, sizeof(cfi2));
+    fdes[2] = pc;
+    pc = test_emit_fde(pc, mod, cie, TEST_FDE3_START, TEST_FDE_SIZE,
+                       cfi3, sizeof(cfi3));
+    fdes[3] = pc;
+    pc = test_emit_fde(pc, mod, cie, TEST_FDE4_START, TEST_FDE_SIZE, NULL, 0);
+    pc = test_emit_u32(pc, 0); /* terminator */
+    ASSERT(pc < mod + TEST_FDE1_START, "test eh_frame too large");
+
+    pc = hdr;
+    pc = test_emit_u8(pc, 1); /* version */
+    pc = test_emit_u8(pc, DW_EH_PE_pcrel | DW_EH_PE_sdata4);
+    pc = test_emit_u8(pc, DW_EH_PE_udata4);
+    pc = test_emit_u8(pc, DW_EH_PE_datarel | DW_EH_PE_sdata4);
+    pc = test_emit_u32(pc, (uint)(mod + TEST_EH_OFFS - pc));
+    pc = test_emit_u32(pc, TEST_NUM_FDES);
+    for (i = 0; i < TEST_NUM_FDES; i++) {
+        pc = test_emit_u32(pc, (uint)(mod + test_fde_start[i] - hdr));
+        pc = test_emit_u32(pc, (uint)(fdes[i] - hdr));
+    }
+}
+
+/* The CFA offset from xsp that the synthetic module has at offs, or -1.
+ * Bit i of failed is set if FDE i failed to parse.
+ */
+static int
+test_expected_sp_offs(size_t offs, uint failed)
+{
+    uint i;
+    for (i = 0; i < TEST_NUM_FDES; i++) {
+        if (TEST(1 << i, failed) && offs >= test_fde_start[i] &&
+            offs < test_fde_start[i] + test_fde_size[i])
+            return -1;
+    }
+    if (offs == TEST_FDE1_START)
+        return sizeof(app_pc);
+    if (offs > TEST_FDE1_START && offs < TEST_FDE1_START + 5)
+        return 16;
+    /* the rest of FDE1 uses another register, and FDE2 an expression */
+    if (offs >= TEST_FDE2_START && offs < TEST_FDE2_START + 2)
+        return sizeof(app_pc);
+    if (offs >= TEST_FDE4_START && offs < TEST_FDE4_START + TEST_FDE_SIZE)
+        return sizeof(app_pc);
+    return -1;
+}
+
+/* Parses mod's .eh_frame_hdr, with reads bounded to [mod, end) */
+static eh_frame_table_t *
+test_parse(byte *mod, byte *end, bool *ok OUT)
+{
+    eh_frame_table_t *table = (eh_frame_table_t *)
+        global_alloc(sizeof(*table), HEAPSTAT_CALLSTACK);
+    eh_reader_t rd;
+    memset(table, 0, sizeof(*table));
+    rd.start = mod;
+    rd.end = end;
+    rd.mod_start = mod;
+    *ok = parse_eh_frame_hdr(&rd, table, mod + TEST_HDR_OFFS);
+    return table;
+}
+
+/* Checks the CFA lookup at every offset, given which FDEs failed */
+static void
+test_lookups(eh_frame_table_t *table, uint failed)
+{
+    byte *sp = (byte *) PAGE_SIZE, *cfa;
+    size_t offs;
+    for (offs = 0; offs < TEST_MOD_SIZE; offs++) {
+        int expect = test_expected_sp_offs(offs, failed);
+        bool found = eh_frame_table_cfa(table, offs, sp, &cfa);
+        EXPECT(found == (expect != -1));
+        EXPECT(!found || cfa == sp + expect);
+    }
+}
+
+void
+test_eh_frame(void)
+{
+    byte *mod = (byte *) test_mod_buf;
+    byte *fdes[TEST_NUM_FDES];
+    module_data_t info;
+    eh_frame_table_t *table;
+    bool ok;
+    uint saved;
+
+    test_build_module(mod, fdes);
+    memset(&info, 0, sizeof(info));
+    info.start = mod;
+    info.end = mod + TEST_MOD_SIZE;
+    EXPECT(find_eh_frame_hdr(&info) == mod + TEST_HDR_OFFS);
+
+    /* Round trip: each FDE's rules come back, merged into as few rows as
+     * possible, with unsupported rules and the failed FDE as unknown rows.
+     */
+    table = test_parse(mod, mod + TEST_MOD_SIZE, &ok);
+    EXPECT(ok);
+    EXPECT(table->num_rows == 7);
+    test_lookups(table, TEST_FAILED_NONE);
+    eh_frame_table_destroy(table);
+
+    /* A truncated .eh_frame_hdr fails outright */
+    table = test_parse(mod, mod + TEST_HDR_OFFS + 16, &ok);
+    EXPECT(!ok);
+    eh_frame_table_destroy(table);
+
+    /* A truncated .eh_frame fails each FDE, leaving just unknown rows */
+    table = test_parse(mod, fdes[0] + 10, &ok);
+    EXPECT(ok);
+    test_lookups(table, TEST_FAILED_ALL);
+    eh_frame_table_destroy(table);
+
+    /* So does a corrupt CIE */
+    mod[TEST_EH_OFFS + sizeof(uint)] = 1; /* CIE id */
+    table = test_parse(mod, mod + TEST_MOD_SIZE, &ok);
+    EXPECT(ok);
+    test_lookups(table, TEST_FAILED_ALL);
+    eh_frame_table_destroy(table);
+    mod[TEST_EH_OFFS + sizeof(uint)] = 0;
+
+    /* An FDE whose length runs off the end fails just that FDE */
+    memcpy(&saved, fdes[1], sizeof(saved));
+    test_emit_u32(fdes[1], TEST_MOD_SIZE);
+    table = test_parse(mod, mod + TEST_MOD_SIZE, &ok);
+    EXPECT(ok);
+    test_lookups(table, TEST_FAILED_NONE | 0x2);
+    eh_frame_table_destroy(table);
+    memcpy(fdes[1], &saved, sizeof(saved));
+
+    /* An unknown .eh_frame_hdr version fails outright */
+    mod[TEST_HDR_OFFS] = 2;
+    table = test_parse(mod, mod + TEST_MOD_SIZE, &ok);
+    EXPECT(!ok);
+    eh_frame_table_destroy(table);
+    mod[TEST_HDR_OFFS] = 1;
+
+    /* Bad ELF headers are rejected before we look for unwind info */
+    ((ELF_HEADER_TYPE *) mod)->e_phnum = TEST_MOD_SIZE;
+    EXPECT(find_eh_frame_hdr(&info) == NULL);
+    ((ELF_HEADER_TYPE *) mod)->e_phnum = 2;
+    mod[0] = 0;
+    EXPECT(find_eh_frame_hdr(&info) == NULL);
+}
+
+#endif /* BUILD_UNIT_TESTS */
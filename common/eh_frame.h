@@ -0,0 +1,67 @@
+/* **********************************************************
+ * Copyright (c) 2014 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/* Dr. Memory: the memory debugger
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/***************************************************************************
+ * eh_frame.h: ELF .eh_frame call frame information for callstack walking
+ */
+
+#ifndef _EH_FRAME_H_
+#define _EH_FRAME_H_ 1
+
+#include "dr_api.h"
+
+/* We pre-parse the call frame information (CFI) of a module into a compact
+ * array of rows sorted by module offset, each giving the canonical frame
+ * address (CFA) rule in effect from that offset on.  We only keep the rules
+ * that a stack-pointer-relative walk can use: everything else is stored as
+ * "unknown" and the caller falls back to its heuristics.
+ */
+
+/* opaque struct */
+struct _eh_frame_table_t;
+typedef struct _eh_frame_table_t eh_frame_table_t;
+
+/* Parses the in-memory .eh_frame of the fully-loaded module described by
+ * info, located via its PT_GNU_EH_FRAME segment.  Offsets in the resulting
+ * table are relative to info->start.  Returns NULL if the module has no
+ * usable unwind information.
+ */
+eh_frame_table_t *
+eh_frame_table_create(const module_data_t *info);
+
+void
+eh_frame_table_destroy(eh_frame_table_t *table);
+
+/* Computes the CFA of the frame executing at module offset modoffs, given the
+ * stack pointer value at that point.  For a return address, pass the offset
+ * of the return address minus one, so that a call at the end of a function
+ * is attributed to that function.  Returns false if there is no
+ * stack-pointer-relative rule for modoffs.
+ */
+bool
+eh_frame_table_cfa(eh_frame_table_t *table, size_t modoffs, byte *sp, byte **cfa OUT);
+
+#ifdef BUILD_UNIT_TESTS
+void
+test_eh_frame(void);
+#endif
+
+#endif /* _EH_FRAME_H_ */
@@ -760,7 +760,8 @@ heap_region_init(void (*region_add_cb)(app_pc, app_pc, dr_mcontext_t *mc),
     heap_lock = dr_mutex_create();
     cb_add = region_add_cb;
     cb_remove = region_remove_cb;
-    heap_tree = rb_tree_create(heap_info_delete);
+    /* looked up on every heap-region query but rarely changed */
+    heap_tree = rb_tree_create_ex(heap_info_delete, RB_TREE_BTREE);
 #ifdef WINDOWS
     heap_walk_init();
 #endif
@@ -779,18 +780,22 @@ void
 heap_region_add(app_pc start, app_pc end, uint flags, dr_mcontext_t *mc)
 {
     heap_info_t *info = (heap_info_t *) global_alloc(sizeof(*info), HEAPSTAT_RBTREE);
-    IF_DEBUG(rb_node_t *existing;)
+    rb_node_t *existing;
     dr_mutex_lock(heap_lock);
     LOG(2, "adding heap region "PFX"-"PFX" %s\n", start, end,
         TEST(HEAP_ARENA, flags) ? "arena" : "chunk");
-    STATS_INC(heap_regions);
-    if (cb_add != NULL)
-        cb_add(start, end, mc);
     info->flags = flags;
     IF_WINDOWS(info->heap = INVALID_HANDLE_VALUE;)
-    IF_DEBUG(existing =)
-        rb_insert(heap_tree, start, (end - start), (void *) info);
-    ASSERT(existing == NULL, "new heap region overlaps w/ existing");
+    existing = rb_insert(heap_tree, start, (end - start), (void *) info);
+    if (existing != NULL) {
+        /* The tree was not changed: keep the existing region */
+        ASSERT(false, "new heap region overlaps w/ existing");
+        global_free(info, sizeof(*info), HEAPSTAT_RBTREE);
+    } else {
+        STATS_INC(heap_regions);
+        if (cb_add != NULL)
+            cb_add(start, end, mc);
+    }
     dr_mutex_unlock(heap_lock);
 }
 
@@ -23,31 +23,42 @@
 /* Red-black tree implementation to store allocated regions and their
  * size.  Algorithm taken from the description in "Intro to
  * Algorithms" by CLR.
+ *
+ * A tree created with RB_TREE_BTREE instead hands every operation to
+ * btree.c, which stores the rb_node_t for each region as its value.
  */
 
 #include "redblack.h"
+#include "btree.h"
 #include "utils.h"
 #include "drmgr.h"
+#include <stddef.h> /* for offsetof */
 
 typedef enum { RED, BLACK } rb_color;
 
 struct _rb_node_t {
+    /* the node key is the base */
+    byte *base;
+    size_t size;
+    /* custom data field */
+    void *client;
+    /* The B-tree backend allocates only the fields above (RB_ENTRY_SIZE)
+     * for each region, so rb_node_fields() and rb_node_set_client() work
+     * the same for both.  The rest are only used by the red-black tree.
+     */
     rb_node_t *parent;
     rb_node_t *right;
     rb_node_t *left;
     rb_color color;
-    /* the node key is the base */
-    byte *base;
-    size_t size;
     /* for efficiently finding nearest neighbors: max base+size of childen.
      * if our data sets weren't disjoint we would also need this for normal
      * lookups.
      */
     byte *max;
-    /* custom data field */
-    void *client;
 };
 
+#define RB_ENTRY_SIZE offsetof(rb_node_t, parent)
+
 /* Data structure to wrap around the root node, to store global info
  * such as callback routines.
  */
@@ -62,6 +73,8 @@ struct _rb_tree_t {
      */
     rb_node_t NIL_node;
     void (*free_payload_func)(void*);
+    /* non-NULL for RB_TREE_BTREE, in which case the fields above are unused */
+    btree_t *btree;
 };
 
 #define NIL(tree) (&(tree)->NIL_node)
@@ -125,6 +138,28 @@ rb_free_node(rb_tree_t *tree, rb_node_t *node, bool free_payload)
     global_free(node, sizeof(rb_node_t), HEAPSTAT_RBTREE);
 }
 
+/* Allocate a node for the B-tree backend, which uses only the first fields */
+static rb_node_t *
+rb_new_entry(byte *base, size_t size, void *client)
+{
+    rb_node_t *node = (rb_node_t *) global_alloc(RB_ENTRY_SIZE, HEAPSTAT_RBTREE);
+    node->base = base;
+    node->size = size;
+    node->client = client;
+    return node;
+}
+
+/* Called by btree.c whenever it is done with one of our nodes */
+static void
+rb_free_entry(void *value, void *data)
+{
+    rb_tree_t *tree = (rb_tree_t *) data;
+    rb_node_t *node = (rb_node_t *) value;
+    if (tree->free_payload_func != NULL)
+        (tree->free_payload_func)(node->client);
+    global_free(node, RB_ENTRY_SIZE, HEAPSTAT_RBTREE);
+}
+
 
 static void
 rb_clear_helper(rb_tree_t *tree, rb_node_t *node)
@@ -140,6 +175,10 @@ rb_clear_helper(rb_tree_t *tree, rb_node_t *node)
 void
 rb_clear(rb_tree_t *tree)
 {
+    if (tree->btree != NULL) {
+        btree_clear(tree->btree);
+        return;
+    }
     rb_clear_helper(tree, tree->root);
     tree->root = NIL(tree);
 }
@@ -153,6 +192,8 @@ rb_find(rb_tree_t *tree, byte *base)
 {
     rb_node_t *iter = tree->root;
 
+    if (tree->btree != NULL)
+        return (rb_node_t *) btree_find(tree->btree, base);
     while (iter != NIL(tree)) {
         if (base == iter->base) {
             return iter;
@@ -194,11 +235,36 @@ get_next_helper(rb_tree_t *tree, void *client, rb_node_t *curr)
     return NIL(tree);
 }
 
+typedef struct _find_client_data_t {
+    void *client;
+    rb_node_t *found;
+} find_client_data_t;
+
+static bool
+find_client_btree_cb(byte *base, byte *end, void *value, void *iter_data)
+{
+    find_client_data_t *data = (find_client_data_t *) iter_data;
+    rb_node_t *node = (rb_node_t *) value;
+    if (node->client == data->client) {
+        data->found = node;
+        return false;
+    }
+    return true;
+}
+
 /* Find the first node with client field == 'client' */
 rb_node_t *
 rb_find_client_node(rb_tree_t *tree, void *client)
 {
-    rb_node_t *node = get_next_helper(tree, client, tree->root);
+    rb_node_t *node;
+    if (tree->btree != NULL) {
+        find_client_data_t data;
+        data.client = client;
+        data.found = NULL;
+        btree_iterate(tree->btree, find_client_btree_cb, &data);
+        return data.found;
+    }
+    node = get_next_helper(tree, client, tree->root);
     if (node == NIL(tree)) {
         return NULL;
     }
@@ -359,6 +425,12 @@ rb_delete(rb_tree_t *tree, rb_node_t *z)
 {
     rb_node_t *y, *x;
     void *client_tmp;
+    if (tree->btree != NULL) {
+        IF_DEBUG(bool found =)
+            btree_remove(tree->btree, z->base);
+        ASSERT(found, "node not in tree");
+        return;
+    }
     ASSERT(z != NIL(tree), "don't change NIL(tree)");
 
     if (z->left == NIL(tree) || z->right == NIL(tree)) {
@@ -506,8 +578,16 @@ rb_insert_helper(rb_tree_t *tree, rb_node_t *x)
 rb_node_t *
 rb_insert(rb_tree_t *tree, byte *base, size_t size, void *client)
 {
-    rb_node_t *node = rb_new_node(tree, base, size, client);
-    rb_node_t *existing = rb_insert_helper(tree, node);
+    rb_node_t *node, *existing;
+    if (tree->btree != NULL) {
+        node = rb_new_entry(base, size, client);
+        existing = (rb_node_t *) btree_insert(tree->btree, base, base + size, node);
+        if (existing != NULL)
+            global_free(node, RB_ENTRY_SIZE, HEAPSTAT_RBTREE);
+        return existing;
+    }
+    node = rb_new_node(tree, base, size, client);
+    existing = rb_insert_helper(tree, node);
     if (existing != NULL)
         rb_free_node(tree, node, false/*do not free payload*/);
     return existing;
@@ -519,6 +599,9 @@ rb_in_node(rb_tree_t *tree, byte *addr)
 {
     rb_node_t *iter = tree->root;
 
+    if (tree->btree != NULL)
+        return (rb_node_t *) btree_in_range(tree->btree, addr);
+
     while (iter != NIL(tree)) {
         byte *base = iter->base;
         byte *last = base + iter->size;
@@ -545,6 +628,9 @@ rb_overlaps_node(rb_tree_t *tree, byte *start, byte *end)
 {
     rb_node_t *iter = tree->root;
 
+    if (tree->btree != NULL)
+        return (rb_node_t *) btree_overlaps(tree->btree, start, end);
+
     while (iter != NIL(tree)) {
         byte *base = iter->base;
         byte *last = base + iter->size;
@@ -569,6 +655,8 @@ rb_node_t *
 rb_next_higher_node(rb_tree_t *tree, byte *addr)
 {
     rb_node_t *iter = tree->root;
+    if (tree->btree != NULL)
+        return (rb_node_t *) btree_next_higher(tree->btree, addr);
     while (iter != NIL(tree)) {
         if (addr >= iter->left->max && addr < iter->base + iter->size) {
             return iter;
@@ -592,6 +680,8 @@ rb_node_t *
 rb_next_lower_node(rb_tree_t *tree, byte *addr)
 {
     rb_node_t *iter = tree->root;
+    if (tree->btree != NULL)
+        return (rb_node_t *) btree_next_lower(tree->btree, addr);
     while (iter != NIL(tree)) {
         if (addr >= iter->base && (iter->right == NIL(tree) || addr < iter->right->base)) {
             return iter;
@@ -607,33 +697,43 @@ rb_next_lower_node(rb_tree_t *tree, byte *addr)
     return NULL;
 }
 
-/* Returns node with highest base+size */
+/* Returns node with highest base+size, or NULL if the tree is empty */
 rb_node_t *
 rb_max_node(rb_tree_t *tree)
 {
     rb_node_t *iter = tree->root;
-    if (iter != NIL(tree)) {
-        while (iter->right != NIL(tree))
-            iter = iter->right;
-    }
+    if (tree->btree != NULL)
+        return (rb_node_t *) btree_max(tree->btree);
+    if (iter == NIL(tree))
+        return NULL;
+    while (iter->right != NIL(tree))
+        iter = iter->right;
     return iter;
 }
 
-/* Returns node with lowest base */
+/* Returns node with lowest base, or NULL if the tree is empty */
 rb_node_t *
 rb_min_node(rb_tree_t *tree)
 {
     rb_node_t *iter = tree->root;
-    if (iter != NIL(tree)) {
-        while (iter->left != NIL(tree))
-            iter = iter->left;
-    }
+    if (tree->btree != NULL)
+        return (rb_node_t *) btree_min(tree->btree);
+    if (iter == NIL(tree))
+        return NULL;
+    while (iter->left != NIL(tree))
+        iter = iter->left;
     return iter;
 }
 
 
 rb_tree_t *
 rb_tree_create(void (*free_payload_func)(void*))
+{
+    return rb_tree_create_ex(free_payload_func, 0);
+}
+
+rb_tree_t *
+rb_tree_create_ex(void (*free_payload_func)(void*), uint flags)
 {
     rb_tree_t *tree = global_alloc(sizeof(*tree), HEAPSTAT_RBTREE);
 
@@ -648,6 +748,12 @@ rb_tree_create(void (*free_payload_func)(void*))
 
     tree->root = NIL(tree);
     tree->free_payload_func = free_payload_func;
+    if (TESTANY(RB_TREE_BTREE | RB_TREE_READ_MOSTLY, flags)) {
+        tree->btree = btree_create(rb_free_entry, tree,
+                                   TEST(RB_TREE_READ_MOSTLY, flags) ?
+                                   BTREE_READ_MOSTLY : 0);
+    } else
+        tree->btree = NULL;
     return tree;
 }
 
@@ -655,10 +761,82 @@ void
 rb_tree_destroy(rb_tree_t *tree)
 {
     ASSERT(tree != NULL, "invalid params");
-    rb_clear(tree);
+    if (tree->btree != NULL)
+        btree_destroy(tree->btree);
+    else
+        rb_clear(tree);
     global_free(tree, sizeof(*tree), HEAPSTAT_RBTREE);
 }
 
+void
+rb_tree_reclaim(rb_tree_t *tree)
+{
+    ASSERT(tree != NULL, "invalid params");
+    if (tree->btree != NULL)
+        btree_reclaim(tree->btree);
+}
+
+/* We have no qsort in the client, and a heapsort needs no extra memory */
+static void
+bulk_sift_down(rb_bulk_entry_t *entries, uint start, uint count)
+{
+    uint root = start;
+    while (2 * root + 1 < count) {
+        uint child = 2 * root + 1;
+        rb_bulk_entry_t tmp;
+        if (child + 1 < count && entries[child].base < entries[child + 1].base)
+            child++;
+        if (entries[root].base >= entries[child].base)
+            return;
+        tmp = entries[root];
+        entries[root] = entries[child];
+        entries[child] = tmp;
+        root = child;
+    }
+}
+
+static void
+bulk_sort(rb_bulk_entry_t *entries, uint count)
+{
+    uint i;
+    if (count < 2)
+        return;
+    for (i = count / 2; i > 0; i--)
+        bulk_sift_down(entries, i - 1, count);
+    for (i = count - 1; i > 0; i--) {
+        rb_bulk_entry_t tmp = entries[0];
+        entries[0] = entries[i];
+        entries[i] = tmp;
+        bulk_sift_down(entries, 0, i);
+    }
+}
+
+static void
+bulk_get_entry(void *data, uint i, byte **base OUT, byte **end OUT, void **value OUT)
+{
+    rb_bulk_entry_t *entries = (rb_bulk_entry_t *) data;
+    *base = entries[i].base;
+    *end = entries[i].base + entries[i].size;
+    *value = rb_new_entry(entries[i].base, entries[i].size, entries[i].client);
+}
+
+void
+rb_bulk_load(rb_tree_t *tree, rb_bulk_entry_t *entries, uint count)
+{
+    uint i;
+    ASSERT(tree != NULL && (entries != NULL || count == 0), "invalid params");
+    bulk_sort(entries, count);
+    if (tree->btree != NULL) {
+        btree_bulk_load(tree->btree, count, bulk_get_entry, entries);
+        return;
+    }
+    for (i = 0; i < count; i++) {
+        IF_DEBUG(rb_node_t *node =)
+            rb_insert(tree, entries[i].base, entries[i].size, entries[i].client);
+        ASSERT(node == NULL, "bulk load entries should not overlap");
+    }
+}
+
 static bool
 iterate_helper(rb_tree_t *tree, rb_node_t *node,
                bool (*iter_cb)(rb_node_t *, void *), void *iter_data)
@@ -675,12 +853,29 @@ iterate_helper(rb_tree_t *tree, rb_node_t *node,
     return true;
 }
 
+typedef struct _iterate_btree_data_t {
+    bool (*iter_cb)(rb_node_t *, void *);
+    void *iter_data;
+} iterate_btree_data_t;
+
+static bool
+iterate_btree_cb(byte *base, byte *end, void *value, void *iter_data)
+{
+    iterate_btree_data_t *data = (iterate_btree_data_t *) iter_data;
+    return data->iter_cb((rb_node_t *) value, data->iter_data);
+}
+
 /* Performs an in-order traversal, calling iter_cb on each node. */
 void
 rb_iterate(rb_tree_t *tree, bool (*iter_cb)(rb_node_t *, void *), void *iter_data)
 {
     ASSERT(tree != NULL && iter_cb != NULL, "invalid params");
-    if (tree->root != NIL(tree))
+    if (tree->btree != NULL) {
+        iterate_btree_data_t data;
+        data.iter_cb = iter_cb;
+        data.iter_data = iter_data;
+        btree_iterate(tree->btree, iterate_btree_cb, &data);
+    } else if (tree->root != NIL(tree))
         iterate_helper(tree, tree->root, iter_cb, iter_data);
 }
 
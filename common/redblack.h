@@ -23,7 +23,8 @@
 #ifndef _REDBLACK_H_
 #define _REDBLACK_H_
 
-/* Interval tree for address ranges implemented as a red-black binary tree.
+/* Interval tree for address ranges implemented as a red-black binary tree,
+ * or as the B+ tree in btree.h if requested via rb_tree_create_ex().
  * Assumes that no intervals in the tree overlap and they are all
  * open at the upper end.
  */
@@ -39,7 +40,10 @@ typedef struct _rb_tree_t rb_tree_t;
 
 /* Synchronization is up to the caller.  A lock should be held from
  * the point of a call to any routine here to the last use of any
- * returned rb_node_t*.
+ * returned rb_node_t*.  The exception is a tree created with
+ * RB_TREE_READ_MOSTLY, where only modifications need the lock: lookups,
+ * rb_node_fields(), and rb_iterate() may run concurrently with them, and
+ * a returned rb_node_t* remains valid until the next rb_tree_reclaim().
  */
 
 /* Allocate a new, empy tree.  free_payload_func, if non-null, will be called
@@ -48,6 +52,22 @@ typedef struct _rb_tree_t rb_tree_t;
 rb_tree_t *
 rb_tree_create(void (*free_payload_func)(void*));
 
+/* Flags for rb_tree_create_ex() */
+enum {
+    /* Use a B+ tree with wide nodes rather than a red-black tree.  Lookups
+     * touch far fewer cache lines, at some cost in insertion and deletion.
+     */
+    RB_TREE_BTREE       = 0x01,
+    /* Implies RB_TREE_BTREE.  Modifications copy the nodes they change, so
+     * readers need no lock; see the synchronization comment above.
+     */
+    RB_TREE_READ_MOSTLY = 0x02,
+};
+
+/* Like rb_tree_create(), with flags from the enum above */
+rb_tree_t *
+rb_tree_create_ex(void (*free_payload_func)(void*), uint flags);
+
 /* Remove and free all nodes in the tree and free the tree itself */
 void
 rb_tree_destroy(rb_tree_t *tree);
@@ -98,11 +118,31 @@ rb_delete(rb_tree_t *tree, rb_node_t *node);
 void
 rb_clear(rb_tree_t *tree);
 
-/* Returns node with highest base+size */
+/* For RB_TREE_READ_MOSTLY: frees the nodes and payloads removed since the
+ * last call.  The caller must ensure that no reader is still using an
+ * rb_node_t* it obtained before the most recent modification.
+ */
+void
+rb_tree_reclaim(rb_tree_t *tree);
+
+typedef struct _rb_bulk_entry_t {
+    byte *base;
+    size_t size;
+    void *client;
+} rb_bulk_entry_t;
+
+/* Adds count nodes to an empty tree at once.  The entries need not be sorted
+ * (this routine sorts them in place) but must not overlap.  For a B+ tree
+ * this is much faster than inserting one at a time and packs the nodes full.
+ */
+void
+rb_bulk_load(rb_tree_t *tree, rb_bulk_entry_t *entries, uint count);
+
+/* Returns node with highest base+size, or NULL if the tree is empty */
 rb_node_t *
 rb_max_node(rb_tree_t *tree);
 
-/* Returns node with lowest base */
+/* Returns node with lowest base, or NULL if the tree is empty */
 rb_node_t *
 rb_min_node(rb_tree_t *tree);
 
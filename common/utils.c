@@ -995,7 +995,10 @@ syscall_get_param(void *drcontext, uint num)
  *
  */
 
-#ifdef STATISTICS
+/* The accounting costs an atomic add or two per allocation, so outside of
+ * STATISTICS builds it is off unless a client turns it on (for -memusage).
+ */
+
 /* We could have each client define this to avoid ifdefs in common/,
  * but the shared hashtable code needs a shared define, so going w/
  * ifdefs.
@@ -1011,25 +1014,55 @@ static const char * heapstat_names[] = {
     "hashtable",
     "gencode",
     "rbtree",
-    "suppress",
+    "report",
+    "leak",
     "wrap/replace",
     "misc",
 };
 
-static uint heap_usage[HEAPSTAT_NUMTYPES];  /* cur usage  */
-static uint heap_max[HEAPSTAT_NUMTYPES];    /* peak usage */
-static uint heap_count[HEAPSTAT_NUMTYPES];  /* # allocs   */
+/* 64-bit so large or long runs can't wrap them */
+static volatile uint64 heap_usage[HEAPSTAT_NUMTYPES]; /* cur usage  */
+static uint64 heap_max[HEAPSTAT_NUMTYPES];            /* peak usage */
+static uint heap_count[HEAPSTAT_NUMTYPES];            /* # allocs   */
+#ifdef STATISTICS
+static bool heap_stats_enabled = true;
+#else
+static bool heap_stats_enabled;
+#endif
+
+void
+heap_enable_stats(void)
+{
+    heap_stats_enabled = true;
+}
+
+/* Adds delta to *counter and returns the new value.  Stops at 0, as the
+ * free of an allocation made before heap_enable_stats() would otherwise
+ * take the counter below it.
+ */
+static uint64
+heap_counter_add(volatile uint64 *counter, int64 delta)
+{
+    uint64 cur, val;
+    do {
+        /* a torn read on 32-bit just fails the exchange */
+        cur = *counter;
+        if (delta < 0 && cur < (uint64)-delta)
+            val = 0;
+        else
+            val = cur + delta;
+    } while (ATOMIC_COMPARE_EXCHANGE64(counter, val, cur) != cur);
+    return val;
+}
 
 static void
 heap_usage_inc(heapstat_t type, size_t size)
 {
-    uint usage;
-    uint delta;
-    ASSERT_TRUNCATE(delta, uint, size);
-    delta = (uint)size;
-    ATOMIC_ADD32(heap_usage[type], delta);
+    uint64 usage;
+    if (!heap_stats_enabled)
+        return;
+    usage = heap_counter_add(&heap_usage[type], (int64)size);
     /* racy: if a problem in practice we can switch to per-thread stats */
-    usage = heap_usage[type];
     if (usage > heap_max[type])
         heap_max[type] = usage;
     ATOMIC_INC32(heap_count[type]);
@@ -1038,10 +1071,9 @@ heap_usage_inc(heapstat_t type, size_t size)
 static void
 heap_usage_dec(heapstat_t type, size_t size)
 {
-    int delta;
-    ASSERT_TRUNCATE(delta, int, size);
-    delta = (int)size;
-    ATOMIC_ADD32(heap_usage[type], -delta);
+    if (!heap_stats_enabled)
+        return;
+    heap_counter_add(&heap_usage[type], -(int64)size);
     ATOMIC_DEC32(heap_count[type]);
 }
 
@@ -1051,14 +1083,35 @@ heap_dump_stats(file_t f)
     int i;
     dr_fprintf(f, "\nHeap usage:\n");
     for (i = 0; i < HEAPSTAT_NUMTYPES; i++) {
-        dr_fprintf(f, "\t%12s: count=%8u, cur=%6u %s, max=%6u KB\n",
+        dr_fprintf(f, "\t%12s: count=%8u, cur=%6"UINT64_FORMAT_CODE" %s, "
+                   "max=%6"UINT64_FORMAT_CODE" KB\n",
                    heapstat_names[i], heap_count[i],
                    (heap_usage[i] > 8192) ? heap_usage[i]/1024 : heap_usage[i],
                    (heap_usage[i] > 8192) ? "KB" : " B",
                    heap_max[i]/1024);
     }
 }
-#endif /* STATISTICS */
+
+const char *
+heap_stat_name(heapstat_t type)
+{
+    ASSERT(type < HEAPSTAT_NUMTYPES, "invalid heapstat type");
+    return heapstat_names[type];
+}
+
+void
+heap_get_stats(heapstat_t type, size_t *cur OUT, size_t *max OUT,
+               uint *count OUT)
+{
+    ASSERT(type < HEAPSTAT_NUMTYPES, "invalid heapstat type");
+    /* racy, but this is only for reporting */
+    if (cur != NULL)
+        *cur = (size_t) heap_usage[type];
+    if (max != NULL)
+        *max = (size_t) heap_max[type];
+    if (count != NULL)
+        *count = heap_count[type];
+}
 
 #undef dr_global_alloc
 #undef dr_global_free
@@ -1070,9 +1123,7 @@ heap_dump_stats(file_t f)
 void *
 global_alloc(size_t size, heapstat_t type)
 {
-#ifdef STATISTICS
     heap_usage_inc(type, size);
-#endif
     /* Note that the recursive lock inside DR is a perf hit for
      * malloc-intensive apps: we're already holding the malloc_lock,
      * so could use own heap alloc, or add option to DR to not use
@@ -1084,45 +1135,35 @@ global_alloc(size_t size, heapstat_t type)
 void
 global_free(void *p, size_t size, heapstat_t type)
 {
-#ifdef STATISTICS
     heap_usage_dec(type, size);
-#endif
     dr_global_free(p, size);
 }
 
 void *
 thread_alloc(void *drcontext, size_t size, heapstat_t type)
 {
-#ifdef STATISTICS
     heap_usage_inc(type, size);
-#endif
     return dr_thread_alloc(drcontext, size);
 }
 
 void
 thread_free(void *drcontext, void *p, size_t size, heapstat_t type)
 {
-#ifdef STATISTICS
     heap_usage_dec(type, size);
-#endif
     dr_thread_free(drcontext, p, size);
 }
 
 void *
 nonheap_alloc(size_t size, uint prot, heapstat_t type)
 {
-#ifdef STATISTICS
     heap_usage_inc(type, size);
-#endif
     return dr_nonheap_alloc(size, prot);
 }
 
 void
 nonheap_free(void *p, size_t size, heapstat_t type)
 {
-#ifdef STATISTICS
     heap_usage_dec(type, size);
-#endif
     dr_nonheap_free(p, size);
 }
 
@@ -584,6 +584,10 @@ atomic_add32_return_sum(volatile int *x, int val)
                          : "1" (val) : "memory");
     return (cur + val);
 }
+
+/* Returns the prior value of *x.  gcc uses cmpxchg8b on 32-bit. */
+# define ATOMIC_COMPARE_EXCHANGE64(x, newval, expected) \
+    __sync_val_compare_and_swap((x), (expected), (newval))
 #else
 # define ATOMIC_INC32(x) _InterlockedIncrement((volatile LONG *)&(x))
 # define ATOMIC_DEC32(x) _InterlockedDecrement((volatile LONG *)&(x))
@@ -594,6 +598,10 @@ atomic_add32_return_sum(volatile int *x, int val)
 {
     return (ATOMIC_ADD32(*x, val) + val);
 }
+
+/* Returns the prior value of *x */
+# define ATOMIC_COMPARE_EXCHANGE64(x, newval, expected) \
+    _InterlockedCompareExchange64((volatile __int64 *)(x), (newval), (expected))
 #endif
 
 /* racy: should be used only for diagnostics */
@@ -794,6 +802,7 @@ typedef enum {
     HEAPSTAT_GENCODE,
     HEAPSTAT_RBTREE,
     HEAPSTAT_REPORT,
+    HEAPSTAT_LEAK,
     HEAPSTAT_WRAP,
     HEAPSTAT_MISC,
     /* when you add here, add to heapstat_names in utils.c */
@@ -819,9 +828,28 @@ nonheap_alloc(size_t size, uint prot, heapstat_t type);
 void
 nonheap_free(void *p, size_t size, heapstat_t type);
 
+/* Turns on the accounting of global_alloc() and friends, which is otherwise
+ * only done in STATISTICS builds.  Frees of allocations made before this is
+ * called are not matched by an increment: the counts stop at 0 rather than
+ * wrapping, but read low by the size of whatever was allocated earlier and
+ * is still live.
+ */
+void
+heap_enable_stats(void);
+
 void
 heap_dump_stats(file_t f);
 
+const char *
+heap_stat_name(heapstat_t type);
+
+/* Returns the current and peak bytes and the current number of allocations
+ * of the given type.  Any of the OUT params may be NULL.
+ */
+void
+heap_get_stats(heapstat_t type, size_t *cur OUT, size_t *max OUT,
+               uint *count OUT);
+
 #define dr_global_alloc DO_NOT_USE_use_global_alloc
 #define dr_global_free  DO_NOT_USE_use_global_free
 #define dr_thread_alloc DO_NOT_USE_use_thread_alloc
@@ -35,6 +35,7 @@
 #include "callstack.h"
 #include "crypto.h"
 #include "staleness.h"
+#include "snapshot_log.h"
 #include "../drmemory/leak.h"
 #include "../drmemory/stack.h"
 #include "../drmemory/shadow.h"
@@ -103,7 +104,7 @@ static int reachable_leak_count;
 static byte *shared_instrcnt_callout;
 static byte *shared_code_region;
 #define SHARED_CODE_SIZE \
-    (PAGE_SIZE + (options.staleness ? (SHARED_SLOWPATH_SIZE) : 0))
+    (PAGE_SIZE + (INSTRUMENT_STALENESS() ? (SHARED_SLOWPATH_SIZE) : 0))
 
 /* We serialize snapshots since rare so not costly perf-wise, and this avoids
  * needing potentially very large buffers to try and get atomic writes
@@ -296,12 +297,29 @@ struct _per_callstack_t {
     heap_used_t *used;
     /* for node removal w/o keeping a prev per heap_used_t per snapshot */
     heap_used_t *prev_used;
+    /* For -snapshot_delta: the usage last written to snapshot.bin.  Kept
+     * per callstack rather than per snapshot so the cost does not grow
+     * with the number of snapshots.
+     */
+    uint delta_instances;
+    uint delta_bytes_asked_for;
+    ushort delta_extra_usable;
+    ushort delta_extra_occupied;
+    uint delta_gen;
+    /* list of callstacks with non-zero usage in the last record written */
+    struct _per_callstack_t *delta_next;
 };
 
 static uint num_callstacks;
 static uint snapshot_count;
 static uint nudge_count;
 
+/* For -snapshot_delta */
+static per_callstack_t *delta_list;
+static uint delta_gen;
+/* Snapshots written since the last keyframe: 0 forces a keyframe */
+static uint delta_since_keyframe;
+
 uint
 get_cstack_id(per_callstack_t *per)
 {
@@ -389,6 +407,184 @@ unit_name(void)
     return "<error>";
 }
 
+/***************************************************************************
+ * -snapshot_delta: binary snapshot.bin (see snapshot_log.h)
+ */
+
+static void
+delta_write_header(void)
+{
+    snapshot_log_header_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, SNAPSHOT_LOG_MAGIC, sizeof(SNAPSHOT_LOG_MAGIC));
+    hdr.version = SNAPSHOT_LOG_VERSION;
+    dr_snprintf(hdr.unit_name, BUFFER_SIZE_ELEMENTS(hdr.unit_name), "%s", unit_name());
+    NULL_TERMINATE_BUFFER(hdr.unit_name);
+    dr_write_file(f_snapshot, &hdr, sizeof(hdr));
+    /* a reader starting at the top of a new file has no prior state */
+    delta_since_keyframe = 0;
+}
+
+static void
+delta_write_nudge(uint64 nudge_stamp)
+{
+    snapshot_rec_nudge_t rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.rec.type = SNAPSHOT_REC_NUDGE;
+    rec.rec.size = sizeof(rec);
+    rec.stamp = nudge_stamp;
+    dr_write_file(f_snapshot, &rec, sizeof(rec));
+    /* postprocess.pl starts reading at the position after a nudge */
+    delta_since_keyframe = 0;
+}
+
+static void
+delta_write_end(void)
+{
+    snapshot_rec_t rec;
+    rec.type = SNAPSHOT_REC_END;
+    rec.size = sizeof(rec);
+    dr_write_file(f_snapshot, &rec, sizeof(rec));
+}
+
+/* Appends val to buf in the BER compressed integer format of Perl's
+ * pack("w"): 7 bits per byte, most significant first, with the top bit
+ * set on all but the last byte.  Returns the number of bytes written.
+ */
+static size_t
+delta_encode_uint(byte *buf, uint val)
+{
+    byte tmp[5];
+    size_t len = 0, i;
+    do {
+        tmp[len++] = (byte)(val & 0x7f);
+        val >>= 7;
+    } while (val != 0);
+    for (i = 0; i < len; i++)
+        buf[i] = tmp[len - 1 - i] | (i < len - 1 ? 0x80 : 0);
+    return len;
+}
+
+/* Appends per's last-written usage to snaps_log_buf, flushing it first
+ * if it might not fit.
+ */
+static void
+delta_write_entry(per_callstack_t *per, size_t *sofar INOUT, size_t *written INOUT)
+{
+    byte *buf;
+    if (*sofar + SNAPSHOT_MAX_ENTRY_SIZE > SNAPSHOT_LOG_BUF_SIZE) {
+        dr_write_file(f_snapshot, snaps_log_buf, *sofar);
+        *written += *sofar;
+        *sofar = 0;
+    }
+    buf = (byte *) snaps_log_buf + *sofar;
+    buf += delta_encode_uint(buf, per->id);
+    buf += delta_encode_uint(buf, per->delta_instances);
+    buf += delta_encode_uint(buf, per->delta_bytes_asked_for);
+    buf += delta_encode_uint(buf, per->delta_extra_usable);
+    buf += delta_encode_uint(buf, per->delta_extra_occupied);
+    *sofar = buf - (byte *) snaps_log_buf;
+}
+
+/* Up to caller to synchronize.
+ * Writes the callstacks whose usage differs from what we last wrote, or
+ * all of them for a keyframe.  Like the text format, callstacks with no
+ * bytes are omitted.
+ */
+static void
+dump_snapshot_delta(per_snapshot_t *snap, int idx)
+{
+    snapshot_rec_snapshot_t rec;
+    heap_used_t *u;
+    per_callstack_t *per, *prev, *next;
+    size_t sofar = sizeof(rec), written = 0;
+    int64 rec_pos = dr_file_tell(f_snapshot);
+    bool keyframe = (delta_since_keyframe == 0);
+
+    memset(&rec, 0, sizeof(rec));
+    rec.rec.type = SNAPSHOT_REC_SNAPSHOT;
+    rec.number = snapshot_count;
+    rec.idx = idx;
+    rec.flags = keyframe ? SNAPSHOT_FLAG_KEYFRAME : 0;
+    rec.stamp = snap->stamp + stamp_offs;
+    rec.stamp_offs = stamp_offs;
+    rec.tot_mallocs = snap->tot_mallocs;
+    rec.tot_bytes_asked_for = snap->tot_bytes_asked_for;
+    rec.tot_bytes_usable = snap->tot_bytes_usable;
+    rec.tot_bytes_occupied = snap->tot_bytes_occupied;
+    /* we fill in the size and count at the end */
+    memcpy(snaps_log_buf, &rec, sizeof(rec));
+
+    delta_gen++;
+    for (u = snap->used; u != NULL; u = u->next) {
+        if (u->bytes_asked_for + u->extra_usable == 0)
+            continue;
+        per = u->callstack;
+        if (per->delta_bytes_asked_for + per->delta_extra_usable == 0) {
+            per->delta_next = delta_list;
+            delta_list = per;
+        }
+        per->delta_gen = delta_gen;
+        if (keyframe ||
+            per->delta_instances != u->instances ||
+            per->delta_bytes_asked_for != u->bytes_asked_for ||
+            per->delta_extra_usable != u->extra_usable ||
+            per->delta_extra_occupied != u->extra_occupied) {
+            per->delta_instances = u->instances;
+            per->delta_bytes_asked_for = u->bytes_asked_for;
+            per->delta_extra_usable = u->extra_usable;
+            per->delta_extra_occupied = u->extra_occupied;
+            delta_write_entry(per, &sofar, &written);
+            rec.num_entries++;
+        }
+    }
+    /* Now remove (and, unless a keyframe, write as all zeros) the callstacks
+     * that had usage in the prior record but not in this one.
+     */
+    prev = NULL;
+    for (per = delta_list; per != NULL; per = next) {
+        next = per->delta_next;
+        if (per->delta_gen == delta_gen) {
+            prev = per;
+            continue;
+        }
+        per->delta_instances = 0;
+        per->delta_bytes_asked_for = 0;
+        per->delta_extra_usable = 0;
+        per->delta_extra_occupied = 0;
+        if (!keyframe) {
+            delta_write_entry(per, &sofar, &written);
+            rec.num_entries++;
+        }
+        if (prev == NULL)
+            delta_list = next;
+        else
+            prev->delta_next = next;
+        per->delta_next = NULL;
+    }
+
+    rec.rec.size = (uint)(written + sofar);
+    if (written == 0) {
+        memcpy(snaps_log_buf, &rec, sizeof(rec));
+        dr_write_file(f_snapshot, snaps_log_buf, sofar);
+    } else {
+        /* the record did not fit in the buffer so we must go back */
+        dr_write_file(f_snapshot, snaps_log_buf, sofar);
+        if (rec_pos < 0 || !dr_file_seek(f_snapshot, rec_pos, DR_SEEK_SET)) {
+            ASSERT(false, "unable to seek in snapshot.bin");
+        } else {
+            dr_write_file(f_snapshot, &rec, sizeof(rec));
+            dr_file_seek(f_snapshot, 0, DR_SEEK_END);
+        }
+    }
+    LOG(2, "wrote %s of %u entries, %u bytes\n", keyframe ? "keyframe" : "delta",
+        rec.num_entries, rec.rec.size);
+
+    delta_since_keyframe++;
+    if (delta_since_keyframe >= options.snapshot_keyframe)
+        delta_since_keyframe = 0;
+}
+
 /* Up to caller to synchronize */
 static void
 dump_snapshot(per_snapshot_t *snap, int idx/*-1 means peak*/)
@@ -399,25 +595,29 @@ dump_snapshot(per_snapshot_t *snap, int idx/*-1 means peak*/)
 
     LOG(2, "dumping snapshot idx=%d count=%"INT64_FORMAT"u\n",
         idx, snap->stamp);
-    dr_fprintf(f_snapshot, "SNAPSHOT #%4d @ %16"INT64_FORMAT"u %s\n",
-               snapshot_count, snap->stamp + stamp_offs, unit_name());
-    dr_fprintf(f_snapshot, "idx=%d, stamp_offs=%16"INT64_FORMAT"u\n",
-               idx, stamp_offs);
-    dr_fprintf(f_snapshot, "total: %"INT64_FORMAT"u,%"INT64_FORMAT"u,%"
-               INT64_FORMAT"u,%"INT64_FORMAT"u\n",
-               snap->tot_mallocs, snap->tot_bytes_asked_for,
-               snap->tot_bytes_usable, snap->tot_bytes_occupied);
-
-    for (u = snap->used; u != NULL; u = u->next) {
-        if (u->bytes_asked_for + u->extra_usable > 0) {
-            /* PR 551841: buffer snapshot output else performance is bad. */
-            BUFFERED_WRITE(f_snapshot, snaps_log_buf, SNAPSHOT_LOG_BUF_SIZE,
-                           sofar, len, "%u,%u,%u,%u,%u\n",
-                           u->callstack->id, u->instances, u->bytes_asked_for,
-                           u->extra_usable, u->extra_occupied);
+    if (options.snapshot_delta)
+        dump_snapshot_delta(snap, idx);
+    else {
+        dr_fprintf(f_snapshot, "SNAPSHOT #%4d @ %16"INT64_FORMAT"u %s\n",
+                   snapshot_count, snap->stamp + stamp_offs, unit_name());
+        dr_fprintf(f_snapshot, "idx=%d, stamp_offs=%16"INT64_FORMAT"u\n",
+                   idx, stamp_offs);
+        dr_fprintf(f_snapshot, "total: %"INT64_FORMAT"u,%"INT64_FORMAT"u,%"
+                   INT64_FORMAT"u,%"INT64_FORMAT"u\n",
+                   snap->tot_mallocs, snap->tot_bytes_asked_for,
+                   snap->tot_bytes_usable, snap->tot_bytes_occupied);
+
+        for (u = snap->used; u != NULL; u = u->next) {
+            if (u->bytes_asked_for + u->extra_usable > 0) {
+                /* PR 551841: buffer snapshot output else performance is bad. */
+                BUFFERED_WRITE(f_snapshot, snaps_log_buf, SNAPSHOT_LOG_BUF_SIZE,
+                               sofar, len, "%u,%u,%u,%u,%u\n",
+                               u->callstack->id, u->instances, u->bytes_asked_for,
+                               u->extra_usable, u->extra_occupied);
+            }
         }
+        FLUSH_BUFFER(f_snapshot, snaps_log_buf, sofar);
     }
-    FLUSH_BUFFER(f_snapshot, snaps_log_buf, sofar);
 
     if (options.staleness) {
         uint i;
@@ -1221,7 +1421,7 @@ create_shared_code(void)
     pc = generate_shared_callout(drcontext, ilist, pc);
     ASSERT(pc - shared_code_region <= SHARED_CODE_SIZE, "shared code region too small");
 
-    if (options.staleness) {
+    if (INSTRUMENT_STALENESS()) {
         pc = generate_shared_slowpath(drcontext, ilist, pc);
         ASSERT(pc - shared_code_region <= SHARED_CODE_SIZE,
                "shared code region too small");
@@ -1338,7 +1538,7 @@ event_bb_analysis(void *drcontext, void *tag, instrlist_t *bb,
         }
     });
 #endif
-    if (options.staleness)
+    if (INSTRUMENT_STALENESS())
         fastpath_top_of_bb(drcontext, tag, bb, &ii->bi);
     return DR_EMIT_DEFAULT;
 }
@@ -1372,7 +1572,7 @@ event_bb_insert(void *drcontext, void *tag, instrlist_t *bb, instr_t *inst,
         }
     }
 
-    if (options.staleness) {
+    if (INSTRUMENT_STALENESS()) {
         /* We want to spill AFTER any clean call in case it changes mcontext */
         ii->bi.spill_after = instr_get_prev(inst);
 
@@ -1412,7 +1612,7 @@ event_bb_insert(void *drcontext, void *tag, instrlist_t *bb, instr_t *inst,
         ii->bi.added_instru = true;
     }
 
-    if (options.staleness)
+    if (INSTRUMENT_STALENESS())
         fastpath_pre_app_instr(drcontext, bb, inst, &ii->bi, &mi);
 
     return DR_EMIT_DEFAULT;
@@ -1423,7 +1623,7 @@ event_bb_instru2instru(void *drcontext, void *tag, instrlist_t *bb,
                        bool for_trace, bool translating, void *user_data)
 {
     instru_info_t *ii = (instru_info_t *) user_data;
-    if (options.staleness) {
+    if (INSTRUMENT_STALENESS()) {
         fastpath_bottom_of_bb(drcontext, tag, bb, &ii->bi, ii->bi.added_instru,
                               translating, false);
     }
@@ -1494,7 +1694,7 @@ static void
 client_heap_add(app_pc start, app_pc end, dr_mcontext_t *mc)
 {
     LOG(2, "%s "PFX"-"PFX"\n", __FUNCTION__, start, end);
-    if (options.staleness)
+    if (INSTRUMENT_STALENESS())
         shadow_create_shadow_memory(start, end, 0);
 }
 
@@ -1617,7 +1817,11 @@ create_global_logfile(void)
     LOGF(1, f_global, "global logfile fd=%d\n", f_global);
 
     f_callstack = open_logfile("callstack.log", false, -1);
-    f_snapshot = open_logfile("snapshot.log", false, -1);
+    if (options.snapshot_delta) {
+        f_snapshot = open_logfile("snapshot.bin", false, -1);
+        delta_write_header();
+    } else
+        f_snapshot = open_logfile("snapshot.log", false, -1);
     if (options.staleness)
         f_staleness = open_logfile("staleness.log", false, -1);
 
@@ -1840,6 +2044,8 @@ event_fork(void *drcontext)
         LOG(0, "ERROR: unable to copy parent callstack file\n");
     close_file(f_parent_callstack);
 
+    if (options.staleness)
+        staleness_fork();
     reset_to_time_zero(false/*start time over*/);
 }
 #endif
@@ -1996,7 +2202,10 @@ event_nudge(void *drcontext, uint64 argument)
     malloc_lock(); /* must be acquired before snapshot_lock */
     nudge_count++;
     snapshot_dump_all();
-    print_nudge_header(f_snapshot);
+    if (options.snapshot_delta)
+        delta_write_nudge(snaps[snap_idx].stamp);
+    else
+        print_nudge_header(f_snapshot);
     print_nudge_header(f_callstack);
     if (options.dump) {
         /* For const # snapshots, we want the peak to be the global peak for the
@@ -2046,7 +2255,9 @@ event_module_unload(void *drcontext, const module_data_t *info)
 static void
 event_fragment_delete(void *drcontext, void *tag)
 {
-    instrument_fragment_delete(drcontext, tag);
+    /* bb_table only exists if instrument_init() was called */
+    if (options.check_leaks || INSTRUMENT_STALENESS())
+        instrument_fragment_delete(drcontext, tag);
     alloc_fragment_delete(drcontext, tag);
 }
 
@@ -2077,9 +2288,9 @@ event_thread_init(void *drcontext)
 
     LOGPT(2, PT_GET(drcontext), "in event_thread_init()\n");
     callstack_thread_init(drcontext);
-    if (options.check_leaks || options.staleness)
+    if (options.check_leaks || INSTRUMENT_STALENESS())
         shadow_thread_init(drcontext);
-    if (options.staleness)
+    if (INSTRUMENT_STALENESS())
         instrument_thread_init(drcontext);
 }
 
@@ -2089,8 +2300,8 @@ event_thread_exit(void *drcontext)
     tls_heapstat_t *pt = (tls_heapstat_t *)
         drmgr_get_tls_field(drcontext, tls_idx_heapstat);
     LOGPT(2, PT_GET(drcontext), "in event_thread_exit()\n");
-    if (options.staleness)
-        instrument_thread_init(drcontext);
+    if (INSTRUMENT_STALENESS())
+        instrument_thread_exit(drcontext);
     callstack_thread_exit(drcontext);
     utils_thread_exit(drcontext);
     thread_free(drcontext, (void *) pt->errbuf, pt->errbufsz, HEAPSTAT_MISC);
@@ -2128,8 +2339,10 @@ event_exit(void)
         leak_exit();
     }
 
-    if (options.staleness)
+    if (options.staleness) {
         malloc_iterate(alloc_itercb_exit, NULL);
+        staleness_exit();
+    }
 
     alloc_exit(); /* must be before deleting alloc_stack_table */
     heap_region_exit(); /* must be after alloc_exit */
@@ -2140,7 +2353,7 @@ event_exit(void)
     hashtable_delete(&alloc_md5_table);
 #endif
     callstack_exit();
-    if (options.check_leaks || options.staleness) {
+    if (options.check_leaks || INSTRUMENT_STALENESS()) {
         instrument_exit();
         shadow_exit();
     }
@@ -2168,7 +2381,10 @@ event_exit(void)
     close_file(f_global);
     dr_fprintf(f_callstack, "LOG END\n");
     close_file(f_callstack);
-    dr_fprintf(f_snapshot, "LOG END\n");
+    if (options.snapshot_delta)
+        delta_write_end();
+    else
+        dr_fprintf(f_snapshot, "LOG END\n");
     close_file(f_snapshot);
     if (options.staleness) {
         dr_fprintf(f_staleness, "LOG END\n");
@@ -2287,13 +2503,19 @@ dr_init(client_id_t client_id)
     callstack_ops.bad_fp_list = options.callstack_bad_fp_list;
     callstack_init(&callstack_ops);
 
+    /* must be before heap_region_init() and create_shared_code() */
+    staleness_init();
+
     heap_region_init(client_heap_add, client_heap_remove);
     /* We keep callstacks around forever and only free when we delete
      * the alloc_stack_table, so no refcounts
      */
 
-    /* must be before heap_walk() and alloc_init() */
-    if (options.check_leaks || options.staleness)
+    /* must be before heap_walk() and alloc_init().
+     * -stale_pages needs no shadow memory: staleness_init() has already
+     * decided whether it stays on.
+     */
+    if (options.check_leaks || INSTRUMENT_STALENESS())
         shadow_init();
 
     hashtable_init_ex(&alloc_stack_table, ASTACK_TABLE_HASH_BITS, HASH_CUSTOM,
@@ -2335,7 +2557,7 @@ dr_init(client_id_t client_id)
     /* must be after heap_region_init and snapshot_init */
     heap_walk();
 
-    if (options.check_leaks || options.staleness)
+    if (options.check_leaks || INSTRUMENT_STALENESS())
         instrument_init();
 
     create_shared_code();
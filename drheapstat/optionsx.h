@@ -119,6 +119,12 @@ OPTION_CLIENT_BOOL(client, dump, false,
 OPTION_CLIENT(client, dump_freq, uint, 1, 0, UINT_MAX,
               "Frequency at which to take snapshots for -dump",
               "If explicitly set to a non-zero value, enables -dump and indicates the frequency at which data will be written to the log files.  For -time_instrs, the frequency is -dump_freq*1000 instructions.  For -time_clock, the frequency is -dump_freq*10 milliseconds.  For -time_allocs, the frequency is -dump_freq instances of allocations and deallocations.  For -time_bytes, the frequency is -dump_freq bytes of allocations and deallocations.  For all cases the exact point of each snapshot may vary slightly from the precise -dump_freq specified.")
+OPTION_CLIENT_BOOL(client, snapshot_delta, false,
+                   "Write snapshots as binary deltas",
+                   "Write snapshots to snapshot.bin in a compact binary format that records, for each snapshot, only the callstacks whose usage changed since the previous snapshot, rather than to snapshot.log as text.  This greatly reduces the log size of long runs, particularly with -dump.")
+OPTION_CLIENT(client, snapshot_keyframe, uint, 64, 1, UINT_MAX,
+              "Frequency of full snapshots for -snapshot_delta",
+              "For -snapshot_delta, every -snapshot_keyframe-th snapshot is written in full rather than as a delta.  Viewing a snapshot requires reading every snapshot since the prior full one, so lower values speed up the visualization at the cost of a larger log.")
 OPTION_CLIENT(client, peak_threshold, uint, 5, 0, 99,
               "Accuracy of peak snapshot, in percentage from the true peak.",
               "A new peak snapshot will only be taken if it is more than this percentage different from the existing peak snapshot in any of total size, number of allocations and frees, and timestamp.  Lowering this number can reduce performance but will also increase accuracy.")
@@ -129,6 +135,12 @@ OPTION_CLIENT_BOOL(client, staleness, true,
 OPTION_CLIENT(client, stale_granularity, uint, 1000, 0, UINT_MAX,
               "Granularity of staleness, in milliseconds",
               "The granularity with which staleness is measured, in milliseconds.")
+OPTION_CLIENT(client, stale_sweep_threads, uint, 2, 0, 16,
+              "Number of extra threads for each staleness sweep",
+              "Each periodic staleness sweep first records the bounds of every live allocation, which briefly holds the heap lock, and then checks and clears each allocation's shadow metadata without holding any lock.  The second part is split among this many extra threads in addition to the thread that runs the sweep.  0 has the sweeping thread do it all.  Has no effect with -stale_pages.")
+OPTION_CLIENT_BOOL(client, stale_pages, false,
+                   "Track staleness via page dirty bits instead of instrumentation",
+                   "Rather than instrumenting every memory reference, find out which pages were written to since the prior sweep from the kernel's soft-dirty page bits (Linux 3.11 and later), and consider every allocation on such a page to have been accessed.  This removes nearly all of the overhead of -staleness, but the data is coarser: reads are not noticed, and a write to any part of a page, including the heap's own bookkeeping, counts as an access to every allocation on it.  Currently Linux-only: if soft-dirty bits are unavailable a warning is printed and this option is disabled.")
 OPTION_CLIENT_BOOL(client, stale_ignore_sp, true,
                    "Ignore memory references off the stack",
                    "Do not track staleness of memory references that use only the stack pointer.  If your application allocates stacks in the heap, or uses the stack pointer register for purposes other than to point at the stack, then you should disable this option.  Disabling this option will decrease the performance of the Dr. Heapstat.")
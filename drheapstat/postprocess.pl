@@ -51,6 +51,7 @@ $SIG{__DIE__} = sub {
 };
 
 my $xaxis_label = "";   # can be one of: allocs, ticks, bytes or mallocs
+my $xaxis_unit = "";    # full unit name from snapshot.bin
 my $fsize_idx = 7;  # index number for file size in the array returned by stat
 my $use_vmtree = 0;
 my $group_by_files = 0; # PR 584617
@@ -64,6 +65,8 @@ my @staleness_idx = ();
 my @cstack_idx = ();
 my $vistool = "$RealBin/drheapstat.swf";
 my $visualize = 0;
+# Prints every snapshot as text instead of serving the vistool, for testing.
+my $text = 0;
 my $from_nudge = -1;    # Which nudge to start reading data from.  PR 502468.
 my $to_nudge = -1;      # Up to which nudge.
 # Specifies which nudge to view - used only for constant number of snapshots;
@@ -126,11 +129,10 @@ if ($is_vmk || $vs_vmk) {
     $use_vmtree = &vmk_expect_vmtree();
 }
 
-init_flash();   # Init flash before doing any work.
-
 if (!GetOptions("x=s" => \$exename,
                 "profdir=s" => \$logdir,
                 "v" => \$verbose,
+                "text" => \$text,
                 "from_nudge=i" => \$from_nudge,
                 "to_nudge=i" => \$to_nudge,
                 "view_nudge=i" => \$view_nudge,
@@ -147,10 +149,26 @@ die "can't find executable: $exename\n" if (! -e $exename);
 
 die "Visualization won't work on ESXi, use Linux or Windows.\n" if ($is_vmk);
 
+init_flash() if (!$text);   # Init flash before doing any work.
+
 init_libsearch_path($use_vmtree);
 
 my $cstack_logfile = $logdir."/callstack.log";
 my $snapshot_logfile = $logdir."/snapshot.log";
+# With -snapshot_delta the client writes snapshot.bin instead (see
+# snapshot_log.h for the format).
+my $snapshot_is_delta = 0;
+if (!-e $snapshot_logfile && -e $logdir."/snapshot.bin") {
+    $snapshot_logfile = $logdir."/snapshot.bin";
+    $snapshot_is_delta = 1;
+}
+# Sizes and values from snapshot_log.h.
+my $delta_hdr_size = 48;
+my $delta_rec_hdr_size = 8;
+my $delta_snapshot_size = 72;
+my $DELTA_REC_SNAPSHOT = 1;
+my $DELTA_REC_END = 3;
+my $DELTA_FLAG_KEYFRAME = 1;
 my $staleness_logfile = $logdir."/staleness.log";
 my $nudge_idxfile = $logdir."/nudge.idx";
 
@@ -171,12 +189,16 @@ if (!-e $staleness_logfile) {
 }
 
 process_all_logs();
-collaborate_with_vistool();
+if ($text) {
+    print_all_snapshots();
+} else {
+    collaborate_with_vistool();
 
-unlink $flash_trust_file or
-    die "Can't delete Flash player trust file: $flash_trust_file: $!.\n".
-        "Delete it manually or future runs of drheapstat.pl -visualize won't ".
-        "work.\n";
+    unlink $flash_trust_file or
+        die "Can't delete Flash player trust file: $flash_trust_file: $!.\n".
+            "Delete it manually or future runs of drheapstat.pl -visualize ".
+            "won't work.\n";
+}
 
 #-------------------------------------------------------------------------------
 # FIXME: the code below upto exit() is also common so move it into symbol.pm.
@@ -306,7 +328,11 @@ sub collaborate_with_vistool()
                 $staleness_data = get_using_idx($staleness_logfile,
                                                 \@staleness_idx, $1);
             }
-            $res = get_using_idx($snapshot_logfile, \@snapshot_idx, $1);
+            if ($snapshot_is_delta) {
+                $res = get_delta_snapshot($1);
+            } else {
+                $res = get_using_idx($snapshot_logfile, \@snapshot_idx, $1);
+            }
             $res = create_snapshot_xml($res, $staleness_data, $from, $to);
         } elsif (/summary:(\d+)-(\d+)/){
             # Client requested snapshot summary for a specific range.
@@ -336,6 +362,39 @@ sub collaborate_with_vistool()
     close $client;
 }
 
+#-------------------------------------------------------------------------------
+# For -text: prints the totals of every snapshot and the snapshot itself with
+# all of its callstacks, in the XML the vistool would be sent.  Since this goes
+# through the same code as the vistool requests, comparing the output of a
+# -snapshot_delta run with that of a text snapshot run checks the whole
+# snapshot.bin round trip.
+#
+sub print_all_snapshots()
+{
+    my ($i, $res);
+    my $staleness_data = "";
+
+    for ($i = 0; $i < $total_ss; $i++) {
+        my $snapshot = $sorted_ss[$i];
+        print "<totals id=\"".${$snapshot}{"id"}."\"".
+              " xaxis=\"".${$snapshot}{"x_axis_val"}."\"".
+              " totMemReq=\"".${$snapshot}{"totMemReq"}."\"".
+              " totMemPad=\"".${$snapshot}{"totMemPad"}."\"".
+              " totMemTot=\"".${$snapshot}{"totMemTot"}."\"/>\n";
+        if ($have_stale) {
+            $staleness_data = get_using_idx($staleness_logfile,
+                                            \@staleness_idx, $i);
+        }
+        if ($snapshot_is_delta) {
+            $res = get_delta_snapshot($i);
+        } else {
+            $res = get_using_idx($snapshot_logfile, \@snapshot_idx, $i);
+        }
+        # Asking for more callstacks than there are returns all of them.
+        print create_snapshot_xml($res, $staleness_data, 1, 0x7fffffff), "\n";
+    }
+}
+
 #-------------------------------------------------------------------------------
 # Checks nudge options, reads the nudge index file and sets up from and to
 # points to read snapshot and staleness log files.  PR 502468.
@@ -495,7 +554,11 @@ sub process_all_logs()
     # Processing of staleness assumes that snapshot log file was read first.
     # Don't change order.
     my @snapshots = ();
-    process_log($snapshot_logfile, "snapshot", \@snapshots);
+    if ($snapshot_is_delta) {
+        process_delta_log($snapshot_logfile, \@snapshots);
+    } else {
+        process_log($snapshot_logfile, "snapshot", \@snapshots);
+    }
     process_log($staleness_logfile, "staleness", \@snapshots) if ($have_stale);
 
     # Snapshots in the log file are numbered sequentially but aren't sorted by
@@ -523,6 +586,8 @@ sub process_all_logs()
         ${$snapshot}{"id"} = $i;    # explicitly re-number the snapshot
         $snapshot_idx[$i]{"pos"} = ${$snapshot}{"snapshot_pos"};
         $snapshot_idx[$i]{"size"} = ${$snapshot}{"snapshot_size"};
+        $snapshot_idx[$i]{"key"} = ${$snapshot}{"snapshot_key"}
+            if ($snapshot_is_delta);
         if ($have_stale) {
             $staleness_idx[$i]{"pos"} = ${$snapshot}{"staleness_pos"};
             $staleness_idx[$i]{"size"} = ${$snapshot}{"staleness_size"};
@@ -736,7 +801,9 @@ sub create_snapshot_xml($snapshot_str, $staleness_str, $from, $to)
     # window.
     @sorted_cstack_ids =  sort {
         # We want it descending so that we can pick the top $from-$to elements.
-        $snapshot_details{$b}{"memTot"} <=> $snapshot_details{$a}{"memTot"}
+        # Ties go by callstack id so the order does not depend on hash order.
+        $snapshot_details{$b}{"memTot"} <=> $snapshot_details{$a}{"memTot"} ||
+            $a <=> $b
     } keys %snapshot_details;
 
     $xml .= "<snapshot id=\"$snapshot_id\" xaxis=\"$xaxis\" ".
@@ -991,12 +1058,16 @@ sub has_log_end($file_in)
 {
     my ($file) = @_;
     my $marker = "LOG END\n";
+    # snapshot.bin ends with an end record instead.
+    $marker = pack("VV", $DELTA_REC_END, $delta_rec_hdr_size)
+        if ($snapshot_is_delta && $file eq $snapshot_logfile);
     my $fpos = (stat($file))[$fsize_idx] - length($marker);
 
     open LOG_END, $file or die "Can't open file for LOG END check: $!\n";
+    binmode LOG_END;
     seek LOG_END, $fpos, SEEK_SET;
     $line = <LOG_END>;
-    return $line =~ /$marker/ ? 1 : 0;
+    return $line =~ /\Q$marker\E/ ? 1 : 0;
     close LOG_END;
 }
 
@@ -1155,6 +1226,157 @@ sub process_log($log_file, $log_type, $ss_aref)
     close LOG;
 }
 
+#-------------------------------------------------------------------------------
+# The -snapshot_delta counterpart of process_log() for the snapshot log.  Only
+# the fixed-size part of each record is read: the per-callstack entries are
+# skipped using the record size and are only decoded, by get_delta_snapshot(),
+# for the snapshots the vistool asks for.  Besides the position of each
+# snapshot this records the position of the full snapshot (keyframe) from
+# which it must be decoded.
+#
+sub process_delta_log($log_file, $ss_aref)
+{
+    my ($log_file, $ss_aref) = @_;
+    my ($rec, $body);
+    my $i = -1;
+    my $key_pos = -1;
+
+    open LOG, $log_file or die "can't open $log_file: $!\n";
+    binmode LOG;
+    read_delta_header(\*LOG, $log_file);
+
+    # Decide which location to start reading snapshot info from.  PR 502468.
+    # The client always writes a keyframe first after a nudge.
+    my $pos = tell LOG;
+    if ($from_nudge > 0) {
+        $pos = $nudge[$from_nudge]{"snapshot"};
+        seek LOG, $pos, SEEK_SET;
+    }
+    while ($pos < $nudge[$to_nudge]{"snapshot"}) {
+        last if (read(LOG, $rec, $delta_rec_hdr_size) != $delta_rec_hdr_size);
+        my ($type, $size) = unpack "V V", $rec;
+        die "$log_file: invalid record at $pos\n" if ($size < $delta_rec_hdr_size);
+        if ($type == $DELTA_REC_SNAPSHOT) {
+            my $len = $delta_snapshot_size - $delta_rec_hdr_size;
+            die "$log_file: truncated snapshot at $pos\n"
+                if ($size < $delta_snapshot_size || read(LOG, $body, $len) != $len);
+            my ($number, $idx, $flags, $num_entries, @u64) = unpack "V16", $body;
+            $key_pos = $pos if ($flags & $DELTA_FLAG_KEYFRAME);
+            die "$log_file: snapshot at $pos has no preceding keyframe\n"
+                if ($key_pos < 0);
+            $i++;
+            $$ss_aref[$i]{"id"} = $number;
+            $$ss_aref[$i]{"x_axis_val"} = delta_u64($u64[0], $u64[1]);
+            # $u64[4,5] - the number of mallocs is ignored just like in
+            # process_log().
+            $$ss_aref[$i]{"totMemReq"} = delta_u64($u64[6], $u64[7]);
+            $$ss_aref[$i]{"totMemPad"} = delta_u64($u64[8], $u64[9]);
+            $$ss_aref[$i]{"totMemTot"} = delta_u64($u64[10], $u64[11]);
+            $$ss_aref[$i]{"snapshot_pos"} = $pos;
+            $$ss_aref[$i]{"snapshot_size"} = $size;
+            $$ss_aref[$i]{"snapshot_key"} = $key_pos;
+        } elsif ($type == $DELTA_REC_END) {
+            last;
+        }
+        # Nudge records carry nothing we need.
+        $pos += $size;
+        seek LOG, $pos, SEEK_SET;
+    }
+    close LOG;
+}
+
+#-------------------------------------------------------------------------------
+# Returns snapshot $num_in from snapshot.bin in the same text form as a
+# snapshot in snapshot.log, for create_snapshot_xml().  The usage of each
+# callstack is rebuilt by applying the records from the snapshot's keyframe
+# up to the snapshot itself, so only one snapshot is ever held in memory.
+#
+sub get_delta_snapshot($num_in)
+{
+    my ($num) = @_;
+    my %usage = ();
+    my ($rec, $str);
+
+    die "no entry index for $num\n" if (!defined($snapshot_idx[$num]));
+    my $target = $snapshot_idx[$num]{"pos"};
+    my $pos = $snapshot_idx[$num]{"key"};
+    open INPUT, $snapshot_logfile or die "can't open $snapshot_logfile: $!\n";
+    binmode INPUT;
+    while ($pos <= $target) {
+        seek INPUT, $pos, SEEK_SET or die "can't seek to $pos in $snapshot_logfile: $!\n";
+        die "$snapshot_logfile: truncated record at $pos\n"
+            if (read(INPUT, $rec, $delta_rec_hdr_size) != $delta_rec_hdr_size);
+        my ($type, $size) = unpack "V V", $rec;
+        die "$snapshot_logfile: invalid record at $pos\n"
+            if ($size < $delta_rec_hdr_size);
+        if ($type == $DELTA_REC_SNAPSHOT) {
+            my $len = $size - $delta_rec_hdr_size;
+            die "$snapshot_logfile: truncated snapshot at $pos\n"
+                if ($size < $delta_snapshot_size || read(INPUT, $rec, $len) != $len);
+            my ($number, $idx, $flags, $num_entries, @u64) = unpack "V16", $rec;
+            my @vals = unpack "w*", substr($rec, $delta_snapshot_size -
+                                          $delta_rec_hdr_size);
+            die "$snapshot_logfile: malformed snapshot at $pos\n"
+                if (scalar(@vals) != 5 * $num_entries);
+            %usage = () if ($flags & $DELTA_FLAG_KEYFRAME);
+            # Each entry is: id, instances, bytes requested, pad and headers.
+            for (my $j = 0; $j < scalar(@vals); $j += 5) {
+                if ($vals[$j+2] + $vals[$j+3] == 0) {
+                    delete $usage{$vals[$j]};
+                } else {
+                    $usage{$vals[$j]} = join(",", @vals[$j+1 .. $j+4]);
+                }
+            }
+            if ($pos == $target) {
+                $idx -= 4294967296 if ($idx >= 2147483648);
+                $str = sprintf("SNAPSHOT #%4d @ %16.0f %s\n", $number,
+                               delta_u64($u64[0], $u64[1]), $xaxis_unit);
+                $str .= sprintf("idx=%d, stamp_offs=%16.0f\n", $idx,
+                                delta_u64($u64[2], $u64[3]));
+                $str .= sprintf("total: %.0f,%.0f,%.0f,%.0f\n",
+                                delta_u64($u64[4], $u64[5]),
+                                delta_u64($u64[6], $u64[7]),
+                                delta_u64($u64[8], $u64[9]),
+                                delta_u64($u64[10], $u64[11]));
+                foreach my $id (keys %usage) {
+                    $str .= "$id,$usage{$id}\n";
+                }
+            }
+        }
+        $pos += $size;
+    }
+    close INPUT;
+    return $str;
+}
+
+#-------------------------------------------------------------------------------
+# Returns the 64-bit value made up of the two 32-bit halves passed.  Kept as a
+# float so this works with a 32-bit perl; exact up to 2^53.
+#
+sub delta_u64($lo, $hi)
+{
+    my ($lo, $hi) = @_;
+    return $hi * 4294967296 + $lo;
+}
+
+#-------------------------------------------------------------------------------
+# Reads and checks the header of snapshot.bin from the handle $fh_in and sets
+# the x-axis label from the unit name it holds.
+#
+sub read_delta_header($fh_in, $log_file_in)
+{
+    my ($fh, $log_file) = @_;
+    my $hdr;
+
+    die "$log_file is too short\n"
+        if (read($fh, $hdr, $delta_hdr_size) != $delta_hdr_size);
+    my ($magic, $version, $unused, $unit) = unpack "Z8 V V Z32", $hdr;
+    die "$log_file is not a snapshot log\n" if ($magic ne "DHSNAPS");
+    die "$log_file has unsupported version $version\n" if ($version != 1);
+    $xaxis_unit = $unit;
+    ($xaxis_label) = split /\s/, $unit;
+}
+
 #-------------------------------------------------------------------------------
 # Returns 1 if the last access time of a malloc was earlier than what the user
 # specified (either via -stale_since or -stale_for), 0 otherwise.
@@ -0,0 +1,90 @@
+/* **********************************************************
+ * Copyright (c) 2014 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/* Dr. Memory: the memory debugger
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/***************************************************************************
+ * snapshot_log.h: format of snapshot.bin, written with -snapshot_delta
+ * and read by postprocess.pl and the visualizer.
+ *
+ * The file is a snapshot_log_header_t followed by records, each starting
+ * with a snapshot_rec_t giving its type and total size so a reader can skip
+ * the types it does not know.  A SNAPSHOT_REC_SNAPSHOT record holds the
+ * same totals as a "SNAPSHOT #" block of snapshot.log, followed by one
+ * entry per callstack whose usage changed since the previous record.  Each
+ * entry is 5 unsigned integers in the BER compressed format of Perl's
+ * pack("w"): callstack id, instances, bytes_asked_for, extra_usable and
+ * extra_occupied.  An entry of all zeros beyond the id means the callstack
+ * no longer has any usage.  A record with SNAPSHOT_FLAG_KEYFRAME lists
+ * every callstack with usage rather than the changes, so a reader can
+ * start decoding at any keyframe, such as the position in nudge.idx.
+ *
+ * All fixed-size fields are little-endian.
+ */
+
+#ifndef _SNAPSHOT_LOG_H_
+#define _SNAPSHOT_LOG_H_ 1
+
+#define SNAPSHOT_LOG_MAGIC "DHSNAPS"
+#define SNAPSHOT_LOG_VERSION 1
+
+typedef struct _snapshot_log_header_t {
+    char magic[8];
+    uint version;
+    uint unused;
+    char unit_name[32];
+} snapshot_log_header_t;
+
+typedef enum {
+    SNAPSHOT_REC_SNAPSHOT = 1,
+    SNAPSHOT_REC_NUDGE,
+    SNAPSHOT_REC_END,
+} snapshot_rec_type_t;
+
+typedef struct _snapshot_rec_t {
+    uint type; /* snapshot_rec_type_t */
+    uint size; /* total size including this header */
+} snapshot_rec_t;
+
+#define SNAPSHOT_FLAG_KEYFRAME 0x1
+
+/* Followed by num_entries variable-length entries */
+typedef struct _snapshot_rec_snapshot_t {
+    snapshot_rec_t rec;
+    uint number;
+    int idx; /* -1 means peak */
+    uint flags;
+    uint num_entries;
+    uint64 stamp; /* includes stamp_offs */
+    uint64 stamp_offs;
+    uint64 tot_mallocs;
+    uint64 tot_bytes_asked_for;
+    uint64 tot_bytes_usable;
+    uint64 tot_bytes_occupied;
+} snapshot_rec_snapshot_t;
+
+typedef struct _snapshot_rec_nudge_t {
+    snapshot_rec_t rec;
+    uint64 stamp;
+} snapshot_rec_nudge_t;
+
+/* Upper bound on the encoded size of one entry */
+#define SNAPSHOT_MAX_ENTRY_SIZE (5 * 5)
+
+#endif /* _SNAPSHOT_LOG_H_ */
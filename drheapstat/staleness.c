@@ -26,6 +26,17 @@
  * read/write set shadow metadata, and use a periodic sweep then sets
  * a last-accessed timestamp if an alloc's metadata is set and
  * subsequently clears the metadata.
+ *
+ * With -stale_pages we instead let the kernel do the tracking: the
+ * sweep reads the soft-dirty bit of each page holding an alloc from
+ * /proc/self/pagemap and then clears all the bits.  There is no
+ * instrumentation of memory references, at the cost of page granularity
+ * and of only noticing writes.
+ *
+ * Walking the heap holds the malloc lock, so the shadow sweep only
+ * records each alloc's bounds while walking and does the shadow checks
+ * afterward, unlocked, split into shards among -stale_sweep_threads
+ * worker threads.
  */
 
 #include "dr_api.h"
@@ -376,6 +387,282 @@ instr_ok_for_instrument_fastpath(instr_t *inst, fastpath_info_t *mi, bb_info_t *
  */
 static uint num_live_mallocs;
 
+/* The unlocked part of a shadow sweep works on shards of this many allocs */
+#define SWEEP_SHARD_ENTRIES 2048
+#define SWEEP_MAX_THREADS 16
+
+typedef struct _sweep_entry_t {
+    byte *base;
+    byte *end;
+    stale_per_alloc_t *spa;
+} sweep_entry_t;
+
+typedef struct _sweep_shard_t {
+    uint num_entries;
+    struct _sweep_shard_t *next;
+    sweep_entry_t entry[SWEEP_SHARD_ENTRIES];
+} sweep_shard_t;
+
+static uint num_sweep_workers;
+static volatile bool sweep_exit;
+/* Written before any shard is queued, so the workers read it without a lock */
+static uint64 sweep_stamp;
+
+/* Protects the fields below */
+static void *sweep_lock;
+/* Signaled when the queue is non-empty or on exit */
+static void *sweep_work_event;
+/* Signaled when sweep_pending drops to 0 */
+static void *sweep_done_event;
+static sweep_shard_t *sweep_queue;
+/* Shards queued or being swept, plus 1 while the sweeper is still walking
+ * the heap so we can't finish before all the shards are queued.
+ */
+static uint sweep_pending;
+/* While a sweep is in progress, a freed alloc's stale_per_alloc_t may still be
+ * in an unswept shard, so staleness_free_per_alloc() puts it on this list
+ * (linked through its cstack field) for the sweep to free once it's done.
+ */
+static volatile bool sweep_active;
+static stale_per_alloc_t *sweep_deferred;
+
+#ifdef LINUX
+# define PAGEMAP_FILE "/proc/self/pagemap"
+# define CLEAR_REFS_FILE "/proc/self/clear_refs"
+/* Writing this to clear_refs clears the soft-dirty bits */
+# define CLEAR_REFS_SOFT_DIRTY "4"
+# define PAGEMAP_SOFT_DIRTY ((uint64)1 << 55)
+# define PAGEMAP_PRESENT    ((uint64)1 << 63)
+/* Pages covered by one read of the pagemap file */
+# define PAGEMAP_WINDOW 512
+
+/* State for one -stale_pages sweep.  The malloc iteration is usually in
+ * address order so we read the pagemap a window at a time.
+ */
+typedef struct _page_sweep_t {
+    uint64 stamp;
+    file_t pagemap;
+    app_pc window_start; /* NULL if the window is not filled in */
+    uint64 window[PAGEMAP_WINDOW];
+} page_sweep_t;
+
+static bool
+clear_soft_dirty(void)
+{
+    file_t f = dr_open_file(CLEAR_REFS_FILE, DR_FILE_WRITE_OVERWRITE);
+    bool ok;
+    if (f == INVALID_FILE)
+        return false;
+    ok = (dr_write_file(f, CLEAR_REFS_SOFT_DIRTY, strlen(CLEAR_REFS_SOFT_DIRTY)) ==
+          (ssize_t) strlen(CLEAR_REFS_SOFT_DIRTY));
+    dr_close_file(f);
+    return ok;
+}
+
+static bool
+read_pagemap_entry(file_t f, app_pc page, uint64 *entry OUT)
+{
+    return (dr_file_seek(f, (int64)((ptr_uint_t)page / PAGE_SIZE) * sizeof(*entry),
+                         DR_SEEK_SET) &&
+            dr_read_file(f, entry, sizeof(*entry)) == sizeof(*entry));
+}
+
+/* A kernel without soft-dirty support may still accept the clear_refs write
+ * (and older kernels used bit 55 for the page shift), so we check that a
+ * write to a page we just cleared actually sets the bit.
+ */
+static bool
+soft_dirty_works(void)
+{
+    bool ok = false;
+    uint64 entry;
+    file_t f;
+    volatile byte *page = (volatile byte *)
+        dr_raw_mem_alloc(PAGE_SIZE, DR_MEMPROT_READ | DR_MEMPROT_WRITE, NULL);
+    if (page == NULL)
+        return false;
+    f = dr_open_file(PAGEMAP_FILE, DR_FILE_READ);
+    if (f != INVALID_FILE) {
+        *page = 1; /* make it present */
+        if (clear_soft_dirty() &&
+            read_pagemap_entry(f, (app_pc) page, &entry) &&
+            !TEST(PAGEMAP_SOFT_DIRTY, entry)) {
+            *page = 2;
+            ok = (read_pagemap_entry(f, (app_pc) page, &entry) &&
+                  TESTALL(PAGEMAP_PRESENT | PAGEMAP_SOFT_DIRTY, entry));
+        }
+        dr_close_file(f);
+    }
+    dr_raw_mem_free((void *) page, PAGE_SIZE);
+    return ok;
+}
+
+static bool
+page_is_dirty(page_sweep_t *sweep, app_pc page)
+{
+    ptr_uint_t idx;
+    if (sweep->window_start == NULL || page < sweep->window_start ||
+        page >= sweep->window_start + PAGEMAP_WINDOW*PAGE_SIZE) {
+        app_pc start = (app_pc) ALIGN_BACKWARD(page, PAGEMAP_WINDOW*PAGE_SIZE);
+        ssize_t got;
+        memset(sweep->window, 0, sizeof(sweep->window));
+        if (dr_file_seek(sweep->pagemap, (int64)((ptr_uint_t)start / PAGE_SIZE) *
+                         sizeof(sweep->window[0]), DR_SEEK_SET)) {
+            /* a short read near the top of the address space leaves zeroes */
+            got = dr_read_file(sweep->pagemap, sweep->window, sizeof(sweep->window));
+            if (got < 0)
+                LOG(1, "failed to read pagemap @"PFX"\n", start);
+        }
+        sweep->window_start = start;
+    }
+    idx = (page - sweep->window_start) / PAGE_SIZE;
+    return TESTALL(PAGEMAP_PRESENT | PAGEMAP_SOFT_DIRTY, sweep->window[idx]);
+}
+
+static bool
+alloc_itercb_sweep_pages(malloc_info_t *info, void *iter_data)
+{
+    page_sweep_t *sweep = (page_sweep_t *) iter_data;
+    app_pc page;
+    for (page = (app_pc) ALIGN_BACKWARD(info->base, PAGE_SIZE);
+         page < info->base + info->request_size; page += PAGE_SIZE) {
+        if (page_is_dirty(sweep, page)) {
+            stale_per_alloc_t *spa = (stale_per_alloc_t *) info->client_data;
+            LOG(3, "\t"PFX"-"PFX" was written @%"INT64_FORMAT"u\n", info->base,
+                info->base + info->request_size, sweep->stamp);
+            spa->last_access = sweep->stamp;
+            break;
+        }
+    }
+    return true;
+}
+
+static void
+staleness_sweep_pages(uint64 stamp)
+{
+    page_sweep_t *sweep = (page_sweep_t *)
+        global_alloc(sizeof(*sweep), HEAPSTAT_STALENESS);
+    /* We open the file each time rather than at init so a forked child
+     * reads its own pagemap.
+     */
+    sweep->pagemap = dr_open_file(PAGEMAP_FILE, DR_FILE_READ);
+    if (sweep->pagemap == INVALID_FILE) {
+        ASSERT(false, "unable to open pagemap");
+    } else {
+        sweep->stamp = stamp;
+        sweep->window_start = NULL;
+        malloc_iterate(alloc_itercb_sweep_pages, (void *) sweep);
+        dr_close_file(sweep->pagemap);
+        /* Writes that land in between the iteration and here are lost: like
+         * the shadow sweep, we are fine with not being perfectly accurate.
+         */
+        if (!clear_soft_dirty())
+            ASSERT(false, "unable to clear soft-dirty bits");
+    }
+    global_free(sweep, sizeof(*sweep), HEAPSTAT_STALENESS);
+}
+#endif /* LINUX */
+
+static void
+sweep_worker_run(void *arg);
+
+static bool
+stale_pages_init(void)
+{
+#ifdef LINUX
+    /* Soft-dirty bits need CONFIG_MEM_SOFT_DIRTY (Linux 3.11+) */
+    if (soft_dirty_works()) {
+        LOG(1, "using soft-dirty page tracking for staleness\n");
+        return true;
+    }
+#endif
+    NOTIFY("WARNING: soft-dirty page tracking is unavailable: "
+           "reverting to -no_stale_pages"NL);
+    options.stale_pages = false;
+    return false;
+}
+
+void
+staleness_init(void)
+{
+    uint i;
+    if (!options.staleness)
+        return;
+    ASSERT(sizeof(stale_snap_alloc_small_t) == 8, "struct size changed");
+    ASSERT(STALE_SMALL_BITS_ID + STALE_SMALL_BITS_SZ == 32, "bitfields inconsistent");
+    if (options.stale_pages && stale_pages_init())
+        return;
+    sweep_lock = dr_mutex_create();
+    sweep_work_event = dr_event_create();
+    sweep_done_event = dr_event_create();
+    for (i = 0; i < options.stale_sweep_threads && i < SWEEP_MAX_THREADS; i++) {
+        if (!dr_create_client_thread(sweep_worker_run, NULL)) {
+            ASSERT(false, "unable to create thread");
+            break;
+        }
+    }
+    num_sweep_workers = i;
+    LOG(1, "%s: started %d staleness sweep threads\n", __FUNCTION__, num_sweep_workers);
+}
+
+void
+staleness_exit(void)
+{
+    stale_per_alloc_t *spa, *next;
+    if (sweep_lock == NULL)
+        return;
+    sweep_exit = true;
+    dr_event_signal(sweep_work_event);
+    /* i#297: the sideline thread and the workers have been terminated by now,
+     * perhaps in the middle of a sweep, so nobody else is touching these.
+     */
+    while (sweep_queue != NULL) {
+        sweep_shard_t *shard = sweep_queue;
+        sweep_queue = shard->next;
+        global_free(shard, sizeof(*shard), HEAPSTAT_STALENESS);
+    }
+    for (spa = sweep_deferred; spa != NULL; spa = next) {
+        next = (stale_per_alloc_t *) spa->cstack;
+        global_free(spa, sizeof(*spa), HEAPSTAT_STALENESS);
+    }
+    sweep_deferred = NULL;
+    dr_event_destroy(sweep_done_event);
+    dr_event_destroy(sweep_work_event);
+    dr_mutex_destroy(sweep_lock);
+}
+
+#ifdef UNIX
+void
+staleness_fork(void)
+{
+    stale_per_alloc_t *spa, *next;
+    if (sweep_lock == NULL)
+        return;
+    /* The workers, and the sideline thread if it was in the middle of a
+     * sweep, do not exist in the child, and sweep_lock may have been held by
+     * one of them at the fork.  We can't destroy a lock that may be held, so
+     * we leak it and its events and start over, dropping any sweep in
+     * progress.  Later sweeps are done by the sweeping thread alone.
+     */
+    sweep_lock = dr_mutex_create();
+    sweep_work_event = dr_event_create();
+    sweep_done_event = dr_event_create();
+    num_sweep_workers = 0;
+    while (sweep_queue != NULL) {
+        sweep_shard_t *shard = sweep_queue;
+        sweep_queue = shard->next;
+        global_free(shard, sizeof(*shard), HEAPSTAT_STALENESS);
+    }
+    sweep_pending = 0;
+    sweep_active = false;
+    for (spa = sweep_deferred; spa != NULL; spa = next) {
+        next = (stale_per_alloc_t *) spa->cstack;
+        global_free(spa, sizeof(*spa), HEAPSTAT_STALENESS);
+    }
+    sweep_deferred = NULL;
+}
+#endif
+
 #ifdef STATISTICS
 uint stale_small_needs_ext;
 uint stale_needs_large;
@@ -405,44 +692,183 @@ staleness_create_per_alloc(per_callstack_t *cstack, uint64 stamp)
 void
 staleness_free_per_alloc(stale_per_alloc_t *spa)
 {
-    global_free(spa, sizeof(*spa), HEAPSTAT_STALENESS);
     num_live_mallocs--;
+    if (sweep_active) {
+        dr_mutex_lock(sweep_lock);
+        if (sweep_active) {
+            /* an unswept shard may still point at spa */
+            spa->cstack = (per_callstack_t *) sweep_deferred;
+            sweep_deferred = spa;
+            dr_mutex_unlock(sweep_lock);
+            return;
+        }
+        dr_mutex_unlock(sweep_lock);
+    }
+    global_free(spa, sizeof(*spa), HEAPSTAT_STALENESS);
 }
 
 /* The basic algorithm is to have each read/write set the shadow metadata,
  * and the periodic sweep then sets the timestamp if an alloc's metadata
  * is set and subsequently clears the metadata.
  */
+static void
+sweep_shard(sweep_shard_t *shard)
+{
+    uint i;
+    /* we don't care much about synch: ok to not be perfectly accurate.
+     * An alloc freed since we recorded it may have its shadow cleared after
+     * a new alloc in the same spot was accessed, losing that access.
+     */
+    for (i = 0; i < shard->num_entries; i++) {
+        sweep_entry_t *e = &shard->entry[i];
+        if (shadow_val_in_range(e->base, e->end, 1)) {
+            LOG(3, "\t"PFX"-"PFX" was accessed @%"INT64_FORMAT"u\n",
+                e->base, e->end, sweep_stamp);
+            e->spa->last_access = sweep_stamp;
+            shadow_set_range(e->base, e->end, 0);
+        }
+    }
+    global_free(shard, sizeof(*shard), HEAPSTAT_STALENESS);
+}
+
+static void
+sweep_enqueue(sweep_shard_t *shard)
+{
+    dr_mutex_lock(sweep_lock);
+    shard->next = sweep_queue;
+    sweep_queue = shard;
+    sweep_pending++;
+    dr_event_signal(sweep_work_event);
+    dr_mutex_unlock(sweep_lock);
+}
+
+/* Caller must hold sweep_lock */
+static sweep_shard_t *
+sweep_dequeue(void)
+{
+    sweep_shard_t *shard = sweep_queue;
+    if (shard != NULL)
+        sweep_queue = shard->next;
+    return shard;
+}
+
+/* Returns whether this was the last pending unit of work */
+static bool
+sweep_work_done(void)
+{
+    bool last;
+    dr_mutex_lock(sweep_lock);
+    ASSERT(sweep_pending > 0, "sweep count off");
+    sweep_pending--;
+    last = (sweep_pending == 0);
+    if (last)
+        dr_event_signal(sweep_done_event);
+    dr_mutex_unlock(sweep_lock);
+    return last;
+}
+
+static void
+sweep_worker_run(void *arg)
+{
+    /* Like the sideline thread, keep running during synchall */
+    dr_client_thread_set_suspendable(false);
+    while (!sweep_exit) {
+        sweep_shard_t *shard;
+        dr_mutex_lock(sweep_lock);
+        shard = sweep_dequeue();
+        if (shard == NULL) {
+            dr_event_reset(sweep_work_event);
+            dr_mutex_unlock(sweep_lock);
+            dr_event_wait(sweep_work_event);
+            continue;
+        }
+        dr_mutex_unlock(sweep_lock);
+        sweep_shard(shard);
+        sweep_work_done();
+    }
+    /* i#297: DR may terminate us before we get here: staleness_exit cleans up */
+}
+
+/* Runs with the malloc lock held, so we only copy the bounds here */
 static bool
 alloc_itercb_sweep(malloc_info_t *info, void *iter_data)
 {
-    /* we don't care much about synch: ok to not be perfectly accurate */
+    sweep_shard_t **cur = (sweep_shard_t **) iter_data;
+    sweep_entry_t *e;
     /* FIXME: ignore pre_us? option-controlled? */
-    byte *end = info->base + info->request_size;
-    if (shadow_val_in_range(info->base, end, 1)) {
-        stale_per_alloc_t *spa = (stale_per_alloc_t *) info->client_data;
-        uint64 stamp = *((uint64 *)iter_data);
-        LOG(3, "\t"PFX"-"PFX" was accessed @%"INT64_FORMAT"u\\n", info->base, end, stamp);
-        spa->last_access = stamp;
-        shadow_set_range(info->base, end, 0);
+    if (*cur != NULL && (*cur)->num_entries == SWEEP_SHARD_ENTRIES) {
+        sweep_enqueue(*cur);
+        *cur = NULL;
+    }
+    if (*cur == NULL) {
+        *cur = (sweep_shard_t *) global_alloc(sizeof(**cur), HEAPSTAT_STALENESS);
+        (*cur)->num_entries = 0;
     }
+    e = &(*cur)->entry[(*cur)->num_entries++];
+    e->base = info->base;
+    e->end = info->base + info->request_size;
+    e->spa = (stale_per_alloc_t *) info->client_data;
     return true;
 }
 
 void
 staleness_sweep(uint64 stamp)
 {
-    /* if we changed iter param to always be 64 bits we wouldn't need this */
-    uint64 *iter_data = (uint64 *) global_alloc(sizeof(*iter_data), HEAPSTAT_STALENESS);
+    sweep_shard_t *shard = NULL;
+    stale_per_alloc_t *spa, *next;
+    ASSERT(options.staleness, "should not get here");
+    LOG(2, "\nSTALENESS SWEEP @%"INT64_FORMAT"u\n", stamp);
+#ifdef LINUX
+    if (options.stale_pages) {
+        staleness_sweep_pages(stamp);
+        return;
+    }
+#endif
     /* note that depending on the time units in use, and the period between
      * snapshots, this sweep could use the same stamp as the last sweep:
      * that's fine, but should we up the sweep timer?
      */
-    *iter_data = stamp;
-    ASSERT(options.staleness, "should not get here");
-    LOG(2, "\nSTALENESS SWEEP @%"INT64_FORMAT"u\n", stamp);
-    malloc_iterate(alloc_itercb_sweep, (void *) iter_data);
-    global_free(iter_data, sizeof(*iter_data), HEAPSTAT_STALENESS);
+    sweep_stamp = stamp;
+    dr_mutex_lock(sweep_lock);
+    ASSERT(sweep_pending == 0 && sweep_queue == NULL, "prior sweep not finished");
+    sweep_pending = 1; /* us, until we're done walking the heap */
+    dr_event_reset(sweep_done_event);
+    sweep_active = true;
+    dr_mutex_unlock(sweep_lock);
+    /* A free that saw !sweep_active may be freeing a spa right now.  Frees
+     * hold the malloc lock, so once we can acquire it every such free is
+     * done and any later one will see sweep_active.
+     */
+    malloc_lock();
+    malloc_unlock();
+
+    malloc_iterate(alloc_itercb_sweep, (void *) &shard);
+    if (shard != NULL)
+        sweep_enqueue(shard);
+    /* Help out rather than just waiting.  This also means we do not depend
+     * on the workers, which do not exist in a forked child.
+     */
+    while (true) {
+        dr_mutex_lock(sweep_lock);
+        shard = sweep_dequeue();
+        dr_mutex_unlock(sweep_lock);
+        if (shard == NULL)
+            break;
+        sweep_shard(shard);
+        sweep_work_done();
+    }
+    if (!sweep_work_done())
+        dr_event_wait(sweep_done_event);
+
+    dr_mutex_lock(sweep_lock);
+    sweep_active = false;
+    spa = sweep_deferred;
+    sweep_deferred = NULL;
+    dr_mutex_unlock(sweep_lock);
+    for (; spa != NULL; spa = next) {
+        next = (stale_per_alloc_t *) spa->cstack;
+        global_free(spa, sizeof(*spa), HEAPSTAT_STALENESS);
+    }
 }
 
 /* Accessors for compressed per-snapshot data */
@@ -573,9 +999,6 @@ staleness_take_snapshot(uint64 cur_stamp)
         snaps->data.sm.ext_capacity = 0;
     }
     ASSERT(options.staleness, "should not get here");
-    /* These two could be done at init time but there is no staleness_init() */
-    ASSERT(sizeof(stale_snap_alloc_small_t) == 8, "struct size changed");
-    ASSERT(STALE_SMALL_BITS_ID + STALE_SMALL_BITS_SZ == 32, "bitfields inconsistent");
     LOG(2, "\nSTALENESS SNAPSHOT\n");
     if (snaps->num_entries > 0)
         malloc_iterate(alloc_itercb_snapshot, (void *) snaps);
@@ -134,11 +134,27 @@ typedef struct _stale_snap_allocs_t {
     } data;
 } stale_snap_allocs_t;
 
+/* Whether memory references are instrumented, as opposed to -stale_pages */
+#define INSTRUMENT_STALENESS() (options.staleness && !options.stale_pages)
+
 #ifdef STATISTICS
 extern uint stale_small_needs_ext;
 extern uint stale_needs_large;
 #endif
 
+/* Must be called prior to instrumentation: may turn off -stale_pages */
+void
+staleness_init(void);
+
+void
+staleness_exit(void);
+
+#ifdef UNIX
+/* Called in the child after a fork */
+void
+staleness_fork(void);
+#endif
+
 stale_per_alloc_t *
 staleness_create_per_alloc(per_callstack_t *cstack, uint64 stamp);
 
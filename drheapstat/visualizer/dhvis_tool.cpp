@@ -50,9 +50,12 @@
 #include <QProcess>
 #include <QStackedLayout>
 #include <QUrl>
+#include <QDataStream>
+#include <QHash>
 
 #include <algorithm>
 #include <cmath>
+#include <cstring>
 
 #include "dhvis_snapshot_graph.h"
 #include "dhvis_stale_graph.h"
@@ -458,6 +461,13 @@ dhvis_tool_t::read_log_data(void)
     QFile callstack_log(dr_log_dir.absoluteFilePath("callstack.log"));
     QFile snapshot_log(dr_log_dir.absoluteFilePath("snapshot.log"));
     QFile staleness_log(dr_log_dir.absoluteFilePath("staleness.log"));
+    /* -snapshot_delta writes snapshot.bin instead */
+    bool snapshot_is_delta = false;
+    if (!snapshot_log.exists() &&
+        QFile::exists(dr_log_dir.absoluteFilePath("snapshot.bin"))) {
+        snapshot_log.setFileName(dr_log_dir.absoluteFilePath("snapshot.bin"));
+        snapshot_is_delta = true;
+    }
     if (!dr_check_file(callstack_log) ||
         !dr_check_file(snapshot_log) ||
         !dr_check_file(staleness_log))
@@ -470,7 +480,10 @@ dhvis_tool_t::read_log_data(void)
     delete_data();
 
     read_callstack_log(callstack_log);
-    read_snapshot_log(snapshot_log);
+    if (snapshot_is_delta)
+        read_snapshot_bin(snapshot_log);
+    else
+        read_snapshot_log(snapshot_log);
     read_staleness_log(staleness_log);
 
     /* Sort all of the information properly */
@@ -701,6 +714,149 @@ dhvis_tool_t::read_snapshot_log(QFile &snapshot_log)
     qDebug() << "INFO: snapshot.log read";
 }
 
+/* Decodes one unsigned integer in the BER compressed format of Perl's
+ * pack("w"), advancing *pos past it.
+ */
+static bool
+decode_ber_uint(const uchar **pos, const uchar *end, quint64 *val)
+{
+    *val = 0;
+    while (*pos < end) {
+        uchar byte = *(*pos)++;
+        *val = (*val << 7) | (byte & 0x7f);
+        if ((byte & 0x80) == 0)
+            return true;
+    }
+    return false;
+}
+
+/* Private
+ * Processes snapshot.bin, written in place of snapshot.log by
+ * -snapshot_delta: see drheapstat/snapshot_log.h for the format.
+ * Each record only lists the callstacks that changed, so we carry
+ * the usage of every callstack from one record to the next.
+ */
+void
+dhvis_tool_t::read_snapshot_bin(QFile &snapshot_bin)
+{
+    /* Values from snapshot_log.h */
+    const quint32 REC_SNAPSHOT = 1;
+    const quint32 REC_END = 3;
+    const quint32 FLAG_KEYFRAME = 0x1;
+    const int REC_HEADER_SIZE = 8;
+    const int SNAPSHOT_FIXED_SIZE = 72;
+
+    /* Clear current snapshot data */
+    snapshots.clear();
+    if (!snapshot_bin.open(QFile::ReadOnly))
+        return;
+    QDataStream in_log(&snapshot_bin);
+    in_log.setByteOrder(QDataStream::LittleEndian);
+    char magic[8];
+    char unit[32];
+    quint32 version, unused;
+    if (in_log.readRawData(magic, sizeof(magic)) != sizeof(magic) ||
+        memcmp(magic, "DHSNAPS", sizeof(magic)) != 0) {
+        qDebug() << "Malformed snapshot log: " << snapshot_bin.fileName();
+        snapshot_bin.close();
+        return;
+    }
+    in_log >> version >> unused;
+    if (in_log.readRawData(unit, sizeof(unit)) != sizeof(unit) || version != 1) {
+        qDebug() << "Unsupported snapshot log: " << snapshot_bin.fileName();
+        snapshot_bin.close();
+        return;
+    }
+    unit[sizeof(unit) - 1] = '\0';
+    time_unit = QString(unit).section(' ', 0, 0);
+
+    dhvis_snapshot_listing_t *peak_snapshot = NULL;
+    /* callstack id => instances, bytes_asked_for, extra_usable, extra_occupied */
+    QHash<quint64, QVector<quint64> > usage;
+    quint64 counter = 0;
+    while (!in_log.atEnd()) {
+        quint32 type, size;
+        in_log >> type >> size;
+        if (in_log.status() != QDataStream::Ok || size < REC_HEADER_SIZE)
+            break;
+        QByteArray body(size - REC_HEADER_SIZE, '\0');
+        if (in_log.readRawData(body.data(), body.size()) != body.size())
+            break;
+        if (type == REC_END)
+            break;
+        if (type != REC_SNAPSHOT)
+            continue;
+        if (body.size() < SNAPSHOT_FIXED_SIZE - REC_HEADER_SIZE) {
+            qDebug() << "Malformed snapshot record";
+            break;
+        }
+        QDataStream in_rec(body);
+        in_rec.setByteOrder(QDataStream::LittleEndian);
+        quint32 number, flags, num_entries;
+        qint32 idx;
+        quint64 stamp, stamp_offs;
+        dhvis_snapshot_listing_t *this_snapshot;
+        this_snapshot = new dhvis_snapshot_listing_t;
+        this_snapshot->snapshot_num = counter;
+        in_rec >> number >> idx >> flags >> num_entries >> stamp >> stamp_offs
+               >> this_snapshot->tot_mallocs >> this_snapshot->tot_bytes_asked_for
+               >> this_snapshot->tot_bytes_usable
+               >> this_snapshot->tot_bytes_occupied;
+        this_snapshot->num_time = stamp;
+        this_snapshot->is_peak = false;
+        if (peak_snapshot == NULL ||
+            this_snapshot->tot_bytes_occupied > peak_snapshot->tot_bytes_occupied)
+            peak_snapshot = this_snapshot;
+
+        if ((flags & FLAG_KEYFRAME) != 0)
+            usage.clear();
+        const uchar *pos = (const uchar *) body.constData() +
+            SNAPSHOT_FIXED_SIZE - REC_HEADER_SIZE;
+        const uchar *end = (const uchar *) body.constData() + body.size();
+        for (quint32 i = 0; i < num_entries; i++) {
+            quint64 vals[5];
+            if (!decode_ber_uint(&pos, end, &vals[0]) ||
+                !decode_ber_uint(&pos, end, &vals[1]) ||
+                !decode_ber_uint(&pos, end, &vals[2]) ||
+                !decode_ber_uint(&pos, end, &vals[3]) ||
+                !decode_ber_uint(&pos, end, &vals[4])) {
+                qDebug() << "Malformed snapshot entry";
+                break;
+            }
+            /* An entry with no bytes means the callstack dropped out */
+            if (vals[2] + vals[3] == 0)
+                usage.remove(vals[0]);
+            else
+                usage[vals[0]] = QVector<quint64>() << vals[1] << vals[2]
+                                                    << vals[3] << vals[4];
+        }
+        /* Add new data to callstacks, as read_snapshot_log() does */
+        QHash<quint64, QVector<quint64> >::const_iterator it;
+        for (it = usage.constBegin(); it != usage.constEnd(); ++it) {
+            /* Callstack #s start at 1 in the log */
+            if (it.key() == 0 || it.key() > (quint64) callstacks.size()) {
+                qDebug() << "Invalid callstack: " << it.key();
+                continue;
+            }
+            dhvis_callstack_listing_t *this_callstack;
+            this_callstack = callstacks.at(it.key() - 1);
+            this_callstack->instances = it.value().at(0);
+            this_callstack->bytes_asked_for = it.value().at(1);
+            this_callstack->extra_usable = it.value().at(2)
+                                         + this_callstack->bytes_asked_for;
+            this_callstack->extra_occupied = it.value().at(3)
+                                           + this_callstack->extra_usable;
+            this_snapshot->assoc_callstacks.prepend(this_callstack);
+        }
+        snapshots.append(this_snapshot);
+        counter++;
+    }
+    snapshot_bin.close();
+    if (peak_snapshot != NULL)
+        peak_snapshot->is_peak = true;
+    qDebug() << "INFO: snapshot.bin read";
+}
+
 /* Private
  * Processes snapshot.log
  */
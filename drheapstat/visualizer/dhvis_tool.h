@@ -123,6 +123,8 @@ private:
 
     void read_snapshot_log(QFile &snapshot_log);
 
+    void read_snapshot_bin(QFile &snapshot_bin);
+
     void read_staleness_log(QFile &staleness_log);
 
     void sort_log_data(void);
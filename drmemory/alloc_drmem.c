@@ -50,11 +50,48 @@
 
 /* PR 465174: share allocation site callstacks.  We do not rely on
  * global malloc synchronization and instead use the
- * hashtable_{,un}lock() functions plus reference counts in the
- * payloads.
+ * callstack_trie_{,un}lock() functions plus reference counts in the
+ * callstacks.  We use a prefix trie rather than a hashtable so that
+ * callstacks sharing outer frames store them once rather than each
+ * keeping its own frames array.
  */
-#define ASTACK_TABLE_HASH_BITS 8
-static hashtable_t alloc_stack_table;
+static callstack_trie_t *alloc_stack_trie;
+
+/* -malloc_callstack_samples: once we've walked the full callstack for an
+ * allocation site that many times, we reuse the last callstack for that
+ * site.  A site is identified by the return address into the immediate
+ * caller plus the stack depth, i.e., the distance of xsp from the top of
+ * the thread's stack, which tells apart most callers reached via different
+ * paths without walking.  Reused sites are re-walked every
+ * ALLOC_SITE_REVALIDATE reuses, and a site whose walk disagrees goes back
+ * to walking until it is stable again.  We track how often a revalidating
+ * walk, made where we would otherwise have reused, disagreed with the
+ * callstack we would have reused, as an estimate of the accuracy lost.
+ * Protected by the alloc_stack_trie lock.
+ */
+typedef struct _alloc_site_key_t {
+    app_pc post_call;
+    size_t stack_depth;
+} alloc_site_key_t;
+
+typedef struct _alloc_site_t {
+    alloc_site_key_t key;
+    uint walks;
+    /* reuses since the last walk */
+    uint reuses;
+    packed_callstack_t *pcs;
+} alloc_site_t;
+
+#define ALLOC_SITE_REVALIDATE 1024
+
+#define ALLOC_SITE_TABLE_HASH_BITS 10
+static hashtable_t alloc_site_table;
+/* Only accessed with the alloc_stack_trie lock held */
+static uint alloc_site_walks;
+/* The walks made for a site that had been walked enough to reuse */
+static uint alloc_site_revalidations;
+static uint alloc_site_mismatches;
+static uint alloc_site_reuses;
 
 #ifdef UNIX
 /* Track all signal handlers registered by app so we can instrument them */
@@ -148,6 +185,11 @@ static rb_tree_t *delay_free_tree;
 
 #define DELAY_FREE_FULL(info) (info->delay_free_fill == options.delay_frees)
 
+/* Sum of delay_free_bytes across all queues, for alloc_drmem_get_usage().
+ * Protected by delay_free_lock.
+ */
+static size_t delay_free_total_bytes;
+
 #ifdef STATISTICS
 uint delayed_free_bytes; /* includes redzones */
 #endif
@@ -155,7 +197,13 @@ uint delayed_free_bytes; /* includes redzones */
 /***************************************************************************/
 
 static void
-alloc_callstack_free(void *p);
+alloc_site_free(void *p);
+
+static uint
+alloc_site_hash(void *key);
+
+static bool
+alloc_site_cmp(void *key1, void *key2);
 
 static byte *
 next_defined_ptrsz(byte *start, byte *end);
@@ -212,15 +260,16 @@ alloc_drmem_init(void)
 #endif
     alloc_init(&alloc_ops, sizeof(alloc_ops));
 
-    hashtable_init_ex(&alloc_stack_table, ASTACK_TABLE_HASH_BITS, HASH_CUSTOM,
-                      false/*!str_dup*/, false/*using external synch*/,
-                      alloc_callstack_free,
-                      (uint (*)(void*)) packed_callstack_hash,
-                      (bool (*)(void*, void*)) packed_callstack_cmp);
+    alloc_stack_trie = callstack_trie_create();
+    if (options.malloc_callstack_samples > 0) {
+        hashtable_init_ex(&alloc_site_table, ALLOC_SITE_TABLE_HASH_BITS, HASH_CUSTOM,
+                          false/*!str_dup*/, false/*!synch: we use the stack trie lock*/,
+                          alloc_site_free, alloc_site_hash, alloc_site_cmp);
+    }
 
 #ifdef UNIX
     hashtable_init(&sighand_table, SIGHAND_HASH_BITS, HASH_INTPTR, false/*!strdup*/);
-    mmap_tree = rb_tree_create(NULL);
+    mmap_tree = rb_tree_create_ex(NULL, RB_TREE_BTREE);
     mmap_tree_lock = dr_mutex_create();
 #endif
 
@@ -253,8 +302,28 @@ alloc_drmem_exit(void)
 {
     process_exiting = true;
     leak_exit();
-    alloc_exit(); /* must be before deleting alloc_stack_table */
-    hashtable_delete_with_stats(&alloc_stack_table, "alloc stack table");
+    alloc_exit(); /* must be before deleting alloc_stack_trie */
+    if (options.malloc_callstack_samples > 0) {
+        /* Report the estimated accuracy loss of reusing callstacks */
+        dr_fprintf(f_global, "malloc callstack sampling: %u full walks, %u reused, "
+                   "%u of %u revalidating walks differed from the reused callstack\n",
+                   alloc_site_walks, alloc_site_reuses, alloc_site_mismatches,
+                   alloc_site_revalidations);
+        LOG(1, "malloc callstack sampling: est. %u%% of reused callstacks are wrong\n",
+            alloc_site_revalidations == 0 ? 0 :
+            (uint)(((uint64)alloc_site_mismatches * 100) /
+                   alloc_site_revalidations));
+        /* Must be before deleting alloc_stack_trie */
+        callstack_trie_lock(alloc_stack_trie);
+        hashtable_delete(&alloc_site_table);
+        callstack_trie_unlock(alloc_stack_trie);
+    }
+    /* For -replace_malloc, this force-frees the remaining callstacks.  With
+     * wrapping, we rely on the malloc hashtable exit to free all references to
+     * these callstacks.  For replacing, there's no reason to iterate the heap
+     * just to clean these up.
+     */
+    callstack_trie_destroy(alloc_stack_trie);
 #ifdef UNIX
     hashtable_delete(&sighand_table);
     rb_tree_destroy(mmap_tree);
@@ -278,8 +347,10 @@ mmap_tree_add(byte *base, size_t size)
 {
     dr_mutex_lock(mmap_tree_lock);
     rb_node_t *node = rb_insert(mmap_tree, base, size, NULL);
-    if (node != NULL) {
-        /* merge overlap */
+    /* Merge with each overlapping region in turn: the new range may span
+     * several of them, and the insert fails until none are left.
+     */
+    while (node != NULL) {
         app_pc merge_base, merge_end;
         size_t merge_size;
         rb_node_fields(node, &merge_base, &merge_size, NULL);
@@ -289,8 +360,9 @@ mmap_tree_add(byte *base, size_t size)
         merge_base = (base < merge_base) ? base : merge_base;
         LOG(2, "mmap add: merged "PFX"-"PFX" with existing => "PFX"-"PFX"\n",
             base, base+size, merge_base, merge_end);
-        node = rb_insert(mmap_tree, merge_base, merge_end - merge_base, NULL);
-        ASSERT(node == NULL, "mmap tree error");
+        base = merge_base;
+        size = merge_end - merge_base;
+        node = rb_insert(mmap_tree, base, size, NULL);
     }
     dr_mutex_unlock(mmap_tree_lock);
 }
@@ -351,23 +423,13 @@ mmap_anon_lookup(byte *addr, byte **start OUT, size_t *size OUT)
 void
 alloc_callstack_lock(void)
 {
-    hashtable_lock(&alloc_stack_table);
+    callstack_trie_lock(alloc_stack_trie);
 }
 
 void
 alloc_callstack_unlock(void)
 {
-    hashtable_unlock(&alloc_stack_table);
-}
-
-void
-alloc_callstack_free(void *p)
-{
-    /* For -replace_malloc, we need to force-remove here.  With wrapping, we rely
-     * on the malloc hashtable exist to free all references to these callstacks.
-     * For replacing, there's no reason to iterate the heap just to clean these up.
-     */
-    packed_callstack_destroy(p);
+    callstack_trie_unlock(alloc_stack_trie);
 }
 
 void
@@ -376,19 +438,19 @@ shared_callstack_free(packed_callstack_t *pcs)
     uint count;
     if (pcs == NULL)
         return;
-    /* We need to synchronize removal from the table w/ additions */
-    hashtable_lock(&alloc_stack_table);
+    /* We need to synchronize removal from the trie w/ additions */
+    callstack_trie_lock(alloc_stack_trie);
     count = packed_callstack_free(pcs);
     LOG(4, "%s: freed pcs "PFX" => refcount %d\n", __FUNCTION__, pcs, count);
     ASSERT(count != 0, "refcount should not hit 0 in malloc_table");
     if (count == 1) {
-        /* One ref left, which must be the alloc_stack_table.
-         * packed_callstack_free will be called by hashtable_remove
-         * to dec refcount to 0 and do the actual free.
+        /* One ref left, which must be the alloc_stack_trie.
+         * packed_callstack_remove_from_trie will dec the refcount to 0
+         * and do the actual free.
          */
-        hashtable_remove(&alloc_stack_table, (void *)pcs);
+        packed_callstack_remove_from_trie(alloc_stack_trie, pcs);
     }
-    hashtable_unlock(&alloc_stack_table);
+    callstack_trie_unlock(alloc_stack_trie);
 }
 
 void
@@ -428,23 +490,146 @@ get_shared_callstack(packed_callstack_t *existing_data, dr_mcontext_t *mc,
         if (!options.replace_malloc)
             packed_callstack_first_frame_retaddr(pcs);
     }
-    /* XXX i#246: store last malloc callstack outside of hashtable,
-     * and only add to hashtable on next malloc, so that if freed
-     * right away we avoid the hashtable lookup+cmp+insert+remove
-     * costs
+    /* XXX i#246: store last malloc callstack outside of the trie,
+     * and only add to the trie on next malloc, so that if freed
+     * right away we avoid the lookup+insert+remove costs
      */
 
     /* Synchronization: we no longer rely on malloc_lock(), as we
      * don't enable a global lock for -replace_malloc: i#949.  Thus we
-     * must hold the hashtable lock across the lookup and ref count inc.
-     * shared_callstack_free() grabs the hashtable lock before the final
+     * must hold the trie lock across the lookup and ref count inc.
+     * shared_callstack_free() grabs the trie lock before the final
      * remove, ensuring pcs doesn't disappear underneath us.
      */
-    hashtable_lock(&alloc_stack_table);
-    pcs = packed_callstack_add_to_table(&alloc_stack_table, pcs
-                                        _IF_STATS(&alloc_stack_count));
-    LOG(4, "%s: created pcs "PFX"\n", __FUNCTION__, pcs);
-    hashtable_unlock(&alloc_stack_table);
+    callstack_trie_lock(alloc_stack_trie);
+    pcs = packed_callstack_add_to_trie(alloc_stack_trie, pcs
+                                       _IF_STATS(&alloc_stack_count));
+    LOG(4, "%s: created pcs "PFX" id %d\n", __FUNCTION__, pcs,
+        packed_callstack_trie_id(pcs));
+    callstack_trie_unlock(alloc_stack_trie);
+    return pcs;
+}
+
+static uint
+alloc_site_hash(void *key)
+{
+    alloc_site_key_t *site = (alloc_site_key_t *) key;
+    return (uint) (((ptr_uint_t)site->post_call) ^ (site->stack_depth << 7));
+}
+
+static bool
+alloc_site_cmp(void *key1, void *key2)
+{
+    alloc_site_key_t *site1 = (alloc_site_key_t *) key1;
+    alloc_site_key_t *site2 = (alloc_site_key_t *) key2;
+    return (site1->post_call == site2->post_call &&
+            site1->stack_depth == site2->stack_depth);
+}
+
+static void
+alloc_site_free(void *p)
+{
+    alloc_site_t *site = (alloc_site_t *) p;
+    /* Caller holds the stack trie lock, which is recursive */
+    shared_callstack_free(site->pcs);
+    global_free(site, sizeof(*site), HEAPSTAT_CALLSTACK);
+}
+
+/* Returns the distance of xsp from the top of the current thread's stack,
+ * or 0 if we do not know where that is.
+ */
+static size_t
+malloc_stack_depth(dr_mcontext_t *mc)
+{
+    byte *sp = (byte *) mc->xsp;
+    byte *top;
+#ifdef WINDOWS
+    TEB *teb = get_TEB();
+    top = teb->StackBase;
+#else
+    void *drcontext = dr_get_current_drcontext();
+    tls_drmem_t *pt = (tls_drmem_t *) drmgr_get_tls_field(drcontext, tls_idx_drmem);
+    if (pt == NULL)
+        return 0;
+    if (sp < pt->malloc_stack_lo || sp >= pt->malloc_stack_hi) {
+        /* First malloc on this thread, or we're on a different stack such as
+         * a sigaltstack: we only query when the stack changes.
+         */
+        dr_mem_info_t info;
+        if (!dr_query_memory_ex(sp, &info))
+            return 0;
+        pt->malloc_stack_lo = info.base_pc;
+        pt->malloc_stack_hi = info.base_pc + info.size;
+    }
+    top = pt->malloc_stack_hi;
+#endif
+    if (sp >= top)
+        return 0;
+    return top - sp;
+}
+
+/* Implements -malloc_callstack_samples: returns a callstack for this
+ * allocation, reusing the site's last callstack once it's been walked
+ * enough times.
+ */
+static packed_callstack_t *
+get_sampled_callstack(dr_mcontext_t *mc, app_pc post_call)
+{
+    alloc_site_key_t key;
+    alloc_site_t *site;
+    packed_callstack_t *pcs;
+    bool revalidating;
+    key.post_call = post_call;
+    key.stack_depth = malloc_stack_depth(mc);
+
+    callstack_trie_lock(alloc_stack_trie);
+    site = (alloc_site_t *) hashtable_lookup(&alloc_site_table, &key);
+    if (site != NULL && site->walks >= options.malloc_callstack_samples &&
+        site->reuses < ALLOC_SITE_REVALIDATE) {
+        pcs = site->pcs;
+        packed_callstack_add_ref(pcs);
+        site->reuses++;
+        alloc_site_reuses++;
+        callstack_trie_unlock(alloc_stack_trie);
+        return pcs;
+    }
+    callstack_trie_unlock(alloc_stack_trie);
+
+    pcs = get_shared_callstack(NULL, mc, post_call, options.malloc_max_frames);
+
+    callstack_trie_lock(alloc_stack_trie);
+    /* Re-lookup as we dropped the lock for the walk */
+    site = (alloc_site_t *) hashtable_lookup(&alloc_site_table, &key);
+    if (site == NULL) {
+        site = (alloc_site_t *) global_alloc(sizeof(*site), HEAPSTAT_CALLSTACK);
+        site->key = key;
+        site->walks = 0;
+        site->reuses = 0;
+        site->pcs = NULL;
+        hashtable_add(&alloc_site_table, &site->key, site);
+    }
+    /* Only a walk in place of a reuse tells us what reusing would have cost:
+     * while a site is still being learned, we weren't going to reuse.
+     */
+    revalidating = (site->walks >= options.malloc_callstack_samples);
+    if (revalidating)
+        alloc_site_revalidations++;
+    if (site->pcs != pcs) {
+        if (site->pcs != NULL) {
+            /* If revalidating, we would have reported the wrong callstack here */
+            if (revalidating)
+                alloc_site_mismatches++;
+            shared_callstack_free(site->pcs);
+            /* The site is not as stable as we thought: learn it again */
+            site->walks = 0;
+        }
+        packed_callstack_add_ref(pcs);
+        site->pcs = pcs;
+    }
+    site->reuses = 0;
+    site->walks++;
+    alloc_site_walks++;
+    callstack_trie_unlock(alloc_stack_trie);
     return pcs;
 }
 
@@ -453,6 +638,8 @@ client_add_malloc_pre(malloc_info_t *mal, dr_mcontext_t *mc, app_pc post_call)
 {
     if (!options.count_leaks && !options.track_origins_unaddr)
         return NULL;
+    if (options.malloc_callstack_samples > 0 && mal->client_data == NULL)
+        return (void *) get_sampled_callstack(mc, post_call);
     return (void *)
         get_shared_callstack((packed_callstack_t *)mal->client_data, mc, post_call,
                              options.malloc_max_frames);
@@ -695,6 +882,7 @@ client_remove_malloc_routine(void *client_data)
                 shared_callstack_free(info->delay_free_list[i].pcs);
             }
         }
+        delay_free_total_bytes -= info->delay_free_bytes;
         global_free(info->delay_free_list,
                     options.delay_frees * sizeof(*info->delay_free_list), HEAPSTAT_MISC);
         global_free(info, sizeof(*info), HEAPSTAT_MISC);
@@ -744,6 +932,7 @@ next_to_free(delay_free_info_t *info, int idx _IF_WINDOWS(ptr_int_t *auxarg OUT)
             ASSERT(false, "delay_free_tree inconsistent");
         }
         info->delay_free_bytes -= info->delay_free_list[idx].real_size;
+        delay_free_total_bytes -= info->delay_free_list[idx].real_size;
         STATS_ADD(delayed_free_bytes,
                   -(int)info->delay_free_list[idx].real_size);
         LOG(2, "%s: freeing "PFX"-"PFX
@@ -814,6 +1003,7 @@ client_handle_free(malloc_info_t *mal, byte *tofree, dr_mcontext_t *mc,
         }
         /* Store real base and real size: i.e., including redzones (PR 572716) */
         info->delay_free_bytes += tot_sz;
+        delay_free_total_bytes += tot_sz;
         if (info->delay_free_bytes > options.delay_frees_maxsz) {
             int head_start = info->delay_free_head;
             int idx = info->delay_free_head;
@@ -855,6 +1045,7 @@ client_handle_free(malloc_info_t *mal, byte *tofree, dr_mcontext_t *mc,
                 LOG(2, "malloc size %d larger than any entry + over size limit\n",
                     tot_sz);
                 info->delay_free_bytes -= tot_sz;
+                delay_free_total_bytes -= tot_sz;
                 dr_mutex_unlock(delay_free_lock);
                 if (options.pattern != 0) {
                     pattern_handle_real_free(mal, false);
@@ -1015,6 +1206,20 @@ client_handle_heap_destroy(void *drcontext, HANDLE heap, void *client_data)
 }
 #endif
 
+void
+alloc_drmem_get_usage(size_t *heap_capacity OUT, size_t *delayed OUT)
+{
+    if (options.replace_malloc) {
+        alloc_replace_get_usage(heap_capacity, delayed);
+        return;
+    }
+    /* the app's own heap holds the wrapped mallocs: we don't know its size */
+    if (heap_capacity != NULL)
+        *heap_capacity = 0;
+    if (delayed != NULL)
+        *delayed = delay_free_total_bytes; /* racy, but only for reporting */
+}
+
 bool
 overlaps_delayed_free(byte *start, byte *end,
                       byte **free_start OUT, /* app base */
@@ -1042,7 +1247,7 @@ overlaps_delayed_free(byte *start, byte *end,
             if (free_end != NULL)
                 *free_end = info.base + info.request_size;
             /* There can be a race where this client_data is freed (due to
-             * the delay-free or freed chunk being re-used), but our alloc_stack_table
+             * the delay-free or freed chunk being re-used), but our alloc_stack_trie
              * refcount keeps it alive for the process lifetime.  So I see no
              * reason to hold a lock, and esp not to clone it here.
              */
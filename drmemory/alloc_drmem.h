@@ -64,6 +64,13 @@ handle_removed_heap_region(app_pc start, app_pc end, dr_mcontext_t *mc);
 void
 check_reachability(bool at_exit);
 
+/* For memory usage reports: returns the bytes of heap space obtained from the
+ * OS (0 unless -replace_malloc) and the bytes held in delayed frees,
+ * including redzones.
+ */
+void
+alloc_drmem_get_usage(size_t *heap_capacity OUT, size_t *delayed OUT);
+
 /* Returns true if the overlap is in any portion of freed memory,
  * including padding and redzones.  The returned bounds can be used to
  * rule out padding and redzones if desired.
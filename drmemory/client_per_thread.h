@@ -70,8 +70,12 @@ typedef struct _tls_drmem_t {
     /* since we can't get TEB via syscall for some threads (i#442) */
     TEB *teb;
 #else
-    void *empty; /* not worth code ugliness to have no TLS at all */
+    /* for -malloc_callstack_samples: the stack region last seen at a malloc */
+    byte *malloc_stack_lo;
+    byte *malloc_stack_hi;
 #endif
+    /* for -phase_times: when the current bb's events began */
+    uint64 bb_start_usec;
 } tls_drmem_t;
 
 extern int tls_idx_drmem;
@@ -117,6 +117,9 @@ event_context_init(void *drcontext, bool new_depth);
 static void
 event_context_exit(void *drcontext, bool thread_exit);
 
+static void
+memusage_exit(void);
+
 /***************************************************************************
  * OPTIONS
  */
@@ -174,8 +177,8 @@ dump_statistics(void)
     dr_fprintf(f_global, "Statistics:\n");
     dr_fprintf(f_global, "nudges: %d\n", num_nudges);
     dr_fprintf(f_global, "basic blocks: %d\n", num_bbs);
-    dr_fprintf(f_global, "adjust_esp:%10u slow; %10u fast\n", adjust_esp_executions,
-               adjust_esp_fastpath);
+    dr_fprintf(f_global, "adjust_esp:%10u slow; %10u fast; %10u bulk\n",
+               adjust_esp_executions, adjust_esp_fastpath, adjust_esp_bulk);
     dr_fprintf(f_global, "slow_path invocations: %10u\n", slowpath_executions);
     dr_fprintf(f_global, "med_path invocations: %10u, fast movs: %10u, fast cmps: %10u\n",
                medpath_executions, movs4_med_fast, cmps1_med_fast);
@@ -275,6 +278,9 @@ dump_statistics(void)
     dr_fprintf(f_global, "pcaches loaded: %3u, base mismatch: %3u, written: %3u\n",
                pcaches_loaded, pcaches_mismatch, pcaches_written);
 
+    dr_fprintf(f_global, "syscall writes batched: %9u, unaddr fallback: %9u\n",
+               sysmem_batch_ranges, sysmem_batch_unaddr);
+
     dr_fprintf(f_global, "\nSystem calls invoked:\n");
     for (i = 0; i < MAX_SYSNUM; i++) {
         if (syscall_invoked[i] > 0) {
@@ -373,6 +379,82 @@ event_resurrect_ro(void *drcontext, void *perscxt, byte **map INOUT)
     return true;
 }
 
+/***************************************************************************
+ * PHASE TIMERS
+ *
+ * For -phase_times we measure startup, basic block building and
+ * instrumentation, and exit separately from the time the app spends running,
+ * with the leak scan and the error report split out of exit.  All times are
+ * in microseconds.
+ */
+
+static uint64 phase_init_start;
+static uint64 phase_init_end;
+static uint64 phase_exit_start;
+static uint64 phase_leakscan;
+static uint64 phase_report;
+static uint64 phase_bb_total; /* protected by phase_lock */
+static void *phase_lock;
+
+static dr_emit_flags_t
+phase_bb_start(void *drcontext, void *tag, instrlist_t *bb,
+               bool for_trace, bool translating)
+{
+    tls_drmem_t *pt = (tls_drmem_t *) drmgr_get_tls_field(drcontext, tls_idx_drmem);
+    pt->bb_start_usec = dr_get_microseconds();
+    return DR_EMIT_DEFAULT;
+}
+
+static dr_emit_flags_t
+phase_bb_end(void *drcontext, void *tag, instrlist_t *bb,
+             bool for_trace, bool translating)
+{
+    tls_drmem_t *pt = (tls_drmem_t *) drmgr_get_tls_field(drcontext, tls_idx_drmem);
+    uint64 elapsed = dr_get_microseconds() - pt->bb_start_usec;
+    dr_mutex_lock(phase_lock);
+    phase_bb_total += elapsed;
+    dr_mutex_unlock(phase_lock);
+    return DR_EMIT_DEFAULT;
+}
+
+/* Called at the end of dr_init */
+static void
+phase_times_init(void)
+{
+    drmgr_priority_t pri_start = {sizeof(pri_start), "drmemory.phase.start", NULL, NULL,
+                                  DRMGR_PRIORITY_APP2APP_PHASE};
+    drmgr_priority_t pri_end = {sizeof(pri_end), "drmemory.phase.end", NULL, NULL,
+                                DRMGR_PRIORITY_INSTRU2INSTRU_PHASE};
+    if (!options.phase_times)
+        return;
+    phase_lock = dr_mutex_create();
+    if (!drmgr_register_bb_app2app_event(phase_bb_start, &pri_start) ||
+        !drmgr_register_bb_instru2instru_event(phase_bb_end, &pri_end))
+        ASSERT(false, "drmgr registration failed");
+    phase_init_end = dr_get_microseconds();
+}
+
+/* Called at the end of event_exit, before the global log is closed */
+static void
+phase_times_report(void)
+{
+    uint64 now = dr_get_microseconds();
+    uint64 steady;
+    if (!options.phase_times)
+        return;
+    steady = phase_exit_start - phase_init_end;
+    /* nearly all bbs are built while the app runs, so take them out */
+    steady = (steady > phase_bb_total) ? steady - phase_bb_total : 0;
+    ELOGF(0, f_global, "PHASE TIMES (ms): startup=%u instrument=%u steady=%u "
+          "leakscan=%u report=%u exit=%u total=%u\n",
+          (uint)((phase_init_end - phase_init_start) / 1000),
+          (uint)(phase_bb_total / 1000), (uint)(steady / 1000),
+          (uint)(phase_leakscan / 1000), (uint)(phase_report / 1000),
+          (uint)((now - phase_exit_start) / 1000),
+          (uint)((now - phase_init_start) / 1000));
+    dr_mutex_destroy(phase_lock);
+}
+
 /***************************************************************************
  * DYNAMORIO EVENTS
  */
@@ -389,9 +471,14 @@ close_file(file_t f)
 static void
 event_exit(void)
 {
+    uint64 phase_start;
     LOGF(2, f_global, "in event_exit\n");
+    phase_exit_start = dr_get_microseconds();
 
     check_reachability(true/*at exit*/);
+    phase_leakscan = dr_get_microseconds() - phase_exit_start;
+    /* before we tear down the shadow and heap state that it reads */
+    memusage_exit();
 
     if (options.pause_at_exit)
         wait_for_user("pausing at exit");
@@ -418,8 +505,10 @@ event_exit(void)
     }
     hashtable_delete(&known_table);
 
+    phase_start = dr_get_microseconds();
     if (!options.perturb_only)
         report_exit();
+    phase_report = dr_get_microseconds() - phase_start;
 #ifdef USE_DRSYMS
     if (options.use_symcache)
         drsymcache_exit();
@@ -438,6 +527,7 @@ event_exit(void)
     heap_dump_stats(f_global);
 #endif
     print_timestamp_elapsed_to_file(f_global, "Exiting ");
+    phase_times_report();
 
     /* To help postprocess.pl to perform sideline processing of errors, we add
      * a few markers to the log files.
@@ -1468,6 +1558,120 @@ create_global_logfile(void)
 #endif
 }
 
+/***************************************************************************
+ * MEMORY USAGE
+ *
+ * For -memusage we write our own memory usage by category to memusage.csv,
+ * one row per nudge, at exit, and every -memusage_freq ms, so that a
+ * developer can graph where our footprint goes over a long run without
+ * needing a debug build.
+ */
+
+static file_t f_memusage = INVALID_FILE;
+static void *memusage_lock;
+static uint64 memusage_start;
+static volatile bool memusage_thread_exit;
+
+static void
+memusage_write_header(void)
+{
+    int i;
+    dr_fprintf(f_memusage, "time_ms,reason");
+    for (i = 0; i < HEAPSTAT_NUMTYPES; i++) {
+        const char *name = heap_stat_name(i);
+        dr_fprintf(f_memusage, ",%s_cur,%s_peak", name, name);
+    }
+#ifndef X64 /* 64-bit shadow memory is not made of blocks */
+    if (options.shadowing)
+        dr_fprintf(f_memusage, ",shadow_blocks_private,shadow_blocks_special");
+#endif
+    dr_fprintf(f_memusage, ",heap_capacity,delayed_free_bytes\n");
+}
+
+static void
+memusage_open(void)
+{
+    f_memusage = open_logfile("memusage.csv", false, -1);
+    memusage_write_header();
+}
+
+static void
+memusage_write(const char *reason)
+{
+    int i;
+    size_t cur, peak, capacity, delayed;
+    if (!options.memusage)
+        return;
+    dr_mutex_lock(memusage_lock);
+    if (f_memusage == INVALID_FILE) {
+        /* already closed at exit */
+        dr_mutex_unlock(memusage_lock);
+        return;
+    }
+    dr_fprintf(f_memusage, "%"UINT64_FORMAT_CODE",%s",
+               dr_get_milliseconds() - memusage_start, reason);
+    for (i = 0; i < HEAPSTAT_NUMTYPES; i++) {
+        heap_get_stats(i, &cur, &peak, NULL);
+        dr_fprintf(f_memusage, ","SZFMT","SZFMT, cur, peak);
+    }
+#ifndef X64
+    if (options.shadowing) {
+        uint num_private, num_special;
+        shadow_get_block_counts(&num_private, &num_special);
+        dr_fprintf(f_memusage, ",%u,%u", num_private, num_special);
+    }
+#endif
+    alloc_drmem_get_usage(&capacity, &delayed);
+    dr_fprintf(f_memusage, ","SZFMT","SZFMT"\n", capacity, delayed);
+    dr_mutex_unlock(memusage_lock);
+}
+
+static void
+memusage_thread(void *arg)
+{
+    /* We only read counters and write our own file, so there is no reason
+     * to hold up a synchall.
+     */
+    dr_client_thread_set_suspendable(false);
+    LOG(1, "memusage thread "TIDFMT" running\n",
+        dr_get_thread_id(dr_get_current_drcontext()));
+    while (!memusage_thread_exit) {
+        dr_sleep(options.memusage_freq);
+        if (memusage_thread_exit)
+            break;
+        memusage_write("timer");
+    }
+}
+
+static void
+memusage_init(void)
+{
+    if (!options.memusage)
+        return;
+    memusage_lock = dr_mutex_create();
+    memusage_start = dr_get_milliseconds();
+    memusage_open();
+    if (options.memusage_freq > 0) {
+        if (!dr_create_client_thread(memusage_thread, NULL)) {
+            ASSERT(false, "unable to create thread");
+        }
+    }
+}
+
+static void
+memusage_exit(void)
+{
+    if (!options.memusage)
+        return;
+    memusage_write("exit");
+    dr_mutex_lock(memusage_lock);
+    memusage_thread_exit = true;
+    close_file(f_memusage);
+    f_memusage = INVALID_FILE;
+    dr_mutex_unlock(memusage_lock);
+    /* The timer thread may still be asleep, so we leave the lock in place */
+}
+
 #ifdef UNIX
 static void
 event_fork(void *drcontext)
@@ -1478,6 +1682,17 @@ event_fork(void *drcontext)
 # endif
     close_file(f_global);
     create_global_logfile();
+    if (options.memusage) {
+        /* XXX: our timer thread does not survive the fork, so the child
+         * only gets nudge and exit rows.  The lock may have been held by
+         * another parent thread at the fork, so we make a new one rather
+         * than taking it.
+         */
+        memusage_lock = dr_mutex_create();
+        close_file(f_memusage);
+        memusage_start = dr_get_milliseconds();
+        memusage_open();
+    }
 
 # ifndef USE_DRSYMS
     /* PR 453867: tell postprocess.pl to fork a new copy.
@@ -1537,6 +1752,9 @@ nudge_leak_scan(void *drcontext)
     dump_statistics();
 #endif
     STATS_INC(num_nudges);
+    memusage_write("nudge");
+    if (options.memusage)
+        heap_dump_stats(f_global);
     if (options.perturb_only)
         return;
 #ifdef WINDOWS
@@ -1733,6 +1951,9 @@ dr_init(client_id_t id)
     module_data_t *data;
     const char *opstr;
 
+    /* recorded before we know whether -phase_times is on, as it's cheap */
+    phase_init_start = dr_get_microseconds();
+
     dr_set_client_name("Dr. Memory", "http://drmemory.org/issues");
 
     utils_early_init();
@@ -1762,6 +1983,8 @@ dr_init(client_id_t id)
     opstr = dr_get_options(client_id);
     ASSERT(opstr != NULL, "error obtaining option string");
     drmem_options_init(opstr);
+    if (options.memusage)
+        heap_enable_stats();
 
     drmgr_init(); /* must be before utils_init and any other tls/cls uses */
     tls_idx_drmem = drmgr_register_tls_field();
@@ -1915,4 +2138,9 @@ dr_init(client_id_t id)
         perturb_init();
 
     instrument_init();
+
+    memusage_init();
+
+    /* last, so startup includes everything else */
+    phase_times_init();
 }
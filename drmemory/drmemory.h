@@ -36,6 +36,8 @@ extern client_id_t client_id;
 
 /* instrumentation ordering */
 enum {
+    /* -phase_times brackets all other bb events */
+    DRMGR_PRIORITY_APP2APP_PHASE    = -10000,
     /* replace first, then app2app */
 #if 0
     DRMGR_PRIORITY_APP2APP_DRWRAP   = -500, /* from drwrap.h */
@@ -64,6 +66,7 @@ enum {
     /* we need our alloc wrapping to go after CLS tracking */
     DRMGR_PRIORITY_INSERT_ALLOC     = 2020, /* from alloc.h */
 #endif
+    DRMGR_PRIORITY_INSTRU2INSTRU_PHASE = 10000,
 };
 
 /***************************************************************************
@@ -339,6 +339,12 @@ reg_ok_for_fastpath(int opc, opnd_t reg, bool dst)
              reg_is_mmx(r)));
 }
 
+/* Stack operations are pointer-sized: on 64-bit the push and pop memrefs
+ * are 8 bytes, shadowed by 2 shadow bytes.  We leave pushf and popf, with
+ * their special eflags shadow handling, and push of memory to the slowpath.
+ */
+#define STACKOP_8BYTE IF_X64_ELSE(true, false)
+
 /* Up to caller to check rest of reqts for 8+-byte */
 static bool
 memop_ok_for_fastpath(opnd_t memop, bool allow8plus)
@@ -459,11 +465,11 @@ instr_ok_for_instrument_fastpath(instr_t *inst, fastpath_info_t *mi, bb_info_t *
     case OP_call_ind:
         /* all have dst0=esp, dst1=(esp), src0=imm/reg/pc/mem, src1=esp */
         if (opnd_get_reg(instr_get_dst(inst, 0)) != DR_REG_XSP ||
-            opnd_get_size(instr_get_dst(inst, 1)) != OPSZ_4)
+            opnd_get_size(instr_get_dst(inst, 1)) != OPSZ_PTR)
             return false;
         if (opc == OP_push_imm || opc == OP_call) {
             mi->dst[0].app = instr_get_dst(inst, 1);
-            if (!memop_ok_for_fastpath(mi->dst[0].app, false/*no 8-byte*/))
+            if (!memop_ok_for_fastpath(mi->dst[0].app, STACKOP_8BYTE))
                 return false;
             mi->store = true;
             mi->pushpop = true;
@@ -474,7 +480,7 @@ instr_ok_for_instrument_fastpath(instr_t *inst, fastpath_info_t *mi, bb_info_t *
              * ok to propagate (instead of propagating the immed==always defined)
              */
             mi->dst[0].app = instr_get_dst(inst, 1);
-            if (!memop_ok_for_fastpath(mi->dst[0].app, false/*no 8-byte*/))
+            if (!memop_ok_for_fastpath(mi->dst[0].app, STACKOP_8BYTE))
                 return false;
             mi->src[0].app = instr_get_src(inst, 0);
             mi->store = true;
@@ -509,13 +515,13 @@ instr_ok_for_instrument_fastpath(instr_t *inst, fastpath_info_t *mi, bb_info_t *
         return true;
     case OP_pop:
         if (opnd_get_reg(instr_get_dst(inst, 1)) != DR_REG_XSP ||
-            opnd_get_size(instr_get_src(inst, 1)) != OPSZ_4)
+            opnd_get_size(instr_get_src(inst, 1)) != OPSZ_PTR)
             return false;
         mi->dst[0].app = instr_get_dst(inst, 0);
         if (opnd_is_reg(mi->dst[0].app)) {
             if (reg_ok_for_fastpath(opc, mi->dst[0].app, true/*dst*/)) {
                 mi->src[0].app = instr_get_src(inst, 1);
-                if (!memop_ok_for_fastpath(mi->src[0].app, false/*no 8-byte*/))
+                if (!memop_ok_for_fastpath(mi->src[0].app, STACKOP_8BYTE))
                     return false;
                 if (!reg_ignore_for_fastpath(opc, mi->dst[0].app, true/*dst*/))
                     mi->dst[0].app = mi->dst[0].app;
@@ -545,11 +551,11 @@ instr_ok_for_instrument_fastpath(instr_t *inst, fastpath_info_t *mi, bb_info_t *
         /* both a reg-reg move and a pop */
         if (opnd_get_reg(instr_get_dst(inst, 0)) != DR_REG_XSP ||
             opnd_get_reg(instr_get_dst(inst, 1)) != DR_REG_XBP ||
-            opnd_get_size(instr_get_src(inst, 2)) != OPSZ_4)
+            opnd_get_size(instr_get_src(inst, 2)) != OPSZ_PTR)
             return false;
         /* pop into ebp */
         mi->src[0].app = instr_get_src(inst, 2); /* stack memref */
-        if (!memop_ok_for_fastpath(mi->src[0].app, false/*no 8-byte*/))
+        if (!memop_ok_for_fastpath(mi->src[0].app, STACKOP_8BYTE))
             return false;
         mi->dst[0].app = instr_get_dst(inst, 1); /* ebp */
         if (!reg_ok_for_fastpath(opc, mi->dst[0].app, true/*dst*/))
@@ -568,16 +574,16 @@ instr_ok_for_instrument_fastpath(instr_t *inst, fastpath_info_t *mi, bb_info_t *
          * adjustment is handled separately (it doesn't read those bytes)
          */
         mi->src[0].app = instr_get_src(inst, instr_num_srcs(inst)-1);
-        /* L4 ret may have this size.  will encode as OPSZ_4 b/c there's
+        /* L4 ret may have this size.  will encode as OPSZ_PTR b/c there's
          * no other data prefix constraint.
          */
         if (opnd_get_size(mi->src[0].app) == OPSZ_ret)
-            opnd_set_size(&mi->src[0].app, OPSZ_4);
+            opnd_set_size(&mi->src[0].app, OPSZ_PTR);
         if (opnd_get_reg(instr_get_dst(inst, 0)) != DR_REG_XSP ||
-            opnd_get_size(mi->src[0].app) != OPSZ_4)
+            opnd_get_size(mi->src[0].app) != OPSZ_PTR)
             return false;
         ASSERT(opnd_is_memory_reference(mi->src[0].app), "internal opnd num error");
-        if (!memop_ok_for_fastpath(mi->src[0].app, false/*no 8-byte*/))
+        if (!memop_ok_for_fastpath(mi->src[0].app, STACKOP_8BYTE))
             return false;
         mi->load = true;
         mi->pushpop = true;
@@ -874,8 +880,11 @@ adjust_opnds_for_fastpath(instr_t *inst, fastpath_info_t *mi)
             ASSERT(opnd_same(mem2op, mi->src[1].app), "load2x 2nd mem can't be stack op");
             ASSERT(mem2sz == mi->memsz, "load2x 2nd mem must be same size as 1st");
         }
-        /* stack ops are the ones that vary and might reach 8+ */
+        /* stack ops are the ones that vary and might reach 8+: we only
+         * support pointer-sized ones
+         */
         if (!(((mi->memsz == 8 || mi->memsz == 16 || mi->memsz == 10) && !mi->pushpop) ||
+              (mi->memsz == sizeof(void*) && mi->pushpop) ||
               mi->memsz == 4 || mi->memsz == 2 || mi->memsz == 1)) {
             return false; /* needs slowpath */
         }
@@ -4800,8 +4809,10 @@ instrument_fastpath(void *drcontext, instrlist_t *bb, instr_t *inst,
          */
         ASSERT(mi->reg1.used && mi->reg2.used, "internal reg spill error");
         ASSERT(!mi->need_offs, "assuming don't need mi->reg2_8h");
+        /* an 8-byte pop's slot is shadowed by 2 shadow bytes */
         PRE(bb, inst,
             INSTR_CREATE_movzx(drcontext, opnd_create_reg(mi->reg2.reg),
+                               (mi->memsz == 8) ? OPND_CREATE_MEM16(mi->reg1.reg, 0) :
                                OPND_CREATE_MEM8(mi->reg1.reg, 0)));
     }
 
@@ -5050,8 +5061,11 @@ instrument_fastpath(void *drcontext, instrlist_t *bb, instr_t *inst,
             if (options.check_push) {
                 ASSERT(mi->reg1.used, "internal reg spill error");
                 PRE(bb, inst,
-                    INSTR_CREATE_cmp(drcontext, OPND_CREATE_MEM8(mi->reg1.reg, 0),
-                                     OPND_CREATE_INT8((char)SHADOW_DWORD_UNADDRESSABLE)));
+                    INSTR_CREATE_cmp(drcontext,
+                                     (mi->memsz == 8) ?
+                                     OPND_CREATE_MEM16(mi->reg1.reg, 0) :
+                                     OPND_CREATE_MEM8(mi->reg1.reg, 0),
+                                     shadow_immed(mi->memsz, SHADOW_UNADDRESSABLE)));
                 add_jcc_slowpath(drcontext, bb, inst,
                                  (check_ignore_unaddr || mi->memsz < 4) ?
                                  OP_jne : OP_jne_short, mi);
@@ -5192,8 +5206,11 @@ instrument_fastpath(void *drcontext, instrlist_t *bb, instr_t *inst,
         opnd_info_t dst, src;
         initialize_opnd_info(&dst);
         initialize_opnd_info(&src);
-        dst.shadow = OPND_CREATE_MEM8(mi->reg1.reg, 0);
-        src.shadow = OPND_CREATE_INT8((char)SHADOW_DWORD_UNADDRESSABLE);
+        dst.shadow = (mi->memsz == 8) ? OPND_CREATE_MEM16(mi->reg1.reg, 0) :
+            OPND_CREATE_MEM8(mi->reg1.reg, 0);
+        /* -lazy_stack keeps the stack below xsp undefined */
+        src.shadow = shadow_immed(mi->memsz, options.lazy_stack ?
+                                  SHADOW_UNDEFINED : SHADOW_UNADDRESSABLE);
         ASSERT(mi->reg2.used, "internal reg spill error");
         add_dst_shadow_write(drcontext, bb, inst, mi, dst, src, mi->src_opsz,
                              instr_is_return(inst) ? mi->src_opsz : mi->opsz,
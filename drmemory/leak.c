@@ -396,7 +396,7 @@ typedef struct _unreach_entry_t {
 static unreach_entry_t *
 unreach_entry_alloc(void)
 {
-    unreach_entry_t *e = global_alloc(sizeof(*e), HEAPSTAT_MISC);
+    unreach_entry_t *e = global_alloc(sizeof(*e), HEAPSTAT_LEAK);
     memset(e, 0, sizeof(*e));
     return e;
 }
@@ -408,7 +408,7 @@ rb_cleanup_entries(rb_node_t *node, void *iter_data)
     ASSERT(node != NULL, "invalid param");
     rb_node_fields(node, NULL, NULL, (void*)&e);
     if (e != NULL)
-        global_free(e, sizeof(*e), HEAPSTAT_MISC);
+        global_free(e, sizeof(*e), HEAPSTAT_LEAK);
     return true;
 }
 
@@ -1022,7 +1022,7 @@ check_reachability_pointer(byte *pointer, byte *ptr_addr, byte *defined_end,
         ASSERT(found, "malloc chunk must be in hashtable");
         ASSERT(!add_reachable || data->primary_scan, "only add reachable in primary");
         /* Add to queue of chunks to scan */
-        add = (pc_entry_t *) global_alloc(sizeof(*add), HEAPSTAT_MISC);
+        add = (pc_entry_t *) global_alloc(sizeof(*add), HEAPSTAT_LEAK);
         add->start = chunk_start;
         add->end = chunk_end;
         add->next = NULL;
@@ -1256,19 +1256,42 @@ malloc_iterate_cb(malloc_info_t *info, void *iter_data)
     return true;
 }
 
+/* The chunks gathered for bulk loading into the alloc tree */
+typedef struct _alloc_array_t {
+    rb_bulk_entry_t *entries;
+    uint num;
+    uint capacity;
+} alloc_array_t;
+
+#define ALLOC_ARRAY_INITIAL_CAPACITY 1024
+
 static bool
 malloc_iterate_build_tree_cb(malloc_info_t *info, void *iter_data)
 {
-    rb_tree_t *alloc_tree = (rb_tree_t *) iter_data;
-    IF_DEBUG(rb_node_t *node;)
-    ASSERT(alloc_tree != NULL, "invalid iteration data");
+    alloc_array_t *array = (alloc_array_t *) iter_data;
+    rb_bulk_entry_t *entry;
+    ASSERT(array != NULL, "invalid iteration data");
+    if (array->num == array->capacity) {
+        uint new_capacity = (array->capacity == 0) ?
+            ALLOC_ARRAY_INITIAL_CAPACITY : array->capacity * 2;
+        rb_bulk_entry_t *grown = (rb_bulk_entry_t *)
+            global_alloc(new_capacity * sizeof(*grown), HEAPSTAT_LEAK);
+        if (array->entries != NULL) {
+            memcpy(grown, array->entries, array->num * sizeof(*grown));
+            global_free(array->entries, array->capacity * sizeof(*grown),
+                        HEAPSTAT_LEAK);
+        }
+        array->entries = grown;
+        array->capacity = new_capacity;
+    }
+    entry = &array->entries[array->num++];
+    entry->base = info->base;
+    entry->size = info->request_size;
     /* We use NULL for client b/c we only need unreach_entry_t for the
      * leaks, a small fraction (for most apps!) of the total and thus
      * best allocated lazily
      */
-    IF_DEBUG(node = )
-        rb_insert(alloc_tree, info->base, info->request_size, NULL);
-    ASSERT(node == NULL, "mallocs should not overlap");
+    entry->client = NULL;
     return true;
 }
 
@@ -1333,6 +1356,7 @@ leak_scan_for_leaks(bool at_exit)
     uint num_threads = 0, i;
     dr_mcontext_t mc; /* do not init whole thing: memset is expensive */
     reachability_data_t data;
+    alloc_array_t allocs;
     void *my_drcontext = dr_get_current_drcontext();
     dr_mem_info_t mem_info;
 #ifdef DEBUG
@@ -1381,7 +1405,7 @@ leak_scan_for_leaks(bool at_exit)
         }
         /* Restore app's PEB and TEB fields (i#248) */
         /* Store prior state (+1 for cur thread) (i#5) */
-        was_app_state = (bool *) global_alloc((num_threads+1)*sizeof(bool), HEAPSTAT_MISC);
+        was_app_state = (bool *) global_alloc((num_threads+1)*sizeof(bool), HEAPSTAT_LEAK);
         for (i = 0; i < num_threads; i++)
             prepare_thread_for_scan(drcontexts[i], &was_app_state[i]);
         prepare_thread_for_scan(my_drcontext, &was_app_state[num_threads]);
@@ -1389,7 +1413,10 @@ leak_scan_for_leaks(bool at_exit)
 
     memset(&data, 0, sizeof(data));
     data.primary_scan = true;
-    data.alloc_tree = rb_tree_create(NULL);
+    /* The alloc tree is built once and then only looked up, over and over,
+     * which is the case the B-tree is best at.
+     */
+    data.alloc_tree = rb_tree_create_ex(NULL, RB_TREE_BTREE);
     data.stack_tree = rb_tree_create(NULL);
     /* get the lowest allocated memory */
     dr_query_memory_ex(NULL, &mem_info);
@@ -1403,8 +1430,16 @@ leak_scan_for_leaks(bool at_exit)
      * useful later on.  I have measured the cost of having the malloc
      * hashtable be an rbtree instead, avoiding this creation, but the extra
      * overhead shows up on heap-intensive bmarks (PR 535568).
+     * We gather the chunks first so the tree can be bulk loaded with packed
+     * nodes rather than built by one insertion at a time.
      */
-    malloc_iterate(malloc_iterate_build_tree_cb, (void *) data.alloc_tree);
+    memset(&allocs, 0, sizeof(allocs));
+    malloc_iterate(malloc_iterate_build_tree_cb, (void *) &allocs);
+    rb_bulk_load(data.alloc_tree, allocs.entries, allocs.num);
+    if (allocs.entries != NULL) {
+        global_free(allocs.entries, allocs.capacity * sizeof(*allocs.entries),
+                    HEAPSTAT_LEAK);
+    }
 
     if (!at_exit || !op_have_defined_info) {
         /* Walk the thread's registers.  We rely on mcontext field ordering here. */
@@ -1425,7 +1460,7 @@ leak_scan_for_leaks(bool at_exit)
     for (e = data.reachq_head; e != NULL; e = next_e) {
         check_reachability_helper(e->start, e->end, false, &data);
         next_e = e->next;
-        global_free(e, sizeof(*e), HEAPSTAT_MISC);
+        global_free(e, sizeof(*e), HEAPSTAT_LEAK);
     }
     data.primary_scan = false;
 
@@ -1451,7 +1486,7 @@ leak_scan_for_leaks(bool at_exit)
             check_reachability_helper(e->start, e->end, false, &data);
         }
         next_e = e->next;
-        global_free(e, sizeof(*e), HEAPSTAT_MISC);
+        global_free(e, sizeof(*e), HEAPSTAT_LEAK);
     }
 
     /* we must restore prior to any symbol lookup (i#324) */
@@ -1462,7 +1497,7 @@ leak_scan_for_leaks(bool at_exit)
     }
     if (was_app_state != NULL) {
         restore_thread_after_scan(my_drcontext, was_app_state[num_threads]);
-        global_free(was_app_state, (num_threads+1)*sizeof(bool), HEAPSTAT_MISC);
+        global_free(was_app_state, (num_threads+1)*sizeof(bool), HEAPSTAT_LEAK);
     }
 
     /* up to caller to call report_leak_stats_{checkpoint,revert} if desired */
@@ -535,6 +535,12 @@ options_init(const char *opstr)
         options.check_stack_access = true;
         options.check_alignment = true;
     }
+    if (options.lazy_stack) {
+        if (!options.check_uninitialized)
+            usage_error("-lazy_stack only valid w/ -check_uninitialized", "");
+        /* pushes now target undefined rather than unaddressable memory */
+        options.check_push = false;
+    }
 # ifdef WINDOWS
     if (options.visual_studio) {
         /* Allow earlier options to override by checking all for whether specified.
@@ -234,6 +234,9 @@ OPTION_CLIENT(client, callstack_max_frames, uint, 20, 0, 4096,
 OPTION_CLIENT(client, malloc_max_frames, uint, 12, 0, 4096,
               "How many call stack frames to record on each malloc",
               "How many call stack frames to record on each malloc, for use in leak error reports as well as alloc/free mismatch error reports.  A larger maximum will ensure that no call stack is truncated, but can use more memory and slow down the tool.")
+OPTION_CLIENT(client, malloc_callstack_samples, uint, 0, 0, UINT_MAX,
+              "Reuse malloc call stacks after this many walks per allocation site",
+              "If non-zero, once the full call stack has been recorded this many times for an allocation site, later allocations from that site reuse the most recently recorded call stack rather than walking the stack.  A site is identified by the return address into the caller of the allocation routine and by the stack depth at the call.  Each site's call stack is walked again after every 1024 reuses, and a site whose walk disagrees goes back to walking every time until it is stable again.  This can greatly reduce overhead for applications that make many allocation calls, at the cost of occasionally attributing an allocation (and thus a leak) to a call stack that differs from the real one in its outer frames.  The number of full walks that disagreed with the site's prior call stack is written to the log file at exit as an estimate of this accuracy loss.  A value of 0 records the full call stack for every allocation.")
 OPTION_CLIENT(client, free_max_frames, uint, 6, 0, 4096,
               "How many call stack frames to record on each free",
               "If -delay_frees_stack is enabled, this controls how many call stack frames to record for each use-after-free informational report.  A larger maximum will ensure that no call stack is truncated, but can use more memory and slow down the tool.")
@@ -313,6 +316,9 @@ OPTION_CLIENT_BOOL(client, callstack_use_top_fp_selectively, true,
 OPTION_CLIENT_BOOL(client, callstack_use_fp, true,
               "Use frame pointers to walk the callstack",
               "Whether to use frame pointers at all.  The -callstack_use_top_fp and -callstack_use_top_fp_selectively options control whether to use the top frame pointer.  This option controls whether to continue walking the frame pointer chain.  Turning this off may be necessary if a mixture of frame pointer optimized code and un-optimized code is in use in the application, to avoid skipping interior callstack frames.")
+OPTION_CLIENT_BOOL(client, callstack_use_unwind_info, true,
+              "Use .eh_frame unwind information to walk the callstack",
+              "Whether to use the unwind information in each module's .eh_frame section to locate the next stack frame when the frame pointer chain is broken, before falling back to a stack scan.  This is both faster and more accurate than scanning for frames in code built without frame pointers.  This option is only supported on Linux.")
 OPTION_CLIENT_BOOL(client, callstack_conservative, false,
               "Perform extra checks for more accurate callstacks",
               "By default, callstack walking is tuned for performance.  It is possible to miss some frames when application code is optimized.  Enabling this option causes extra checks to be performed to attempt to create more accurate callstacks.  These checks add extra overhead.")
@@ -493,6 +499,9 @@ OPTION_CLIENT_BOOL(drmemscope, check_uninitialized, IF_X64_ELSE(false, true),
 OPTION_CLIENT_BOOL(drmemscope, check_stack_bounds, false,
                    "For -no_check_uninitialized, whether to check for beyond-top-of-stack accesses",
                    "Only applies for -no_check_uninitialized.  Determines whether to check for beyond-top-of-stack accesses.")
+OPTION_CLIENT_BOOL(drmemscope, lazy_stack, false,
+                   "For -check_uninitialized, update stack shadow memory lazily",
+                   "Only applies for -check_uninitialized.  Rather than marking stack memory as unaddressable when it is de-allocated and as uninitialized when it is allocated again, keep all memory beyond the top of the stack marked as uninitialized.  Then allocating stack memory that the thread has used before needs no shadow memory update at all, which reduces the overhead of code that makes many calls or recursive calls.  The cost is that accesses beyond the top of the stack are not reported as unaddressable accesses, though reading such memory still results in an uninitialized read error.  Furthermore, memory beyond the top of the stack that is written by the application, by the kernel (e.g., a signal frame), or as part of the x86-64 red zone stays marked as defined until the stack pointer drops below the deepest point it has reached before, so uninitialized reads of that memory after it is re-allocated are not reported.")
 OPTION_CLIENT_BOOL(drmemscope, check_stack_access, false,
                    "For -no_check_uninitialized, whether to check for errors on stack or frame references",
                    "Only applies for -no_check_uninitialized.  Determines whether to check for errors on memory references that use %esp or %ebp as a base.  These are normally local variable and function parameter references only, but for optimized or unusual code they could point elsewhere in memory.  Checking these incurs additional overhead.")
@@ -601,6 +610,9 @@ OPTION_CLIENT_BOOL(internal, use_stderr, true,
 OPTION_CLIENT_BOOL(internal, shadowing, true,
                    "Enable memory shadowing",
                    "For debugging and -leaks_only and -perturb_only modes: can disable all shadowing and do nothing but track mallocs")
+OPTION_CLIENT_BOOL(internal, shadow_inline_xl8, false,
+                   "Translate to shadow memory without a table lookup (32-bit only)",
+                   "On 32-bit, try to reserve a single region holding the shadow memory of the whole address space, so that translating an application address to its shadow address is a shift and an add rather than a shift and a load from the shadow table.  This removes one dependent load from each instrumented memory reference.  Shadow memory in the region is committed as it is touched.  If the region (1GB) cannot be reserved, the shadow table is used.  Has no effect on 64-bit, which never uses a table.")
 OPTION_CLIENT_BOOL(internal, track_allocs, true,
                    "Enable malloc and alloc syscall tracking",
                    "for debugging and -leaks_only and -perturb_only modes: can disable all malloc and alloc syscall tracking")
@@ -619,6 +631,9 @@ OPTION_CLIENT_BOOL(internal, fastpath, true,
 OPTION_CLIENT_BOOL(internal, esp_fastpath, true,
                    "Enable esp-adjust fastpath",
                    "Enable esp-adjust fastpath")
+OPTION_CLIENT(internal, stack_bulk_threshold, int, 0x4000, 0, INT_MAX,
+              "Stack change amount to update in bulk",
+              "The esp-adjust fastpath marks shadow memory, or for -leaks_only zeroes stack memory, one dword at a time.  A stack adjustment larger than this amount that is not a swap is instead handled out of line with a single bulk update.  0 disables bulk updates.")
 OPTION_CLIENT_BOOL(internal, shared_slowpath, true,
                    "Enable shared slowpath calling code",
                    "Enable shared slowpath calling code")
@@ -652,6 +667,15 @@ OPTION_CLIENT_BOOL(internal, statistics, false,
 OPTION_CLIENT(internal, stats_dump_interval, uint, 500000, 1, UINT_MAX,
               "How often to dump statistics, in units of slowpath executions",
               "How often to dump statistics, in units of slowpath executions")
+OPTION_CLIENT_BOOL(internal, memusage, false,
+                   "Write the tool's own memory usage to memusage.csv",
+                   "Record "TOOLNAME"'s own memory usage, broken down by category, as comma-separated rows in memusage.csv in the log directory: one row at each nudge, one at exit, and one every -memusage_freq milliseconds.  Each row has the current and peak heap bytes of each internal category (shadow memory, callstacks, error reports, leak scanning, and so on), the number of private and shared shadow memory blocks (32-bit only), the space the -replace_malloc heap obtained from the system, and the bytes held in delayed frees.")
+OPTION_CLIENT(internal, memusage_freq, uint, 0, 0, UINT_MAX,
+              "Interval in milliseconds between -memusage rows",
+              "If non-zero, -memusage also writes a row every -memusage_freq milliseconds from a separate thread.  If zero, rows are only written at each nudge and at exit.")
+OPTION_CLIENT_BOOL(internal, phase_times, false,
+                   "Time each phase of the run",
+                   "Measure how long "TOOLNAME" spends starting up, building and instrumenting basic blocks, running the application, and exiting, with the leak scan and the error report timed separately, and write the results to the global log file as a PHASE TIMES line.")
 /* We don't want or need this on Linux (xref i#1295) */
 OPTION_CLIENT_BOOL(internal, define_unknown_regions, IF_WINDOWS_ELSE(true, false),
                    "Mark unknown regions as defined",
@@ -659,6 +683,9 @@ OPTION_CLIENT_BOOL(internal, define_unknown_regions, IF_WINDOWS_ELSE(true, false
 OPTION_CLIENT_BOOL(internal, replace_libc , true,
                    "Replace libc str/mem routines w/ our own versions",
                    "Replace libc str/mem routines w/ our own versions")
+OPTION_CLIENT_BOOL(internal, replace_libc_native, true,
+                   "Run libc routine replacements natively when no error is possible",
+                   "When the shadow memory shows that a large memcpy, memmove, or memset can raise no error, perform it natively and update the shadow in bulk rather than running our replacement routine's instrumented loop.  Similarly, once a string routine replacement (strlen, strchr, strcmp, strstr, and their relatives) has scanned a short prefix, it scans the rest natively and then confirms that every byte it examined was defined.  Otherwise, the instrumented loop is used and reports errors as usual.")
 OPTION_CLIENT_STRING(internal, libc_addrs, "",
                      /* XXX: should we expose this option, or should users w/ custom
                       * or inlined versions be expected to use suppression?
@@ -1509,7 +1509,8 @@ pattern_init(void)
 {
     ASSERT(options.pattern != 0, "should not be called");
     if (options.pattern_use_malloc_tree) {
-        pattern_malloc_tree = rb_tree_create(NULL);
+        /* queried for every access that finds the pattern, so lookups dominate */
+        pattern_malloc_tree = rb_tree_create_ex(NULL, RB_TREE_BTREE);
         pattern_malloc_tree_rwlock = dr_rwlock_create();
     }
     note_base = drmgr_reserve_note_range(NOTE_MAX_VALUE);
@@ -386,21 +386,26 @@ is_spill_slot_opnd(void *drcontext, opnd_t op)
  * the non-directly-addressable DR slots (only 3 are direct)
  */
 
-#ifdef UNIX
 /* Data for which we need direct addressability access from instrumentation */
 typedef struct _tls_instru_t {
+#ifdef UNIX
     /* We store segment bases here for dynamic access from thread-shared code */
     byte *app_fs_base;
     byte *app_gs_base;
     byte *dr_fs_base;
     byte *dr_gs_base;
+#endif
+    /* For -lazy_stack: the lowest stack address whose shadow we've set.
+     * Must be last: it is only allocated with -lazy_stack, so that otherwise
+     * the spill slots are where they have always been (on Windows they
+     * start right at the base).
+     */
+    byte *stack_low_water;
 } tls_instru_t;
 /* followed by reg spill slots */
-# define NUM_INSTRU_TLS_SLOTS (sizeof(tls_instru_t)/sizeof(byte *))
-#else
-# define NUM_INSTRU_TLS_SLOTS 0
-/* just reg spill slots */
-#endif
+#define NUM_INSTRU_TLS_SLOTS \
+    ((sizeof(tls_instru_t) - (options.lazy_stack ? 0 : sizeof(byte *))) / \
+     sizeof(byte *))
 
 #define NUM_TLS_SLOTS (NUM_INSTRU_TLS_SLOTS + options.num_spill_slots)
 
@@ -512,13 +517,14 @@ instru_tls_thread_init(void *drcontext)
     LOG(1, "app: fs base="PFX", gs base="PFX"\n"
         "dr: fs base"PFX", gs base="PFX"\n",
         app_fs_base, app_gs_base, dr_fs_base, dr_gs_base);
-    /* store in per-thread data struct so we can access from another thread */
-    drmgr_set_tls_field(drcontext, tls_idx_instru, (void *) tls);
 #else
-    /* store in per-thread data struct so we can access from another thread */
-    drmgr_set_tls_field(drcontext, tls_idx_instru, (void *)
-                        (get_own_seg_base() + tls_instru_base));
+    tls_instru_t *tls = (tls_instru_t *) (get_own_seg_base() + tls_instru_base);
 #endif
+    /* nothing is known about this thread's stack yet */
+    if (options.lazy_stack)
+        tls->stack_low_water = (byte *) POINTER_MAX;
+    /* store in per-thread data struct so we can access from another thread */
+    drmgr_set_tls_field(drcontext, tls_idx_instru, (void *) tls);
 }
 
 static void
@@ -573,6 +579,32 @@ set_own_tls_value(uint index, ptr_uint_t val)
     }
 }
 
+opnd_t
+opnd_create_stack_low_water_slot(void)
+{
+    ASSERT(INSTRUMENT_MEMREFS() && options.lazy_stack, "incorrectly called");
+    return opnd_create_far_base_disp_ex
+        (seg_tls, REG_NULL, REG_NULL, 0,
+         tls_instru_base + offsetof(tls_instru_t, stack_low_water), OPSZ_PTR,
+         false, true, false);
+}
+
+byte *
+get_stack_low_water(void)
+{
+    tls_instru_t *tls = (tls_instru_t *) (get_own_seg_base() + tls_instru_base);
+    ASSERT(options.lazy_stack, "slot only allocated for -lazy_stack");
+    return tls->stack_low_water;
+}
+
+void
+set_stack_low_water(byte *val)
+{
+    tls_instru_t *tls = (tls_instru_t *) (get_own_seg_base() + tls_instru_base);
+    ASSERT(options.lazy_stack, "slot only allocated for -lazy_stack");
+    tls->stack_low_water = val;
+}
+
 ptr_uint_t
 get_thread_tls_value(void *drcontext, uint index)
 {
@@ -4004,10 +4036,12 @@ instr_shared_slowpath_decode_pc(instr_t *inst, fastpath_info_t *mi,
         *decode_pc_opnd = OPND_CREATE_INTPTR(pc);
         return true;
     } else {
-        if (options.replace_malloc && alloc_entering_replace_routine(pc)) {
+        if ((options.replace_malloc && alloc_entering_replace_routine(pc)) ||
+            in_replace_routine(pc)) {
             /* drwrap_replace_native() emulates a push for call site
              * replacement via generated instrs whose app pcs do not match
-             * their code cache forms.
+             * their code cache forms.  Our replace_native_stub is replaced
+             * this way too.
              */
         } else {
             DOLOG(1, {
@@ -5056,7 +5090,9 @@ handle_mem_ref_internal(uint flags, app_loc_t *loc, app_pc addr, size_t sz,
                 ASSERT(false, "bitlevel NOT YET IMPLEMENTED");
             }
             if (TEST(MEMREF_PUSHPOP, flags)) {
-                shadow_set_byte(&info, addr + i, SHADOW_UNADDRESSABLE);
+                /* -lazy_stack keeps the stack below xsp undefined */
+                shadow_set_byte(&info, addr + i, options.lazy_stack ?
+                                SHADOW_UNDEFINED : SHADOW_UNADDRESSABLE);
             }
         } else if (!TEST(MEMREF_CHECK_ADDRESSABLE, flags)) {
             uint newval;
@@ -6219,6 +6255,16 @@ should_mark_stack_frames_defined(app_pc pc)
  */
 
 #ifdef BUILD_UNIT_TESTS
+# include "btree.h"
+# include "callstack.h"
+# ifdef LINUX
+#  include "eh_frame.h"
+# endif
+
+/* In drsymcache.c, which unit_tests links with its tests built in */
+void
+test_drsymcache(void);
+
 void
 test_punpck(void)
 {
@@ -6358,6 +6404,12 @@ main(int argc, char *argv[])
     test_punpck();
 
     test_pinsr(drcontext);
+    test_btree();
+    test_callstack_trie();
+    test_drsymcache();
+#ifdef LINUX
+    test_eh_frame();
+#endif
 
     /* add more tests here */
 
@@ -270,6 +270,16 @@ get_own_tls_value(uint index);
 void
 set_own_tls_value(uint index, ptr_uint_t val);
 
+/* For -lazy_stack: see stack.c */
+opnd_t
+opnd_create_stack_low_water_slot(void);
+
+byte *
+get_stack_low_water(void);
+
+void
+set_stack_low_water(byte *val);
+
 ptr_uint_t
 get_thread_tls_value(void *drcontext, uint index);
 
@@ -36,6 +36,7 @@
 #include "heap.h"
 #include "drmemory.h"
 #include "shadow.h"
+#include "alloc_replace.h"
 #ifdef USE_DRSYMS
 # include "drsymcache.h"
 #endif
@@ -152,6 +153,34 @@ replace_tolower_ascii(int c);
 /* for locale-specific tolower() for str{,n}casecmp */
 static int (*app_tolower)(int) = replace_tolower_ascii;
 
+/* For -replace_libc_native: the instrumented mem routines hand operations of at
+ * least REPLACE_NATIVE_MIN_SIZE bytes to these, which are NULL when the option
+ * is off.  Smaller ones are cheaper to do in the instrumented loop than to
+ * pay for the switch to native code.
+ */
+#define REPLACE_NATIVE_MIN_SIZE 256
+/* The str routines examine this many elements in a bounded instrumented loop
+ * before handing the rest of the string to native_op.  Only if that declines
+ * do they fall back to a plain loop over the tail.
+ */
+#define REPLACE_NATIVE_STR_HEAD 32
+enum {
+    NATIVE_OP_COPY, /* memmove semantics */
+    NATIVE_OP_SET,
+    NATIVE_OP_STRLEN,
+    NATIVE_OP_STRNLEN,
+    NATIVE_OP_STRCHR,
+    NATIVE_OP_STRRCHR,
+    NATIVE_OP_STRCMP,
+    NATIVE_OP_STRNCMP,
+    NATIVE_OP_STRSTR,
+    NATIVE_OP_WCSLEN,
+    NATIVE_OP_WCSCHR,
+    NATIVE_OP_WCSCMP,
+};
+/* For the str ops, the result is written to *res */
+static bool (*native_op)(int op, void *a, const void *b, size_t size, ptr_int_t *res);
+
 /***************************************************************************
  * The replacements themselves.
  * These routines are not static so that under gdb a fault will show
@@ -187,6 +216,9 @@ replace_memset(void *dst, int val_in, size_t size)
     register unsigned char *ptr = (unsigned char *) dst;
     unsigned char val = (unsigned char) val_in;
     unsigned int val4 = (val << 24) | (val << 16) | (val << 8) | val;
+    if (size >= REPLACE_NATIVE_MIN_SIZE && native_op != NULL &&
+        (*native_op)(NATIVE_OP_SET, dst, (void *)(ptr_uint_t) val, size, NULL))
+        return dst;
     while (!ALIGNED(ptr, 4) && size > 0) {
         *ptr++ = val;
         size--;
@@ -218,6 +250,9 @@ replace_memcpy(void *dst, const void *src, size_t size)
 {
     register unsigned char *d = (unsigned char *) dst;
     register unsigned char *s = (unsigned char *) src;
+    if (size >= REPLACE_NATIVE_MIN_SIZE && native_op != NULL &&
+        (*native_op)(NATIVE_OP_COPY, dst, src, size, NULL))
+        return dst;
     if (((ptr_uint_t)dst & 3) == ((ptr_uint_t)src & 3)) {
         /* same alignment, so we can do 4 aligned bytes at a time and stay
          * on fastpath.  when not same alignment, I'm assuming it's faster
@@ -305,7 +340,18 @@ replace_strchr(const char *str, int find)
 {
     register const char *s = str;
     register char c = (char) find;
+    ptr_int_t res;
+    uint i;
     /* be sure to match the terminating 0 instead of failing (i#275) */
+    for (i = 0; i < REPLACE_NATIVE_STR_HEAD; i++, s++) {
+        if (*s == c)
+            return (char *) s;
+        if (*s == '\0')
+            return NULL;
+    }
+    if (native_op != NULL &&
+        (*native_op)(NATIVE_OP_STRCHR, (void *) s, NULL, (unsigned char) c, &res))
+        return (char *) res;
     while (true) {
         if (*s == c)
             return (char *) s;
@@ -321,7 +367,18 @@ replace_wcschr(const wchar_t *str, int find)
 {
     register const wchar_t *s = str;
     register wchar_t c = (wchar_t) find;
+    ptr_int_t res;
+    uint i;
     /* be sure to match the terminating 0 instead of failing (i#275) */
+    for (i = 0; i < REPLACE_NATIVE_STR_HEAD; i++, s++) {
+        if (*s == c)
+            return (wchar_t *) s;
+        if (*s == L'\0')
+            return NULL;
+    }
+    if (native_op != NULL &&
+        (*native_op)(NATIVE_OP_WCSCHR, (void *) s, NULL, (size_t) c, &res))
+        return (wchar_t *) res;
     while (true) {
         if (*s == c)
             return (wchar_t *) s;
@@ -338,7 +395,18 @@ replace_strrchr(const char *str, int find)
     register const char *s = str;
     register char c = (char) find;
     const char *last = NULL;
+    ptr_int_t res;
+    uint i;
     /* be sure to match the terminating 0 instead of failing (i#275) */
+    for (i = 0; i < REPLACE_NATIVE_STR_HEAD; i++, s++) {
+        if (*s == c)
+            last = s;
+        if (*s == '\0')
+            return (char *) last;
+    }
+    if (native_op != NULL &&
+        (*native_op)(NATIVE_OP_STRRCHR, (void *) s, NULL, (unsigned char) c, &res))
+        return (res != 0) ? (char *) res : (char *) last;
     while (true) {
         if (*s == c)
             last = s;
@@ -385,6 +453,15 @@ IN_REPLACE_SECTION size_t
 replace_strlen(const char *str)
 {
     register const char *s = str;
+    ptr_int_t res;
+    uint i;
+    for (i = 0; i < REPLACE_NATIVE_STR_HEAD; i++, s++) {
+        if (*s == '\0')
+            return i;
+    }
+    if (native_op != NULL &&
+        (*native_op)(NATIVE_OP_STRLEN, (void *) s, NULL, 0, &res))
+        return REPLACE_NATIVE_STR_HEAD + (size_t) res;
     while (*s != '\0')
         s++;
     return (s - str);
@@ -394,6 +471,15 @@ IN_REPLACE_SECTION size_t
 replace_wcslen(const wchar_t *str)
 {
     register const wchar_t *s = str;
+    ptr_int_t res;
+    uint i;
+    for (i = 0; i < REPLACE_NATIVE_STR_HEAD; i++, s++) {
+        if (*s == L'\0')
+            return i;
+    }
+    if (native_op != NULL &&
+        (*native_op)(NATIVE_OP_WCSLEN, (void *) s, NULL, 0, &res))
+        return REPLACE_NATIVE_STR_HEAD + (size_t) res;
     while (*s != L'\0')
         s++;
     return (s - str);
@@ -403,6 +489,16 @@ IN_REPLACE_SECTION size_t
 replace_strnlen(const char *str, size_t max)
 {
     register const char *s = str;
+    ptr_int_t res;
+    uint i;
+    for (i = 0; i < REPLACE_NATIVE_STR_HEAD; i++, s++) {
+        if (i == max || *s == '\0')
+            return i;
+    }
+    if (max > REPLACE_NATIVE_STR_HEAD && native_op != NULL &&
+        (*native_op)(NATIVE_OP_STRNLEN, (void *) s, NULL,
+                     max - REPLACE_NATIVE_STR_HEAD, &res))
+        return REPLACE_NATIVE_STR_HEAD + (size_t) res;
     while ((s - str) < max && *s != '\0')
         s++;
     return (s - str);
@@ -422,6 +518,28 @@ replace_strncmp(const char *str1, const char *str2, size_t size)
 {
     register const unsigned char *s1 = (const unsigned char *) str1;
     register const unsigned char *s2 = (const unsigned char *) str2;
+    ptr_int_t res;
+    uint i;
+    for (i = 0; i < REPLACE_NATIVE_STR_HEAD; i++) {
+        if (size-- == 0)
+            return 0;
+        if (*s1 == '\0') {
+            if (*s2 == '\0')
+                return 0;
+            return -1;
+        }
+        if (*s2 == '\0')
+            return 1;
+        if (*s1 < *s2)
+            return -1;
+        if (*s1 > *s2)
+            return 1;
+        s1++;
+        s2++;
+    }
+    if (size > 0 && native_op != NULL &&
+        (*native_op)(NATIVE_OP_STRNCMP, (void *) s1, s2, size, &res))
+        return (int) res;
     while (size-- > 0) { /* loop will terminate before underflow */
         if (*s1 == '\0') {
             if (*s2 == '\0')
@@ -466,6 +584,26 @@ replace_strcmp(const char *str1, const char *str2)
 {
     register const unsigned char *s1 = (const unsigned char *) str1;
     register const unsigned char *s2 = (const unsigned char *) str2;
+    ptr_int_t res;
+    uint i;
+    for (i = 0; i < REPLACE_NATIVE_STR_HEAD; i++) {
+        if (*s1 == '\0') {
+            if (*s2 == '\0')
+                return 0;
+            return -1;
+        }
+        if (*s2 == '\0')
+            return 1;
+        if (*s1 < *s2)
+            return -1;
+        if (*s1 > *s2)
+            return 1;
+        s1++;
+        s2++;
+    }
+    if (native_op != NULL &&
+        (*native_op)(NATIVE_OP_STRCMP, (void *) s1, s2, 0, &res))
+        return (int) res;
     while (1) {
         if (*s1 == '\0') {
             if (*s2 == '\0')
@@ -546,6 +684,26 @@ replace_strncasecmp(const char *str1, const char *str2, size_t size)
 IN_REPLACE_SECTION int
 replace_wcscmp(const wchar_t *s1, const wchar_t *s2)
 {
+    ptr_int_t res;
+    uint i;
+    for (i = 0; i < REPLACE_NATIVE_STR_HEAD; i++) {
+        if (*s1 == L'\0') {
+            if (*s2 == L'\0')
+                return 0;
+            return -1;
+        }
+        if (*s2 == L'\0')
+            return 1;
+        if ((unsigned int)*s1 < (unsigned int)*s2)
+            return -1;
+        if ((unsigned int)*s1 > (unsigned int)*s2)
+            return 1;
+        s1++;
+        s2++;
+    }
+    if (native_op != NULL &&
+        (*native_op)(NATIVE_OP_WCSCMP, (void *) s1, s2, 0, &res))
+        return (int) res;
     while (1) {
         if (*s1 == L'\0') {
             if (*s2 == L'\0')
@@ -672,22 +830,36 @@ replace_strcspn(const char *str, const char *reject)
     return cur - str;
 }
 
+/* We compare the needle at each haystack position in turn.  Restarting the
+ * needle partway through a partial match would miss matches that overlap
+ * it, such as "aab" in "aaab".
+ */
 IN_REPLACE_SECTION char *
 replace_strstr(const char *haystack, const char *needle)
 {
     register const char *hs = haystack;
-    register const char *n = needle;
+    register const char *h, *n;
+    ptr_int_t res;
+    uint i;
     /* empty needle should return haystack */
-    if (*n == '\0')
+    if (*needle == '\0')
         return (char *) haystack;
+    for (i = 0; i < REPLACE_NATIVE_STR_HEAD; i++, hs++) {
+        if (*hs == '\0')
+            return NULL;
+        for (h = hs, n = needle; *n != '\0' && *h == *n; h++, n++)
+            ; /* nothing */
+        if (*n == '\0')
+            return (char *) hs;
+    }
+    if (native_op != NULL &&
+        (*native_op)(NATIVE_OP_STRSTR, (void *) hs, needle, 0, &res))
+        return (char *) res;
     while (*hs != '\0') {
-        if (*hs != *n)
-            n = needle;
-        if (*hs == *n) {
-            n++;
-            if (*n == '\0')
-                return (char *) (hs - (n - 1 - needle));
-        }
+        for (h = hs, n = needle; *n != '\0' && *h == *n; h++, n++)
+            ; /* nothing */
+        if (*n == '\0')
+            return (char *) hs;
         hs++;
     }
     return NULL;
@@ -697,18 +869,15 @@ IN_REPLACE_SECTION wchar_t *
 replace_wcsstr(const wchar_t *haystack, const wchar_t *needle)
 {
     register const wchar_t *hs = haystack;
-    register const wchar_t *n = needle;
+    register const wchar_t *h, *n;
     /* empty needle should return haystack */
-    if (*n == '\0')
+    if (*needle == L'\0')
         return (wchar_t *) haystack;
-    while (*hs != '\0') {
-        if (*hs != *n)
-            n = needle;
-        if (*hs == *n) {
-            n++;
-            if (*n == '\0')
-                return (wchar_t *) (hs - (n - 1 - needle));
-        }
+    while (*hs != L'\0') {
+        for (h = hs, n = needle; *n != L'\0' && *h == *n; h++, n++)
+            ; /* nothing */
+        if (*n == L'\0')
+            return (wchar_t *) hs;
         hs++;
     }
     return NULL;
@@ -717,6 +886,10 @@ replace_wcsstr(const wchar_t *haystack, const wchar_t *needle)
 IN_REPLACE_SECTION void *
 replace_memmove(void *dst, const void *src, size_t size)
 {
+    /* the native copy handles overlap */
+    if (size >= REPLACE_NATIVE_MIN_SIZE && native_op != NULL &&
+        (*native_op)(NATIVE_OP_COPY, dst, src, size, NULL))
+        return dst;
     if (((ptr_uint_t)dst) - ((ptr_uint_t)src) >= size) {
         /* forward walk won't clobber: either no overlap or dst < src */
         register const char *s = (const char *) src;
@@ -809,6 +982,16 @@ replace_wmemcmp(const wchar_t *s1, const wchar_t *s2, size_t count)
     return 0;
 }
 
+/* This is never run as is: replace_init() replaces it with replace_native_op(),
+ * which runs natively.  We need a function in this section so that the
+ * call to it starts a new bb here.
+ */
+IN_REPLACE_SECTION bool
+replace_native_stub(int op, void *a, const void *b, size_t size, ptr_int_t *res)
+{
+    return false;
+}
+
 IN_REPLACE_SECTION void
 replace_final_routine(void)
 {
@@ -835,6 +1018,298 @@ static const void *replace_routine_addr[] = {
 #undef REPLACE_NAME_DEF
 };
 
+/***************************************************************************
+ * NATIVE OPERATIONS
+ *
+ * For -replace_libc_native.  These run natively, in place of the stub
+ * above, so neither their memory references nor their shadow updates are
+ * seen by our instrumentation.  We only finish the operation when the
+ * shadow shows that the instrumented loop would report no error on any
+ * byte it examines, and then we update the shadow in bulk.  In every other
+ * case we return false and let the instrumented loop run, so any error is
+ * reported exactly as before, at the first offending byte.
+ *
+ * The str routines scan natively first, a word at a time where they can,
+ * and then check the shadow of just the elements the instrumented loop
+ * would have examined.  The extra bytes an aligned word load reads are
+ * never checked: such a load never crosses onto a page the byte loop
+ * would not have touched.
+ */
+
+#define WORD_ONES  (POINTER_MAX / 0xff) /* 0x0101...01 */
+#define WORD_HIGHS (WORD_ONES * 0x80)   /* 0x8080...80 */
+/* Non-zero iff some byte of w is zero */
+#define WORD_HAS_ZERO(w) (((w) - WORD_ONES) & ~(w) & WORD_HIGHS)
+
+/* Returns the single shadow value, defined or undefined, of all of
+ * [start, start+size), or UINT_MAX if there is not one.
+ */
+static uint
+native_uniform_shadow(byte *start, size_t size)
+{
+    if (shadow_check_range(start, size, SHADOW_DEFINED, NULL, NULL, NULL))
+        return SHADOW_DEFINED;
+    if (options.check_uninitialized &&
+        shadow_check_range(start, size, SHADOW_UNDEFINED, NULL, NULL, NULL))
+        return SHADOW_UNDEFINED;
+    return UINT_MAX;
+}
+
+/* Returns the first of the max bytes starting at s that is 0 or find,
+ * or s + max if there is none.
+ */
+static const byte *
+native_strscan(const byte *s, byte find, size_t max)
+{
+    ptr_uint_t pattern = WORD_ONES * find;
+    while (max > 0 && !ALIGNED(s, sizeof(ptr_uint_t))) {
+        if (*s == '\0' || *s == find)
+            return s;
+        s++;
+        max--;
+    }
+    while (max >= sizeof(ptr_uint_t)) {
+        ptr_uint_t w = *(const ptr_uint_t *) s;
+        if (WORD_HAS_ZERO(w) || WORD_HAS_ZERO(w ^ pattern))
+            break;
+        s += sizeof(ptr_uint_t);
+        max -= sizeof(ptr_uint_t);
+    }
+    while (max > 0) {
+        if (*s == '\0' || *s == find)
+            return s;
+        s++;
+        max--;
+    }
+    return s;
+}
+
+/* Returns the index of the first of the max bytes where s1 and s2 differ
+ * or s1 has its terminator, or max if there is none.
+ */
+static size_t
+native_strcmp_len(const byte *s1, const byte *s2, size_t max)
+{
+    size_t i = 0;
+    if (((ptr_uint_t)s1 & (sizeof(ptr_uint_t)-1)) ==
+        ((ptr_uint_t)s2 & (sizeof(ptr_uint_t)-1))) {
+        while (i < max && !ALIGNED(s1 + i, sizeof(ptr_uint_t))) {
+            if (s1[i] != s2[i] || s1[i] == '\0')
+                return i;
+            i++;
+        }
+        while (max - i >= sizeof(ptr_uint_t)) {
+            ptr_uint_t w1 = *(const ptr_uint_t *)(s1 + i);
+            ptr_uint_t w2 = *(const ptr_uint_t *)(s2 + i);
+            if (w1 != w2 || WORD_HAS_ZERO(w1))
+                break;
+            i += sizeof(ptr_uint_t);
+        }
+    }
+    while (i < max) {
+        if (s1[i] != s2[i] || s1[i] == '\0')
+            return i;
+        i++;
+    }
+    return i;
+}
+
+/* Computes *res for a str op the way the replace_ routine's loop would,
+ * and sets [a, *a_end) and [b, *b_end) to the bytes that loop would
+ * examine.  Faults are up to the caller.
+ */
+static void
+native_str_op(int op, const byte *a, const byte *b, size_t size, ptr_int_t *res,
+              const byte **a_end, const byte **b_end)
+{
+    const byte *e;
+    size_t i;
+    *b_end = b;
+    switch (op) {
+    case NATIVE_OP_STRLEN:
+        e = native_strscan(a, '\0', POINTER_MAX);
+        *res = e - a;
+        *a_end = e + 1;
+        break;
+    case NATIVE_OP_STRNLEN:
+        e = native_strscan(a, '\0', size);
+        *res = e - a;
+        *a_end = (e < a + size) ? e + 1 : e;
+        break;
+    case NATIVE_OP_STRCHR:
+        e = native_strscan(a, (byte) size, POINTER_MAX);
+        *res = (*e == (byte) size) ? (ptr_int_t) e : 0;
+        *a_end = e + 1;
+        break;
+    case NATIVE_OP_STRRCHR:
+        e = native_strscan(a, '\0', POINTER_MAX);
+        *a_end = e + 1;
+        *res = 0;
+        for (; e >= a; e--) {
+            if (*e == (byte) size) {
+                *res = (ptr_int_t) e;
+                break;
+            }
+        }
+        break;
+    case NATIVE_OP_STRCMP:
+    case NATIVE_OP_STRNCMP:
+        i = native_strcmp_len(a, b, op == NATIVE_OP_STRCMP ? POINTER_MAX : size);
+        if (op == NATIVE_OP_STRNCMP && i == size) {
+            *res = 0;
+            *a_end = a + i;
+            *b_end = b + i;
+            break;
+        }
+        if (a[i] == '\0')
+            *res = (b[i] == '\0') ? 0 : -1;
+        else
+            *res = (a[i] < b[i]) ? -1 : 1;
+        *a_end = a + i + 1;
+        *b_end = b + i + 1;
+        break;
+    case NATIVE_OP_STRSTR: {
+        /* a is the rest of the haystack and b the whole needle, which is not
+         * empty.  Matches are rare, so this simple loop is fine natively.
+         */
+        const byte *hs, *h, *n;
+        *a_end = a;
+        *res = 0;
+        for (hs = a; ; hs++) {
+            for (h = hs, n = b; *n != '\0' && *h == *n; h++, n++)
+                ; /* nothing */
+            /* the loop does not read *h once the needle is matched */
+            if ((*n == '\0' ? h : h + 1) > *a_end)
+                *a_end = (*n == '\0' ? h : h + 1);
+            if (n + 1 > *b_end)
+                *b_end = n + 1;
+            if (*n == '\0') {
+                *res = (ptr_int_t) hs;
+                break;
+            }
+            if (*hs == '\0')
+                break;
+        }
+        break;
+    }
+    case NATIVE_OP_WCSLEN: {
+        const wchar_t *w = (const wchar_t *) a;
+        while (*w != L'\0')
+            w++;
+        *res = w - (const wchar_t *) a;
+        *a_end = (const byte *)(w + 1);
+        break;
+    }
+    case NATIVE_OP_WCSCHR: {
+        const wchar_t *w = (const wchar_t *) a;
+        while (*w != (wchar_t) size && *w != L'\0')
+            w++;
+        *res = (*w == (wchar_t) size) ? (ptr_int_t) w : 0;
+        *a_end = (const byte *)(w + 1);
+        break;
+    }
+    case NATIVE_OP_WCSCMP: {
+        const wchar_t *w1 = (const wchar_t *) a, *w2 = (const wchar_t *) b;
+        while (*w1 == *w2 && *w1 != L'\0') {
+            w1++;
+            w2++;
+        }
+        if (*w1 == L'\0')
+            *res = (*w2 == L'\0') ? 0 : -1;
+        else
+            *res = ((unsigned int)*w1 < (unsigned int)*w2) ? -1 : 1;
+        *a_end = (const byte *)(w1 + 1);
+        *b_end = (const byte *)(w2 + 1);
+        break;
+    }
+    default:
+        ASSERT(false, "unknown native op");
+    }
+}
+
+/* Called on a clean stack, so it is free to call into umbra.
+ * For NATIVE_OP_SET, b holds the value to set.
+ */
+static void *
+native_op_work(int op, byte *a, byte *b, size_t size, ptr_int_t *res)
+{
+    void *drcontext = dr_get_current_drcontext();
+    uint val = SHADOW_DEFINED;
+    bool ok = false;
+    if (op == NATIVE_OP_COPY || op == NATIVE_OP_SET) {
+        if (op == NATIVE_OP_COPY) {
+            /* Copying undefined bytes is not an error: they only need to be
+             * propagated, which is a bulk set as long as they are uniform.
+             */
+            val = native_uniform_shadow(b, size);
+            if (val == UINT_MAX)
+                return (void *) false;
+        }
+        if (native_uniform_shadow(a, size) == UINT_MAX)
+            return (void *) false;
+        /* The shadow could disagree with the actual page protections, e.g. for
+         * memory the app made read-only.  On a fault the instrumented loop will
+         * redo the operation and fault in the same way.
+         */
+        DR_TRY_EXCEPT(drcontext, {
+            if (op == NATIVE_OP_COPY)
+                memmove(a, b, size);
+            else
+                memset(a, (int)(ptr_uint_t) b, size);
+            ok = true;
+        }, { /* EXCEPT */
+            LOG(2, "%s: fault writing "PFX"-"PFX"\n", __FUNCTION__, a, a + size);
+        });
+        if (ok)
+            shadow_set_range(a, a + size, val);
+    } else {
+        const byte *a_end = NULL, *b_end = NULL;
+        ptr_int_t val;
+        /* We read before checking the shadow, so an unaddressable string can
+         * fault here.  The instrumented loop will then report it and fault in
+         * the same way.
+         */
+        DR_TRY_EXCEPT(drcontext, {
+            native_str_op(op, a, b, size, &val, &a_end, &b_end);
+            ok = true;
+        }, { /* EXCEPT */
+            LOG(2, "%s: fault reading "PFX"\n", __FUNCTION__, a);
+        });
+        /* Any examined byte that is undefined would be reported by the
+         * instrumented loop, so we require all of them to be defined.
+         */
+        if (!ok ||
+            (a_end > a && !shadow_check_range(a, a_end - a, SHADOW_DEFINED,
+                                              NULL, NULL, NULL)) ||
+            (b_end > b && !shadow_check_range(b, b_end - b, SHADOW_DEFINED,
+                                              NULL, NULL, NULL)))
+            return (void *) false;
+        *res = val;
+        /* our caller reads it */
+        if (options.check_uninitialized)
+            shadow_set_range((byte *) res, (byte *)(res + 1), SHADOW_DEFINED);
+    }
+    return (void *)(ptr_uint_t) ok;
+}
+
+static bool
+replace_native_op(int op, void *a, const void *b, size_t size, ptr_int_t *res)
+{
+    void *drcontext = enter_client_code();
+    bool ok = (bool)(ptr_uint_t)
+        dr_call_on_clean_stack(drcontext, (void* (*)(void)) native_op_work,
+                               (void *)(ptr_int_t) op, a, (void *) b,
+                               (void *) size, res, NULL, NULL, NULL);
+    /* our caller tests the return value */
+    if (options.check_uninitialized)
+        register_shadow_set_dword(DR_REG_PTR_RETURN, SHADOW_DEFINED);
+    exit_client_code(drcontext, false/*need swap*/);
+    return ok;
+}
+
+/*
+ ***************************************************************************/
+
 static app_pc
 get_function_entry(app_pc C_var)
 {
@@ -898,6 +1373,16 @@ replace_init(void)
             i++;
         }
 
+        /* We rely on the shadow to know that no error is possible */
+        if (options.replace_libc_native && options.shadowing && options.pattern == 0) {
+            if (drwrap_replace_native(get_function_entry((app_pc)replace_native_stub),
+                                      (app_pc)replace_native_op, true/*at entry*/,
+                                      0, NULL, false))
+                native_op = replace_native_stub;
+            else
+                ASSERT(false, "failed to replace native stub");
+        }
+
 #ifdef USE_DRSYMS
         hashtable_init(&replace_name_table, REPLACE_NAME_TABLE_HASH_BITS, HASH_STRING,
                        false/*!strdup*/);
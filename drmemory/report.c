@@ -1584,6 +1584,8 @@ report_init(void)
     callstack_ops.fp_flags = 0;
     if (!options.callstack_use_fp)
         callstack_ops.fp_flags |= FP_DO_NOT_WALK_FP;
+    if (!options.callstack_use_unwind_info)
+        callstack_ops.fp_flags |= FP_DO_NOT_USE_UNWIND_INFO;
     if (options.callstack_conservative) {
         /* We don't expose FP_VERIFY_CROSS_MODULE_TARGET, although it can be a big
          * perf win over FP_VERIFY_CALL_TARGET (see i#703 numbers) -- so should we
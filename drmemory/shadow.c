@@ -249,6 +249,10 @@ shadow_table_init(void)
     umbra_map_ops.flags =
         UMBRA_MAP_CREATE_SHADOW_ON_TOUCH |
         UMBRA_MAP_SHADOW_SHARED_READONLY;
+#ifndef X64
+    if (options.shadow_inline_xl8)
+        umbra_map_ops.flags |= UMBRA_MAP_INLINE_TRANSLATION;
+#endif
     umbra_map_ops.scale = SHADOW_MAP_SCALE;
     umbra_map_ops.default_value = SHADOW_DEFAULT_VALUE;
     umbra_map_ops.default_value_size = SHADOW_DEFAULT_VALUE_SIZE;
@@ -300,6 +304,37 @@ get_shadow_block_size(void)
     return size;
 }
 
+#ifndef X64
+typedef struct _block_counts_t {
+    uint num_private;
+    uint num_special;
+} block_counts_t;
+
+static bool
+shadow_count_block(umbra_map_t *map, umbra_shadow_memory_info_t *info,
+                   void *user_data)
+{
+    block_counts_t *counts = (block_counts_t *) user_data;
+    if (TEST(UMBRA_SHADOW_MEMORY_TYPE_SHARED, info->shadow_type))
+        counts->num_special++;
+    else
+        counts->num_private++;
+    return true;
+}
+
+void
+shadow_get_block_counts(uint *num_private OUT, uint *num_special OUT)
+{
+    block_counts_t counts = {0, 0};
+    /* racy, but this is only for reporting */
+    if (umbra_iterate_shadow_memory(umbra_map, &counts, shadow_count_block) !=
+        DRMF_SUCCESS)
+        ASSERT(false, "fail to iterate shadow memory");
+    *num_private = counts.num_private;
+    *num_special = counts.num_special;
+}
+#endif
+
 bool
 shadow_get_special(app_pc addr, uint *val)
 {
@@ -633,6 +668,54 @@ shadow_set_non_matching_range(app_pc start, size_t size, uint val, uint val_not)
     }
 }
 
+/* Sets the two bits for each byte of each of the num ranges to val, in order.
+ * One umbra_shadow_memory_info_t is shared across all the ranges, so ranges in
+ * the same app block (e.g., the buffers of one readv call) share a single
+ * shadow block lookup.  Stops before the first range containing a byte that is
+ * neither defined nor undefined, leaving that range untouched, and returns its
+ * index; returns num if every range was set.
+ */
+uint
+shadow_set_ranges(shadow_range_t *ranges, uint num, uint val)
+{
+    umbra_shadow_memory_info_t info;
+    uint dword_val = shadow_value_byte_2_dword(val);
+    uint i;
+    ASSERT(!MAP_4B_TO_1B, "invalid shadow mode");
+    ASSERT(val == SHADOW_DEFINED || val == SHADOW_UNDEFINED, "invalid shadow value");
+    umbra_shadow_memory_info_init(&info);
+    for (i = 0; i < num; i++) {
+        app_pc start = ranges[i].start, end = ranges[i].end;
+        app_pc pc;
+        ASSERT(end >= start, "invalid range");
+        LOG(3, "set ranges #%d "PFX"-"PFX" => %d\n", i, start, end, val);
+        /* Check the whole range before writing any of it */
+        for (pc = start; pc < end; pc++) {
+            uint shadow;
+            if (ALIGNED(pc, 4) && end - pc >= 4) {
+                shadow = shadow_get_dword(&info, pc);
+                if (shadow == SHADOW_DWORD_DEFINED || shadow == SHADOW_DWORD_UNDEFINED) {
+                    pc += 3;
+                    continue;
+                }
+            }
+            shadow = shadow_get_byte(&info, pc);
+            if (shadow != SHADOW_DEFINED && shadow != SHADOW_UNDEFINED)
+                return i;
+        }
+        for (pc = start; pc < end; pc++) {
+            if (ALIGNED(pc, 4) && end - pc >= 4 &&
+                shadow_get_dword(&info, pc) == dword_val) {
+                pc += 3;
+                continue;
+            }
+            if (shadow_get_byte(&info, pc) != val)
+                shadow_set_byte(&info, pc, val);
+        }
+    }
+    return num;
+}
+
 static uint dqword_to_val(uint dqword)
 {
     if (dqword == SHADOW_DQWORD_UNADDRESSABLE)
@@ -844,6 +927,10 @@ shadow_next_ptrsz(app_pc start, app_pc end, uint expect)
  *   0x4d1cd052  c1 e9 02             shr    $0x00000002 %ecx -> %ecx
  *   0x4d1cd055  03 0c 95 40 26 96 73 add    0x73962640(,%edx,4) %ecx -> %ecx
  * And now the shadow addr is in %ecx.
+ * With -shadow_inline_xl8, if Umbra placed its flat region, it is just:
+ *   shr    $0x00000002 %ecx -> %ecx
+ *   add    $<region base> %ecx -> %ecx
+ * and %edx is untouched.
  */
 void
 shadow_gen_translation_addr(void *drcontext, instrlist_t *bb, instr_t *inst,
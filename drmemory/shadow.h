@@ -144,6 +144,15 @@ shadow_thread_exit(void *drcontext);
 size_t
 get_shadow_block_size(void);
 
+#ifndef X64
+/* For memory usage reports: counts the shadow blocks that are private and
+ * those that are shared read-only special blocks.  Not available on 64-bit,
+ * where umbra maps whole shadow regions directly rather than per-block.
+ */
+void
+shadow_get_block_counts(uint *num_private OUT, uint *num_special OUT);
+#endif
+
 /* Returns whether pc is a pointer into a special shadow block */
 bool
 is_in_special_shadow_block(byte *pc);
@@ -207,6 +216,21 @@ shadow_copy_range(app_pc old_start, app_pc new_start, size_t size);
 void
 shadow_set_non_matching_range(app_pc start, size_t size, uint val, uint val_not);
 
+/* A range [start, end) for shadow_set_ranges() */
+typedef struct _shadow_range_t {
+    app_pc start;
+    app_pc end;
+} shadow_range_t;
+
+/* Sets the shadow value for each of the num ranges to val, sharing shadow
+ * block lookups between ranges.  val must be SHADOW_DEFINED or
+ * SHADOW_UNDEFINED.  Stops before, and does not touch, the first range
+ * containing an unaddressable (or bitlevel) byte, and returns its index, so
+ * the caller can handle it with error reporting; returns num if all were set.
+ */
+uint
+shadow_set_ranges(shadow_range_t *ranges, uint num, uint val);
+
 /* Compares every byte in [start, start+size) to expect.
  * start must be 16-byte aligned.
  * Stops and returns the pc of the first non-matching value.
@@ -44,6 +44,7 @@ uint push_addressable_heap;
 uint push_addressable_mmap;
 uint zero_loop_aborts_fault;
 uint zero_loop_aborts_thresh;
+uint adjust_esp_bulk;
 #endif
 
 static int
@@ -73,6 +74,16 @@ needs_esp_adjust(instr_t *inst, sp_adjust_action_t sp_action);
  */
 #define MIN_SWAP_THRESHOLD 2048
 
+/* -lazy_stack: rather than marking de-allocated stack memory unaddressable and
+ * then marking it undefined again when it is re-allocated, we keep it undefined.
+ * Each thread tracks its stack low-water mark, below which we have not yet set
+ * the shadow: so long as [low-water, xsp) stays undefined, an allocation above
+ * the mark needs no shadow update at all.  An allocation below the mark, or one
+ * so far above it that it is probably on a different stack, sets the shadow
+ * and moves the mark.
+ */
+#define LAZY_STACK_MAX_GAP (1024*1024)
+
 void
 check_stack_size_vs_threshold(void *drcontext, size_t stack_size)
 {
@@ -347,6 +358,32 @@ get_esp_adjust_type(uint opc)
     }
 }
 
+/* Zeroes the newly allocated stack [start, end) for -leaks_only.  Like the
+ * inlined loop in insert_zeroing_loop() we go from the top down, a page at a
+ * time so that any guard page is hit in order, and we give up on a fault
+ * (see handle_zeroing_fault()).
+ */
+static void
+zero_stack_bulk(app_pc start, app_pc end)
+{
+    void *drcontext = dr_get_current_drcontext();
+    LOG(3, "zeroing stack "PFX"-"PFX"\n", start, end);
+    STATS_INC(adjust_esp_bulk);
+    DR_TRY_EXCEPT(drcontext, {
+        app_pc pc = end;
+        while (pc > start) {
+            app_pc chunk = (app_pc) ALIGN_BACKWARD(pc - 1, PAGE_SIZE);
+            if (chunk < start)
+                chunk = start;
+            memset(chunk, 0, pc - chunk);
+            pc = chunk;
+        }
+    }, { /* EXCEPT */
+        LOG(2, "zeroing stack "PFX"-"PFX" faulted\n", start, end);
+        STATS_INC(zero_loop_aborts_fault);
+    });
+}
+
 /* N.B.: mcontext is not in consistent app state, for efficiency.
  * esp is guaranteed to hold app value, though.
  */
@@ -370,6 +407,8 @@ handle_esp_adjust(esp_adjust_t type, reg_t val/*either relative delta, or absolu
              delta < -options.stack_swap_threshold) &&
             check_stack_swap((byte *)mc.xsp, (byte *)val)) {
             /* Stack swap: nothing to do */
+            if (options.lazy_stack)
+                set_stack_low_water((byte *)val);
             return;
         }
     } else if (type == ESP_ADJUST_AND) {
@@ -380,6 +419,8 @@ handle_esp_adjust(esp_adjust_t type, reg_t val/*either relative delta, or absolu
              delta < -options.stack_swap_threshold) &&
             check_stack_swap((byte *)mc.xsp, (byte *)newval)) {
             /* Stack swap: nothing to do */
+            if (options.lazy_stack)
+                set_stack_low_water((byte *)newval);
             return;
         }
     } else {
@@ -392,7 +433,7 @@ handle_esp_adjust(esp_adjust_t type, reg_t val/*either relative delta, or absolu
                 delta);
         }
         if (type == ESP_ADJUST_RET_IMMED)
-            mc.xsp += 4; /* pop of retaddr happens first */
+            mc.xsp += sizeof(void*); /* pop of retaddr happens first */
         LOG(3, "esp adjust relative esp="PFX" delta=%d\n", mc.xsp, delta);
     }
     if (delta != 0) {
@@ -402,12 +443,36 @@ handle_esp_adjust(esp_adjust_t type, reg_t val/*either relative delta, or absolu
                  * pointers from misleading our leak scan (PR 520916).
                  * yes, I realize it may not be perfectly transparent.
                  */
-                memset((app_pc)(mc.xsp + delta), 0, -delta);
+                zero_stack_bulk((app_pc)(mc.xsp + delta), (app_pc)mc.xsp);
+            }
+        } else if (options.lazy_stack && sp_action == SP_ADJUST_ACTION_SHADOW &&
+                   delta < 0) {
+            byte *new_xsp = (byte *)(mc.xsp + delta);
+            byte *low_water = get_stack_low_water();
+            if (new_xsp < low_water) {
+                /* Do not touch anything pushed below the mark */
+                shadow_set_range(new_xsp, MIN(low_water, (byte *)mc.xsp),
+                                 SHADOW_UNDEFINED);
+                set_stack_low_water(new_xsp);
+            } else if (new_xsp - low_water >= LAZY_STACK_MAX_GAP) {
+                /* Probably a different stack: we can't trust the mark */
+                LOG(3, "lazy stack: resetting low-water mark "PFX" => "PFX"\n",
+                    low_water, new_xsp);
+                shadow_set_range(new_xsp, (byte *)mc.xsp, SHADOW_UNDEFINED);
+                set_stack_low_water(new_xsp);
             }
         } else {
+#ifdef STATISTICS
+            if (options.stack_bulk_threshold > 0 &&
+                (delta > options.stack_bulk_threshold ||
+                 delta < -options.stack_bulk_threshold))
+                STATS_INC(adjust_esp_bulk);
+#endif
             shadow_set_range((app_pc) (delta > 0 ? mc.xsp : (mc.xsp + delta)),
                              (app_pc) (delta > 0 ? (mc.xsp + delta) : mc.xsp),
-                             (delta > 0 ? SHADOW_UNADDRESSABLE :
+                             (delta > 0 ?
+                              (options.lazy_stack ? SHADOW_UNDEFINED :
+                               SHADOW_UNADDRESSABLE) :
                               ((sp_action == SP_ADJUST_ACTION_DEFINED) ?
                                SHADOW_DEFINED : SHADOW_UNDEFINED)));
         }
@@ -877,6 +942,31 @@ insert_zeroing_loop(void *drcontext, instrlist_t *bb, instr_t *inst,
                                 opnd_create_reg(REG_XSP)));
     }
 
+    if (options.stack_bulk_threshold > 0) {
+        /* A large frame (e.g., a big local array) is zeroed out of line with
+         * memset rather than a dword at a time.
+         */
+        instr_t *not_bulk = INSTR_CREATE_label(drcontext);
+        PRE(bb, inst,
+            INSTR_CREATE_sub(drcontext, opnd_create_reg(mi->reg1.reg),
+                             opnd_create_reg(reg_mod)));
+        PRE(bb, inst,
+            INSTR_CREATE_cmp(drcontext, opnd_create_reg(mi->reg1.reg),
+                             OPND_CREATE_INT32(options.stack_bulk_threshold)));
+        /* mov does not touch eflags */
+        PRE(bb, inst,
+            INSTR_CREATE_mov_ld(drcontext, opnd_create_reg(mi->reg1.reg),
+                                opnd_create_reg(REG_XSP)));
+        /* the clean call is too long for a short jcc */
+        PRE(bb, inst,
+            INSTR_CREATE_jcc(drcontext, OP_jbe, opnd_create_instr(not_bulk)));
+        dr_insert_clean_call(drcontext, bb, inst, (void *) zero_stack_bulk, false, 2,
+                             opnd_create_reg(reg_mod), opnd_create_reg(mi->reg1.reg));
+        PRE(bb, inst,
+            INSTR_CREATE_jmp(drcontext, opnd_create_instr(retaddr)));
+        PRE(bb, inst, not_bulk);
+    }
+
     PRE(bb, inst, loop_repeat);
     PRE(bb, inst,
         INSTR_CREATE_sub(drcontext, opnd_create_reg(mi->reg1.reg),
@@ -1102,6 +1192,11 @@ generate_shared_esp_fastpath_helper(void *drcontext, instrlist_t *bb,
                                 SHADOW_DWORD_DEFINED : SHADOW_DWORD_UNDEFINED);
     uint shadow_dqword_newmem = (sp_action == SP_ADJUST_ACTION_DEFINED ?
                                  SHADOW_DQWORD_DEFINED : SHADOW_DQWORD_UNDEFINED);
+    /* -lazy_stack keeps de-allocated stack memory undefined */
+    uint shadow_dword_oldmem = (options.lazy_stack ?
+                                SHADOW_DWORD_UNDEFINED : SHADOW_DWORD_UNADDRESSABLE);
+    uint shadow_dqword_oldmem = (options.lazy_stack ?
+                                 SHADOW_DQWORD_UNDEFINED : SHADOW_DQWORD_UNADDRESSABLE);
 
     push_unaligned = INSTR_CREATE_label(drcontext);
     push_aligned = INSTR_CREATE_label(drcontext);
@@ -1161,7 +1256,7 @@ generate_shared_esp_fastpath_helper(void *drcontext, instrlist_t *bb,
         /* pop of retaddr happens first (handled in definedness routines) */
         PRE(bb, NULL,
             INSTR_CREATE_add(drcontext, opnd_create_reg(mi.reg1.reg),
-                             OPND_CREATE_INT8(4)));
+                             OPND_CREATE_INT8(sizeof(void*))));
     }
 
     /* for absolute, calculate the delta */
@@ -1184,6 +1279,52 @@ generate_shared_esp_fastpath_helper(void *drcontext, instrlist_t *bb,
         add_jcc_slowpath(drcontext, bb, NULL, OP_jl/*short doesn't reach*/, &mi);
     }
 
+    if (options.stack_bulk_threshold > 0) {
+        /* A large frame (e.g., a big local array) is marked by the slowpath,
+         * whose shadow_set_range() does a bulk memset of the shadow, rather
+         * than a dword at a time here.
+         * These must come after the swap cmps for
+         * esp_fastpath_update_swap_threshold().
+         */
+        PRE(bb, NULL,
+            INSTR_CREATE_cmp(drcontext, opnd_create_reg(mi.reg3.reg),
+                             OPND_CREATE_INT32(options.stack_bulk_threshold)));
+        add_jcc_slowpath(drcontext, bb, NULL, OP_jg/*short doesn't reach*/, &mi);
+        PRE(bb, NULL,
+            INSTR_CREATE_cmp(drcontext, opnd_create_reg(mi.reg3.reg),
+                             OPND_CREATE_INT32(-options.stack_bulk_threshold)));
+        add_jcc_slowpath(drcontext, bb, NULL, OP_jl/*short doesn't reach*/, &mi);
+    }
+
+    if (options.lazy_stack && sp_action == SP_ADJUST_ACTION_SHADOW) {
+        /* An allocation that stays not far above the low-water mark needs
+         * no shadow update: see LAZY_STACK_MAX_GAP.
+         */
+        instr_t *not_alloc = INSTR_CREATE_label(drcontext);
+        PRE(bb, NULL,
+            INSTR_CREATE_cmp(drcontext, opnd_create_reg(mi.reg3.reg),
+                             OPND_CREATE_INT32(0)));
+        PRE(bb, NULL,
+            INSTR_CREATE_jcc(drcontext, OP_jge_short, opnd_create_instr(not_alloc)));
+        PRE(bb, NULL,
+            INSTR_CREATE_lea(drcontext, opnd_create_reg(mi.reg2.reg),
+                             opnd_create_base_disp(mi.reg1.reg, mi.reg3.reg, 1, 0,
+                                                   OPSZ_lea)));
+        PRE(bb, NULL,
+            INSTR_CREATE_cmp(drcontext, opnd_create_reg(mi.reg2.reg),
+                             opnd_create_stack_low_water_slot()));
+        add_jcc_slowpath(drcontext, bb, NULL, OP_jb/*short doesn't reach*/, &mi);
+        PRE(bb, NULL,
+            INSTR_CREATE_sub(drcontext, opnd_create_reg(mi.reg2.reg),
+                             opnd_create_stack_low_water_slot()));
+        PRE(bb, NULL,
+            INSTR_CREATE_cmp(drcontext, opnd_create_reg(mi.reg2.reg),
+                             OPND_CREATE_INT32(LAZY_STACK_MAX_GAP)));
+        add_jcc_slowpath(drcontext, bb, NULL, OP_jae/*short doesn't reach*/, &mi);
+        PRE(bb, NULL, INSTR_CREATE_jmp(drcontext, opnd_create_instr(loop_done)));
+        PRE(bb, NULL, not_alloc);
+    }
+
     /* Ensure the size is 4-aligned so our loop works out */
     PRE(bb, NULL,
         INSTR_CREATE_test(drcontext, opnd_create_reg(mi.reg3.reg),
@@ -1305,7 +1446,7 @@ generate_shared_esp_fastpath_helper(void *drcontext, instrlist_t *bb,
         INSTR_CREATE_jcc(drcontext, OP_jz_short, opnd_create_instr(pop_aligned)));
     PRE(bb, NULL,
         INSTR_CREATE_mov_st(drcontext, OPND_CREATE_MEM8(mi.reg1.reg, 0),
-                            OPND_CREATE_INT8((char)SHADOW_DWORD_UNADDRESSABLE)));
+                            OPND_CREATE_INT8((char)shadow_dword_oldmem)));
     PRE(bb, NULL,
         INSTR_CREATE_dec(drcontext, opnd_create_reg(mi.reg3.reg)));
     PRE(bb, NULL,
@@ -1332,7 +1473,7 @@ generate_shared_esp_fastpath_helper(void *drcontext, instrlist_t *bb,
         INSTR_CREATE_jcc(drcontext, OP_jz_short, opnd_create_instr(pop_aligned_done)));
     PRE(bb, NULL,
         INSTR_CREATE_mov_st(drcontext, OPND_CREATE_MEM32(mi.reg1.reg, 0),
-                            OPND_CREATE_INT32(SHADOW_DQWORD_UNADDRESSABLE)));
+                            OPND_CREATE_INT32(shadow_dqword_oldmem)));
     PRE(bb, NULL,
         INSTR_CREATE_dec(drcontext, opnd_create_reg(mi.reg3.reg)));
     PRE(bb, NULL,
@@ -1356,7 +1497,7 @@ generate_shared_esp_fastpath_helper(void *drcontext, instrlist_t *bb,
         INSTR_CREATE_jcc(drcontext, OP_jz_short, opnd_create_instr(pop_unaligned_done)));
     PRE(bb, NULL,
         INSTR_CREATE_mov_st(drcontext, OPND_CREATE_MEM8(mi.reg1.reg, 0),
-                            OPND_CREATE_INT8((char)SHADOW_DWORD_UNADDRESSABLE)));
+                            OPND_CREATE_INT8((char)shadow_dword_oldmem)));
     PRE(bb, NULL,
         INSTR_CREATE_dec(drcontext, opnd_create_reg(mi.reg3.reg)));
     PRE(bb, NULL,
@@ -1395,7 +1536,7 @@ generate_shared_esp_fastpath_helper(void *drcontext, instrlist_t *bb,
         /* pop of retaddr happens first (handled in definedness routines) */
         PRE(bb, NULL,
             INSTR_CREATE_add(drcontext, opnd_create_reg(mi.reg1.reg),
-                             OPND_CREATE_INT8(4)));
+                             OPND_CREATE_INT8(sizeof(void*))));
     }
     if (type == ESP_ADJUST_ABSOLUTE) {
         /* TLS slot holds abs esp so re-compute orig delta */
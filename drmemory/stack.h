@@ -39,6 +39,7 @@ extern uint push_addressable_heap;
 extern uint push_addressable_mmap;
 extern uint zero_loop_aborts_fault;
 extern uint zero_loop_aborts_thresh;
+extern uint adjust_esp_bulk;
 #endif
 
 /* since we dynamically adjust options.stack_swap_threshold we use a separate
@@ -370,6 +370,61 @@ check_sysmem(uint flags, drsys_sysnum_t sysnum, app_pc ptr, size_t sz, dr_mconte
     }
 }
 
+/* Post-syscall writes are collected per thread and committed together via
+ * shadow_set_ranges(), which shares shadow block lookups between them: for
+ * readv or recvmsg with many iovecs, that is one lookup per shadow block rather
+ * than a handle_mem_ref() call per buffer.  A range with unaddressable bytes
+ * is left to check_sysmem() so that the error is reported against its own arg.
+ */
+#define SYSMEM_BATCH_MAX 64
+/* Larger writes go straight to check_sysmem() for its i#556 handling */
+#define SYSMEM_BATCH_MAX_SIZE (64*1024)
+
+typedef struct _sysmem_batch_t {
+    uint num;
+    shadow_range_t range[SYSMEM_BATCH_MAX];
+    const char *id[SYSMEM_BATCH_MAX];
+} sysmem_batch_t;
+
+#ifdef STATISTICS
+uint sysmem_batch_ranges;
+uint sysmem_batch_unaddr;
+#endif
+
+static void
+sysmem_batch_flush(sysmem_batch_t *batch, drsys_sysnum_t sysnum, dr_mcontext_t *mc)
+{
+    uint i = 0;
+    while (i < batch->num) {
+        i += shadow_set_ranges(&batch->range[i], batch->num - i, SHADOW_DEFINED);
+        if (i < batch->num) {
+            STATS_INC(sysmem_batch_unaddr);
+            check_sysmem(MEMREF_WRITE, sysnum, batch->range[i].start,
+                         batch->range[i].end - batch->range[i].start, mc,
+                         batch->id[i]);
+            i++;
+        }
+    }
+    batch->num = 0;
+}
+
+/* Returns false if arg should be committed on its own */
+static bool
+sysmem_batch_add(sysmem_batch_t *batch, drsys_arg_t *arg)
+{
+    if (arg->start_addr == NULL || arg->size == 0 || arg->size > SYSMEM_BATCH_MAX_SIZE)
+        return false;
+    if (batch->num == SYSMEM_BATCH_MAX)
+        sysmem_batch_flush(batch, arg->sysnum, arg->mc);
+    STATS_INC(sysmem_batch_ranges);
+    batch->range[batch->num].start = (app_pc) arg->start_addr;
+    batch->range[batch->num].end = (app_pc) arg->start_addr + arg->size;
+    batch->id[batch->num] = arg->arg_name;
+    batch->num++;
+    return true;
+}
+
+/* user_data is a sysmem_batch_t for post-syscall iteration */
 static bool
 drsys_iter_memarg_cb(drsys_arg_t *arg, void *user_data)
 {
@@ -407,6 +462,9 @@ drsys_iter_memarg_cb(drsys_arg_t *arg, void *user_data)
         }
     } else {
         ASSERT(TEST(DRSYS_PARAM_OUT, arg->mode), "shouldn't see IN params in post");
+        if (user_data != NULL && options.check_uninitialized &&
+            sysmem_batch_add((sysmem_batch_t *) user_data, arg))
+            return true; /* keep going */
         flags = MEMREF_WRITE;
     }
     check_sysmem(flags, arg->sysnum, arg->start_addr, arg->size, arg->mc, arg->arg_name);
@@ -549,10 +607,21 @@ event_post_syscall(void *drcontext, int sysnum)
         /* post-syscall, eax is defined */
         register_shadow_set_dword(REG_XAX, SHADOW_DWORD_DEFINED);
         if (success) {
-            /* commit the writes via MEMREF_WRITE */
-            if (drsys_iterate_memargs(drcontext, drsys_iter_memarg_cb, NULL) !=
+            /* commit the writes */
+            sysmem_batch_t *batch = NULL;
+            if (options.check_uninitialized) {
+                if (pt->sysmem_batch == NULL) {
+                    pt->sysmem_batch = thread_alloc(drcontext, sizeof(sysmem_batch_t),
+                                                    HEAPSTAT_MISC);
+                    ((sysmem_batch_t *)pt->sysmem_batch)->num = 0;
+                }
+                batch = (sysmem_batch_t *) pt->sysmem_batch;
+            }
+            if (drsys_iterate_memargs(drcontext, drsys_iter_memarg_cb, batch) !=
                 DRMF_SUCCESS)
                 ASSERT(false, "drsys_iterate_memargs failed");
+            if (batch != NULL)
+                sysmem_batch_flush(batch, sysnum_full, mc);
         }
         if (auxlib_known_syscall(sysnum))
             auxlib_shadow_post_syscall(drcontext, sysnum, mc);
@@ -568,7 +637,11 @@ event_filter_syscall(void *drcontext, int sysnum)
 static void
 syscall_reset_per_thread(void *drcontext, cls_syscall_t *cpt)
 {
-    /* nothing to free anymore */
+    if (cpt->sysmem_batch != NULL) {
+        thread_free(drcontext, cpt->sysmem_batch, sizeof(sysmem_batch_t),
+                    HEAPSTAT_MISC);
+        cpt->sysmem_batch = NULL;
+    }
 }
 
 static void
@@ -85,6 +85,8 @@ syscall_is_known(drsys_sysnum_t num);
 #  define MAX_SYSNUM 1400
 # endif
 extern int syscall_invoked[MAX_SYSNUM];
+extern uint sysmem_batch_ranges;
+extern uint sysmem_batch_unaddr;
 #endif
 
 void
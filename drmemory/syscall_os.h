@@ -28,6 +28,8 @@ extern int cls_idx_syscall;
 typedef struct _cls_syscall_t {
     /* Saves syscall params across syscall */
     void *sysaux_params;
+    /* Post-syscall writes to commit together: a lazily allocated sysmem_batch_t */
+    void *sysmem_batch;
 
 #ifdef WINDOWS
     /* for GDI checks (i#752) */
@@ -26,8 +26,14 @@
  * + callstacks
  * + timestamps
  *
- * XXX i#1497: port to Linux
  * XXX i#1498: port to MacOS
+ *
+ * With -binary, instead of formatting each argument as text at syscall time
+ * we append raw arg values and copies of the memory they point at to a
+ * buffer per thread, written to a separate file per thread in the format
+ * described in drstrace_log.h.  The drstrace_decode tool, which is built
+ * from this file with DRSTRACE_DECODER, converts those files to the same
+ * text we would have printed.
  */
 
 #include "dr_api.h"
@@ -35,6 +41,7 @@
 #include "drx.h"
 #include "drsyscall.h"
 #include "drstrace_named_consts.h"
+#include "drstrace_log.h"
 #include "utils.h"
 #include <string.h>
 #ifdef WINDOWS
@@ -42,7 +49,9 @@
 # include <windows.h>
 #endif
 
+#ifdef WINDOWS
 extern size_t get_const_arrays_num(void);
+#endif
 
 /* Where to write the trace */
 static file_t outf;
@@ -58,6 +67,16 @@ hashtable_t nconsts_table;
 #define TYPE_OUTPUT_SIZE 2048
 #define HASHTABLE_BITSIZE 10 /* 512 < entries # < 1024 */
 
+/* For -binary: the per-thread buffer */
+#define BINBUF_SIZE (64*1024)
+/* The per-thread and global tables of syscalls seen */
+#define THREAD_SYSCALL_TABLE_BITS 6
+#define SYSCALL_TABLE_BITS 10
+/* For -summary: bucket 0 is <1us and bucket i is [2^(i-1), 2^i) us, except
+ * the last one which has no upper bound.
+ */
+#define LATENCY_BUCKETS 24
+
 typedef struct _buf_info_t {
     char buf[OUTBUF_SIZE];
     size_t sofar;
@@ -86,25 +105,87 @@ static uint verbose = 1;
       dr_abort(), 0) : 0))
 
 #define OPTION_MAX_LENGTH MAXIMUM_PATH
+#define OPTION_LIST_MAX_LENGTH 4096
 
 typedef struct _drstrace_options_t {
     char logdir[MAXIMUM_PATH];
     char sympath[MAXIMUM_PATH];
+    bool binary;
+    bool summary;
+    /* Comma-separated lists, applied once drsyscall is initialized */
+    char include[OPTION_LIST_MAX_LENGTH];
+    char exclude[OPTION_LIST_MAX_LENGTH];
+    char threads[OPTION_LIST_MAX_LENGTH];
+    char sample[OPTION_LIST_MAX_LENGTH];
 } drstrace_options_t;
 
 static drstrace_options_t options;
 
+/* All reads of app memory made while printing go through here.  The decoder
+ * has no app to read from and instead looks in the memory copies recorded
+ * alongside the syscall being printed.
+ */
+#ifdef DRSTRACE_DECODER
+extern bool
+drstrace_decode_read_mem(void *addr, size_t size, void *dst);
+# define READ_APP_MEM(addr, size, dst) drstrace_decode_read_mem(addr, size, dst)
+#else
+# define READ_APP_MEM(addr, size, dst) dr_safe_read(addr, size, dst, NULL)
+#endif
+
+static bool
+nconsts_table_init(void)
+{
+#ifdef WINDOWS
+    uint i;
+    uint const_arrays_num = get_const_arrays_num();
+#endif
+    hashtable_init(&nconsts_table, HASHTABLE_BITSIZE, HASH_STRING, false);
+#ifdef WINDOWS
+    for (i = 0; i < const_arrays_num; i++) {
+        const_values_t *named_consts = const_struct_array[i];
+        if (!hashtable_add(&nconsts_table, (void *) named_consts[0].const_name,
+                           (void *) named_consts))
+            return false;
+    }
+#endif
+    return true;
+}
+
+#ifdef WINDOWS
 static void
-print_unicode_string(buf_info_t *buf, UNICODE_STRING *us)
+print_unicode_string(buf_info_t *buf, UNICODE_STRING *us_app)
 {
-    if (us == NULL)
+    UNICODE_STRING us;
+    const wchar_t *str;
+    size_t len;
+#ifdef DRSTRACE_DECODER
+    wchar_t copy[DRSTRACE_MAX_MEM_COPY/sizeof(wchar_t)];
+#endif
+    if (us_app == NULL) {
         OUTPUT(buf, "<null>");
-    else {
-        OUTPUT(buf, "%d/%d \"%.*S\"", us->Length, us->MaximumLength,
-               us->Length/sizeof(wchar_t),
-               (us->Buffer == NULL) ? L"<null>" : us->Buffer);
+        return;
+    }
+    if (!READ_APP_MEM(us_app, sizeof(us), &us)) {
+        OUTPUT(buf, "<field unreadable>");
+        return;
+    }
+#ifdef DRSTRACE_DECODER
+    /* Only the start of a long string was recorded */
+    len = MIN(us.Length/sizeof(wchar_t), BUFFER_SIZE_ELEMENTS(copy));
+    if (us.Buffer != NULL && !READ_APP_MEM(us.Buffer, len*sizeof(wchar_t), copy)) {
+        OUTPUT(buf, "%d/%d <field unreadable>", us.Length, us.MaximumLength);
+        return;
     }
+    str = copy;
+#else
+    len = us.Length/sizeof(wchar_t);
+    str = us.Buffer;
+#endif
+    OUTPUT(buf, "%d/%d \"%.*S\"", us.Length, us.MaximumLength, (int) len,
+           (us.Buffer == NULL) ? L"<null>" : str);
 }
+#endif
 
 void
 print_simple_value(buf_info_t *buf, drsys_arg_t *arg, bool leading_zeroes)
@@ -116,7 +197,7 @@ print_simple_value(buf_info_t *buf, drsys_arg_t *arg, bool leading_zeroes)
         ptr_uint_t deref = 0;
         ASSERT(arg->size <= sizeof(deref), "too-big simple type");
         /* We assume little-endian */
-        if (dr_safe_read((void *)arg->value, arg->size, &deref, NULL))
+        if (READ_APP_MEM((void *)arg->value, arg->size, &deref))
             OUTPUT(buf, (leading_zeroes ? " => "PFX : " => "PIFX), deref);
     }
 }
@@ -193,7 +274,7 @@ safe_read_field(buf_info_t *buf, void *addr_to_resolve, size_t addr_size,
 {
     int64 mem_value = 0;
     ASSERT(addr_size <= sizeof(mem_value), "too-big mem value to read");
-    if (!dr_safe_read(addr_to_resolve, addr_size, &mem_value, NULL)) {
+    if (!READ_APP_MEM(addr_to_resolve, addr_size, &mem_value)) {
         OUTPUT(buf, "<field unreadable>");
         return 0;
     }
@@ -206,29 +287,44 @@ static bool
 print_known_compound_type(buf_info_t *buf, drsys_param_type_t type, void *start_addr)
 {
     switch (type) {
+#ifdef WINDOWS
     case DRSYS_TYPE_UNICODE_STRING: {
         print_unicode_string(buf, (UNICODE_STRING *) start_addr);
         break;
     }
     case DRSYS_TYPE_OBJECT_ATTRIBUTES: {
-        OBJECT_ATTRIBUTES *oa = (OBJECT_ATTRIBUTES *) start_addr;
+        OBJECT_ATTRIBUTES oa;
+        if (!READ_APP_MEM(start_addr, sizeof(oa), &oa)) {
+            OUTPUT(buf, "<field unreadable>");
+            break;
+        }
         OUTPUT(buf, "len="PIFX", root="PIFX", name=",
-                oa->Length, oa->RootDirectory);
-        print_unicode_string(buf, oa->ObjectName);
+                oa.Length, oa.RootDirectory);
+        print_unicode_string(buf, oa.ObjectName);
         OUTPUT(buf, ", att="PIFX", sd="PFX", sqos="PFX,
-                oa->Attributes, oa->SecurityDescriptor,
-                oa->SecurityQualityOfService);
+                oa.Attributes, oa.SecurityDescriptor,
+                oa.SecurityQualityOfService);
         break;
     }
     case DRSYS_TYPE_IO_STATUS_BLOCK: {
-        IO_STATUS_BLOCK *io = (IO_STATUS_BLOCK *) start_addr;
-        OUTPUT(buf, "status="PIFX", info="PIFX"", io->StatusPointer.Status,
-                io->Information);
+        IO_STATUS_BLOCK io;
+        if (!READ_APP_MEM(start_addr, sizeof(io), &io)) {
+            OUTPUT(buf, "<field unreadable>");
+            break;
+        }
+        OUTPUT(buf, "status="PIFX", info="PIFX"", io.StatusPointer.Status,
+                io.Information);
         break;
     }
+#endif
     case DRSYS_TYPE_LARGE_INTEGER: {
-        LARGE_INTEGER *li = (LARGE_INTEGER *) start_addr;
-        OUTPUT(buf, "0x"HEX64_FORMAT_STRING, li->QuadPart);
+        /* LARGE_INTEGER is a Windows type but has the layout of an int64 */
+        int64 li;
+        if (!READ_APP_MEM(start_addr, sizeof(li), &li)) {
+            OUTPUT(buf, "<field unreadable>");
+            break;
+        }
+        OUTPUT(buf, "0x"HEX64_FORMAT_STRING, li);
         break;
     }
     default: {
@@ -495,27 +591,827 @@ drsys_iter_arg_cb(drsys_arg_t *arg, void *user_data)
     return true; /* keep going */
 }
 
+static void
+print_syscall_name(buf_info_t *buf, const char *name, bool known)
+{
+    OUTPUT(buf, "%s%s\n", name, known ? "" : " (details not all known)");
+}
+
+static void
+print_syscall_result(buf_info_t *buf, bool success, uint error)
+{
+    if (success)
+        OUTPUT(buf, "    succeeded =>\n");
+    else
+        OUTPUT(buf, "    failed (error="IF_WINDOWS_ELSE(PIFX, "%d")") =>\n", error);
+}
+
+/***************************************************************************
+ * Per-syscall configuration and statistics
+ */
+
+typedef struct _syscall_stats_t {
+    /* all invocations, including those skipped by sampling */
+    uint calls;
+    /* the rest only count sampled invocations */
+    uint sampled;
+    uint failures;
+    uint64 total_usec;
+    uint latency[LATENCY_BUCKETS];
+} syscall_stats_t;
+
+typedef struct _syscall_entry_t {
+    const char *name;
+    drsys_sysnum_t sysnum;
+    bool traced;
+    /* We record the first of every sample_rate invocations in each thread */
+    uint sample_rate;
+    /* Merged from each thread's counts at thread exit, under stats_lock */
+    syscall_stats_t stats;
+} syscall_entry_t;
+
+/* Maps drsys_syscall_t* to syscall_entry_t*.  Filled at init from
+ * drsys_iterate_syscalls(), and on first use for syscalls drsyscall only
+ * learns about later.
+ */
+static hashtable_t syscall_table;
+static void *stats_lock;
+
+/* Primary syscall numbers for event_filter_syscall(): with -include, those
+ * to intercept; otherwise, those all of whose syscalls are excluded.
+ * Read-only after init.
+ */
+static hashtable_t sysnum_filter;
+static bool sysnum_filter_is_include;
+
+static uint default_sample_rate = 1;
+
+#define MAX_THREAD_IDS 64
+static thread_id_t thread_ids[MAX_THREAD_IDS];
+static uint num_thread_ids;
+
+static syscall_entry_t *
+syscall_entry_create(drsys_syscall_t *syscall, drsys_sysnum_t sysnum)
+{
+    syscall_entry_t *entry = (syscall_entry_t *) dr_global_alloc(sizeof(*entry));
+    memset(entry, 0, sizeof(*entry));
+    if (drsys_syscall_name(syscall, &entry->name) != DRMF_SUCCESS)
+        ASSERT(false, "drsys_syscall_name failed");
+    entry->sysnum = sysnum;
+    /* The name-based options were applied at init to the syscalls known
+     * then, so only the numbers matter for later ones.
+     */
+    entry->traced = (hashtable_lookup(&sysnum_filter, (void *)(ptr_int_t)
+                                      sysnum.number) != NULL) ==
+        sysnum_filter_is_include;
+    entry->sample_rate = default_sample_rate;
+    return entry;
+}
+
+static void
+syscall_entry_free(void *p)
+{
+    dr_global_free(p, sizeof(syscall_entry_t));
+}
+
+static syscall_entry_t *
+syscall_entry_lookup(drsys_syscall_t *syscall)
+{
+    syscall_entry_t *entry;
+    hashtable_lock(&syscall_table);
+    entry = (syscall_entry_t *) hashtable_lookup(&syscall_table, syscall);
+    if (entry == NULL) {
+        drsys_sysnum_t sysnum;
+        if (drsys_syscall_number(syscall, &sysnum) != DRMF_SUCCESS)
+            ASSERT(false, "drsys_syscall_number failed");
+        entry = syscall_entry_create(syscall, sysnum);
+        hashtable_add(&syscall_table, syscall, entry);
+    }
+    hashtable_unlock(&syscall_table);
+    return entry;
+}
+
+static bool
+syscall_table_add_cb(drsys_sysnum_t sysnum, drsys_syscall_t *syscall, void *user_data)
+{
+    if (hashtable_lookup(&syscall_table, syscall) == NULL)
+        hashtable_add(&syscall_table, syscall, syscall_entry_create(syscall, sysnum));
+    return true; /* keep going */
+}
+
+/* Calls cb on each item of a comma-separated list */
+static void
+list_iterate(const char *list, void (*cb)(const char *item, void *data), void *data)
+{
+    char item[MAXIMUM_PATH];
+    const char *start = list, *end;
+    while (*start != '\0') {
+        size_t len;
+        end = strchr(start, ',');
+        if (end == NULL)
+            end = start + strlen(start);
+        len = MIN((size_t)(end - start), BUFFER_SIZE_ELEMENTS(item) - 1);
+        if (len > 0) {
+            memcpy(item, start, len);
+            item[len] = '\0';
+            cb(item, data);
+        }
+        start = (*end == '\0') ? end : end + 1;
+    }
+}
+
+/* An item is a syscall name, a number, or a range of numbers "lo-hi" */
+static bool
+parse_number_range(const char *item, uint *lo, uint *hi)
+{
+    if (item[0] < '0' || item[0] > '9')
+        return false;
+    if (dr_sscanf(item, "%u-%u", lo, hi) == 2)
+        return *lo <= *hi;
+    if (dr_sscanf(item, "%u", lo) == 1) {
+        *hi = *lo;
+        return true;
+    }
+    return false;
+}
+
+static void
+filter_item_cb(const char *item, void *data)
+{
+    bool include = *(bool *)data;
+    uint lo, hi, i;
+    if (parse_number_range(item, &lo, &hi)) {
+        for (i = 0; i < HASHTABLE_SIZE(syscall_table.table_bits); i++) {
+            hash_entry_t *he;
+            for (he = syscall_table.table[i]; he != NULL; he = he->next) {
+                syscall_entry_t *entry = (syscall_entry_t *) he->payload;
+                if ((uint)entry->sysnum.number >= lo && (uint)entry->sysnum.number <= hi)
+                    entry->traced = include;
+            }
+        }
+        /* This also covers numbers drsyscall does not know about yet */
+        USAGE_CHECK(hi - lo <= 0xffff, "system call number range too large");
+        for (i = lo; ; i++) {
+            if (include) {
+                drsys_sysnum_t sysnum = {i, 0};
+                hashtable_add(&sysnum_filter, (void *)(ptr_int_t)i, (void *)1);
+                drsys_filter_syscall(sysnum);
+            } else if (!sysnum_filter_is_include)
+                hashtable_add(&sysnum_filter, (void *)(ptr_int_t)i, (void *)1);
+            if (i == hi)
+                break;
+        }
+    } else {
+        drsys_syscall_t *syscall;
+        syscall_entry_t *entry;
+        if (drsys_name_to_syscall(item, &syscall) != DRMF_SUCCESS) {
+            ALERT(0, "<drstrace: unknown system call \"%s\" in %s list>\n",
+                  item, include ? "-include" : "-exclude");
+            return;
+        }
+        entry = (syscall_entry_t *) hashtable_lookup(&syscall_table, syscall);
+        if (entry != NULL)
+            entry->traced = include;
+    }
+}
+
+static void
+sample_item_cb(const char *item, void *data)
+{
+    bool names = *(bool *)data;
+    const char *eq = strchr(item, '=');
+    uint rate;
+    if ((eq != NULL) != names)
+        return;
+    if (eq == NULL) {
+        USAGE_CHECK(dr_sscanf(item, "%u", &rate) == 1 && rate > 0,
+                    "invalid -sample rate");
+        default_sample_rate = rate;
+    } else {
+        char name[MAXIMUM_PATH];
+        drsys_syscall_t *syscall;
+        syscall_entry_t *entry;
+        USAGE_CHECK(dr_sscanf(eq + 1, "%u", &rate) == 1 && rate > 0,
+                    "invalid -sample rate");
+        dr_snprintf(name, MIN((size_t)(eq - item) + 1, BUFFER_SIZE_ELEMENTS(name)),
+                    "%s", item);
+        NULL_TERMINATE_BUFFER(name);
+        if (drsys_name_to_syscall(name, &syscall) != DRMF_SUCCESS) {
+            ALERT(0, "<drstrace: unknown system call \"%s\" in -sample list>\n",
+                  name);
+            return;
+        }
+        entry = (syscall_entry_t *) hashtable_lookup(&syscall_table, syscall);
+        if (entry != NULL)
+            entry->sample_rate = rate;
+    }
+}
+
+static void
+thread_item_cb(const char *item, void *data)
+{
+    uint tid;
+    USAGE_CHECK(dr_sscanf(item, "%u", &tid) == 1, "invalid -threads id");
+    USAGE_CHECK(num_thread_ids < MAX_THREAD_IDS, "too many -threads ids");
+    thread_ids[num_thread_ids++] = (thread_id_t) tid;
+}
+
+static bool
+thread_is_traced(thread_id_t tid)
+{
+    uint i;
+    if (num_thread_ids == 0)
+        return true;
+    for (i = 0; i < num_thread_ids; i++) {
+        if (thread_ids[i] == tid)
+            return true;
+    }
+    return false;
+}
+
+/* Applies -include, -exclude, -sample, and -threads.  Syscalls filtered out
+ * by number are not intercepted at all; the thread filter and finer-grained
+ * exclusions of syscalls sharing a primary number with a traced syscall are
+ * applied in the pre-syscall event.  With -include or -exclude we only ask
+ * drsyscall for the syscalls we trace, so syscalls it does not know about
+ * are then not traced.
+ */
+static void
+syscall_config_init(void)
+{
+    bool include = true, exclude = false, names = false;
+    uint i;
+    hash_entry_t *he;
+
+    stats_lock = dr_mutex_create();
+    hashtable_init_ex(&syscall_table, SYSCALL_TABLE_BITS, HASH_INTPTR,
+                      false/*!str_dup*/, true/*synch*/,
+                      syscall_entry_free, NULL, NULL);
+    hashtable_init(&sysnum_filter, HASHTABLE_BITSIZE, HASH_INTPTR, false/*!strdup*/);
+    sysnum_filter_is_include = (options.include[0] != '\0');
+
+    /* The default rate must be known when the entries are created */
+    list_iterate(options.sample, sample_item_cb, &names);
+    if (drsys_iterate_syscalls(syscall_table_add_cb, NULL) != DRMF_SUCCESS)
+        ASSERT(false, "drsys_iterate_syscalls failed");
+    for (i = 0; i < HASHTABLE_SIZE(syscall_table.table_bits); i++) {
+        for (he = syscall_table.table[i]; he != NULL; he = he->next)
+            ((syscall_entry_t *) he->payload)->traced = !sysnum_filter_is_include;
+    }
+    list_iterate(options.include, filter_item_cb, &include);
+    list_iterate(options.exclude, filter_item_cb, &exclude);
+    names = true;
+    list_iterate(options.sample, sample_item_cb, &names);
+    list_iterate(options.threads, thread_item_cb, NULL);
+
+    if (!sysnum_filter_is_include) {
+        /* Exclude a primary number only if all of its syscalls are excluded */
+        for (i = 0; i < HASHTABLE_SIZE(syscall_table.table_bits); i++) {
+            for (he = syscall_table.table[i]; he != NULL; he = he->next) {
+                syscall_entry_t *entry = (syscall_entry_t *) he->payload;
+                if (!entry->traced) {
+                    hashtable_add(&sysnum_filter,
+                                  (void *)(ptr_int_t)entry->sysnum.number, (void *)1);
+                }
+            }
+        }
+        for (i = 0; i < HASHTABLE_SIZE(syscall_table.table_bits); i++) {
+            for (he = syscall_table.table[i]; he != NULL; he = he->next) {
+                syscall_entry_t *entry = (syscall_entry_t *) he->payload;
+                if (entry->traced) {
+                    hashtable_remove(&sysnum_filter,
+                                     (void *)(ptr_int_t)entry->sysnum.number);
+                    /* DR intercepts a syscall if any filter event wants it,
+                     * so we can't ask drsyscall for all of them.
+                     */
+                    if (options.exclude[0] != '\0' &&
+                        drsys_filter_syscall(entry->sysnum) != DRMF_SUCCESS)
+                        ASSERT(false, "drsys_filter_syscall failed");
+                }
+            }
+        }
+        /* Without exclusions we also want syscalls drsyscall does not know */
+        if (options.exclude[0] == '\0' &&
+            drsys_filter_all_syscalls() != DRMF_SUCCESS)
+            ASSERT(false, "drsys_filter_all_syscalls should never fail");
+    } else {
+        for (i = 0; i < HASHTABLE_SIZE(syscall_table.table_bits); i++) {
+            for (he = syscall_table.table[i]; he != NULL; he = he->next) {
+                syscall_entry_t *entry = (syscall_entry_t *) he->payload;
+                if (entry->traced) {
+                    hashtable_add(&sysnum_filter,
+                                  (void *)(ptr_int_t)entry->sysnum.number, (void *)1);
+                    if (drsys_filter_syscall(entry->sysnum) != DRMF_SUCCESS)
+                        ASSERT(false, "drsys_filter_syscall failed");
+                }
+            }
+        }
+    }
+}
+
+static void
+syscall_stats_add(syscall_stats_t *dst, syscall_stats_t *src)
+{
+    uint i;
+    dst->calls += src->calls;
+    dst->sampled += src->sampled;
+    dst->failures += src->failures;
+    dst->total_usec += src->total_usec;
+    for (i = 0; i < LATENCY_BUCKETS; i++)
+        dst->latency[i] += src->latency[i];
+}
+
+/* Prints the -summary table, most frequent syscalls first */
+static void
+summary_print(void)
+{
+    syscall_entry_t **sorted;
+    uint num = 0, i, j, b;
+    uint64 total_calls = 0;
+    hash_entry_t *he;
+    buf_info_t buf;
+    buf.sofar = 0;
+
+    sorted = (syscall_entry_t **)
+        dr_global_alloc(syscall_table.entries * sizeof(*sorted));
+    for (i = 0; i < HASHTABLE_SIZE(syscall_table.table_bits); i++) {
+        for (he = syscall_table.table[i]; he != NULL; he = he->next) {
+            syscall_entry_t *entry = (syscall_entry_t *) he->payload;
+            if (entry->stats.calls == 0)
+                continue;
+            total_calls += entry->stats.calls;
+            /* insertion sort: there are only a few hundred at most */
+            for (j = num; j > 0 && sorted[j-1]->stats.calls < entry->stats.calls; j--)
+                sorted[j] = sorted[j-1];
+            sorted[j] = entry;
+            num++;
+        }
+    }
+    OUTPUT(&buf, "System call summary: %"UINT64_FORMAT_CODE" calls to %u system calls\n",
+           total_calls, num);
+    for (i = 0; i < num; i++) {
+        syscall_stats_t *stats = &sorted[i]->stats;
+        OUTPUT(&buf, "%s: calls=%u", sorted[i]->name, stats->calls);
+        if (stats->sampled != stats->calls)
+            OUTPUT(&buf, ", sampled=%u", stats->sampled);
+        OUTPUT(&buf, ", failed=%u", stats->failures);
+        if (stats->sampled > 0) {
+            OUTPUT(&buf, ", avg=%"UINT64_FORMAT_CODE"us\n    latency:",
+                   stats->total_usec / stats->sampled);
+            for (b = 0; b < LATENCY_BUCKETS; b++) {
+                if (stats->latency[b] == 0)
+                    continue;
+                if (b == 0)
+                    OUTPUT(&buf, " <1us=%u", stats->latency[b]);
+                else {
+                    OUTPUT(&buf, " %s%uus=%u", b == LATENCY_BUCKETS - 1 ? ">=" : "",
+                           1 << (b - 1), stats->latency[b]);
+                }
+            }
+        }
+        OUTPUT(&buf, "\n");
+    }
+    FLUSH_BUFFER(outf, buf.buf, buf.sofar);
+    dr_global_free(sorted, syscall_table.entries * sizeof(*sorted));
+}
+
+/***************************************************************************
+ * Per-thread state
+ */
+
+/* A syscall as seen by one thread */
+typedef struct _thread_syscall_t {
+    syscall_entry_t *entry;
+    /* for -binary: the id plus one in this thread's file, or 0 if not yet
+     * described there
+     */
+    uint log_id;
+    syscall_stats_t stats;
+} thread_syscall_t;
+
+typedef struct _per_thread_t {
+    /* whether -threads selects this thread */
+    bool traced;
+    /* the syscall in progress, or NULL if we are not recording it */
+    thread_syscall_t *cur;
+    uint64 start_usec;
+    /* maps drsys_syscall_t* to thread_syscall_t* */
+    hashtable_t syscalls;
+    /* for -binary */
+    file_t f;
+    byte *buf;
+    size_t sofar;
+    uint num_ids;
+    /* On the all_threads list, for cleanup at process exit */
+    struct _per_thread_t *next;
+    struct _per_thread_t *prev;
+} per_thread_t;
+
+static int tls_idx = -1;
+/* DR does not call the thread exit event for threads still alive at
+ * process exit, so we keep a list of them.
+ */
+static void *all_threads_lock;
+static per_thread_t *all_threads;
+
+/* Also merges the thread's counts into the global entry */
+static void
+thread_syscall_free(void *p)
+{
+    thread_syscall_t *ts = (thread_syscall_t *) p;
+    dr_mutex_lock(stats_lock);
+    syscall_stats_add(&ts->entry->stats, &ts->stats);
+    dr_mutex_unlock(stats_lock);
+    dr_global_free(ts, sizeof(*ts));
+}
+
+static thread_syscall_t *
+thread_syscall_lookup(per_thread_t *pt, drsys_syscall_t *syscall)
+{
+    thread_syscall_t *ts = (thread_syscall_t *)
+        hashtable_lookup(&pt->syscalls, syscall);
+    if (ts == NULL) {
+        ts = (thread_syscall_t *) dr_global_alloc(sizeof(*ts));
+        memset(ts, 0, sizeof(*ts));
+        ts->entry = syscall_entry_lookup(syscall);
+        hashtable_add(&pt->syscalls, syscall, ts);
+    }
+    return ts;
+}
+
+static void
+summary_post_syscall(void *drcontext, per_thread_t *pt, thread_syscall_t *ts)
+{
+    uint64 usec = dr_get_microseconds() - pt->start_usec;
+    bool success = false;
+    uint b;
+    if (drsys_cur_syscall_result(drcontext, &success, NULL, NULL) != DRMF_SUCCESS)
+        ASSERT(false, "drsys_cur_syscall_result failed");
+    ts->stats.sampled++;
+    if (!success)
+        ts->stats.failures++;
+    ts->stats.total_usec += usec;
+    for (b = 0; b < LATENCY_BUCKETS - 1 && usec >= ((uint64)1 << b); b++)
+        ; /* nothing */
+    ts->stats.latency[b]++;
+}
+
+/***************************************************************************
+ * Binary log
+ */
+
+typedef struct _bin_args_t {
+    uint num_args;
+    uint64 values[DRSTRACE_MAX_ARGS];
+} bin_args_t;
+
+typedef struct _bin_desc_t {
+    uint num_args;
+    drsys_arg_t args[DRSTRACE_MAX_ARGS];
+} bin_desc_t;
+
+static void
+binlog_flush(per_thread_t *pt)
+{
+    FLUSH_BUFFER(pt->f, pt->buf, pt->sofar);
+}
+
+/* Returns space for a record of size bytes (including the drstrace_rec_t)
+ * at the end of pt's buffer, flushing first if there is not enough room.
+ */
+static void *
+binlog_reserve(per_thread_t *pt, drstrace_rec_type_t type, size_t size)
+{
+    drstrace_rec_t *rec;
+    size = ALIGN_FORWARD(size, DRSTRACE_REC_ALIGN);
+    ASSERT(size <= BINBUF_SIZE, "record too large for buffer");
+    if (pt->sofar + size > BINBUF_SIZE)
+        binlog_flush(pt);
+    rec = (drstrace_rec_t *)(pt->buf + pt->sofar);
+    /* zero the padding so the files are deterministic */
+    memset((byte *)rec + size - DRSTRACE_REC_ALIGN, 0, DRSTRACE_REC_ALIGN);
+    rec->type = (ushort) type;
+    rec->unused = 0;
+    rec->size = (uint) size;
+    pt->sofar += size;
+    return rec;
+}
+
+/* Drops rec, which must be the most recently reserved record */
+static void
+binlog_unreserve(per_thread_t *pt, drstrace_rec_t *rec)
+{
+    ASSERT((byte *)rec + rec->size == pt->buf + pt->sofar, "not the last record");
+    pt->sofar -= rec->size;
+}
+
+static void
+binlog_open(void *drcontext, per_thread_t *pt)
+{
+    char buf[MAXIMUM_PATH];
+    drstrace_log_header_t *hdr;
+    pt->f = drx_open_unique_appid_file(options.logdir, dr_get_thread_id(drcontext),
+                                       "drstrace", "bin",
+#ifndef WINDOWS
+                                       DR_FILE_CLOSE_ON_FORK |
+#endif
+                                       DR_FILE_ALLOW_LARGE,
+                                       buf, BUFFER_SIZE_ELEMENTS(buf));
+    ASSERT(pt->f != INVALID_FILE, "failed to open binary log file");
+    ALERT(2, "<drstrace binary log file is %s>\n", buf);
+    /* the header is not a record: it goes straight into the buffer */
+    ASSERT(pt->sofar == 0, "buffer should be empty");
+    hdr = (drstrace_log_header_t *) pt->buf;
+    memcpy(hdr->magic, DRSTRACE_LOG_MAGIC, sizeof(hdr->magic));
+    hdr->version = DRSTRACE_LOG_VERSION;
+    hdr->pointer_size = sizeof(void *);
+    hdr->process_id = dr_get_process_id();
+    hdr->thread_id = dr_get_thread_id(drcontext);
+    pt->sofar = sizeof(*hdr);
+}
+
+static bool
+binlog_desc_cb(drsys_arg_t *arg, void *user_data)
+{
+    bin_desc_t *desc = (bin_desc_t *) user_data;
+    if (desc->num_args < DRSTRACE_MAX_ARGS)
+        desc->args[desc->num_args++] = *arg;
+    return true; /* keep going */
+}
+
+static uint
+binlog_add_string(drstrace_rec_syscall_t *rec, size_t *offs, const char *str)
+{
+    uint res;
+    size_t len;
+    if (str == NULL)
+        return 0;
+    len = strlen(str) + 1;
+    memcpy((byte *)rec + *offs, str, len);
+    res = (uint) *offs;
+    *offs += len;
+    return res;
+}
+
+/* Writes a DRSTRACE_REC_SYSCALL record describing syscall's args as id */
+static void
+binlog_write_syscall(void *drcontext, per_thread_t *pt, drsys_syscall_t *syscall,
+                     uint id)
+{
+    bin_desc_t *desc;
+    drstrace_rec_syscall_t *rec;
+    drstrace_arg_desc_t *arg_desc;
+    drsys_sysnum_t sysnum;
+    const char *name;
+    bool known;
+    drmf_status_t res;
+    size_t size, offs;
+    uint i;
+
+    if (drsys_syscall_name(syscall, &name) != DRMF_SUCCESS)
+        ASSERT(false, "drsys_syscall_name failed");
+    if (drsys_syscall_is_known(syscall, &known) != DRMF_SUCCESS)
+        ASSERT(false, "failed to find whether known");
+    if (drsys_syscall_number(syscall, &sysnum) != DRMF_SUCCESS)
+        ASSERT(false, "drsys_syscall_number failed");
+
+    /* This is once per syscall per thread so we don't mind the heap */
+    desc = (bin_desc_t *) dr_thread_alloc(drcontext, sizeof(*desc));
+    desc->num_args = 0;
+    res = drsys_iterate_args(drcontext, binlog_desc_cb, desc);
+    if (res != DRMF_SUCCESS && res != DRMF_ERROR_DETAILS_UNKNOWN)
+        ASSERT(false, "drsys_iterate_args failed pre-syscall");
+
+    size = sizeof(*rec) + desc->num_args * sizeof(*arg_desc) + strlen(name) + 1;
+    for (i = 0; i < desc->num_args; i++) {
+        drsys_arg_t *arg = &desc->args[i];
+        size += (arg->arg_name == NULL ? 0 : strlen(arg->arg_name) + 1) +
+            (arg->type_name == NULL ? 0 : strlen(arg->type_name) + 1) +
+            (arg->enum_name == NULL ? 0 : strlen(arg->enum_name) + 1);
+    }
+    rec = (drstrace_rec_syscall_t *) binlog_reserve(pt, DRSTRACE_REC_SYSCALL, size);
+    rec->id = id;
+    rec->number = (int) sysnum.number;
+    rec->secondary = (int) sysnum.secondary;
+    rec->known = known;
+    rec->num_args = desc->num_args;
+    arg_desc = (drstrace_arg_desc_t *)(rec + 1);
+    offs = sizeof(*rec) + desc->num_args * sizeof(*arg_desc);
+    rec->name_offs = binlog_add_string(rec, &offs, name);
+    for (i = 0; i < desc->num_args; i++) {
+        drsys_arg_t *arg = &desc->args[i];
+        arg_desc[i].ordinal = arg->ordinal;
+        arg_desc[i].mode = arg->mode;
+        arg_desc[i].type = arg->type;
+        arg_desc[i].size = (uint) arg->size;
+        arg_desc[i].arg_name_offs = binlog_add_string(rec, &offs, arg->arg_name);
+        arg_desc[i].type_name_offs = binlog_add_string(rec, &offs, arg->type_name);
+        arg_desc[i].enum_name_offs = binlog_add_string(rec, &offs, arg->enum_name);
+        arg_desc[i].unused = 0;
+    }
+    ASSERT(offs <= size, "syscall record size miscalculation");
+    dr_thread_free(drcontext, desc, sizeof(*desc));
+}
+
+static uint
+binlog_syscall_id(void *drcontext, per_thread_t *pt, thread_syscall_t *ts,
+                  drsys_syscall_t *syscall)
+{
+    if (ts->log_id == 0) {
+        ts->log_id = ++pt->num_ids;
+        binlog_write_syscall(drcontext, pt, syscall, ts->log_id - 1);
+    }
+    return ts->log_id - 1;
+}
+
+static bool
+binlog_arg_cb(drsys_arg_t *arg, void *user_data)
+{
+    bin_args_t *args = (bin_args_t *) user_data;
+    if (args->num_args < DRSTRACE_MAX_ARGS)
+        args->values[args->num_args++] = arg->valid ? arg->value64 : 0;
+    return true; /* keep going */
+}
+
+static bool
+binlog_memarg_cb(drsys_arg_t *arg, void *user_data)
+{
+    per_thread_t *pt = (per_thread_t *) user_data;
+    drstrace_rec_mem_t *mem;
+    size_t size = MIN(arg->size, DRSTRACE_MAX_MEM_COPY);
+    /* Record what the kernel reads before it runs and what it wrote after */
+    if (size == 0 ||
+        !TEST(arg->pre ? DRSYS_PARAM_IN : DRSYS_PARAM_OUT, arg->mode))
+        return true;
+    mem = (drstrace_rec_mem_t *)
+        binlog_reserve(pt, DRSTRACE_REC_MEM, sizeof(*mem) + size);
+    mem->addr = (uint64)(ptr_uint_t) arg->start_addr;
+    mem->size = (uint) size;
+    mem->unused = 0;
+    if (!dr_safe_read(arg->start_addr, size, mem + 1, NULL))
+        binlog_unreserve(pt, &mem->rec);
+    return true; /* keep going */
+}
+
+static void
+binlog_pre_syscall(void *drcontext, per_thread_t *pt, thread_syscall_t *ts,
+                   drsys_syscall_t *syscall)
+{
+    drstrace_rec_pre_t *rec;
+    bin_args_t args;
+    drmf_status_t res;
+
+    uint id = binlog_syscall_id(drcontext, pt, ts, syscall);
+    args.num_args = 0;
+    res = drsys_iterate_args(drcontext, binlog_arg_cb, &args);
+    if (res != DRMF_SUCCESS && res != DRMF_ERROR_DETAILS_UNKNOWN)
+        ASSERT(false, "drsys_iterate_args failed pre-syscall");
+    rec = (drstrace_rec_pre_t *)
+        binlog_reserve(pt, DRSTRACE_REC_PRE,
+                       sizeof(*rec) + args.num_args * sizeof(args.values[0]));
+    rec->id = id;
+    rec->num_args = args.num_args;
+    memcpy(rec + 1, args.values, args.num_args * sizeof(args.values[0]));
+    res = drsys_iterate_memargs(drcontext, binlog_memarg_cb, pt);
+    if (res != DRMF_SUCCESS && res != DRMF_ERROR_DETAILS_UNKNOWN)
+        ASSERT(false, "drsys_iterate_memargs failed pre-syscall");
+    /* Unlike the text log we do not flush here: a thread that never returns
+     * from the kernel is flushed at process exit.
+     */
+}
+
+static void
+binlog_post_syscall(void *drcontext, per_thread_t *pt, thread_syscall_t *ts)
+{
+    drstrace_rec_post_t *rec;
+    bin_args_t args;
+    bool success = false;
+    uint64 retval = 0;
+    uint error = 0;
+    drmf_status_t res;
+
+    if (drsys_cur_syscall_result(drcontext, &success, &retval, &error) !=
+        DRMF_SUCCESS)
+        ASSERT(false, "drsys_cur_syscall_result failed");
+    args.num_args = 0;
+    res = drsys_iterate_args(drcontext, binlog_arg_cb, &args);
+    if (res != DRMF_SUCCESS && res != DRMF_ERROR_DETAILS_UNKNOWN)
+        ASSERT(false, "drsys_iterate_args failed post-syscall");
+    rec = (drstrace_rec_post_t *)
+        binlog_reserve(pt, DRSTRACE_REC_POST,
+                       sizeof(*rec) + args.num_args * sizeof(args.values[0]));
+    rec->id = ts->log_id - 1;
+    rec->success = success;
+    rec->error = error;
+    rec->retval = retval;
+    rec->num_args = args.num_args;
+    rec->unused = 0;
+    memcpy(rec + 1, args.values, args.num_args * sizeof(args.values[0]));
+    res = drsys_iterate_memargs(drcontext, binlog_memarg_cb, pt);
+    if (res != DRMF_SUCCESS && res != DRMF_ERROR_DETAILS_UNKNOWN)
+        ASSERT(false, "drsys_iterate_memargs failed post-syscall");
+}
+
+/***************************************************************************
+ * Events
+ */
+
+/* Frees pt, merging its counts into the global ones.  It is in global rather
+ * than thread heap so that a forked child can free the entries of threads
+ * that do not exist there.
+ */
+static void
+per_thread_free(per_thread_t *pt)
+{
+    hashtable_delete(&pt->syscalls);
+    if (pt->buf != NULL)
+        dr_global_free(pt->buf, BINBUF_SIZE);
+    dr_global_free(pt, sizeof(*pt));
+}
+
+static void
+event_thread_init(void *drcontext)
+{
+    per_thread_t *pt = (per_thread_t *) dr_global_alloc(sizeof(*pt));
+    memset(pt, 0, sizeof(*pt));
+    pt->traced = thread_is_traced(dr_get_thread_id(drcontext));
+    hashtable_init_ex(&pt->syscalls, THREAD_SYSCALL_TABLE_BITS, HASH_INTPTR,
+                      false/*!str_dup*/, false/*!synch*/,
+                      thread_syscall_free, NULL, NULL);
+    if (options.binary && pt->traced) {
+        pt->buf = (byte *) dr_global_alloc(BINBUF_SIZE);
+        binlog_open(drcontext, pt);
+    }
+    drmgr_set_tls_field(drcontext, tls_idx, (void *) pt);
+    dr_mutex_lock(all_threads_lock);
+    pt->next = all_threads;
+    if (all_threads != NULL)
+        all_threads->prev = pt;
+    all_threads = pt;
+    dr_mutex_unlock(all_threads_lock);
+}
+
+static void
+event_thread_exit(void *drcontext)
+{
+    per_thread_t *pt = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_idx);
+    dr_mutex_lock(all_threads_lock);
+    if (pt->prev == NULL)
+        all_threads = pt->next;
+    else
+        pt->prev->next = pt->next;
+    if (pt->next != NULL)
+        pt->next->prev = pt->prev;
+    dr_mutex_unlock(all_threads_lock);
+    if (pt->buf != NULL) {
+        binlog_flush(pt);
+        dr_close_file(pt->f);
+    }
+    per_thread_free(pt);
+}
+
 static bool
 event_pre_syscall(void *drcontext, int sysnum)
 {
+    per_thread_t *pt = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_idx);
     drsys_syscall_t *syscall;
+    thread_syscall_t *ts;
     bool known;
-    drsys_param_type_t ret_type;
     const char *name;
     drmf_status_t res;
     buf_info_t buf;
     buf.sofar = 0;
 
+    pt->cur = NULL;
+    if (!pt->traced)
+        return true;
+
     if (drsys_cur_syscall(drcontext, &syscall) != DRMF_SUCCESS)
         ASSERT(false, "drsys_cur_syscall failed");
 
-    if (drsys_syscall_name(syscall, &name) != DRMF_SUCCESS)
-        ASSERT(false, "drsys_syscall_name failed");
+    ts = thread_syscall_lookup(pt, syscall);
+    if (!ts->entry->traced)
+        return true;
+    /* We record the first of every sample_rate invocations */
+    if (ts->stats.calls++ % ts->entry->sample_rate != 0)
+        return true;
+    pt->cur = ts;
+
+    if (options.summary) {
+        pt->start_usec = dr_get_microseconds();
+        return true;
+    }
+    if (options.binary) {
+        binlog_pre_syscall(drcontext, pt, ts, syscall);
+        return true;
+    }
+
+    name = ts->entry->name;
 
     if (drsys_syscall_is_known(syscall, &known) != DRMF_SUCCESS)
         ASSERT(false, "failed to find whether known");
 
-    OUTPUT(&buf, "%s%s\n", name, known ? "" : " (details not all known)");
+    print_syscall_name(&buf, name, known);
 
     res = drsys_iterate_args(drcontext, drsys_iter_arg_cb, &buf);
     if (res != DRMF_SUCCESS && res != DRMF_ERROR_DETAILS_UNKNOWN)
@@ -530,23 +1426,31 @@ event_pre_syscall(void *drcontext, int sysnum)
 static void
 event_post_syscall(void *drcontext, int sysnum)
 {
-    drsys_syscall_t *syscall;
+    per_thread_t *pt = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_idx);
+    thread_syscall_t *ts = pt->cur;
     bool success = false;
     uint errno;
     drmf_status_t res;
     buf_info_t buf;
     buf.sofar = 0;
 
-    if (drsys_cur_syscall(drcontext, &syscall) != DRMF_SUCCESS)
-        ASSERT(false, "drsys_cur_syscall failed");
+    if (ts == NULL)
+        return; /* filtered out or not sampled */
+    pt->cur = NULL;
+
+    if (options.summary) {
+        summary_post_syscall(drcontext, pt, ts);
+        return;
+    }
+    if (options.binary) {
+        binlog_post_syscall(drcontext, pt, ts);
+        return;
+    }
 
     if (drsys_cur_syscall_result(drcontext, &success, NULL, &errno) != DRMF_SUCCESS)
         ASSERT(false, "drsys_cur_syscall_result failed");
 
-    if (success)
-        OUTPUT(&buf, "    succeeded =>\n");
-    else
-        OUTPUT(&buf, "    failed (error="IF_WINDOWS_ELSE(PIFX, "%d")") =>\n", errno);
+    print_syscall_result(&buf, success, errno);
     res = drsys_iterate_args(drcontext, drsys_iter_arg_cb, &buf);
     if (res != DRMF_SUCCESS && res != DRMF_ERROR_DETAILS_UNKNOWN)
         ASSERT(false, "drsys_iterate_args failed post-syscall");
@@ -556,7 +1460,9 @@ event_post_syscall(void *drcontext, int sysnum)
 static bool
 event_filter_syscall(void *drcontext, int sysnum)
 {
-    return true; /* intercept everything */
+    /* Syscalls we return false for never reach drsyscall or our events */
+    return (hashtable_lookup(&sysnum_filter, (void *)(ptr_int_t)sysnum) != NULL) ==
+        sysnum_filter_is_include;
 }
 
 static void
@@ -582,16 +1488,62 @@ open_log_file(void)
 static void
 event_fork(void *drcontext)
 {
-    /* The old file was closed by DR b/c we passed DR_FILE_CLOSE_ON_FORK */
-    open_log_file();
+    per_thread_t *pt = (per_thread_t *) drmgr_get_tls_field(drcontext, tls_idx);
+    per_thread_t *other, *next;
+    uint i;
+    hash_entry_t *he;
+    /* The other threads are gone, and what is buffered or counted so far
+     * belongs to the parent.  DR closed the parent's files b/c we passed
+     * DR_FILE_CLOSE_ON_FORK.
+     */
+    for (other = all_threads; other != NULL; other = next) {
+        next = other->next;
+        if (other != pt)
+            per_thread_free(other);
+    }
+    pt->next = pt->prev = NULL;
+    all_threads = pt;
+    pt->cur = NULL;
+    hashtable_clear(&pt->syscalls);
+    for (i = 0; i < HASHTABLE_SIZE(syscall_table.table_bits); i++) {
+        for (he = syscall_table.table[i]; he != NULL; he = he->next) {
+            syscall_entry_t *entry = (syscall_entry_t *) he->payload;
+            memset(&entry->stats, 0, sizeof(entry->stats));
+        }
+    }
+    if (options.binary) {
+        if (pt->buf != NULL) {
+            pt->sofar = 0;
+            pt->num_ids = 0;
+            binlog_open(drcontext, pt);
+        }
+    } else
+        open_log_file();
 }
 #endif
 
 static
 void exit_event(void)
 {
-    if (outf != STDERR)
+    per_thread_t *pt, *next;
+    /* Threads still alive at exit never see their thread exit event */
+    for (pt = all_threads; pt != NULL; pt = next) {
+        next = pt->next;
+        if (pt->buf != NULL) {
+            binlog_flush(pt);
+            dr_close_file(pt->f);
+        }
+        per_thread_free(pt);
+    }
+    drmgr_unregister_tls_field(tls_idx);
+    dr_mutex_destroy(all_threads_lock);
+    if (options.summary)
+        summary_print();
+    if (!options.binary && outf != STDERR)
         dr_close_file(outf);
+    hashtable_delete(&syscall_table);
+    hashtable_delete(&sysnum_filter);
+    dr_mutex_destroy(stats_lock);
     if (drsys_exit() != DRMF_SUCCESS)
         ASSERT(false, "drsys failed to exit");
     drsym_exit();
@@ -629,18 +1581,36 @@ options_init(client_id_t id)
                              BUFFER_SIZE_ELEMENTS(options.sympath));
             USAGE_CHECK(s != NULL, "missing symcache dir path");
             ALERT(2, "<drstrace symbol source is %s>\n", options.sympath);
+        } else if (strcmp(token, "-binary") == 0) {
+            options.binary = true;
+        } else if (strcmp(token, "-summary") == 0) {
+            options.summary = true;
+        } else if (strcmp(token, "-include") == 0) {
+            s = dr_get_token(s, options.include, BUFFER_SIZE_ELEMENTS(options.include));
+            USAGE_CHECK(s != NULL, "missing -include list");
+        } else if (strcmp(token, "-exclude") == 0) {
+            s = dr_get_token(s, options.exclude, BUFFER_SIZE_ELEMENTS(options.exclude));
+            USAGE_CHECK(s != NULL, "missing -exclude list");
+        } else if (strcmp(token, "-threads") == 0) {
+            s = dr_get_token(s, options.threads, BUFFER_SIZE_ELEMENTS(options.threads));
+            USAGE_CHECK(s != NULL, "missing -threads list");
+        } else if (strcmp(token, "-sample") == 0) {
+            s = dr_get_token(s, options.sample, BUFFER_SIZE_ELEMENTS(options.sample));
+            USAGE_CHECK(s != NULL, "missing -sample list");
         } else {
             ALERT(0, "UNRECOGNIZED OPTION: \"%s\"\n", token);
             USAGE_CHECK(false, "invalid option");
         }
     }
+    USAGE_CHECK(!options.binary || strcmp(options.logdir, "-") != 0,
+                "-binary requires a -logdir directory");
+    USAGE_CHECK(!options.binary || !options.summary,
+                "-binary and -summary are mutually exclusive");
 }
 
 DR_EXPORT
 void dr_init(client_id_t id)
 {
-    uint i = 0;
-    uint const_arrays_num;
     drsys_options_t ops = { sizeof(ops), 0, };
 
     dr_set_client_name("Dr. STrace", "http://drmemory.org/issues");
@@ -658,27 +1628,76 @@ void dr_init(client_id_t id)
         ASSERT(false, "drsys failed to init");
     dr_register_exit_event(exit_event);
 
+    syscall_config_init();
     dr_register_filter_syscall_event(event_filter_syscall);
     drmgr_register_pre_syscall_event(event_pre_syscall);
     drmgr_register_post_syscall_event(event_post_syscall);
-    if (drsys_filter_all_syscalls() != DRMF_SUCCESS)
-        ASSERT(false, "drsys_filter_all_syscalls should never fail");
-    open_log_file();
 
-    const_arrays_num = get_const_arrays_num();
-    hashtable_init(&nconsts_table, HASHTABLE_BITSIZE, HASH_STRING, false);
-    while (i < const_arrays_num) {
-        const_values_t *named_consts = const_struct_array[i];
-        bool res = hashtable_add(&nconsts_table,
-                                 (void *) named_consts[0].const_name,
-                                 (void *) named_consts);
-        if (!res)
-            ASSERT(false, "drstrace failed to add to hashtable");
-        i++;
+    tls_idx = drmgr_register_tls_field();
+    ASSERT(tls_idx > -1, "unable to reserve TLS slot");
+    all_threads_lock = dr_mutex_create();
+    drmgr_register_thread_init_event(event_thread_init);
+    drmgr_register_thread_exit_event(event_thread_exit);
+    /* The binary log is only ever converted offline, so no text log file */
+    if (!options.binary)
+        open_log_file();
+#ifndef WINDOWS
+    dr_register_fork_init_event(event_fork);
+#endif
+
+    if (!nconsts_table_init())
+        ASSERT(false, "drstrace failed to add to hashtable");
+}
+
+/****************************************************************************
+ * Offline decoding of the binary log, used by drstrace_decode
+ */
+
+#ifdef DRSTRACE_DECODER
+bool
+drstrace_decode_init(file_t f, const char *sympath)
+{
+    outf = f;
+    if (sympath != NULL) {
+        dr_snprintf(options.sympath, BUFFER_SIZE_ELEMENTS(options.sympath),
+                    "%s", sympath);
+        NULL_TERMINATE_BUFFER(options.sympath);
     }
+    if (drsym_init(0) != DRSYM_SUCCESS)
+        return false;
+    return nconsts_table_init();
+}
 
+void
+drstrace_decode_exit(void)
+{
+    drsym_exit();
+    hashtable_delete(&nconsts_table);
 }
 
+/* Prints a syscall invocation (if pre) or its result (if !pre) the same way
+ * the client does in text mode.  Any memory the args point at is obtained
+ * through drstrace_decode_read_mem().
+ */
+void
+drstrace_decode_print(bool pre, const char *name, bool known, bool success,
+                      uint error, drsys_arg_t *args, uint num_args)
+{
+    buf_info_t buf;
+    uint i;
+    buf.sofar = 0;
+    if (pre)
+        print_syscall_name(&buf, name, known);
+    else
+        print_syscall_result(&buf, success, error);
+    for (i = 0; i < num_args; i++) {
+        args[i].pre = pre;
+        drsys_iter_arg_cb(&args[i], &buf);
+    }
+    FLUSH_BUFFER(outf, buf.buf, buf.sofar);
+}
+#endif /* DRSTRACE_DECODER */
+
 /****************************************************************************
  * Unit tests group of functions
  */
@@ -696,26 +1715,12 @@ drstrace_unit_test_syscall_exit()
 bool
 drstrace_unit_test_syscall_init()
 {
-    uint const_arrays_num;
-    uint i = 0;
-
     dr_standalone_init();
 
     if (drsym_init(0) != DRSYM_SUCCESS)
         return false;
 
-    const_arrays_num = get_const_arrays_num();
-    hashtable_init(&nconsts_table, HASHTABLE_BITSIZE, HASH_STRING, false);
-    while (i < const_arrays_num) {
-        const_values_t *named_consts = const_struct_array[i];
-        bool res = hashtable_add(&nconsts_table,
-                                 (void *) named_consts[0].const_name,
-                                 (void *) named_consts);
-        if (!res)
-            return false;
-        i++;
-    }
-    return true;
+    return nconsts_table_init();
 }
 
 void
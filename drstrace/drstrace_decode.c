@@ -0,0 +1,306 @@
+/* **********************************************************
+ * Copyright (c) 2014 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/* Dr. Memory: the memory debugger
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* drstrace_decode: converts the per-thread files written by drstrace -binary
+ * into the same text drstrace writes by default.  The printing code is
+ * drstrace.c's own, built with DRSTRACE_DECODER so that its reads of app
+ * memory come here, to the memory copies recorded with each syscall.
+ */
+
+#include "dr_api.h"
+#include "drsyscall.h"
+#include "drstrace_log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern bool
+drstrace_decode_init(file_t f, const char *sympath);
+extern void
+drstrace_decode_exit(void);
+extern void
+drstrace_decode_print(bool pre, const char *name, bool known, bool success,
+                      uint error, drsys_arg_t *args, uint num_args);
+
+#define MAX_MEM_RECS 256
+
+typedef struct _syscall_desc_t {
+    const char *name;
+    bool known;
+    uint num_args;
+    drsys_arg_t args[DRSTRACE_MAX_ARGS];
+} syscall_desc_t;
+
+/* The memory copies that follow the record being printed */
+static drstrace_rec_mem_t *cur_mem[MAX_MEM_RECS];
+static uint num_cur_mem;
+
+static void
+print_usage(void)
+{
+    fprintf(stderr, "usage: drstrace_decode [-symcache_path <path>] "
+            "<drstrace.*.bin file>...\n");
+}
+
+bool
+drstrace_decode_read_mem(void *addr, size_t size, void *dst)
+{
+    uint64 start = (uint64)(ptr_uint_t) addr;
+    uint i;
+    /* Search backward so post-syscall copies win over any pre-syscall copy
+     * of the same region.
+     */
+    for (i = num_cur_mem; i > 0; i--) {
+        drstrace_rec_mem_t *mem = cur_mem[i - 1];
+        if (start >= mem->addr && start + size <= mem->addr + mem->size) {
+            memcpy(dst, (byte *)(mem + 1) + (start - mem->addr), size);
+            return true;
+        }
+    }
+    return false;
+}
+
+static const char *
+rec_string(drstrace_rec_t *rec, uint offs)
+{
+    if (offs == 0 || offs >= rec->size)
+        return NULL;
+    return (const char *)rec + offs;
+}
+
+static syscall_desc_t *
+decode_syscall(drstrace_rec_syscall_t *rec)
+{
+    drstrace_arg_desc_t *arg_desc = (drstrace_arg_desc_t *)(rec + 1);
+    syscall_desc_t *desc;
+    uint i;
+    if (rec->num_args > DRSTRACE_MAX_ARGS ||
+        sizeof(*rec) + rec->num_args * sizeof(*arg_desc) > rec->rec.size)
+        return NULL;
+    desc = (syscall_desc_t *) calloc(1, sizeof(*desc));
+    if (desc == NULL)
+        return NULL;
+    desc->name = rec_string(&rec->rec, rec->name_offs);
+    if (desc->name == NULL)
+        desc->name = "<unknown>";
+    desc->known = rec->known;
+    desc->num_args = rec->num_args;
+    for (i = 0; i < rec->num_args; i++) {
+        drsys_arg_t *arg = &desc->args[i];
+        arg->sysnum.number = rec->number;
+        arg->sysnum.secondary = rec->secondary;
+        arg->ordinal = arg_desc[i].ordinal;
+        arg->mode = (drsys_param_mode_t) arg_desc[i].mode;
+        arg->type = (drsys_param_type_t) arg_desc[i].type;
+        arg->size = arg_desc[i].size;
+        arg->arg_name = rec_string(&rec->rec, arg_desc[i].arg_name_offs);
+        arg->type_name = rec_string(&rec->rec, arg_desc[i].type_name_offs);
+        arg->enum_name = rec_string(&rec->rec, arg_desc[i].enum_name_offs);
+        arg->containing_type = DRSYS_TYPE_INVALID;
+        arg->reg = DR_REG_NULL;
+        arg->valid = true;
+    }
+    return desc;
+}
+
+/* Collects the memory records following the one at offs */
+static void
+collect_mem(byte *data, size_t size, size_t offs)
+{
+    num_cur_mem = 0;
+    while (offs + sizeof(drstrace_rec_t) <= size) {
+        drstrace_rec_t *rec = (drstrace_rec_t *)(data + offs);
+        if (rec->type != DRSTRACE_REC_MEM || rec->size < sizeof(drstrace_rec_mem_t) ||
+            offs + rec->size > size)
+            break;
+        if (sizeof(drstrace_rec_mem_t) + ((drstrace_rec_mem_t *)rec)->size <=
+            rec->size && num_cur_mem < MAX_MEM_RECS)
+            cur_mem[num_cur_mem++] = (drstrace_rec_mem_t *) rec;
+        offs += rec->size;
+    }
+}
+
+static void
+print_invocation(syscall_desc_t *desc, bool pre, bool success, uint error,
+                 const uint64 *values, uint num_values)
+{
+    drsys_arg_t args[DRSTRACE_MAX_ARGS];
+    uint i, num_args = desc->num_args;
+    if (num_values < num_args)
+        num_args = num_values;
+    for (i = 0; i < num_args; i++) {
+        args[i] = desc->args[i];
+        args[i].value = (ptr_uint_t) values[i];
+        args[i].value64 = values[i];
+        args[i].start_addr = NULL;
+    }
+    drstrace_decode_print(pre, desc->name, desc->known, success, error,
+                          args, num_args);
+}
+
+static bool
+decode_file(const char *path)
+{
+    file_t f;
+    uint64 fsize;
+    size_t size, offs;
+    byte *data;
+    drstrace_log_header_t *hdr;
+    syscall_desc_t **descs = NULL;
+    uint num_descs = 0, i;
+    bool ok = true;
+
+    f = dr_open_file(path, DR_FILE_READ);
+    if (f == INVALID_FILE) {
+        fprintf(stderr, "ERROR: unable to open %s\n", path);
+        return false;
+    }
+    if (!dr_file_size(f, &fsize) || fsize < sizeof(*hdr) ||
+        (data = (byte *) malloc((size_t)fsize)) == NULL) {
+        fprintf(stderr, "ERROR: unable to read %s\n", path);
+        dr_close_file(f);
+        return false;
+    }
+    size = (size_t) fsize;
+    if (dr_read_file(f, data, size) != (ssize_t) size) {
+        fprintf(stderr, "ERROR: unable to read %s\n", path);
+        dr_close_file(f);
+        free(data);
+        return false;
+    }
+    dr_close_file(f);
+
+    hdr = (drstrace_log_header_t *) data;
+    if (memcmp(hdr->magic, DRSTRACE_LOG_MAGIC, sizeof(hdr->magic)) != 0 ||
+        hdr->version != DRSTRACE_LOG_VERSION) {
+        fprintf(stderr, "ERROR: %s is not a drstrace binary log\n", path);
+        free(data);
+        return false;
+    }
+    if (hdr->pointer_size != sizeof(void *)) {
+        fprintf(stderr, "ERROR: %s is from a %d-bit process: use the %d-bit "
+                "decoder\n", path, hdr->pointer_size*8, hdr->pointer_size*8);
+        free(data);
+        return false;
+    }
+    dr_fprintf(STDOUT, "== process %d thread %d (%s) ==\n",
+               (int) hdr->process_id, (int) hdr->thread_id, path);
+
+    for (offs = sizeof(*hdr); offs + sizeof(drstrace_rec_t) <= size; ) {
+        drstrace_rec_t *rec = (drstrace_rec_t *)(data + offs);
+        if (rec->size < sizeof(*rec) || offs + rec->size > size) {
+            /* a truncated tail, e.g. from a process that was killed */
+            fprintf(stderr, "WARNING: %s: truncated record at offset %d\n",
+                    path, (int) offs);
+            ok = false;
+            break;
+        }
+        switch (rec->type) {
+        case DRSTRACE_REC_SYSCALL: {
+            drstrace_rec_syscall_t *sys = (drstrace_rec_syscall_t *) rec;
+            if (rec->size < sizeof(*sys))
+                break;
+            if (sys->id >= num_descs) {
+                uint new_num = sys->id + 1;
+                syscall_desc_t **grown = (syscall_desc_t **)
+                    realloc(descs, new_num * sizeof(*descs));
+                if (grown == NULL)
+                    break;
+                memset(grown + num_descs, 0, (new_num - num_descs) * sizeof(*descs));
+                descs = grown;
+                num_descs = new_num;
+            }
+            free(descs[sys->id]);
+            descs[sys->id] = decode_syscall(sys);
+            break;
+        }
+        case DRSTRACE_REC_PRE: {
+            drstrace_rec_pre_t *pre = (drstrace_rec_pre_t *) rec;
+            if (rec->size < sizeof(*pre) ||
+                sizeof(*pre) + pre->num_args * sizeof(uint64) > rec->size ||
+                pre->id >= num_descs || descs[pre->id] == NULL)
+                break;
+            collect_mem(data, size, offs + rec->size);
+            print_invocation(descs[pre->id], true, false, 0,
+                             (uint64 *)(pre + 1), pre->num_args);
+            break;
+        }
+        case DRSTRACE_REC_POST: {
+            drstrace_rec_post_t *post = (drstrace_rec_post_t *) rec;
+            if (rec->size < sizeof(*post) ||
+                sizeof(*post) + post->num_args * sizeof(uint64) > rec->size ||
+                post->id >= num_descs || descs[post->id] == NULL)
+                break;
+            collect_mem(data, size, offs + rec->size);
+            print_invocation(descs[post->id], false, post->success != 0,
+                             (uint) post->error, (uint64 *)(post + 1), post->num_args);
+            break;
+        }
+        default:
+            /* DRSTRACE_REC_MEM is consumed by collect_mem(); skip unknown types */
+            break;
+        }
+        offs += rec->size;
+    }
+
+    for (i = 0; i < num_descs; i++)
+        free(descs[i]);
+    free(descs);
+    free(data);
+    return ok;
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *sympath = NULL;
+    int i;
+    int res = 0;
+
+    dr_standalone_init();
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-symcache_path") == 0) {
+            if (i >= argc - 1) {
+                print_usage();
+                return 1;
+            }
+            sympath = argv[++i];
+        } else if (argv[i][0] == '-') {
+            print_usage();
+            return 1;
+        } else
+            break;
+    }
+    if (i >= argc) {
+        print_usage();
+        return 1;
+    }
+    if (!drstrace_decode_init(STDOUT, sympath)) {
+        fprintf(stderr, "ERROR: failed to initialize\n");
+        return 1;
+    }
+    for (; i < argc; i++) {
+        if (!decode_file(argv[i]))
+            res = 1;
+    }
+    drstrace_decode_exit();
+    return res;
+}
@@ -58,11 +58,20 @@
 #define LIB32_ARCH "lib32"
 #define LIB64_ARCH "lib64"
 
-/* As this is a Windows tool, we tune it for startup and not steady-state perf.
+/* We tune for startup and not steady-state perf, as most of the time goes
+ * to the syscalls themselves.
  * -fast_client_decode relies on drmgr, drx, and drsyscall support.
  */
 #define DEFAULT_DR_OPS "-disable_traces -nop_initial_bblock -fast_client_decode"
 
+#ifdef WINDOWS
+# define DR_LIB_NAME "dynamorio.dll"
+# define CLIENT_LIB_NAME "drstracelib.dll"
+#else
+# define DR_LIB_NAME "libdynamorio.so"
+# define CLIENT_LIB_NAME "libdrstracelib.so"
+#endif
+
 #define CLIENT_ID 0
 
 #define prefix ""
@@ -106,6 +115,18 @@ print_usage(void)
     fprintf(stderr, "                The default value is \".\" (current dir).\n");
     fprintf(stderr, "                If set to \"-\", data for all processes are\n");
     fprintf(stderr, "                printed to stderr (warning: this can be slow).\n");
+    fprintf(stderr, "-binary         Write a compact binary log per thread instead of\n");
+    fprintf(stderr, "                text, to be converted by drstrace_decode.\n");
+    fprintf(stderr, "-summary        Only record per-system-call counts and latency\n");
+    fprintf(stderr, "                histograms, written to the log at exit.\n");
+    fprintf(stderr, "-include <list> Only trace the comma-separated system call names,\n");
+    fprintf(stderr, "                numbers, and number ranges (e.g., \"open,0-3\").\n");
+    fprintf(stderr, "-exclude <list> Do not trace the listed system calls.  Like\n");
+    fprintf(stderr, "                -include, this also skips system calls that\n");
+    fprintf(stderr, "                Dr. Syscall does not know about.\n");
+    fprintf(stderr, "-threads <list> Only trace the listed thread ids.\n");
+    fprintf(stderr, "-sample <list>  Only trace 1 in every N calls of each system call,\n");
+    fprintf(stderr, "                where each item is N for the default or name=N.\n");
     fprintf(stderr, "-symcache_path <path>   Specify absolute path where symbol data\n");
     fprintf(stderr, "                should be cached. If not set, _NT_SYMBOL_PATH\n");
     fprintf(stderr, "                environment variable will be used, if set; else\n");
@@ -208,10 +229,12 @@ _tmain(int argc, TCHAR *targv[])
     size_t cliops_sofar = 0; /* for BUFPRINT to client_ops */
     char dr_ops[MAX_DR_CMDLINE];
     char sym_path[MAXIMUM_PATH];
+    char dr_logdir[MAXIMUM_PATH];
+#ifdef WINDOWS
     char symsrv_path[MAXIMUM_PATH];
     char pdb_path[MAXIMUM_PATH];
-    char dr_logdir[MAXIMUM_PATH];
     char symdll_path[MAXIMUM_PATH];
+#endif
 
     size_t drops_sofar = 0; /* for BUFPRINT to dr_ops */
     ssize_t len; /* shared by all BUFPRINT */
@@ -376,6 +399,7 @@ _tmain(int argc, TCHAR *targv[])
         app_name = full_app_name;
     info("targeting application: \"%s\"", app_name);
 
+#ifdef WINDOWS
     /* Cross-arch injection (i#1506) */
     if (drfront_is_64bit_app(app_name, &res) == DRFRONT_SUCCESS &&
         IF_X64_ELSE(!res, res)) {
@@ -414,6 +438,7 @@ _tmain(int argc, TCHAR *targv[])
                   errcode);
         }
     }
+#endif
 
     /* note that we want target app name as part of cmd line
      * (FYI: if we were using WinMain, the pzsCmdLine passed in
@@ -446,14 +471,14 @@ _tmain(int argc, TCHAR *targv[])
         dr_root = default_dr_root;
     }
     _snprintf(buf, BUFFER_SIZE_ELEMENTS(buf),
-              "%s/%s/%s/dynamorio.dll", dr_root, lib_arch,
+              "%s/%s/%s/"DR_LIB_NAME, dr_root, lib_arch,
               use_dr_debug ? "debug" : "release");
     NULL_TERMINATE_BUFFER(buf);
     if (!file_is_readable(buf)) {
         /* support debug build w/ integrated debug DR build and so no release */
         if (!use_dr_debug) {
             _snprintf(buf, BUFFER_SIZE_ELEMENTS(buf),
-                      "%s/%s/%s/dynamorio.dll", dr_root, lib_arch, "debug");
+                      "%s/%s/%s/"DR_LIB_NAME, dr_root, lib_arch, "debug");
             NULL_TERMINATE_BUFFER(buf);
             if (!file_is_readable(buf)) {
                 fatal("cannot find DynamoRIO library %s", buf);
@@ -465,13 +490,13 @@ _tmain(int argc, TCHAR *targv[])
     }
 
     _snprintf(client_path, BUFFER_SIZE_ELEMENTS(client_path),
-              "%s%c%s%c%s%cdrstracelib.dll", drstrace_root, DIRSEP, bin_arch, DIRSEP,
+              "%s%c%s%c%s%c"CLIENT_LIB_NAME, drstrace_root, DIRSEP, bin_arch, DIRSEP,
               use_drstrace_debug ? "debug" : "release", DIRSEP);
     NULL_TERMINATE_BUFFER(client_path);
     if (!file_is_readable(client_path)) {
         if (!use_drstrace_debug) {
             _snprintf(client_path, BUFFER_SIZE_ELEMENTS(client_path),
-                      "%s%c%s%c%s%cdrstracelib.dll", drstrace_root,
+                      "%s%c%s%c%s%c"CLIENT_LIB_NAME, drstrace_root,
                       DIRSEP, bin_arch, DIRSEP, "debug", DIRSEP);
             NULL_TERMINATE_BUFFER(client_path);
             if (!file_is_readable(client_path)) {
@@ -515,6 +540,10 @@ _tmain(int argc, TCHAR *targv[])
                  drops_sofar, len, "-logdir `%s` ", dr_logdir);
     }
 
+#ifdef WINDOWS
+    /* XXX i#1497: the client's struct printing relies on Wintypes.pdb, so
+     * there is nothing to fetch elsewhere.
+     */
     if (!sym_path_specified) {
         /* Default location for local symbol cache: if our install dir is
          * writable, we want logs/symbols/.  Else just symbols/ inside
@@ -584,6 +613,7 @@ _tmain(int argc, TCHAR *targv[])
     } else {
         warn("symbol initialization error.  Symbol lookup will be disabled.");
     }
+#endif
 
     /* i#1638: fall back to temp dirs if there's no HOME/USERPROFILE set */
     dr_get_config_dir(false/*local*/, true/*use temp*/, buf, BUFFER_SIZE_ELEMENTS(buf));
@@ -0,0 +1,122 @@
+/* **********************************************************
+ * Copyright (c) 2014 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/* Dr. Memory: the memory debugger
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* drstrace binary log format, written by the client with -binary and read
+ * by drstrace_decode.
+ *
+ * Each thread writes its own file: a drstrace_log_header_t followed by a
+ * sequence of records.  Every record starts with a drstrace_rec_t giving
+ * its type and total size, padded to DRSTRACE_REC_ALIGN, so a reader can
+ * skip types it does not know.  Strings (syscall and arg names) are only
+ * written once per thread, in the DRSTRACE_REC_SYSCALL record that
+ * describes a syscall the first time the thread invokes it.  After that
+ * each invocation is a DRSTRACE_REC_PRE and a DRSTRACE_REC_POST holding
+ * raw values, each followed by DRSTRACE_REC_MEM copies of the memory its
+ * pointer args refer to.
+ *
+ * All values are stored in the writer's native byte order.
+ */
+
+#ifndef _DRSTRACE_LOG_H_
+#define _DRSTRACE_LOG_H_ 1
+
+#define DRSTRACE_LOG_MAGIC "DRSTRACE"
+#define DRSTRACE_LOG_VERSION 1
+#define DRSTRACE_REC_ALIGN 8
+
+/* Upper bound on the bytes copied for one memory arg */
+#define DRSTRACE_MAX_MEM_COPY 1024
+/* Upper bound on the args (including the return value) of one syscall */
+#define DRSTRACE_MAX_ARGS 24
+
+typedef struct _drstrace_log_header_t {
+    char magic[8];
+    uint version;
+    uint pointer_size;
+    uint64 process_id;
+    uint64 thread_id;
+} drstrace_log_header_t;
+
+typedef enum {
+    DRSTRACE_REC_SYSCALL = 1,
+    DRSTRACE_REC_PRE,
+    DRSTRACE_REC_POST,
+    DRSTRACE_REC_MEM,
+} drstrace_rec_type_t;
+
+typedef struct _drstrace_rec_t {
+    ushort type; /* drstrace_rec_type_t */
+    ushort unused;
+    uint size;   /* total size including this header and padding */
+} drstrace_rec_t;
+
+/* Describes one arg of a DRSTRACE_REC_SYSCALL.  String fields hold offsets
+ * from the start of the record, or 0 for NULL.
+ */
+typedef struct _drstrace_arg_desc_t {
+    int ordinal;
+    uint mode;  /* drsys_param_mode_t */
+    uint type;  /* drsys_param_type_t */
+    uint size;
+    uint arg_name_offs;
+    uint type_name_offs;
+    uint enum_name_offs;
+    uint unused;
+} drstrace_arg_desc_t;
+
+/* Followed by num_args drstrace_arg_desc_t and then the strings */
+typedef struct _drstrace_rec_syscall_t {
+    drstrace_rec_t rec;
+    uint id; /* referenced by DRSTRACE_REC_PRE and DRSTRACE_REC_POST */
+    int number;
+    int secondary;
+    uint known;
+    uint num_args;
+    uint name_offs;
+} drstrace_rec_syscall_t;
+
+/* Followed by num_args uint64 arg values, in the order of the descriptors */
+typedef struct _drstrace_rec_pre_t {
+    drstrace_rec_t rec;
+    uint id;
+    uint num_args;
+} drstrace_rec_pre_t;
+
+/* Followed by num_args uint64 arg values, in the order of the descriptors */
+typedef struct _drstrace_rec_post_t {
+    drstrace_rec_t rec;
+    uint id;
+    uint success;
+    uint64 error;
+    uint64 retval;
+    uint num_args;
+    uint unused;
+} drstrace_rec_post_t;
+
+/* Followed by size bytes copied from app address addr */
+typedef struct _drstrace_rec_mem_t {
+    drstrace_rec_t rec;
+    uint64 addr;
+    uint size;
+    uint unused;
+} drstrace_rec_mem_t;
+
+#endif /* _DRSTRACE_LOG_H_ */
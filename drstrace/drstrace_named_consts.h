@@ -19,9 +19,11 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
-#include <windows.h>
-#include <stdio.h>
-#include <tchar.h>
+#ifdef WINDOWS
+# include <windows.h>
+# include <stdio.h>
+# include <tchar.h>
+#endif
 
 /* We hardcode each named constant using separate structures for
  * each group of constants. We generate each structure name by using
@@ -0,0 +1,87 @@
+# **********************************************************
+# Copyright (c) 2014 Google, Inc.  All rights reserved.
+# **********************************************************
+
+# Dr. Memory: the memory debugger
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation;
+# version 2.1 of the License, and no later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# Library General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+# Checks that a -binary log run through drstrace_decode reads the same as
+# the text log of the same app.
+#
+# arguments:
+# * drstrace = path to the drstrace frontend
+# * decode = path to drstrace_decode
+# * drdir = DynamoRIO root dir
+# * app = app to run
+# * outdir = scratch dir for the logs
+#
+# The two runs are separate processes, so addresses, handles, and other
+# numbers differ: we compare the text with all numbers masked.  The app must
+# be single-threaded, as the text log interleaves threads.
+
+file(REMOVE_RECURSE "${outdir}")
+file(MAKE_DIRECTORY "${outdir}/text")
+file(MAKE_DIRECTORY "${outdir}/binary")
+
+foreach (mode text binary)
+  if ("${mode}" STREQUAL "binary")
+    set(mode_ops -binary)
+  else ()
+    set(mode_ops "")
+  endif ()
+  execute_process(COMMAND ${drstrace} -dr ${drdir} -logdir ${outdir}/${mode}
+    ${mode_ops} -- ${app}
+    RESULT_VARIABLE cmd_result
+    ERROR_VARIABLE cmd_err
+    OUTPUT_VARIABLE cmd_out)
+  if (cmd_result)
+    message(FATAL_ERROR "*** drstrace ${mode} run failed (${cmd_result}): ${cmd_err}***\n")
+  endif ()
+endforeach ()
+
+file(GLOB text_logs "${outdir}/text/drstrace.*.log")
+list(LENGTH text_logs num_logs)
+if (NOT num_logs EQUAL 1)
+  message(FATAL_ERROR "expected 1 text log, found: ${text_logs}")
+endif ()
+file(READ "${text_logs}" text)
+
+file(GLOB bin_logs "${outdir}/binary/*.bin")
+if ("${bin_logs}" STREQUAL "")
+  message(FATAL_ERROR "no binary logs found")
+endif ()
+list(SORT bin_logs)
+execute_process(COMMAND ${decode} ${bin_logs}
+  RESULT_VARIABLE cmd_result
+  ERROR_VARIABLE cmd_err
+  OUTPUT_VARIABLE decoded)
+if (cmd_result)
+  message(FATAL_ERROR "*** drstrace_decode failed (${cmd_result}): ${cmd_err}***\n")
+endif ()
+# The decoder labels each file
+string(REGEX REPLACE "== process [^\n]*==\n" "" decoded "${decoded}")
+
+foreach (var text decoded)
+  string(REGEX REPLACE "0x[0-9a-fA-F]+" "0x?" ${var} "${${var}}")
+  string(REGEX REPLACE "[0-9]+" "?" ${var} "${${var}}")
+endforeach ()
+
+if (NOT "${text}" STREQUAL "${decoded}")
+  file(WRITE "${outdir}/text.masked" "${text}")
+  file(WRITE "${outdir}/decoded.masked" "${decoded}")
+  message(FATAL_ERROR "decoded binary log differs from the text log: "
+    "compare ${outdir}/text.masked and ${outdir}/decoded.masked")
+endif ()
@@ -32,6 +32,12 @@
 #include <string.h>
 
 /* General comments:
+ * - The file is a binary, position-independent format (see
+ *   symcache_file_header_t) that we map read-only and query in place,
+ *   so loading a module's symcache costs a few validation checks rather
+ *   than a parse, and processes reading the same file share its pages.
+ *   Symbols added during this run live in an in-memory table that
+ *   shadows the file until the next write merges the two.
  * - The file is not assumed to be complete and instead contains negative
  *   entries.  This means it doesn't need to store runtime options used
  *   or anything if there are differences in which symbols we care about
@@ -48,30 +54,110 @@
  *   "std::_DebugHeapDelete<>" duplicates.
  */
 
-#define SYMCACHE_FILE_HEADER "Dr. Memory symbol cache version"
+#define SYMCACHE_FILE_MAGIC "DrMemSymCache"
 
 /* We need to bump the version number whenever we change the file format.
  * We do not need to bump it when we change the symbols we look up,
  * because we include negative entries in the file and make no assumptions
  * that it is a complete record of all lookups we'll need.
  */
-#define SYMCACHE_VERSION 13
+#define SYMCACHE_VERSION 15
+
+/* The file layout is:
+ *   symcache_file_header_t
+ *   symcache_file_symbol_t[num_symbols], sorted by strcmp of the names
+ *   uint[num_offsets], the module offsets of each symbol, contiguous per symbol
+ *   char[strings_size], the NUL-terminated symbol names
+ * All references are file offsets or indices so the file can be mapped
+ * anywhere.
+ *
+ * To share a symcache directory among concurrent processes, we never modify
+ * a file in place.  Each process appends what it learns as a new segment
+ * file <module>.bin.<seq>, where seq is claimed by exclusive file creation.
+ * Once there are enough segments, one process (holding a per-module lock
+ * file) merges the base file <module>.bin with all segments up through
+ * seq, recording seq in the new base's header, and deletes those segments.
+ * Readers map the base plus every later segment, with newer files shadowing
+ * older ones, and look for new segments on each lookup miss.  Symbols that
+ * are still missing after that are remembered per module, so that repeated
+ * misses for them do not touch the file system again.
+ *
+ * We use the same header on all platforms, with the consistency fields that
+ * do not apply left as 0.
+ */
+typedef struct _symcache_file_header_t {
+    char magic[16];
+    uint version;
+    uint header_size;
+    /* For self-consistency checks */
+    uint64 file_size;
+    /* Module consistency checks */
+    uint64 module_file_size;
+    uint64 file_version;
+    uint64 product_version;
+    uint64 module_internal_size;
+    uint checksum;
+    uint timestamp;
+    uint current_version;
+    uint compatibility_version;
+    byte uuid[16];
+    uint has_debug_info;
+    /* The tables */
+    uint num_symbols;
+    uint num_offsets;
+    uint strings_size;
+    uint symbols_offs;
+    uint offsets_offs;
+    uint strings_offs;
+    /* For a segment, its sequence number; for the base, the last segment
+     * merged into it.
+     */
+    uint seq;
+} symcache_file_header_t;
+
+typedef struct _symcache_file_symbol_t {
+    uint name_offs; /* into the strings */
+    uint offs_idx;  /* first entry in the offsets */
+    uint num_offs;
+} symcache_file_symbol_t;
+
+/* A mapped base or segment file */
+typedef struct _symcache_map_t {
+    byte *map;
+    size_t map_size;
+    const symcache_file_header_t *file;
+    const symcache_file_symbol_t *syms;
+    const uint *offs;
+    const char *strings;
+} symcache_map_t;
+
+/* We merge segments into the base file once there are this many */
+#define SYMCACHE_COMPACT_SEGMENTS 8
+/* The base plus the segments we'll map before a compaction */
+#define SYMCACHE_MAX_MAPS 32
+/* How far past a missing segment to look for later ones */
+#define SYMCACHE_SEGMENT_LOOKAHEAD 4
+/* A module lock older than this is from a dead process */
+#define SYMCACHE_LOCK_STALE_MS 60000
+/* How long a writer waits for the module lock before giving up, and how
+ * often it polls.
+ */
+#define SYMCACHE_LOCK_WAIT_MS 5000
+#define SYMCACHE_LOCK_POLL_MS 10
+/* A claimed segment that is still unwritten after this long was abandoned */
+#define SYMCACHE_CLAIM_STALE_MS 60000
 
 /* we need a separate hashtable per module */
 #define SYMCACHE_MASTER_TABLE_HASH_BITS 6
 #define SYMCACHE_MODULE_TABLE_HASH_BITS 6
 #define SYMCACHE_OLIST_TABLE_HASH_BITS 5
+#define SYMCACHE_MISS_TABLE_HASH_BITS 5
 
 /* Size of the buffer used to write the symbol cache.  This is stack allocated,
  * so it should not be increased.
  */
 #define SYMCACHE_BUFFER_SIZE 4096
 
-/* The number of digits used for the decimal representation of the file size of
- * the symcache file.
- */
-#define SYMCACHE_SIZE_DIGITS 10
-
 #define SYMCACHE_MAX_TMP_TRIES 1000
 
 /* We key on full path to reduce chance of duplicate name (i#729).
@@ -93,9 +179,12 @@ typedef struct _mod_cache_t {
     /* strdup-ed modname since key now holds path */
     const char *modname;
     bool from_file; /* came from a cache file */
-    bool appended; /* added to since read from file? */
-    /* Table of offset_list_t entries */
+    /* Table of offset_list_t entries not yet written to a file */
     hashtable_t table;
+    /* Symbols that were in no file even after looking for new segments.
+     * Cleared whenever we map new files.
+     */
+    hashtable_t misses;
     /* Values for consistency that we cache until ready to write to file */
     uint64 module_file_size;
 #ifdef WINDOWS
@@ -114,6 +203,19 @@ typedef struct _mod_cache_t {
 # endif
 #endif
     bool has_debug_info; /* do we have DWARF/PECOFF/PDB symbols? */
+    /* Cached module_has_symbols() result */
+    bool checked_syms;
+    bool mod_has_syms;
+    /* The mapped files, queried in place: the base (if base_mapped) followed
+     * by the segments after it, oldest first.
+     */
+    symcache_map_t maps[SYMCACHE_MAX_MAPS];
+    uint num_maps;
+    bool base_mapped;
+    /* The last segment merged into the base file */
+    uint base_seq;
+    /* The next segment to look for */
+    uint next_seq;
 } mod_cache_t;
 
 typedef struct _offset_entry_t {
@@ -154,6 +256,9 @@ symcache_module_load_save(void *drcontext, const module_data_t *mod, bool loaded
 static void
 symcache_module_unload(void *drcontext, const module_data_t *mod);
 
+static void
+symcache_unmap_all(mod_cache_t *modcache);
+
 static bool
 module_has_symbols(const module_data_t *mod)
 {
@@ -168,6 +273,8 @@ symcache_free_entry(void *v)
     ASSERT(dr_mutex_self_owns(symcache_lock), "missing symcache lock");
     if (modcache != NULL) {
         hashtable_delete(&modcache->table);
+        hashtable_delete(&modcache->misses);
+        symcache_unmap_all(modcache);
         if (modcache->modname != NULL) {
             global_free((void *)modcache->modname, strlen(modcache->modname) + 1,
                         HEAPSTAT_HASHTABLE);
@@ -179,7 +286,7 @@ symcache_free_entry(void *v)
 static void
 symcache_get_filename(const char *modname, char *symfile, size_t symfile_count)
 {
-    dr_snprintf(symfile, symfile_count, "%s/%s.txt", symcache_dir, modname);
+    dr_snprintf(symfile, symfile_count, "%s/%s.bin", symcache_dir, modname);
     symfile[symfile_count-1] = '\0';
 }
 
@@ -269,326 +376,925 @@ symcache_symbol_add(const char *modname, hashtable_t *symtable,
     return true;
 }
 
-/* caller must hold symcache_lock */
+/***************************************************************************
+ * FILE MAPPING
+ */
+
 static void
-symcache_write_symfile(const char *modname, mod_cache_t *modcache)
+symcache_get_segment_filename(const char *modname, uint seq, char *segfile,
+                              size_t segfile_count)
 {
-    uint i;
-    file_t f;
-    hashtable_t *symtable = &modcache->table;
-    char buf[SYMCACHE_BUFFER_SIZE];
-    size_t sofar = 0;
-    ssize_t len;
-    size_t bsz = BUFFER_SIZE_ELEMENTS(buf);
-    size_t filesz_loc;
-    char symfile[MAXIMUM_PATH];
-    char symfile_tmp[MAXIMUM_PATH];
-    int64 file_size;
+    dr_snprintf(segfile, segfile_count, "%s/%s.bin.%u", symcache_dir, modname, seq);
+    segfile[segfile_count-1] = '\0';
+}
 
-    ASSERT(dr_mutex_self_owns(symcache_lock), "missing symcache lock");
+static void
+symcache_get_lock_filename(const char *modname, char *lockfile, size_t lockfile_count)
+{
+    dr_snprintf(lockfile, lockfile_count, "%s/%s.bin.lock", symcache_dir, modname);
+    lockfile[lockfile_count-1] = '\0';
+}
 
-    /* if from file, we assume it's a waste of time to re-write file:
-     * the version matched after all, unless we appended to it.
-     */
-    if (modcache->from_file && !modcache->appended)
-        return;
-    if (symtable->entries == 0)
-        return; /* nothing to write */
+static void
+symcache_unmap(symcache_map_t *m)
+{
+    if (m->map != NULL)
+        dr_unmap_file(m->map, m->map_size);
+    memset(m, 0, sizeof(*m));
+}
 
-    /* Open the temp symcache that we will rename.  */
-    symcache_get_filename(modname, symfile, BUFFER_SIZE_ELEMENTS(symfile));
-    f = INVALID_FILE;
-    i = 0;
-    while (f == INVALID_FILE && i < SYMCACHE_MAX_TMP_TRIES) {
-        dr_snprintf(symfile_tmp, BUFFER_SIZE_ELEMENTS(symfile_tmp),
-                    "%s.%04d.tmp", symfile, i);
-        NULL_TERMINATE_BUFFER(symfile_tmp);
-        f = dr_open_file(symfile_tmp, DR_FILE_WRITE_REQUIRE_NEW);
-        i++;
-    }
-    if (f == INVALID_FILE) {
-        NOTIFY("WARNING: Unable to create symcache temp file %s"NL,
-               symfile_tmp);
-        return;
-    }
+static void
+symcache_unmap_all(mod_cache_t *modcache)
+{
+    uint i;
+    for (i = 0; i < modcache->num_maps; i++)
+        symcache_unmap(&modcache->maps[i]);
+    modcache->num_maps = 0;
+    modcache->base_mapped = false;
+}
 
-    BUFFERED_WRITE(f, buf, bsz, sofar, len, "%s %d\n",
-                   SYMCACHE_FILE_HEADER, SYMCACHE_VERSION);
-    /* Leave room for file size for self-consistency check */
-    filesz_loc = sofar;  /* XXX: Assumes that the buffer hasn't been flushed. */
-    BUFFERED_WRITE(f, buf, bsz, sofar, len,
-                   "%"STRINGIFY(SYMCACHE_SIZE_DIGITS)"u,", 0);
+/* Returns whether the file header matches the current module */
+static bool
+symcache_file_is_consistent(const char *modname, const symcache_file_header_t *hdr,
+                            mod_cache_t *modcache)
+{
+    if (hdr->module_file_size != modcache->module_file_size ||
+        hdr->timestamp != modcache->timestamp) {
+        LOG(1, "module version mismatch: %s symbol cache file is stale\n", modname);
+        LOG(2, "\t"UINT64_FORMAT_STRING" vs "UINT64_FORMAT_STRING", %u vs %u\n",
+            hdr->module_file_size, modcache->module_file_size,
+            hdr->timestamp, modcache->timestamp);
+        return false;
+    }
 #ifdef WINDOWS
-    BUFFERED_WRITE(f, buf, bsz, sofar, len,
-                   UINT64_FORMAT_STRING","UINT64_FORMAT_STRING","
-                   UINT64_FORMAT_STRING",%u,%u,%lu\n",
-                   modcache->module_file_size, modcache->file_version.version,
-                   modcache->product_version.version,
-                   modcache->checksum, modcache->timestamp,
-                   modcache->module_internal_size);
-#else
-    BUFFERED_WRITE(f, buf, bsz, sofar, len, UINT64_FORMAT_STRING",%u",
-                   modcache->module_file_size, modcache->timestamp);
-# ifdef MACOS
-    BUFFERED_WRITE(f, buf, bsz, sofar, len, ",%u,%u,",
-                   modcache->current_version, modcache->compatibility_version);
-    /* For easy sscanf we print as 4 ints */
-    for (i = 0; i < 4; i++)
-        BUFFERED_WRITE(f, buf, bsz, sofar, len, "%08x,", *(int*)(&modcache->uuid[i*4]));
-# endif
-    BUFFERED_WRITE(f, buf, bsz, sofar, len, "\n");
-#endif
-    BUFFERED_WRITE(f, buf, bsz, sofar, len, "%u\n", modcache->has_debug_info);
-    for (i = 0; i < HASHTABLE_SIZE(symtable->table_bits); i++) {
-        hash_entry_t *he;
-        for (he = symtable->table[i]; he != NULL; he = he->next) {
-            offset_list_t *olist = (offset_list_t *) he->payload;
-            offset_entry_t *e;
-            if (olist == NULL)
-                continue;
-            /* skip symbol in dup entries to save space */
-            BUFFERED_WRITE(f, buf, bsz, sofar, len, "%s", he->key);
-            e = olist->list;
-            while (e != NULL) {
-                BUFFERED_WRITE(f, buf, bsz, sofar, len, ",0x%x\n", e->offs);
-                e = e->next;
-            }
-        }
+    if (hdr->file_version != modcache->file_version.version ||
+        hdr->product_version != modcache->product_version.version ||
+        hdr->checksum != modcache->checksum ||
+        hdr->module_internal_size != modcache->module_internal_size) {
+        LOG(1, "module version mismatch: %s symbol cache file is stale\n", modname);
+        LOG(2, "\t"UINT64_FORMAT_STRING" vs "UINT64_FORMAT_STRING", "
+            UINT64_FORMAT_STRING" vs "UINT64_FORMAT_STRING", "
+            "%u vs %u, "UINT64_FORMAT_STRING" vs %lu\n",
+            hdr->file_version, modcache->file_version.version,
+            hdr->product_version, modcache->product_version.version,
+            hdr->checksum, modcache->checksum,
+            hdr->module_internal_size, modcache->module_internal_size);
+        return false;
     }
-
-    /* now update size */
-    FLUSH_BUFFER(f, buf, sofar);
-    if ((file_size = dr_file_tell(f)) < 0 ||
-        dr_snprintf(buf, BUFFER_SIZE_ELEMENTS(buf),
-                    "%"STRINGIFY(SYMCACHE_SIZE_DIGITS)"u", file_size) < 0 ||
-        !dr_file_seek(f, filesz_loc, DR_SEEK_SET) ||
-        dr_write_file(f, buf, SYMCACHE_SIZE_DIGITS) != SYMCACHE_SIZE_DIGITS) {
-        /* If any steps fail, warn and give up. */
-        NOTIFY("WARNING: Unable to write symcache file size."NL);
-        dr_close_file(f);
-        dr_delete_file(symfile_tmp);
-        return;
-    } else {
-        LOG(3, "Wrote symcache %s file size %d to pos filesz_loc\n",
-            modname, (uint)file_size, filesz_loc);
-        ASSERT(strlen(buf) <= SYMCACHE_SIZE_DIGITS, "not enough space for file size");
+#elif defined(MACOS)
+    if (hdr->current_version != modcache->current_version ||
+        hdr->compatibility_version != modcache->compatibility_version ||
+        memcmp(hdr->uuid, modcache->uuid, sizeof(hdr->uuid)) != 0) {
+        LOG(1, "module version mismatch: %s symbol cache file is stale\n", modname);
+        return false;
     }
+#endif
+    return true;
+}
 
-    dr_close_file(f);
-
-    if (!dr_rename_file(symfile_tmp, symfile, /*replace*/true)) {
-        NOTIFY_ERROR("WARNING: Failed to rename the symcache file."NL);
-        dr_delete_file(symfile_tmp);
-    }
+static void
+symcache_file_set_consistency(symcache_file_header_t *hdr, mod_cache_t *modcache)
+{
+    hdr->module_file_size = modcache->module_file_size;
+    hdr->timestamp = modcache->timestamp;
+#ifdef WINDOWS
+    hdr->file_version = modcache->file_version.version;
+    hdr->product_version = modcache->product_version.version;
+    hdr->checksum = modcache->checksum;
+    hdr->module_internal_size = modcache->module_internal_size;
+#elif defined(MACOS)
+    hdr->current_version = modcache->current_version;
+    hdr->compatibility_version = modcache->compatibility_version;
+    memcpy(hdr->uuid, modcache->uuid, sizeof(hdr->uuid));
+#endif
+    hdr->has_debug_info = modcache->has_debug_info;
 }
 
-#define MAX_SYMLEN 256
+/* Returns whether [offs, offs + count*elemsz) is inside a file of size sz */
+static bool
+symcache_file_region_ok(uint64 sz, uint offs, uint count, size_t elemsz)
+{
+    return (offs <= sz && (uint64)count * elemsz <= sz - offs);
+}
 
-/* Sets modcache->has_debug_info.
- * No lock is needed as we assume the caller hasn't exposed modcache outside this
- * thread yet.
+typedef enum {
+    SYMCACHE_MAP_OK,
+    SYMCACHE_MAP_MISSING,
+    SYMCACHE_MAP_EMPTY,   /* a claimed segment not yet written */
+    SYMCACHE_MAP_INVALID, /* corrupted */
+    SYMCACHE_MAP_STALE,   /* valid, but for a different version of the module */
+} symcache_map_status_t;
+
+/* Maps path and validates it.  On SYMCACHE_MAP_OK, fills in *m.  For
+ * SYMCACHE_MAP_OK and SYMCACHE_MAP_STALE, returns the file's sequence
+ * number in *seq.  If mod is NULL, skips the debug info check.
  */
-static bool
-symcache_read_symfile(const module_data_t *mod, const char *modname,
-                      mod_cache_t *modcache)
+static symcache_map_status_t
+symcache_map_file(const module_data_t *mod, const char *modname, const char *path,
+                  mod_cache_t *modcache, symcache_map_t *m OUT, uint *seq OUT)
 {
-    hashtable_t *symtable = &modcache->table;
-    bool res = false;
-    const char *line, *next_line;
-    char symbol[MAX_SYMLEN];
-    size_t offs;
     uint64 map_size;
     size_t actual_size;
     bool ok;
     void *map = NULL;
-    char symfile[MAXIMUM_PATH];
     file_t f;
+    const symcache_file_header_t *hdr;
+    symcache_map_status_t res = SYMCACHE_MAP_INVALID;
 
-    symcache_get_filename(modname, symfile, BUFFER_SIZE_ELEMENTS(symfile));
-    f = dr_open_file(symfile, DR_FILE_READ);
+    f = dr_open_file(path, DR_FILE_READ);
     if (f == INVALID_FILE)
-        goto symcache_read_symfile_done;
-    LOG(2, "processing symbol cache file for %s\n", modname);
-    /* we avoid having to do our own buffering by just mapping the whole file */
+        return SYMCACHE_MAP_MISSING;
+    LOG(2, "mapping symbol cache file %s\n", path);
+    /* We query the file in place, so other processes using the same file
+     * share these pages.
+     */
     ok = dr_file_size(f, &map_size);
+    if (ok && (map_size == 0 || map_size == sizeof(uint64))) {
+        /* Just the claim: see symcache_write_symfile() */
+        dr_close_file(f);
+        return SYMCACHE_MAP_EMPTY;
+    }
     if (ok) {
         actual_size = (size_t) map_size;
         ASSERT(actual_size == map_size, "file size too large");
         map = dr_map_file(f, &actual_size, 0, NULL, DR_MEMPROT_READ, 0);
     }
+    dr_close_file(f);
     if (!ok || map == NULL || actual_size < map_size) {
         NOTIFY_ERROR("Error mapping symcache file for %s"NL, modname);
-        goto symcache_read_symfile_done;
+        if (map != NULL)
+            dr_unmap_file(map, actual_size);
+        return SYMCACHE_MAP_INVALID;
     }
-    if (strncmp((char *)map, SYMCACHE_FILE_HEADER, strlen(SYMCACHE_FILE_HEADER)) != 0) {
+    hdr = (const symcache_file_header_t *) map;
+    if (map_size < sizeof(*hdr) ||
+        strncmp(hdr->magic, SYMCACHE_FILE_MAGIC, sizeof(hdr->magic)) != 0) {
         WARN("WARNING: symbol cache file is corrupted\n");
-        goto symcache_read_symfile_done;
+        goto symcache_map_file_done;
     }
-    /* i#1057: We use dr_sscanf() because sscanf() from ntdll will call strlen()
-     * and read off the end of the mapped file if it doesn't hit a null.
-     */
-    if (dr_sscanf((char *)map + strlen(SYMCACHE_FILE_HEADER) + 1, "%d",
-                  (uint *)&offs) != 1 ||
-        /* neither forward nor backward compatible */
-        offs != SYMCACHE_VERSION) {
+    /* neither forward nor backward compatible */
+    if (hdr->version != SYMCACHE_VERSION || hdr->header_size != sizeof(*hdr)) {
         WARN("WARNING: symbol cache file has wrong version\n");
-        goto symcache_read_symfile_done;
+        goto symcache_map_file_done;
+    }
+    /* We could go further w/ CRC or even MD5 but not worth it for dev tool */
+    if (hdr->file_size != map_size ||
+        !symcache_file_region_ok(map_size, hdr->symbols_offs, hdr->num_symbols,
+                                 sizeof(symcache_file_symbol_t)) ||
+        !symcache_file_region_ok(map_size, hdr->offsets_offs, hdr->num_offsets,
+                                 sizeof(uint)) ||
+        !symcache_file_region_ok(map_size, hdr->strings_offs, hdr->strings_size, 1) ||
+        !ALIGNED(hdr->symbols_offs, sizeof(uint)) ||
+        !ALIGNED(hdr->offsets_offs, sizeof(uint)) ||
+        /* The final NUL bounds every name */
+        (hdr->strings_size > 0 &&
+         ((char *)map)[hdr->strings_offs + hdr->strings_size - 1] != '\0')) {
+        WARN("WARNING: %s symbol cache file is corrupted: map=%d vs file=%d\n",
+             modname, (uint)map_size, (uint)hdr->file_size);
+        goto symcache_map_file_done;
+    }
+    *seq = hdr->seq;
+    res = SYMCACHE_MAP_STALE;
+    if (!symcache_file_is_consistent(modname, hdr, modcache))
+        goto symcache_map_file_done;
+    if (hdr->has_debug_info) {
+        /* We assume that the current availability of debug info doesn't matter */
+        modcache->has_debug_info = true;
+    } else if (mod != NULL) {
+        /* We delay the costly check for symbols until we've read the symcache
+         * b/c if its entry indicates symbols we don't need to look
+         */
+        if (!modcache->checked_syms) {
+            modcache->mod_has_syms = module_has_symbols(mod);
+            modcache->checked_syms = true;
+        }
+        if (modcache->mod_has_syms) {
+            LOG(1, "module now has debug info: %s symbol cache is stale\n", modname);
+            goto symcache_map_file_done;
+        }
     }
-    line = strchr((char *) map, '\n');
-    if (line != NULL)
-        line++;
 
-    if (line != NULL) {
-        /* Module consistency checks */
-        uint cache_file_size;
-        uint64 module_file_size;
-        uint timestamp;
-#ifdef WINDOWS
-        version_number_t file_version;
-        version_number_t product_version;
-        uint checksum;
-        size_t module_internal_size;
-        if (dr_sscanf(line, "%u,"UINT64_FORMAT_STRING","UINT64_FORMAT_STRING","
-                      UINT64_FORMAT_STRING",%u,%u,%lu",
-                      &cache_file_size, &module_file_size, &file_version.version,
-                      &product_version.version, &checksum, &timestamp,
-                      &module_internal_size) != 7) {
-            WARN("WARNING: %s symbol cache file has bad consistency header\n", modname);
-            goto symcache_read_symfile_done;
+    m->map = (byte *) map;
+    m->map_size = actual_size;
+    m->file = hdr;
+    m->syms = (const symcache_file_symbol_t *) ((byte *)map + hdr->symbols_offs);
+    m->offs = (const uint *) ((byte *)map + hdr->offsets_offs);
+    m->strings = (const char *) map + hdr->strings_offs;
+    return SYMCACHE_MAP_OK;
+
+ symcache_map_file_done:
+    dr_unmap_file(map, actual_size);
+    return res;
+}
+
+/* Returns whether the claimed but unwritten segment at path was left
+ * behind by a writer that died, rather than still being written.
+ */
+static bool
+symcache_claim_is_abandoned(const char *path)
+{
+    uint64 stamp;
+    bool res = false;
+    file_t f = dr_open_file(path, DR_FILE_READ);
+    if (f == INVALID_FILE)
+        return false; /* just written or deleted: look again */
+    /* A claim without a time yet is brand new */
+    if (dr_read_file(f, &stamp, sizeof(stamp)) == sizeof(stamp))
+        res = (dr_get_milliseconds() - stamp >= SYMCACHE_CLAIM_STALE_MS);
+    dr_close_file(f);
+    return res;
+}
+
+/* Maps the segments from modcache->next_seq onward, stopping at the first
+ * one that's still being written.  Returns whether any new entries were
+ * mapped.
+ */
+static bool
+symcache_load_segments(const module_data_t *mod, const char *modname,
+                       mod_cache_t *modcache)
+{
+    char segfile[MAXIMUM_PATH];
+    bool found = false;
+    uint seq, ahead;
+    while (true) {
+        symcache_map_status_t status;
+        symcache_map_t m;
+        if (modcache->num_maps >= SYMCACHE_MAX_MAPS) {
+            /* The next compaction will let us see the rest */
+            LOG(1, "%s: too many symcache segments for %s\n", __FUNCTION__, modname);
+            break;
         }
-        if (module_file_size != modcache->module_file_size ||
-            file_version.version != modcache->file_version.version ||
-            product_version.version != modcache->product_version.version ||
-            checksum != modcache->checksum ||
-            timestamp != modcache->timestamp ||
-            module_internal_size != modcache->module_internal_size) {
-            LOG(1, "module version mismatch: %s symbol cache file is stale\n", modname);
-            LOG(2, "\t"UINT64_FORMAT_STRING" vs "UINT64_FORMAT_STRING", "
-                UINT64_FORMAT_STRING" vs "UINT64_FORMAT_STRING", "
-                UINT64_FORMAT_STRING" vs "UINT64_FORMAT_STRING", "
-                "%u vs %u, %u vs %u, %lu vs %lu\n",
-                module_file_size, modcache->module_file_size,
-                file_version.version, modcache->file_version.version,
-                product_version.version, modcache->product_version.version,
-                checksum, modcache->checksum,
-                timestamp, modcache->timestamp,
-                module_internal_size, modcache->module_internal_size);
-            goto symcache_read_symfile_done;
+        symcache_get_segment_filename(modname, modcache->next_seq, segfile,
+                                      BUFFER_SIZE_ELEMENTS(segfile));
+        status = symcache_map_file(mod, modname, segfile, modcache, &m, &seq);
+        if (status == SYMCACHE_MAP_OK) {
+            modcache->maps[modcache->num_maps++] = m;
+            found = true;
+        } else if (status == SYMCACHE_MAP_EMPTY) {
+            /* Wait for the writer to finish, unless it died while writing
+             * (else we would never look past this segment again).  Deleting
+             * the claim leaves a hole, as for a failed writer.
+             */
+            if (!symcache_claim_is_abandoned(segfile))
+                break;
+            LOG(1, "%s: removing abandoned symcache segment %s\n", __FUNCTION__,
+                segfile);
+            dr_delete_file(segfile);
+        } else if (status == SYMCACHE_MAP_MISSING) {
+            /* A writer that failed deletes its claimed segment, leaving a hole:
+             * skip it if there's a later segment.
+             */
+            for (ahead = 1; ahead <= SYMCACHE_SEGMENT_LOOKAHEAD; ahead++) {
+                symcache_get_segment_filename(modname, modcache->next_seq + ahead,
+                                              segfile, BUFFER_SIZE_ELEMENTS(segfile));
+                if (dr_file_exists(segfile))
+                    break;
+            }
+            if (ahead > SYMCACHE_SEGMENT_LOOKAHEAD)
+                break;
         }
-#elif defined(LINUX)
-        if (dr_sscanf(line, "%u,"UINT64_FORMAT_STRING",%u",
-                      &cache_file_size, &module_file_size, &timestamp) != 3) {
-            WARN("WARNING: %s symbol cache file has bad consistency header\n", modname);
-            goto symcache_read_symfile_done;
+        /* Else skip stale and corrupted segments */
+        modcache->next_seq++;
+    }
+    if (found)
+        hashtable_clear(&modcache->misses);
+    return found;
+}
+
+/* Maps the base file and all complete segments after it */
+static void
+symcache_load_files(const module_data_t *mod, const char *modname,
+                    mod_cache_t *modcache)
+{
+    char symfile[MAXIMUM_PATH];
+    uint seq = 0;
+    symcache_map_status_t status;
+    symcache_unmap_all(modcache);
+    hashtable_clear(&modcache->misses);
+    symcache_get_filename(modname, symfile, BUFFER_SIZE_ELEMENTS(symfile));
+    status = symcache_map_file(mod, modname, symfile, modcache,
+                               &modcache->maps[0], &seq);
+    if (status == SYMCACHE_MAP_OK) {
+        modcache->num_maps = 1;
+        modcache->base_mapped = true;
+    }
+    /* A stale base still tells us which segments it superseded */
+    modcache->base_seq = (status == SYMCACHE_MAP_OK || status == SYMCACHE_MAP_STALE) ?
+        seq : 0;
+    modcache->next_seq = modcache->base_seq + 1;
+    symcache_load_segments(mod, modname, modcache);
+}
+
+/* Reads just the header of the base file, returning in *seq the last
+ * segment merged into it.  Returns false if there is no usable base file.
+ */
+static bool
+symcache_read_base_seq(const char *modname, uint *seq OUT)
+{
+    char symfile[MAXIMUM_PATH];
+    symcache_file_header_t hdr;
+    bool res = false;
+    file_t f;
+    symcache_get_filename(modname, symfile, BUFFER_SIZE_ELEMENTS(symfile));
+    f = dr_open_file(symfile, DR_FILE_READ);
+    if (f == INVALID_FILE)
+        return false;
+    if (dr_read_file(f, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+        hdr.version == SYMCACHE_VERSION) {
+        *seq = hdr.seq;
+        res = true;
+    }
+    dr_close_file(f);
+    return res;
+}
+
+/* Picks up entries written by other processes since we last looked.
+ * Returns whether there is anything new.
+ */
+static bool
+symcache_refresh(const module_data_t *mod, const char *modname, mod_cache_t *modcache)
+{
+    uint base_seq;
+    bool compacted;
+    if (symcache_load_segments(mod, modname, modcache))
+        return true;
+    /* If another process compacted, the segments we want may be gone */
+    compacted = (symcache_read_base_seq(modname, &base_seq) &&
+                 base_seq > modcache->base_seq);
+    if (compacted) {
+        LOG(2, "%s: reloading compacted symcache for %s\n", __FUNCTION__, modname);
+        symcache_load_files(mod, modname, modcache);
+    }
+    return compacted;
+}
+
+/* Searches the mapped files, newest first, for symbol.
+ * If modcache is visible outside of this thread, the caller must hold symcache_lock.
+ */
+static const symcache_file_symbol_t *
+symcache_file_lookup(mod_cache_t *modcache, const char *symbol,
+                     symcache_map_t **m_out OUT)
+{
+    uint i;
+    for (i = modcache->num_maps; i > 0; i--) {
+        symcache_map_t *m = &modcache->maps[i - 1];
+        uint lo = 0, hi = m->file->num_symbols;
+        while (lo < hi) {
+            uint mid = lo + (hi - lo) / 2;
+            const symcache_file_symbol_t *sym = &m->syms[mid];
+            int cmp;
+            if (sym->name_offs >= m->file->strings_size ||
+                !symcache_file_region_ok(m->file->num_offsets, sym->offs_idx,
+                                         sym->num_offs, 1) ||
+                sym->num_offs == 0) {
+                WARN("WARNING: %s symbol cache file has a bad entry\n",
+                     modcache->modname);
+                break;
+            }
+            cmp = strcmp(symbol, m->strings + sym->name_offs);
+            if (cmp == 0) {
+                *m_out = m;
+                return sym;
+            } else if (cmp < 0)
+                hi = mid;
+            else
+                lo = mid + 1;
         }
-        if (module_file_size != modcache->module_file_size ||
-            timestamp != modcache->timestamp) {
-            LOG(1, "module version mismatch: %s symbol cache file is stale\n", modname);
-            goto symcache_read_symfile_done;
+    }
+    return NULL;
+}
+
+/* Reads the offset at index idx of sym, guarding against a corrupted file */
+static bool
+symcache_file_get_offs(mod_cache_t *modcache, symcache_map_t *m,
+                       const symcache_file_symbol_t *sym, uint idx, size_t *offs OUT)
+{
+    ASSERT(idx < sym->num_offs, "index out of bounds");
+    *offs = m->offs[sym->offs_idx + idx];
+#ifdef WINDOWS
+    /* Guard against corrupted files that cause DrMem to crash (i#1465) */
+    if (*offs >= modcache->module_internal_size) {
+        /* This one we want to know about */
+        NOTIFY("SYMCACHE ERROR: %s file has too-large entry "PIFX" for %s"NL,
+               modcache->modname, *offs, m->strings + sym->name_offs);
+        return false;
+    }
+#endif
+    return true;
+}
+
+/* Copies the mapped entries for symbol into the in-memory table, so that
+ * they can be appended to.  Caller must hold symcache_lock.
+ */
+static void
+symcache_file_copy_symbol(mod_cache_t *modcache, const char *symbol)
+{
+    symcache_map_t *m;
+    const symcache_file_symbol_t *sym;
+    uint i;
+    size_t offs;
+    if (hashtable_lookup(&modcache->table, (void *)symbol) != NULL)
+        return;
+    sym = symcache_file_lookup(modcache, symbol, &m);
+    if (sym == NULL)
+        return;
+    for (i = 0; i < sym->num_offs; i++) {
+        if (symcache_file_get_offs(modcache, m, sym, i, &offs))
+            symcache_symbol_add(modcache->modname, &modcache->table, symbol, offs);
+    }
+}
+
+/***************************************************************************
+ * CROSS-PROCESS LOCKING
+ *
+ * We need a per-module lock across processes for compaction, which deletes
+ * segments, and for claiming a segment, which must not race with a
+ * compaction that deletes the segment numbers the claim is based on.  We
+ * use the atomic exclusive creation of a lock file, which holds the time it
+ * was taken so a crashed holder can't block compaction forever.
+ *
+ * Deleting a stale lock and then creating a new one would race with another
+ * process doing the same, which could delete our fresh lock in between.  We
+ * instead rename the stale lock to a name private to this process, which
+ * only one process can do, and check that what we renamed is still the
+ * stale lock before discarding it.
+ */
+
+/* The contents of a lock file, identifying its holder */
+typedef struct _symcache_lock_owner_t {
+    uint64 stamp;
+    process_id_t pid;
+} symcache_lock_owner_t;
+
+static bool
+symcache_read_lock_owner(const char *path, symcache_lock_owner_t *owner OUT)
+{
+    bool res;
+    file_t f = dr_open_file(path, DR_FILE_READ);
+    if (f == INVALID_FILE)
+        return false;
+    res = (dr_read_file(f, owner, sizeof(*owner)) == sizeof(*owner));
+    dr_close_file(f);
+    return res;
+}
+
+static bool
+symcache_lock_module(const char *modname)
+{
+    char lockfile[MAXIMUM_PATH];
+    char stalefile[MAXIMUM_PATH];
+    file_t f;
+    symcache_lock_owner_t owner, moved;
+    uint tries;
+    symcache_get_lock_filename(modname, lockfile, BUFFER_SIZE_ELEMENTS(lockfile));
+    for (tries = 0; tries < 2; tries++) {
+        f = dr_open_file(lockfile, DR_FILE_WRITE_REQUIRE_NEW);
+        if (f != INVALID_FILE) {
+            memset(&owner, 0, sizeof(owner));
+            owner.stamp = dr_get_milliseconds();
+            owner.pid = dr_get_process_id();
+            dr_write_file(f, &owner, sizeof(owner));
+            dr_close_file(f);
+            return true;
         }
-#elif defined(MACOS)
-        uint current_version;
-        uint compatibility_version;
-        byte uuid[16];
-        /* XXX: if dr_sscanf supported %n maybe we could split these into
-         * separate scans on the same string and share code w/ Linux.
+        /* Compaction is optional, so we don't wait for a live holder.
+         * A lock we can't read yet is being created.
          */
-        if (dr_sscanf(line, "%u,"UINT64_FORMAT_STRING",%u,%u,%u,%x,%x,%x,%x",
-                      &cache_file_size, &module_file_size, &timestamp,
-                      &current_version, &compatibility_version,
-                      (uint*)(&uuid[0]), (uint*)(&uuid[4]),
-                      (uint*)(&uuid[8]), (uint*)(&uuid[12])) != 9) {
-            WARN("WARNING: %s symbol cache file has bad consistency header B\n", modname);
-            goto symcache_read_symfile_done;
-        }
-        if (current_version != modcache->current_version ||
-            compatibility_version != modcache->compatibility_version ||
-            memcmp(uuid, modcache->uuid, sizeof(uuid)) != 0) {
-            LOG(1, "module version mismatch: %s symbol cache file is stale\n", modname);
-            goto symcache_read_symfile_done;
+        if (!symcache_read_lock_owner(lockfile, &owner) ||
+            dr_get_milliseconds() - owner.stamp < SYMCACHE_LOCK_STALE_MS)
+            return false;
+        dr_snprintf(stalefile, BUFFER_SIZE_ELEMENTS(stalefile), "%s."PIDFMT,
+                    lockfile, dr_get_process_id());
+        NULL_TERMINATE_BUFFER(stalefile);
+        if (!dr_rename_file(lockfile, stalefile, /*replace*/true))
+            continue; /* someone else took it over or it was just released */
+        if (!symcache_read_lock_owner(stalefile, &moved) ||
+            moved.stamp != owner.stamp || moved.pid != owner.pid) {
+            /* Another process replaced the stale lock after we read it:
+             * give its lock back.  If a third process got in meanwhile we
+             * can end up with two concurrent compactions, which at worst
+             * lose some cache entries.
+             */
+            if (!dr_rename_file(stalefile, lockfile, /*replace*/false))
+                dr_delete_file(stalefile);
+            return false;
         }
-#endif
-        /* We could go further w/ CRC or even MD5 but not worth it for dev tool */
-        if (cache_file_size != (uint)map_size) {
-            WARN("WARNING: %s symbol cache file is corrupted: map=%d vs file=%d\n",
-                 modname, (uint)map_size, cache_file_size);
-            goto symcache_read_symfile_done;
+        LOG(1, "%s: removing stale symcache lock for %s\n", __FUNCTION__, modname);
+        dr_delete_file(stalefile);
+    }
+    return false;
+}
+
+/* Unlike compaction, claiming a segment can't be skipped, so we wait a
+ * bounded time for a live holder.
+ */
+static bool
+symcache_lock_module_wait(const char *modname)
+{
+    uint waited;
+    for (waited = 0; waited < SYMCACHE_LOCK_WAIT_MS; waited += SYMCACHE_LOCK_POLL_MS) {
+        if (symcache_lock_module(modname))
+            return true;
+        dr_sleep(SYMCACHE_LOCK_POLL_MS);
+    }
+    return symcache_lock_module(modname);
+}
+
+static void
+symcache_unlock_module(const char *modname)
+{
+    char lockfile[MAXIMUM_PATH];
+    symcache_get_lock_filename(modname, lockfile, BUFFER_SIZE_ELEMENTS(lockfile));
+    dr_delete_file(lockfile);
+}
+
+/***************************************************************************
+ * FILE WRITING
+ */
+
+/* One symbol to write, from either the in-memory table or a mapped file */
+typedef struct _symcache_write_entry_t {
+    const char *name;
+    offset_list_t *olist; /* NULL if from a file */
+    symcache_map_t *m;
+    const symcache_file_symbol_t *file_sym;
+} symcache_write_entry_t;
+
+/* We have no libc qsort so we use a simple shell sort */
+static void
+symcache_sort_entries(symcache_write_entry_t *entries, uint num)
+{
+    uint gap, i, j;
+    for (gap = num / 2; gap > 0; gap /= 2) {
+        for (i = gap; i < num; i++) {
+            symcache_write_entry_t tmp = entries[i];
+            for (j = i; j >= gap && strcmp(entries[j - gap].name, tmp.name) > 0;
+                 j -= gap)
+                entries[j] = entries[j - gap];
+            entries[j] = tmp;
         }
     }
-    line = strchr(line, '\n');
-    if (line != NULL)
-        line++;
-    if (line != NULL) {
-        uint has_debug_info;
-        if (dr_sscanf(line, "%u", &has_debug_info) != 1) {
-            WARN("WARNING: %s symbol cache file has bad consistency header\n", modname);
-            goto symcache_read_symfile_done;
+}
+
+/* Collects the in-memory entries plus, if include_maps, the mapped entries
+ * they don't shadow, with newer files shadowing older ones.  The caller
+ * must free *entries with size *max_num.
+ */
+static void
+symcache_collect_entries(mod_cache_t *modcache, bool include_maps,
+                         symcache_write_entry_t **entries_out OUT, uint *num_out OUT,
+                         uint *max_num_out OUT)
+{
+    hashtable_t *symtable = &modcache->table;
+    hashtable_t seen;
+    symcache_write_entry_t *entries;
+    uint i, j, num = 0, max_num = symtable->entries;
+    if (include_maps) {
+        for (i = 0; i < modcache->num_maps; i++)
+            max_num += modcache->maps[i].file->num_symbols;
+    }
+    entries = (symcache_write_entry_t *)
+        global_alloc((max_num == 0 ? 1 : max_num) * sizeof(*entries),
+                     HEAPSTAT_HASHTABLE);
+    for (i = 0; i < HASHTABLE_SIZE(symtable->table_bits); i++) {
+        hash_entry_t *he;
+        for (he = symtable->table[i]; he != NULL; he = he->next) {
+            offset_list_t *olist = (offset_list_t *) he->payload;
+            if (olist == NULL)
+                continue;
+            ASSERT(num < max_num, "symcache count is off");
+            entries[num].name = (const char *) he->key;
+            entries[num].olist = olist;
+            entries[num].m = NULL;
+            entries[num].file_sym = NULL;
+            num++;
         }
-        if (has_debug_info) {
-            /* We assume that the current availability of debug info doesn't matter */
-            modcache->has_debug_info = true;
-        } else {
-            /* We delay the costly check for symbols until we've read the symcache
-             * b/c if its entry indicates symbols we don't need to look
-             */
-            if (module_has_symbols(mod)) {
-                LOG(1, "module now has debug info: %s symbol cache is stale\n", modname);
-                goto symcache_read_symfile_done;
+    }
+    if (include_maps) {
+        hashtable_init(&seen, SYMCACHE_MODULE_TABLE_HASH_BITS, HASH_STRING,
+                       false/*!strdup*/);
+        for (i = modcache->num_maps; i > 0; i--) {
+            symcache_map_t *m = &modcache->maps[i - 1];
+            for (j = 0; j < m->file->num_symbols; j++) {
+                const symcache_file_symbol_t *sym = &m->syms[j];
+                const char *name;
+                if (sym->name_offs >= m->file->strings_size ||
+                    !symcache_file_region_ok(m->file->num_offsets, sym->offs_idx,
+                                             sym->num_offs, 1))
+                    continue; /* drop corrupted entries */
+                name = m->strings + sym->name_offs;
+                if (hashtable_lookup(symtable, (void *)name) != NULL ||
+                    !hashtable_add(&seen, (void *)name, (void *)name))
+                    continue;
+                ASSERT(num < max_num, "symcache count is off");
+                entries[num].name = name;
+                entries[num].olist = NULL;
+                entries[num].m = m;
+                entries[num].file_sym = sym;
+                num++;
             }
         }
+        hashtable_delete(&seen);
+    }
+    symcache_sort_entries(entries, num);
+    *entries_out = entries;
+    *num_out = num;
+    *max_num_out = (max_num == 0 ? 1 : max_num);
+}
+
+static bool
+symcache_write_bytes(file_t f, char *buf, size_t bufsz, size_t *sofar,
+                     const void *data, size_t size)
+{
+    if (*sofar + size > bufsz) {
+        if (*sofar > 0 && dr_write_file(f, buf, *sofar) != (ssize_t)*sofar)
+            return false;
+        *sofar = 0;
+        if (size > bufsz)
+            return (dr_write_file(f, data, size) == (ssize_t)size);
     }
-    line = strchr(line, '\n');
-    if (line != NULL)
-        line++;
-
-    symbol[0] = '\0';
-    for (; line != NULL && line < ((char *)map) + map_size; line = next_line) {
-        const char *comma = strchr(line, ',');
-        const char *newline = strchr(line, '\n');
-        size_t symlen = (comma != NULL ? comma - line : 0);
-        if (newline == NULL) {
-            next_line = ((char *)map) + map_size + 1; /* handle EOF w/o trailing \n */
+    memcpy(buf + *sofar, data, size);
+    *sofar += size;
+    return true;
+}
+
+static bool
+symcache_write_flush(file_t f, char *buf, size_t *sofar)
+{
+    bool ok = (*sofar == 0 || dr_write_file(f, buf, *sofar) == (ssize_t)*sofar);
+    *sofar = 0;
+    return ok;
+}
+
+/* Writes the header and all entries in sorted order.  Returns false on a
+ * write failure.
+ */
+static bool
+symcache_write_entries(file_t f, symcache_write_entry_t *entries, uint num,
+                       symcache_file_header_t *hdr)
+{
+    char buf[SYMCACHE_BUFFER_SIZE];
+    size_t sofar = 0, bsz = BUFFER_SIZE_ELEMENTS(buf);
+    uint i, j;
+    uint name_offs = 0, offs_idx = 0;
+
+    if (!symcache_write_bytes(f, buf, bsz, &sofar, hdr, sizeof(*hdr)))
+        return false;
+    for (i = 0; i < num; i++) {
+        symcache_file_symbol_t sym;
+        sym.name_offs = name_offs;
+        sym.offs_idx = offs_idx;
+        sym.num_offs = (entries[i].olist != NULL) ? entries[i].olist->num :
+            entries[i].file_sym->num_offs;
+        if (!symcache_write_bytes(f, buf, bsz, &sofar, &sym, sizeof(sym)))
+            return false;
+        name_offs += (uint) strlen(entries[i].name) + 1;
+        offs_idx += sym.num_offs;
+    }
+    for (i = 0; i < num; i++) {
+        if (entries[i].olist != NULL) {
+            offset_entry_t *e;
+            for (e = entries[i].olist->list; e != NULL; e = e->next) {
+                uint offs = (uint) e->offs;
+                if (!symcache_write_bytes(f, buf, bsz, &sofar, &offs, sizeof(offs)))
+                    return false;
+            }
         } else {
-            next_line = newline + 1;
-        }
-        if (symlen > 0 && symlen < MAX_SYMLEN) {
-            strncpy(symbol, line, symlen);
-            symbol[symlen] = '\0';
+            const symcache_file_symbol_t *sym = entries[i].file_sym;
+            for (j = 0; j < sym->num_offs; j++) {
+                uint offs = entries[i].m->offs[sym->offs_idx + j];
+                if (!symcache_write_bytes(f, buf, bsz, &sofar, &offs, sizeof(offs)))
+                    return false;
+            }
         }
-        if (comma != NULL && symlen < MAX_SYMLEN && symbol[0] != '\0' &&
-            dr_sscanf(comma, ",0x%x", (uint *)&offs) == 1) {
-#ifdef WINDOWS
-            /* Guard against corrupted files that cause DrMem to crash (i#1465) */
-            if (offs >= modcache->module_internal_size) {
-                /* This one we want to know about */
-                NOTIFY("SYMCACHE ERROR: %s file has too-large entry "PIFX" for %s"NL,
-                       modname, offs, symbol);
-                goto symcache_read_symfile_done;
+    }
+    for (i = 0; i < num; i++) {
+        if (!symcache_write_bytes(f, buf, bsz, &sofar, entries[i].name,
+                                  strlen(entries[i].name) + 1))
+            return false;
+    }
+    return symcache_write_flush(f, buf, &sofar);
+}
+
+/* Writes entries to a new temp file next to target, returning its name in
+ * tmpfile.  Returns false on failure, in which case there is no temp file.
+ */
+static bool
+symcache_write_tmpfile(const char *modname, mod_cache_t *modcache, const char *target,
+                       symcache_write_entry_t *entries, uint num, uint seq,
+                       char *tmpfile, size_t tmpfile_count)
+{
+    symcache_file_header_t hdr;
+    uint64 num_offsets = 0, strings_size = 0;
+    file_t f;
+    uint i;
+    bool ok;
+
+    for (i = 0; i < num; i++) {
+        num_offsets += (entries[i].olist != NULL) ? entries[i].olist->num :
+            entries[i].file_sym->num_offs;
+        strings_size += strlen(entries[i].name) + 1;
+    }
+    memset(&hdr, 0, sizeof(hdr));
+    strncpy(hdr.magic, SYMCACHE_FILE_MAGIC, sizeof(hdr.magic));
+    hdr.version = SYMCACHE_VERSION;
+    hdr.header_size = sizeof(hdr);
+    hdr.seq = seq;
+    symcache_file_set_consistency(&hdr, modcache);
+    hdr.num_symbols = num;
+    hdr.num_offsets = (uint) num_offsets;
+    hdr.strings_size = (uint) strings_size;
+    hdr.symbols_offs = sizeof(hdr);
+    hdr.offsets_offs = hdr.symbols_offs + num * sizeof(symcache_file_symbol_t);
+    hdr.strings_offs = hdr.offsets_offs + hdr.num_offsets * sizeof(uint);
+    hdr.file_size = (uint64)hdr.strings_offs + hdr.strings_size;
+
+    f = INVALID_FILE;
+    i = 0;
+    while (f == INVALID_FILE && i < SYMCACHE_MAX_TMP_TRIES) {
+        dr_snprintf(tmpfile, tmpfile_count, "%s.%04d.tmp", target, i);
+        tmpfile[tmpfile_count-1] = '\0';
+        f = dr_open_file(tmpfile, DR_FILE_WRITE_REQUIRE_NEW);
+        i++;
+    }
+    if (f == INVALID_FILE) {
+        NOTIFY("WARNING: Unable to create symcache temp file %s"NL, tmpfile);
+        return false;
+    }
+    ok = symcache_write_entries(f, entries, num, &hdr);
+    dr_close_file(f);
+    if (!ok) {
+        NOTIFY("WARNING: Unable to write symcache file."NL);
+        dr_delete_file(tmpfile);
+        return false;
+    }
+    LOG(3, "Wrote symcache %s seq %d: %d symbols, file size "UINT64_FORMAT_STRING"\n",
+        modname, seq, num, hdr.file_size);
+    return true;
+}
+
+/* Merges the base file and all segments into a new base file, if no other
+ * process is doing so.  Caller must hold symcache_lock.
+ */
+static void
+symcache_compact(const module_data_t *mod, const char *modname, mod_cache_t *modcache)
+{
+    char symfile[MAXIMUM_PATH];
+    char tmpfile[MAXIMUM_PATH];
+    char segfile[MAXIMUM_PATH];
+    symcache_write_entry_t *entries;
+    uint num, max_num, seq, old_base_seq;
+    bool ok;
+
+    if (!symcache_lock_module(modname))
+        return;
+    /* Make sure we include every complete segment */
+    symcache_load_segments(mod, modname, modcache);
+    seq = modcache->next_seq - 1;
+    old_base_seq = modcache->base_seq;
+    if (seq <= old_base_seq) {
+        symcache_unlock_module(modname);
+        return;
+    }
+    symcache_get_filename(modname, symfile, BUFFER_SIZE_ELEMENTS(symfile));
+    symcache_collect_entries(modcache, true/*maps too*/, &entries, &num, &max_num);
+    ok = symcache_write_tmpfile(modname, modcache, symfile, entries, num, seq,
+                                tmpfile, BUFFER_SIZE_ELEMENTS(tmpfile));
+    global_free(entries, max_num * sizeof(*entries), HEAPSTAT_HASHTABLE);
+    if (ok) {
+        /* We must unmap the old base before replacing it on Windows */
+        symcache_unmap_all(modcache);
+        if (dr_rename_file(tmpfile, symfile, /*replace*/true)) {
+            LOG(1, "compacted symcache %s segments %d-%d\n", modname,
+                old_base_seq + 1, seq);
+            /* XXX: on Windows, deleting a segment another process has mapped
+             * fails, leaving a file that is skipped as it's below the base seq.
+             */
+            for (; old_base_seq < seq; old_base_seq++) {
+                symcache_get_segment_filename(modname, old_base_seq + 1, segfile,
+                                              BUFFER_SIZE_ELEMENTS(segfile));
+                dr_delete_file(segfile);
             }
-#endif
-            symcache_symbol_add(modname, symtable, symbol, offs);
+            /* Everything in memory is now in the base file */
+            hashtable_clear(&modcache->table);
         } else {
-            WARN("WARNING: malformed symbol cache line \"%.*s\"\n",
-                 next_line - line - 1, line);
-            /* We abort in case there were two dueling writes to the file
-             * and it somehow got past the self-consistency check,
-             * putting a header in the middle of the file, and we can't
-             * trust subsequent lines since they may belong to a different
-             * version of the module
-             */
-            break; /* res should still be true */
+            NOTIFY_ERROR("WARNING: Failed to rename the symcache file."NL);
+            dr_delete_file(tmpfile);
         }
+        symcache_load_files(mod, modname, modcache);
     }
-    res = true;
- symcache_read_symfile_done:
-    if (map != NULL)
-        dr_unmap_file(map, actual_size);
-    if (f != INVALID_FILE)
-        dr_close_file(f);
-    if (!res)
-        modcache->has_debug_info = module_has_symbols(mod);
+    symcache_unlock_module(modname);
+}
 
-    return res;
+/* Appends the in-memory entries as a new segment.  Other processes pick the
+ * segment up on their next lookup miss.  mod is NULL at exit.
+ * Caller must hold symcache_lock.
+ */
+static void
+symcache_write_symfile(const module_data_t *mod, const char *modname,
+                       mod_cache_t *modcache)
+{
+    uint i, num, max_num, seq, base_seq;
+    uint64 stamp;
+    file_t f = INVALID_FILE;
+    char segfile[MAXIMUM_PATH];
+    char tmpfile[MAXIMUM_PATH];
+    symcache_write_entry_t *entries;
+    bool ok, compacted = false;
+
+    ASSERT(dr_mutex_self_owns(symcache_lock), "missing symcache lock");
+
+    /* Everything from the files that we haven't added to is already on disk */
+    if (modcache->table.entries == 0)
+        return; /* nothing new to write */
+
+    /* Another process may have compacted since we last looked, deleting
+     * segments up through the new base's seq: a claim there would be free
+     * but would be skipped by every reader.  We read the base seq under the
+     * module lock so that no compaction can move it until our claim exists,
+     * and a compaction after that stops at our claim.
+     */
+    if (!symcache_lock_module_wait(modname)) {
+        /* Keep the entries in memory for the next write */
+        LOG(1, "%s: symcache for %s is locked: not writing\n", __FUNCTION__, modname);
+        return;
+    }
+    seq = modcache->next_seq;
+    if (symcache_read_base_seq(modname, &base_seq) && base_seq >= seq) {
+        seq = base_seq + 1;
+        compacted = true;
+    }
+    /* Claim the next free sequence number via exclusive creation, which
+     * is atomic across processes.  Readers see the claim and wait for us to
+     * rename the complete segment over it.  The claim holds the time it was
+     * made so that readers can tell if we die before then.
+     */
+    for (i = 0; i < SYMCACHE_MAX_TMP_TRIES; i++, seq++) {
+        symcache_get_segment_filename(modname, seq, segfile,
+                                      BUFFER_SIZE_ELEMENTS(segfile));
+        f = dr_open_file(segfile, DR_FILE_WRITE_REQUIRE_NEW);
+        if (f != INVALID_FILE)
+            break;
+    }
+    if (f == INVALID_FILE) {
+        symcache_unlock_module(modname);
+        NOTIFY("WARNING: Unable to create symcache segment for %s"NL, modname);
+        return;
+    }
+    stamp = dr_get_milliseconds();
+    dr_write_file(f, &stamp, sizeof(stamp));
+    dr_close_file(f);
+    symcache_unlock_module(modname);
+
+    symcache_collect_entries(modcache, false/*just new*/, &entries, &num, &max_num);
+    ok = symcache_write_tmpfile(modname, modcache, segfile, entries, num, seq,
+                                tmpfile, BUFFER_SIZE_ELEMENTS(tmpfile));
+    global_free(entries, max_num * sizeof(*entries), HEAPSTAT_HASHTABLE);
+    if (ok && !dr_rename_file(tmpfile, segfile, /*replace*/true)) {
+        NOTIFY_ERROR("WARNING: Failed to rename the symcache file."NL);
+        dr_delete_file(tmpfile);
+        ok = false;
+    }
+    if (!ok) {
+        /* Leave a hole, which readers skip */
+        dr_delete_file(segfile);
+        return;
+    }
+    if (mod == NULL)
+        return; /* exiting */
+
+    /* Switch to querying our new segment in place.  If the base moved past
+     * us, the segments we expected to see next are gone.
+     */
+    if (compacted)
+        symcache_load_files(mod, modname, modcache);
+    else
+        symcache_load_segments(mod, modname, modcache);
+    if (modcache->next_seq > seq)
+        hashtable_clear(&modcache->table);
+    if (modcache->num_maps - (modcache->base_mapped ? 1 : 0) >=
+        SYMCACHE_COMPACT_SEGMENTS)
+        symcache_compact(mod, modname, modcache);
+}
+
+/* Sets modcache->has_debug_info.
+ * No lock is needed as we assume the caller hasn't exposed modcache outside this
+ * thread yet.
+ */
+static bool
+symcache_read_symfile(const module_data_t *mod, const char *modname,
+                      mod_cache_t *modcache)
+{
+    symcache_load_files(mod, modname, modcache);
+    LOG(2, "symbol cache for %s: %d files mapped\n", modname, modcache->num_maps);
+    if (!modcache->has_debug_info) {
+        if (!modcache->checked_syms) {
+            modcache->mod_has_syms = module_has_symbols(mod);
+            modcache->checked_syms = true;
+        }
+        modcache->has_debug_info = modcache->mod_has_syms;
+    }
+    return modcache->num_maps > 0;
 }
 
 DR_EXPORT
@@ -692,7 +1398,7 @@ drsymcache_exit(void)
         hash_entry_t *he;
         for (he = symcache_table.table[i]; he != NULL; he = he->next) {
             mod_cache_t *modcache = (mod_cache_t *) he->payload;
-            symcache_write_symfile(modcache->modname, modcache);
+            symcache_write_symfile(NULL, modcache->modname, modcache);
         }
     }
     hashtable_delete(&symcache_table);
@@ -758,6 +1464,8 @@ symcache_module_load(void *drcontext, const module_data_t *mod, bool loaded)
     hashtable_init_ex(&modcache->table, SYMCACHE_MODULE_TABLE_HASH_BITS,
                       HASH_STRING, true/*strdup*/, false/*!synch: using global synch*/,
                       symcache_free_list, NULL, NULL);
+    hashtable_init(&modcache->misses, SYMCACHE_MISS_TABLE_HASH_BITS,
+                   HASH_STRING, true/*strdup*/);
 
     /* store consistency fields */
     f = dr_open_file(mod->full_path, DR_FILE_READ);
@@ -794,6 +1502,10 @@ symcache_module_load(void *drcontext, const module_data_t *mod, bool loaded)
          */
         WARN("WARNING: duplicate module paths: only caching symbols from first\n");
         hashtable_delete(&modcache->table);
+        hashtable_delete(&modcache->misses);
+        symcache_unmap_all(modcache);
+        global_free((void *)modcache->modname, strlen(modcache->modname) + 1,
+                    HEAPSTAT_HASHTABLE);
         global_free(modcache, sizeof(*modcache), HEAPSTAT_HASHTABLE);
     }
     dr_mutex_unlock(symcache_lock);
@@ -811,7 +1523,7 @@ symcache_module_save_common(const module_data_t *mod, bool remove)
     dr_mutex_lock(symcache_lock);
     modcache = (mod_cache_t *) hashtable_lookup(&symcache_table, (void *)mod->full_path);
     if (modcache != NULL) {
-        symcache_write_symfile(modname, modcache);
+        symcache_write_symfile(mod, modname, modcache);
         if (remove)
             hashtable_remove(&symcache_table, (void *)mod->full_path);
     }
@@ -853,7 +1565,11 @@ symcache_module_has_data(const module_data_t *mod, bool require_syms, bool *res)
     dr_mutex_lock(symcache_lock);
     modcache = (mod_cache_t *) hashtable_lookup(&symcache_table, (void *)mod->full_path);
     if (modcache != NULL) {
-        *res = (modcache->table.entries > 0 &&
+        uint i;
+        bool has_entries = (modcache->table.entries > 0);
+        for (i = 0; i < modcache->num_maps && !has_entries; i++)
+            has_entries = (modcache->maps[i].file->num_symbols > 0);
+        *res = (has_entries &&
                 (!require_syms || modcache->has_debug_info));
     }
     dr_mutex_unlock(symcache_lock);
@@ -900,9 +1616,10 @@ drsymcache_add(const module_data_t *mod, const char *symbol, size_t offs)
         dr_mutex_unlock(symcache_lock);
         return DRMF_ERROR_NOT_FOUND;
     }
-    if (symcache_symbol_add(modname, &modcache->table, symbol, offs) &&
-        modcache->from_file)
-        modcache->appended = true;
+    /* To add to a symbol we have in the file, we first copy its entries */
+    symcache_file_copy_symbol(modcache, symbol);
+    symcache_symbol_add(modname, &modcache->table, symbol, offs);
+    hashtable_remove(&modcache->misses, (void *)symbol);
     dr_mutex_unlock(symcache_lock);
     return DRMF_SUCCESS;
 }
@@ -932,8 +1649,43 @@ drsymcache_lookup(const module_data_t *mod, const char *symbol,
     }
     olist = (offset_list_t *) hashtable_lookup(&modcache->table, (void *)symbol);
     if (olist == NULL) {
+        /* Query the mapped files in place */
+        symcache_map_t *m;
+        const symcache_file_symbol_t *sym = symcache_file_lookup(modcache, symbol, &m);
+        if (sym == NULL &&
+            /* Don't look for new files again for a known miss */
+            hashtable_lookup(&modcache->misses, (void *)symbol) == NULL) {
+            /* Another process may have just learned this symbol */
+            if (symcache_refresh(mod, modname, modcache))
+                sym = symcache_file_lookup(modcache, symbol, &m);
+            if (sym == NULL)
+                hashtable_add(&modcache->misses, (void *)symbol, (void *)1);
+        }
+        if (sym == NULL) {
+            dr_mutex_unlock(symcache_lock);
+            return DRMF_ERROR_NOT_FOUND;
+        }
+        if (sym->num_offs == 1)
+            *offs_array = offs_single;
+        else {
+            *offs_array = (size_t *) global_alloc(sym->num_offs * sizeof(size_t),
+                                                  HEAPSTAT_HASHTABLE);
+        }
+        for (i = 0; i < sym->num_offs; i++) {
+            if (!symcache_file_get_offs(modcache, m, sym, i, &(*offs_array)[i])) {
+                if (sym->num_offs > 1) {
+                    global_free(*offs_array, sym->num_offs * sizeof(size_t),
+                                HEAPSTAT_HASHTABLE);
+                }
+                dr_mutex_unlock(symcache_lock);
+                return DRMF_ERROR_NOT_FOUND;
+            }
+            LOG(2, "sym lookup of %s in %s => symcache file hit %d of %d == "PIFX"\n",
+                symbol, mod->full_path, i, sym->num_offs, (*offs_array)[i]);
+        }
+        *num_entries = sym->num_offs;
         dr_mutex_unlock(symcache_lock);
-        return DRMF_ERROR_NOT_FOUND;
+        return DRMF_SUCCESS;
     }
     ASSERT(olist->num > 0, "empty list not allowed");
     if (olist->num == 1)
@@ -963,3 +1715,353 @@ drsymcache_free_lookup(size_t *offs, uint num)
         global_free(offs, num * sizeof(size_t), HEAPSTAT_HASHTABLE);
     return DRMF_SUCCESS;
 }
+
+/***************************************************************************
+ * UNIT TESTS
+ *
+ * We drive the file code directly, with a separate mod_cache_t standing in
+ * for each process sharing the symcache directory.
+ */
+
+#ifdef BUILD_UNIT_TESTS
+
+# define TEST_MODNAME "symcache_test.dll"
+# define TEST_MAX_SEQ 64
+
+/* Zeroed: the file code only checks it for NULL as we set checked_syms */
+static module_data_t test_mod;
+
+static mod_cache_t *
+test_modcache_create(void)
+{
+    mod_cache_t *modcache = (mod_cache_t *)
+        global_alloc(sizeof(*modcache), HEAPSTAT_HASHTABLE);
+    memset(modcache, 0, sizeof(*modcache));
+    hashtable_init_ex(&modcache->table, SYMCACHE_MODULE_TABLE_HASH_BITS,
+                      HASH_STRING, true/*strdup*/, false/*!synch*/,
+                      symcache_free_list, NULL, NULL);
+    hashtable_init(&modcache->misses, SYMCACHE_MISS_TABLE_HASH_BITS,
+                   HASH_STRING, true/*strdup*/);
+    modcache->module_file_size = 0x4000;
+    modcache->timestamp = 42;
+# ifdef WINDOWS
+    modcache->module_internal_size = 0x4000;
+# endif
+    /* Keep drsyms out of it */
+    modcache->checked_syms = true;
+    modcache->modname = drmem_strdup(TEST_MODNAME, HEAPSTAT_HASHTABLE);
+    symcache_load_files(&test_mod, TEST_MODNAME, modcache);
+    return modcache;
+}
+
+static void
+test_add(mod_cache_t *modcache, const char *symbol, size_t offs)
+{
+    EXPECT(symcache_symbol_add(TEST_MODNAME, &modcache->table, symbol, offs));
+}
+
+/* Returns whether the mapped files hold just offs for symbol */
+static bool
+test_file_has(mod_cache_t *modcache, const char *symbol, size_t offs)
+{
+    symcache_map_t *m;
+    const symcache_file_symbol_t *sym = symcache_file_lookup(modcache, symbol, &m);
+    size_t found;
+    return (sym != NULL && sym->num_offs == 1 &&
+            symcache_file_get_offs(modcache, m, sym, 0, &found) && found == offs);
+}
+
+static void
+test_remove_files(void)
+{
+    char path[MAXIMUM_PATH];
+    uint seq;
+    symcache_get_filename(TEST_MODNAME, path, BUFFER_SIZE_ELEMENTS(path));
+    dr_delete_file(path);
+    symcache_get_lock_filename(TEST_MODNAME, path, BUFFER_SIZE_ELEMENTS(path));
+    dr_delete_file(path);
+    for (seq = 0; seq < TEST_MAX_SEQ; seq++) {
+        symcache_get_segment_filename(TEST_MODNAME, seq, path,
+                                      BUFFER_SIZE_ELEMENTS(path));
+        dr_delete_file(path);
+    }
+}
+
+/* Returns whether the mapped files hold exactly offs[0..num) for symbol */
+static bool
+test_file_has_all(mod_cache_t *modcache, const char *symbol, const size_t *offs,
+                  uint num)
+{
+    symcache_map_t *m;
+    const symcache_file_symbol_t *sym = symcache_file_lookup(modcache, symbol, &m);
+    size_t found;
+    uint i;
+    if (sym == NULL || sym->num_offs != num)
+        return false;
+    for (i = 0; i < num; i++) {
+        if (!symcache_file_get_offs(modcache, m, sym, i, &found) || found != offs[i])
+            return false;
+    }
+    return true;
+}
+
+/* Writes the first size bytes of buf to path, replacing any existing file */
+static void
+test_write_file(const char *path, const byte *buf, size_t size)
+{
+    file_t f;
+    dr_delete_file(path);
+    f = dr_open_file(path, DR_FILE_WRITE_REQUIRE_NEW);
+    EXPECT(f != INVALID_FILE);
+    EXPECT(dr_write_file(f, buf, size) == (ssize_t)size);
+    dr_close_file(f);
+}
+
+static symcache_map_status_t
+test_map_status(mod_cache_t *modcache, const char *path)
+{
+    symcache_map_t m;
+    uint seq;
+    symcache_map_status_t status;
+    memset(&m, 0, sizeof(m));
+    status = symcache_map_file(NULL, TEST_MODNAME, path, modcache, &m, &seq);
+    symcache_unmap(&m);
+    return status;
+}
+
+/* What one process writes, another reads back the same */
+static void
+test_round_trip(void)
+{
+    static const size_t foo_offs[] = {0x30, 0x10, 0x20};
+    mod_cache_t *a, *b;
+    uint i;
+
+    a = test_modcache_create();
+    EXPECT(a->num_maps == 0 && a->next_seq == 1);
+    for (i = 0; i < BUFFER_SIZE_ELEMENTS(foo_offs); i++)
+        test_add(a, "foo", foo_offs[i]);
+    test_add(a, "bar", 0x40);
+    /* A negative entry */
+    test_add(a, "baz", 0);
+    symcache_write_symfile(&test_mod, TEST_MODNAME, a);
+    EXPECT(a->table.entries == 0 && a->num_maps == 1 && a->next_seq == 2);
+
+    b = test_modcache_create();
+    EXPECT(!b->base_mapped && b->num_maps == 1 && b->next_seq == 2);
+    EXPECT(b->maps[0].file->seq == 1);
+    EXPECT(b->maps[0].file->num_symbols == 3 && b->maps[0].file->num_offsets == 5);
+    /* Stored sorted by name, with each symbol's offsets in insertion order */
+    EXPECT(strcmp(b->maps[0].strings + b->maps[0].syms[0].name_offs, "bar") == 0);
+    EXPECT(strcmp(b->maps[0].strings + b->maps[0].syms[2].name_offs, "foo") == 0);
+    EXPECT(test_file_has_all(b, "foo", foo_offs, BUFFER_SIZE_ELEMENTS(foo_offs)));
+    EXPECT(test_file_has(b, "bar", 0x40));
+    EXPECT(test_file_has(b, "baz", 0));
+    EXPECT(symcache_file_lookup(b, "qux", NULL) == NULL);
+
+    symcache_free_entry(a);
+    symcache_free_entry(b);
+    test_remove_files();
+}
+
+/* Files from another format version, truncated files, and files for
+ * another build of the module must not be used.
+ */
+static void
+test_reject(void)
+{
+    mod_cache_t *a;
+    char segfile[MAXIMUM_PATH];
+    /* Aligned for the header */
+    uint64 buf[SYMCACHE_BUFFER_SIZE / sizeof(uint64)];
+    symcache_file_header_t *hdr = (symcache_file_header_t *) buf;
+    uint64 size;
+    file_t f;
+
+    a = test_modcache_create();
+    test_add(a, "foo", 0x10);
+    test_add(a, "bar", 0x20);
+    symcache_write_symfile(&test_mod, TEST_MODNAME, a);
+    symcache_get_segment_filename(TEST_MODNAME, 1, segfile,
+                                  BUFFER_SIZE_ELEMENTS(segfile));
+    f = dr_open_file(segfile, DR_FILE_READ);
+    EXPECT(f != INVALID_FILE);
+    EXPECT(dr_file_size(f, &size) && size > sizeof(*hdr) && size <= sizeof(buf));
+    EXPECT(dr_read_file(f, buf, (size_t)size) == (ssize_t)size);
+    dr_close_file(f);
+    /* Release our mapping so we can replace the file on Windows */
+    symcache_unmap_all(a);
+    EXPECT(test_map_status(a, segfile) == SYMCACHE_MAP_OK);
+
+    hdr->version++;
+    test_write_file(segfile, (byte *)buf, (size_t)size);
+    EXPECT(test_map_status(a, segfile) == SYMCACHE_MAP_INVALID);
+    hdr->version--;
+
+    /* Cut off in the strings, in the tables, and in the header */
+    test_write_file(segfile, (byte *)buf, (size_t)size - 1);
+    EXPECT(test_map_status(a, segfile) == SYMCACHE_MAP_INVALID);
+    test_write_file(segfile, (byte *)buf, hdr->offsets_offs);
+    EXPECT(test_map_status(a, segfile) == SYMCACHE_MAP_INVALID);
+    test_write_file(segfile, (byte *)buf, sizeof(*hdr) - 1);
+    EXPECT(test_map_status(a, segfile) == SYMCACHE_MAP_INVALID);
+
+    /* A consistent header whose tables run past the end */
+    hdr->num_offsets += 0x1000;
+    test_write_file(segfile, (byte *)buf, (size_t)size);
+    EXPECT(test_map_status(a, segfile) == SYMCACHE_MAP_INVALID);
+    hdr->num_offsets -= 0x1000;
+
+    hdr->module_file_size++;
+    test_write_file(segfile, (byte *)buf, (size_t)size);
+    EXPECT(test_map_status(a, segfile) == SYMCACHE_MAP_STALE);
+    hdr->module_file_size--;
+
+    /* A reader skips the bad segment but still sees the next good one */
+    hdr->version++;
+    test_write_file(segfile, (byte *)buf, (size_t)size);
+    symcache_free_entry(a);
+    a = test_modcache_create();
+    EXPECT(a->num_maps == 0 && a->next_seq == 2);
+    test_add(a, "qux", 0x30);
+    symcache_write_symfile(&test_mod, TEST_MODNAME, a);
+    symcache_free_entry(a);
+    a = test_modcache_create();
+    EXPECT(a->num_maps == 1 && a->next_seq == 3);
+    EXPECT(symcache_file_lookup(a, "foo", NULL) == NULL);
+    EXPECT(test_file_has(a, "qux", 0x30));
+
+    symcache_free_entry(a);
+    test_remove_files();
+}
+
+/* Newer segments shadow older ones, and compaction keeps just the newest
+ * entry for each symbol.
+ */
+static void
+test_segment_merge(void)
+{
+    mod_cache_t *a, *b, *c;
+    char path[MAXIMUM_PATH];
+    char name[16];
+    uint i, seq;
+
+    a = test_modcache_create();
+    b = test_modcache_create();
+    test_add(a, "x", 0x10);
+    test_add(a, "y", 0x20);
+    symcache_write_symfile(&test_mod, TEST_MODNAME, a);
+    test_add(b, "x", 0x11);
+    symcache_write_symfile(&test_mod, TEST_MODNAME, b);
+    /* b mapped a's segment on its way to claiming the next one */
+    EXPECT(b->num_maps == 2 && test_file_has(b, "x", 0x11));
+    EXPECT(test_file_has(b, "y", 0x20));
+    /* a sees b's entry only once it looks again */
+    EXPECT(test_file_has(a, "x", 0x10));
+    EXPECT(symcache_refresh(&test_mod, TEST_MODNAME, a));
+    EXPECT(test_file_has(a, "x", 0x11));
+
+    /* Fill up to the compaction threshold */
+    for (i = 2; i < SYMCACHE_COMPACT_SEGMENTS; i++) {
+        dr_snprintf(name, BUFFER_SIZE_ELEMENTS(name), "z%d", i);
+        NULL_TERMINATE_BUFFER(name);
+        test_add(a, name, 0x100 + i);
+        symcache_write_symfile(&test_mod, TEST_MODNAME, a);
+    }
+    EXPECT(symcache_read_base_seq(TEST_MODNAME, &seq) &&
+           seq == SYMCACHE_COMPACT_SEGMENTS);
+    for (i = 1; i <= SYMCACHE_COMPACT_SEGMENTS; i++) {
+        symcache_get_segment_filename(TEST_MODNAME, i, path,
+                                      BUFFER_SIZE_ELEMENTS(path));
+        EXPECT(!dr_file_exists(path));
+    }
+
+    c = test_modcache_create();
+    EXPECT(c->base_mapped && c->num_maps == 1);
+    /* x, y, and z2 through z7, each once */
+    EXPECT(c->maps[0].file->num_symbols == SYMCACHE_COMPACT_SEGMENTS);
+    EXPECT(c->maps[0].file->num_offsets == SYMCACHE_COMPACT_SEGMENTS);
+    EXPECT(test_file_has(c, "x", 0x11));
+    EXPECT(test_file_has(c, "y", 0x20));
+    EXPECT(test_file_has(c, "z7", 0x107));
+
+    symcache_free_entry(a);
+    symcache_free_entry(b);
+    symcache_free_entry(c);
+    test_remove_files();
+}
+
+/* A writer that last looked before another process compacted must not
+ * claim a segment number that the compaction freed up.
+ */
+static void
+test_stale_writer(void)
+{
+    mod_cache_t *a, *b, *c;
+    symcache_map_t *m;
+    char name[16];
+    uint i, base_seq;
+
+    a = test_modcache_create();
+    b = test_modcache_create();
+    EXPECT(b->next_seq == 1);
+    for (i = 0; i < SYMCACHE_COMPACT_SEGMENTS; i++) {
+        dr_snprintf(name, BUFFER_SIZE_ELEMENTS(name), "a%d", i);
+        NULL_TERMINATE_BUFFER(name);
+        test_add(a, name, 0x100 + i);
+        symcache_write_symfile(&test_mod, TEST_MODNAME, a);
+    }
+    /* The last write compacted segments 1 through 8 into the base */
+    EXPECT(symcache_read_base_seq(TEST_MODNAME, &base_seq) &&
+           base_seq == SYMCACHE_COMPACT_SEGMENTS);
+    EXPECT(a->base_mapped && a->num_maps == 1 && a->base_seq == base_seq);
+
+    /* b still expects segment 1 next, whose file is gone */
+    test_add(b, "b0", 0x200);
+    symcache_write_symfile(&test_mod, TEST_MODNAME, b);
+    EXPECT(b->table.entries == 0);
+    EXPECT(b->base_seq == base_seq && b->next_seq == base_seq + 2);
+    EXPECT(test_file_has(b, "a0", 0x100) && test_file_has(b, "b0", 0x200));
+
+    /* A new process sees both writers' entries */
+    c = test_modcache_create();
+    EXPECT(c->next_seq == base_seq + 2);
+    EXPECT(test_file_has(c, "a0", 0x100));
+    EXPECT(test_file_has(c, "a7", 0x107));
+    EXPECT(test_file_has(c, "b0", 0x200));
+
+    /* And the compacting process finds b's entry on a miss */
+    EXPECT(symcache_file_lookup(a, "b0", &m) == NULL);
+    EXPECT(symcache_refresh(&test_mod, TEST_MODNAME, a));
+    EXPECT(test_file_has(a, "b0", 0x200));
+
+    symcache_free_entry(a);
+    symcache_free_entry(b);
+    symcache_free_entry(c);
+    test_remove_files();
+}
+
+void
+test_drsymcache(void)
+{
+    char cwd[MAXIMUM_PATH];
+    symcache_lock = dr_mutex_create();
+    EXPECT(dr_get_current_directory(cwd, BUFFER_SIZE_ELEMENTS(cwd)));
+    dr_snprintf(symcache_dir, BUFFER_SIZE_ELEMENTS(symcache_dir),
+                "%s/symcache_test."PIDFMT, cwd, dr_get_process_id());
+    NULL_TERMINATE_BUFFER(symcache_dir);
+    EXPECT(dr_create_dir(symcache_dir));
+    test_remove_files();
+
+    dr_mutex_lock(symcache_lock);
+    test_round_trip();
+    test_reject();
+    test_segment_merge();
+    test_stale_writer();
+    dr_mutex_unlock(symcache_lock);
+
+    dr_delete_dir(symcache_dir);
+    dr_mutex_destroy(symcache_lock);
+}
+
+#endif /* BUILD_UNIT_TESTS */
@@ -118,6 +118,12 @@ void *systable_lock;
 static drsys_param_type_t
 map_to_exported_type(uint sysarg_type, size_t *sz_out OUT);
 
+static void
+sysarg_plans_build(void);
+
+static void
+sysarg_plans_free(void);
+
 /***************************************************************************
  * SYSTEM CALLS
  */
@@ -266,6 +272,143 @@ sysnum_cmp(void *v1, void *v2)
     return drsys_sysnums_equal(num1, num2);
 }
 
+/* The os-specific code fills in systable and secondary_systable during
+ * drsyscall_os_init() and never changes them afterward.  Since syscall_lookup()
+ * is called on every pre- and post-syscall event, once the tables are final we
+ * build lock-free views of them: an array indexed directly by primary number,
+ * and a perfect hash (a multiplier found by trial that gives no collisions)
+ * for the secondary numbers, which are sparse (ioctl request codes, etc.).
+ * Numbers the views do not cover fall back to the hashtables.
+ */
+#define SYSTABLE_DIRECT_MAX 0x4000 /* win32k numbers are 0x1000-0x1fff */
+static syscall_info_t **systable_direct;
+static uint systable_direct_size;
+/* whether every systable entry in [0, systable_direct_size) is in systable_direct */
+static bool systable_direct_complete;
+
+#define SECONDARY_PERFECT_MAX_BITS 14
+#define SECONDARY_PERFECT_TRIES 256
+static syscall_info_t **secondary_perfect;
+static uint secondary_perfect_bits;
+static uint secondary_perfect_mult;
+
+static inline uint
+secondary_perfect_hash(drsys_sysnum_t *num, uint mult, uint bits)
+{
+    uint key = (uint)num->number * 0x9e3779b1 + (uint)num->secondary;
+    return (key * mult) >> (32 - bits);
+}
+
+static void
+systable_build_direct(void)
+{
+    uint i, max = 0;
+    for (i = 0; i < HASHTABLE_SIZE(systable.table_bits); i++) {
+        hash_entry_t *he;
+        for (he = systable.table[i]; he != NULL; he = he->next) {
+            syscall_info_t *sysinfo = (syscall_info_t *) he->payload;
+            if (sysinfo->num.number >= 0 && sysinfo->num.number < SYSTABLE_DIRECT_MAX &&
+                (uint)sysinfo->num.number > max)
+                max = sysinfo->num.number;
+        }
+    }
+    systable_direct_size = max + 1;
+    systable_direct = (syscall_info_t **)
+        global_alloc(systable_direct_size * sizeof(*systable_direct), HEAPSTAT_MISC);
+    memset(systable_direct, 0, systable_direct_size * sizeof(*systable_direct));
+    systable_direct_complete = true;
+    for (i = 0; i < HASHTABLE_SIZE(systable.table_bits); i++) {
+        hash_entry_t *he;
+        for (he = systable.table[i]; he != NULL; he = he->next) {
+            syscall_info_t *sysinfo = (syscall_info_t *) he->payload;
+            if (sysinfo->num.number < 0 ||
+                (uint)sysinfo->num.number >= systable_direct_size)
+                continue;
+            if (sysinfo->num.secondary != 0) {
+                /* not expected: leave such numbers to the hashtable */
+                systable_direct_complete = false;
+                continue;
+            }
+            systable_direct[sysinfo->num.number] = sysinfo;
+        }
+    }
+    LOG(1, "%s: %d direct entries%s\n", __FUNCTION__, systable_direct_size,
+        systable_direct_complete ? "" : " (incomplete)");
+}
+
+static bool
+secondary_perfect_try(uint bits, uint mult, syscall_info_t **table)
+{
+    uint i;
+    memset(table, 0, HASHTABLE_SIZE(bits) * sizeof(*table));
+    for (i = 0; i < HASHTABLE_SIZE(secondary_systable.table_bits); i++) {
+        hash_entry_t *he;
+        for (he = secondary_systable.table[i]; he != NULL; he = he->next) {
+            syscall_info_t *sysinfo = (syscall_info_t *) he->payload;
+            uint idx = secondary_perfect_hash(&sysinfo->num, mult, bits);
+            if (table[idx] != NULL)
+                return false;
+            table[idx] = sysinfo;
+        }
+    }
+    return true;
+}
+
+static void
+systable_build_secondary_perfect(void)
+{
+    uint bits, attempt;
+    if (secondary_systable.entries == 0)
+        return;
+    /* start at a load factor of 1/2 and grow until we find a multiplier */
+    for (bits = 1; HASHTABLE_SIZE(bits) < 2 * secondary_systable.entries; bits++)
+        ; /* nothing */
+    for (; bits <= SECONDARY_PERFECT_MAX_BITS; bits++) {
+        size_t sz = HASHTABLE_SIZE(bits) * sizeof(*secondary_perfect);
+        syscall_info_t **table = (syscall_info_t **) global_alloc(sz, HEAPSTAT_MISC);
+        for (attempt = 0; attempt < SECONDARY_PERFECT_TRIES; attempt++) {
+            /* odd multipliers spread across the 32-bit range */
+            uint mult = 0x9e3779b1 + attempt * 0x7f4a7c16;
+            if (secondary_perfect_try(bits, mult | 1, table)) {
+                secondary_perfect = table;
+                secondary_perfect_bits = bits;
+                secondary_perfect_mult = mult | 1;
+                LOG(1, "%s: %d entries in %d slots after %d tries\n", __FUNCTION__,
+                    secondary_systable.entries, HASHTABLE_SIZE(bits), attempt + 1);
+                return;
+            }
+        }
+        global_free(table, sz, HEAPSTAT_MISC);
+    }
+    LOG(1, "%s: no perfect hash found: using hashtable\n", __FUNCTION__);
+}
+
+static void
+systable_build_lookup(void)
+{
+    dr_recurlock_lock(systable_lock);
+    systable_build_direct();
+    systable_build_secondary_perfect();
+    sysarg_plans_build();
+    dr_recurlock_unlock(systable_lock);
+}
+
+static void
+systable_free_lookup(void)
+{
+    if (systable_direct != NULL) {
+        global_free(systable_direct, systable_direct_size * sizeof(*systable_direct),
+                    HEAPSTAT_MISC);
+        systable_direct = NULL;
+    }
+    if (secondary_perfect != NULL) {
+        global_free(secondary_perfect,
+                    HASHTABLE_SIZE(secondary_perfect_bits) * sizeof(*secondary_perfect),
+                    HEAPSTAT_MISC);
+        secondary_perfect = NULL;
+    }
+}
+
 syscall_info_t *
 syscall_lookup(drsys_sysnum_t num, bool resolve_secondary)
 {
@@ -274,11 +417,29 @@ syscall_lookup(drsys_sysnum_t num, bool resolve_secondary)
      * lookup only if user queries it.
      */
     syscall_info_t *res = NULL;
+    bool need_secondary = resolve_secondary;
     /* First we look for secondary table to avoid collision with primary table
      * in case when user looks for secondary table for entry with .0 secondary num.
      */
+    if (resolve_secondary && secondary_perfect != NULL) {
+        res = secondary_perfect[secondary_perfect_hash(&num, secondary_perfect_mult,
+                                                       secondary_perfect_bits)];
+        if (res != NULL && drsys_sysnums_equal(&res->num, &num))
+            return res;
+        res = NULL;
+        need_secondary = false;
+    }
+    if (!need_secondary && systable_direct != NULL &&
+        num.number >= 0 && (uint)num.number < systable_direct_size) {
+        res = systable_direct[num.number];
+        if (res != NULL && drsys_sysnums_equal(&res->num, &num))
+            return res;
+        res = NULL;
+        if (systable_direct_complete)
+            return NULL;
+    }
     dr_recurlock_lock(systable_lock);
-    if (resolve_secondary) {
+    if (need_secondary) {
         res = (syscall_info_t *) hashtable_lookup(&secondary_systable, (void *) &num);
     }
     if (res == NULL) {
@@ -1200,10 +1361,13 @@ handle_sockaddr(cls_syscall_t *pt, sysarg_iter_info_t *ii, byte *ptr,
  * General syscall arg processing
  */
 
-/* assumes pt->sysarg[] has already been filled in */
+/* assumes pt->sysarg[] has already been filled in.
+ * size_argnum is the sysarg_op_t.size_argnum for argnum.
+ */
 static ptr_uint_t
 sysarg_get_size(void *drcontext, cls_syscall_t *pt, sysarg_iter_info_t *ii,
-                syscall_info_t *sysinfo, int argnum, bool pre, byte *start)
+                syscall_info_t *sysinfo, int argnum, int size_argnum, bool pre,
+                byte *start)
 {
     ptr_uint_t size = 0;
     sysinfo_arg_t *arg = &sysinfo->arg[argnum];
@@ -1272,18 +1436,13 @@ sysarg_get_size(void *drcontext, cls_syscall_t *pt, sysarg_iter_info_t *ii,
         size = (arg->size > 0) ? arg->size : ((ptr_uint_t) pt->sysarg[-arg->size]);
         if (TEST(SYSARG_LENGTH_INOUT, arg->flags)) {
             size_t *ptr;
-            int sz_argnum;
-            ASSERT(arg->size <= 0, "inout can't be immed");
-            /* The size may be smaller than size_t (i#1108) so we need to find
-             * its entry to know the proper size to read.
-             * If the size is behind us, we start from 0; else, from next.
+            /* The size may be smaller than size_t (i#1108) so
+             * sysarg_plan_compile() found its entry to know the proper size to read.
              */
-            sz_argnum = (-arg->size < arg->param) ? 0 : argnum + 1;
-            for (; !sysarg_invalid(&sysinfo->arg[sz_argnum]); sz_argnum++) {
-                if (sysinfo->arg[sz_argnum].param == -arg->size)
-                    break;
-            }
-            ASSERT(!sysarg_invalid(&sysinfo->arg[sz_argnum]),
+            int sz_argnum = size_argnum;
+            ASSERT(arg->size <= 0, "inout can't be immed");
+            ASSERT(sz_argnum < MAX_ARGS_IN_ENTRY &&
+                   !sysarg_invalid(&sysinfo->arg[sz_argnum]),
                    "in/out size should have own entry");
             ASSERT(sysinfo->arg[sz_argnum].size > 0, "in/out size must be immed");
             ASSERT(sysinfo->arg[sz_argnum].size <= sizeof(size),
@@ -1345,6 +1504,126 @@ should_ignore_arg(cls_syscall_t *pt, sysarg_iter_info_t *ii,
             SYSARG_AS_PTR(pt, sysinfo->arg[if_null_arg].param, app_pc) == NULL);
 }
 
+/* Finds the entry describing the in/out size param for a SYSARG_LENGTH_INOUT
+ * entry.  If the size is behind us, we start from 0; else, from next.
+ */
+static int
+sysarg_find_size_entry(syscall_info_t *sysinfo, int argnum)
+{
+    sysinfo_arg_t *arg = &sysinfo->arg[argnum];
+    int sz_argnum = (-arg->size < arg->param) ? 0 : argnum + 1;
+    for (; sz_argnum < MAX_ARGS_IN_ENTRY &&
+             !sysarg_invalid(&sysinfo->arg[sz_argnum]); sz_argnum++) {
+        if (sysinfo->arg[sz_argnum].param == -arg->size)
+            break;
+    }
+    return sz_argnum;
+}
+
+static void
+sysarg_plan_compile(syscall_info_t *sysinfo, sysarg_plan_t *plan OUT)
+{
+    int i, last_param = -1;
+    plan->num_pre = 0;
+    plan->num_post = 0;
+    for (i = 0; i < MAX_ARGS_IN_ENTRY; i++) { /* not <arg_count b/c of double entries */
+        sysinfo_arg_t *arg = &sysinfo->arg[i];
+        sysarg_op_t op;
+        if (sysarg_invalid(arg))
+            break;
+        op.argnum = (byte) i;
+        op.size_argnum = (byte) (TEST(SYSARG_LENGTH_INOUT, arg->flags) ?
+                                 sysarg_find_size_entry(sysinfo, i) : 0);
+        op.flags = 0;
+        if (i + 1 < MAX_ARGS_IN_ENTRY && !sysarg_invalid(&sysinfo->arg[i+1])) {
+            op.flags |= SYSARG_OP_HAS_NEXT;
+            if (sysinfo->arg[i+1].param == arg->param)
+                op.flags |= SYSARG_OP_DOUBLE_FIRST;
+        }
+        /* The 2nd of a double entry is only used in post-syscall */
+        if (arg->param != last_param &&
+            !TESTANY(SYSARG_INLINED | SYSARG_NON_MEMARG, arg->flags))
+            plan->pre[plan->num_pre++] = op;
+        last_param = arg->param;
+        if (TEST(SYSARG_WRITE, arg->flags))
+            plan->post[plan->num_post++] = op;
+    }
+}
+
+static sysarg_plan_t *syscall_plans;
+static uint syscall_plans_num;
+
+/* Called once the tables are final, under systable_lock */
+static void
+sysarg_plans_build(void)
+{
+    hashtable_t *tables[] = { &systable, &secondary_systable };
+    uint t, i, used = 0;
+    syscall_plans_num = systable.entries + secondary_systable.entries;
+    if (syscall_plans_num == 0)
+        return;
+    syscall_plans = (sysarg_plan_t *)
+        global_alloc(syscall_plans_num * sizeof(*syscall_plans), HEAPSTAT_MISC);
+    for (t = 0; t < BUFFER_SIZE_ELEMENTS(tables); t++) {
+        for (i = 0; i < HASHTABLE_SIZE(tables[t]->table_bits); i++) {
+            hash_entry_t *he;
+            for (he = tables[t]->table[i]; he != NULL; he = he->next) {
+                syscall_info_t *sysinfo = (syscall_info_t *) he->payload;
+                if (sysinfo->plan != NULL)
+                    continue;
+                ASSERT(used < syscall_plans_num, "plan count mismatch");
+                sysarg_plan_compile(sysinfo, &syscall_plans[used]);
+                sysinfo->plan = &syscall_plans[used];
+                used++;
+            }
+        }
+    }
+    LOG(1, "%s: compiled %d arg plans\n", __FUNCTION__, used);
+}
+
+static void
+sysarg_plans_free(void)
+{
+    if (syscall_plans != NULL) {
+        global_free(syscall_plans, syscall_plans_num * sizeof(*syscall_plans),
+                    HEAPSTAT_MISC);
+        syscall_plans = NULL;
+    }
+}
+
+/* Returns the compiled plan for sysinfo, or compiles one into local_plan
+ * for entries not in the tables (e.g., unknown syscalls).
+ */
+static sysarg_plan_t *
+sysarg_get_plan(syscall_info_t *sysinfo, sysarg_plan_t *local_plan)
+{
+    if (sysinfo->plan != NULL)
+        return sysinfo->plan;
+    sysarg_plan_compile(sysinfo, local_plan);
+    return local_plan;
+}
+
+/* Indicates which syscall arg (i#510).  These are static to avoid a
+ * dr_snprintf on every memarg.
+ */
+static const char * const param_ids[] = {
+    "parameter #0", "parameter #1", "parameter #2", "parameter #3",
+    "parameter #4", "parameter #5", "parameter #6", "parameter #7",
+    "parameter #8", "parameter #9", "parameter #10", "parameter #11",
+    "parameter #12", "parameter #13", "parameter #14", "parameter #15",
+    "parameter #16", "parameter #17",
+};
+
+static const char *
+sysarg_param_id(int param)
+{
+    ASSERT(param >= 0 && param < BUFFER_SIZE_ELEMENTS(param_ids),
+           "param # out of range");
+    if (param < 0 || param >= BUFFER_SIZE_ELEMENTS(param_ids))
+        return "parameter";
+    return param_ids[param];
+}
+
 /* Walks the param entries stored in the syscall table and processes them
  * for pre-syscall usage.
  * Assumes that arg fields drcontext, sysnum, pre, and mc have already been filled in.
@@ -1354,40 +1633,33 @@ process_pre_syscall_reads_and_writes(cls_syscall_t *pt, sysarg_iter_info_t *ii)
 {
     void *drcontext = ii->arg->drcontext;
     syscall_info_t *sysinfo = pt->sysinfo;
+    sysarg_plan_t local_plan;
+    sysarg_plan_t *plan = sysarg_get_plan(sysinfo, &local_plan);
     app_pc start;
     ptr_uint_t size;
-    int i, last_param = -1;
-    char idmsg[32];
+    uint j;
 
     LOG(SYSCALL_VERBOSE, "processing pre system call #"SYSNUM_FMT"."SYSNUM_FMT" %s\n",
         pt->sysnum.number, pt->sysnum.secondary, sysinfo->name);
-    for (i=0; i<MAX_ARGS_IN_ENTRY; i++) { /* not <arg_count b/c of double entries */
+    /* The length written may not match that requested, so we check whether
+     * addressable at pre-syscall point but only mark as defined (i.e.,
+     * commit the write) at post-syscall when know true length.  This also
+     * waits to determine syscall success before committing, but it opens up
+     * more possibilities for races (PR 408540).  When the pre and post
+     * sizes differ, we indicate what the post-syscall write size is via a
+     * second entry w/ the same param#, which the plan omits here.
+     * Xref PR 408536.
+     */
+    for (j = 0; j < plan->num_pre; j++) {
+        sysarg_op_t *op = &plan->pre[j];
+        int i = op->argnum;
         LOG(SYSCALL_VERBOSE, "\t  pre considering arg %d %d %x\n", sysinfo->arg[i].param,
             sysinfo->arg[i].size, sysinfo->arg[i].flags);
-        if (sysarg_invalid(&sysinfo->arg[i]))
-            break;
         ASSERT(sysinfo->arg[i].param < sysinfo->arg_count, "param # > arg count!");
 
-        /* The length written may not match that requested, so we check whether
-         * addressable at pre-syscall point but only mark as defined (i.e.,
-         * commit the write) at post-syscall when know true length.  This also
-         * waits to determine syscall success before committing, but it opens up
-         * more possibilities for races (PR 408540).  When the pre and post
-         * sizes differ, we indicate what the post-syscall write size is via a
-         * second entry w/ the same param#.
-         * Xref PR 408536.
-         */
-        if (sysinfo->arg[i].param == last_param) {
-            /* Only used in post-syscall */
-            continue;
-        }
-        last_param = sysinfo->arg[i].param;
-
-        if (TESTANY(SYSARG_INLINED | SYSARG_NON_MEMARG, sysinfo->arg[i].flags))
-            continue;
-
         start = SYSARG_AS_PTR(pt, sysinfo->arg[i].param, app_pc);
-        size = sysarg_get_size(drcontext, pt, ii, sysinfo, i, true/*pre*/, start);
+        size = sysarg_get_size(drcontext, pt, ii, sysinfo, i, op->size_argnum,
+                               true/*pre*/, start);
         pt->sysarg_known_sz[sysinfo->arg[i].param] = size;
         LOG(SYSCALL_VERBOSE, "\t  pre storing size "PIFX" for arg %d\n",
             size, sysinfo->arg[i].param);
@@ -1411,15 +1683,8 @@ process_pre_syscall_reads_and_writes(cls_syscall_t *pt, sysarg_iter_info_t *ii)
              * not defined we'll report and then mark as defined anyway.
              */
             if (!skip) {
-                /* indicate which syscall arg (i#510) */
-                IF_DEBUG(int res = )
-                    dr_snprintf(idmsg, BUFFER_SIZE_ELEMENTS(idmsg), "parameter #%d",
-                                sysinfo->arg[i].param);
-                ASSERT(res > 0 && res < BUFFER_SIZE_ELEMENTS(idmsg),
-                       "message buffer too small");
-                NULL_TERMINATE_BUFFER(idmsg);
-
-                if (!report_memarg_nonfield(ii, &sysinfo->arg[i], start, size, idmsg))
+                if (!report_memarg_nonfield(ii, &sysinfo->arg[i], start, size,
+                                            sysarg_param_id(sysinfo->arg[i].param)))
                     break;
             }
         }
@@ -1435,40 +1700,40 @@ process_post_syscall_reads_and_writes(cls_syscall_t *pt, sysarg_iter_info_t *ii)
 {
     void *drcontext = ii->arg->drcontext;
     syscall_info_t *sysinfo = pt->sysinfo;
+    sysarg_plan_t local_plan;
+    sysarg_plan_t *plan = sysarg_get_plan(sysinfo, &local_plan);
     app_pc start;
     ptr_uint_t size, last_size = 0;
-    int i, last_param = -1;
-    IF_DEBUG(int res;)
-    char idmsg[32];
+    int last_param = -1;
+    uint j;
+    const char *idmsg;
 #ifdef WINDOWS
     ptr_int_t result = dr_syscall_get_result(drcontext);
+    bool small_write_last = os_syscall_ret_small_write_last(sysinfo, result);
 #endif
 
     LOG(SYSCALL_VERBOSE, "processing post system call #"SYSNUM_FMT"."SYSNUM_FMT,
         pt->sysnum.number, pt->sysnum.secondary);
     LOG(SYSCALL_VERBOSE, " %s res="PIFX"\n",
         sysinfo->name, dr_syscall_get_result(drcontext));
-    for (i=0; i<MAX_ARGS_IN_ENTRY; i++) { /* not <arg_count b/c of double entries */
+    for (j = 0; j < plan->num_post; j++) {
+        sysarg_op_t *op = &plan->post[j];
+        int i = op->argnum;
         LOG(SYSCALL_VERBOSE, "\t  post considering arg %d %d %x "PFX"\n",
             sysinfo->arg[i].param, sysinfo->arg[i].size, sysinfo->arg[i].flags,
             pt->sysarg[sysinfo->arg[i].param]);
-        if (sysarg_invalid(&sysinfo->arg[i]))
-            break;
         ASSERT(i < SYSCALL_NUM_ARG_STORE, "not storing enough args");
-        if (!TEST(SYSARG_WRITE, sysinfo->arg[i].flags))
-            continue;
         ASSERT(!TEST(SYSARG_INLINED, sysinfo->arg[i].flags),
                "inlined should not be written");
 #ifdef WINDOWS
         /* i#486, i#531, i#932: for too-small buffer, only last param written */
-        if (os_syscall_ret_small_write_last(sysinfo, result) &&
-            i+1 < MAX_ARGS_IN_ENTRY &&
-            !sysarg_invalid(&sysinfo->arg[i+1]))
+        if (small_write_last && TEST(SYSARG_OP_HAS_NEXT, op->flags))
             continue;
 #endif
 
         start = SYSARG_AS_PTR(pt, sysinfo->arg[i].param, app_pc);
-        size = sysarg_get_size(drcontext, pt, ii, sysinfo, i, false/*!pre*/, start);
+        size = sysarg_get_size(drcontext, pt, ii, sysinfo, i, op->size_argnum,
+                               false/*!pre*/, start);
         if (ii->abort)
             break;
 
@@ -1483,12 +1748,7 @@ process_post_syscall_reads_and_writes(cls_syscall_t *pt, sysarg_iter_info_t *ii)
             size = pt->sysarg_known_sz[sysinfo->arg[i].param];
         }
 
-        /* indicate which syscall arg (i#510) */
-        IF_DEBUG(res = )
-            dr_snprintf(idmsg, BUFFER_SIZE_ELEMENTS(idmsg), "parameter #%d",
-                        sysinfo->arg[i].param);
-        ASSERT(res > 0 && res < BUFFER_SIZE_ELEMENTS(idmsg), "message buffer too small");
-        NULL_TERMINATE_BUFFER(idmsg);
+        idmsg = sysarg_param_id(sysinfo->arg[i].param);
 
         if (sysinfo->arg[i].param == last_param) {
             /* For a double entry, the 2nd indicates the actual written size */
@@ -1535,8 +1795,7 @@ process_post_syscall_reads_and_writes(cls_syscall_t *pt, sysarg_iter_info_t *ii)
         /* If the first in a double entry, give 2nd entry precedence, but
          * keep size in last_size in case 2nd was optional OUT and is NULL
          */
-        if (i < MAX_ARGS_IN_ENTRY-1 && sysinfo->arg[i+1].param == last_param &&
-            !sysarg_invalid(&sysinfo->arg[i+1]))
+        if (TEST(SYSARG_OP_DOUBLE_FIRST, op->flags))
             continue;
         LOG(SYSCALL_VERBOSE, "\t     start "PFX", size "PIFX"\n", start, size);
         if (start != NULL && size > 0) {
@@ -2152,6 +2411,7 @@ drsys_init(client_id_t client_id, drsys_options_t *ops)
     res = drsyscall_os_init(drcontext);
     if (res != DRMF_SUCCESS)
         return res;
+    systable_build_lookup();
 
     /* We used to handle all the gory details of Windows pre- and
      * post-syscall hooking ourselves, including system call parameter
@@ -2215,6 +2475,8 @@ drsys_exit(void)
 
     hashtable_delete(&filtered_table);
 
+    systable_free_lookup();
+    sysarg_plans_free();
     drsyscall_os_exit();
 
     dr_recurlock_destroy(systable_lock);
@@ -43,15 +43,12 @@ union ioctl_data {
 
 /* 64-bit vs 32-bit and mixed-mode strategy:
  *
- * We could avoid a hashtable lookup and always use an array deref in
- * syscall_lookup() while still sharing data for syscalls that are
- * identical between the two modes if we generated a static table from
- * macros.  But macros are a little ugly with commas which our nested
- * structs are full of.  So we go ahead and pay the cost of a
- * hashtable lookup.  We could list in x86 order and avoid the
- * hashtable lookup there except we want to eventually support
- * mixed-mode and thus we want both x64 and x86 entries in the same
- * list.  We assume syscall numbers easily fit in 16 bits and pack the
+ * Generating a static table indexed by number from macros is a little ugly
+ * with commas, which our nested structs are full of, and we want to
+ * eventually support mixed-mode and thus want both x64 and x86 entries in
+ * the same list.  So we fill in hashtables here and syscall_lookup() builds
+ * a direct-indexed array from them once init is done.
+ * We assume syscall numbers easily fit in 16 bits and pack the
  * numbers for the two platforms together via PACKNUM.
  *
  * For mixed-mode, the plan is to have the static table be x64 and to copy
@@ -267,6 +267,31 @@ enum {
 
 #define SYSCALL_ARG_TRACK_MAX_SZ 2048
 
+/* A precomputed walk over a syscall_info_t's arg[] entries, built once so
+ * that process_{pre,post}_syscall_reads_and_writes() do not re-derive the
+ * entry structure (terminator, double entries, inlined args, where an in/out
+ * size lives) on every syscall.
+ */
+enum {
+    SYSARG_OP_DOUBLE_FIRST   = 0x01, /* next entry is for the same param */
+    SYSARG_OP_HAS_NEXT       = 0x02, /* a valid entry follows */
+};
+
+typedef struct _sysarg_op_t {
+    byte argnum;      /* index into syscall_info_t.arg[] */
+    byte size_argnum; /* for SYSARG_LENGTH_INOUT: index of the size param's entry */
+    byte flags;       /* SYSARG_OP_* */
+} sysarg_op_t;
+
+typedef struct _sysarg_plan_t {
+    byte num_pre;
+    byte num_post;
+    /* entries to check in pre-syscall, in order */
+    sysarg_op_t pre[MAX_ARGS_IN_ENTRY];
+    /* SYSARG_WRITE entries, in order */
+    sysarg_op_t post[MAX_ARGS_IN_ENTRY];
+} sysarg_plan_t;
+
 typedef struct _syscall_info_t {
     /* System call number: filled in dynamically, allowing us to use the static
      * fields to indicate underlying version reliance.  We read the static
@@ -290,6 +315,10 @@ typedef struct _syscall_info_t {
      * (I'd use a union but that makes syscall table initializers uglier)
      */
     drsys_sysnum_t *num_out;
+    /* Filled in at init for entries in the lookup tables; left NULL in the
+     * static tables.
+     */
+    sysarg_plan_t *plan;
 } syscall_info_t;
 
 typedef struct _cls_syscall_t {
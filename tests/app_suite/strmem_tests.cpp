@@ -106,6 +106,8 @@ TEST(StringTests, strstr) {
     ASSERT_STREQ(strstr("xyzabcxyz", "xyz"), "xyzabcxyz");
     ASSERT_EQ(strstr("xy", "xyz"), (char *)NULL);
     ASSERT_STREQ(strstr("abcd", ""), "abcd");
+    // A partial match must not skip the start of the real one.
+    ASSERT_STREQ(strstr("aaab", "aab"), "aab");
 
     /* Test i#1243 where msvcr100!strstr calls into the middle of strchr
      * and has an unaddr if the string doesn't fill out a malloc chunk
@@ -121,6 +123,7 @@ TEST(StringTests, wcsstr) {
     ASSERT_STREQ(wcsstr(L"xyzabcxyz", L"xyz"), L"xyzabcxyz");
     ASSERT_EQ(wcsstr(L"xy", L"xyz"), (wchar_t *)NULL);
     ASSERT_STREQ(wcsstr(L"abcd", L""), L"abcd");
+    ASSERT_STREQ(wcsstr(L"aaab", L"aab"), L"aab");
 
     /* Test i#350 where VS2012 wcsstr is optimized */
     std::wstring s2(L"foo\r\nbar");
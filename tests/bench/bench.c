@@ -0,0 +1,337 @@
+/* **********************************************************
+ * Copyright (c) 2014 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/* Dr. Memory: the memory debugger
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Microbenchmarks for the paths that dominate our overhead.
+ * Usage: bench <name> [iters] [threads]
+ * Each run prints "<name>: <N> us" with the time spent in the timed loop,
+ * which excludes process startup and exit.  runbench.cmake runs each one
+ * natively and under the tool and computes the ratios.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef UNIX
+# include <unistd.h>
+# include <pthread.h>
+# include <sys/time.h>
+#else
+# include <windows.h>
+#endif
+
+typedef unsigned long long timestamp_t;
+
+static timestamp_t
+get_usecs(void)
+{
+#ifdef UNIX
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (timestamp_t)tv.tv_sec * 1000000 + tv.tv_usec;
+#else
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    if (freq.QuadPart == 0)
+        QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (timestamp_t)(now.QuadPart * 1000000 / freq.QuadPart);
+#endif
+}
+
+/* Sizes come from here so the compiler can neither constant-fold the
+ * string routines into inline code nor delete the loops.
+ */
+static volatile size_t buf_size = 64*1024;
+static volatile size_t str_size = 4*1024;
+static volatile int sink;
+
+/***************************************************************************
+ * malloc and free throughput, through -replace_malloc or the wrapping
+ */
+
+#define MALLOC_WINDOW 64
+
+static int malloc_iters;
+
+static void
+malloc_loop(void)
+{
+    /* Keep a window of live chunks so that frees are not all of the most
+     * recent allocation, and vary the sizes across several free list buckets.
+     */
+    char *live[MALLOC_WINDOW];
+    int i;
+    memset(live, 0, sizeof(live));
+    for (i = 0; i < malloc_iters; i++) {
+        int slot = i % MALLOC_WINDOW;
+        size_t sz = 8 + (i * 37) % 1024;
+        free(live[slot]);
+        live[slot] = (char *) malloc(sz);
+        live[slot][0] = (char) i;
+    }
+    for (i = 0; i < MALLOC_WINDOW; i++)
+        free(live[i]);
+}
+
+#ifdef UNIX
+static void *
+malloc_thread(void *arg)
+{
+    malloc_loop();
+    return NULL;
+}
+#else
+static DWORD WINAPI
+malloc_thread(LPVOID arg)
+{
+    malloc_loop();
+    return 0;
+}
+#endif
+
+static void
+bench_malloc(int iters, int threads)
+{
+    int i;
+    malloc_iters = iters / threads;
+    if (threads == 1) {
+        malloc_loop();
+        return;
+    }
+#ifdef UNIX
+    {
+        pthread_t *thread = (pthread_t *) malloc(threads * sizeof(*thread));
+        for (i = 0; i < threads; i++)
+            pthread_create(&thread[i], NULL, malloc_thread, NULL);
+        for (i = 0; i < threads; i++)
+            pthread_join(thread[i], NULL);
+        free(thread);
+    }
+#else
+    {
+        HANDLE *thread = (HANDLE *) malloc(threads * sizeof(*thread));
+        for (i = 0; i < threads; i++)
+            thread[i] = CreateThread(NULL, 0, malloc_thread, NULL, 0, NULL);
+        WaitForMultipleObjects(threads, thread, TRUE, INFINITE);
+        for (i = 0; i < threads; i++)
+            CloseHandle(thread[i]);
+        free(thread);
+    }
+#endif
+}
+
+/***************************************************************************
+ * string routines, through replace.c
+ */
+
+static void
+bench_memcpy(int iters)
+{
+    char *src = (char *) malloc(buf_size);
+    char *dst = (char *) malloc(buf_size);
+    int i;
+    memset(src, 0x5a, buf_size);
+    for (i = 0; i < iters; i++) {
+        memcpy(dst, src, buf_size);
+        src[i % buf_size] = dst[(i * 7) % buf_size];
+    }
+    sink = dst[buf_size - 1];
+    free(src);
+    free(dst);
+}
+
+static void
+bench_strlen(int iters)
+{
+    char *str = (char *) malloc(str_size + 1);
+    size_t total = 0;
+    int i;
+    memset(str, 'a', str_size);
+    str[str_size] = '\0';
+    for (i = 0; i < iters; i++)
+        total += strlen(str);
+    sink = (int) total;
+    free(str);
+}
+
+/***************************************************************************
+ * loads and stores, through the shadow fastpath
+ */
+
+#define LOADSTORE_ELEMS (256*1024)
+
+static void
+bench_loadstore(int iters)
+{
+    /* unsigned so the running sums wrap rather than overflow */
+    unsigned int *a = (unsigned int *) malloc(LOADSTORE_ELEMS * sizeof(*a));
+    unsigned int *b = (unsigned int *) malloc(LOADSTORE_ELEMS * sizeof(*b));
+    int i, j;
+    for (j = 0; j < LOADSTORE_ELEMS; j++) {
+        a[j] = j;
+        b[j] = j * 3;
+    }
+    for (i = 0; i < iters; i++) {
+        for (j = 1; j < LOADSTORE_ELEMS; j++)
+            a[j] = a[j - 1] + b[j];
+    }
+    sink = (int) a[LOADSTORE_ELEMS - 1];
+    free(a);
+    free(b);
+}
+
+/***************************************************************************
+ * stack-heavy recursion, through the esp adjustment instrumentation
+ */
+
+#define RECURSION_DEPTH 1000
+
+static int
+recurse(int depth)
+{
+    char frame[64];
+    frame[depth % sizeof(frame)] = (char) depth;
+    if (depth == 0)
+        return frame[0];
+    return recurse(depth - 1) + frame[depth % sizeof(frame)];
+}
+
+static void
+bench_recursion(int iters)
+{
+    int i, total = 0;
+    for (i = 0; i < iters; i++)
+        total += recurse(RECURSION_DEPTH);
+    sink = total;
+}
+
+/***************************************************************************
+ * system calls, through the pre- and post-syscall handling
+ */
+
+static void
+bench_syscall(int iters)
+{
+    int i;
+    for (i = 0; i < iters; i++) {
+#ifdef UNIX
+        /* not cached by libc, unlike getpid */
+        sink = (int) getppid();
+#else
+        SwitchToThread();
+#endif
+    }
+}
+
+/***************************************************************************
+ * leak scan over a synthetic heap
+ */
+
+typedef struct _node_t {
+    struct _node_t *next;
+    char payload[48];
+} node_t;
+
+static node_t *reachable_list;
+
+static void
+bench_leakscan(int iters)
+{
+    /* The scan itself happens at exit, so runbench.cmake times the whole
+     * process for this one: here we just build the heap.  Half the nodes
+     * are reachable from a global and half are leaked.
+     */
+    int i;
+    for (i = 0; i < iters; i++) {
+        node_t *node = (node_t *) malloc(sizeof(*node));
+        memset(node, 0, sizeof(*node));
+        if (i % 2 == 0) {
+            node->next = reachable_list;
+            reachable_list = node;
+        }
+    }
+}
+
+/***************************************************************************/
+
+typedef struct _bench_t {
+    const char *name;
+    int default_iters;
+} bench_t;
+
+/* The defaults take a few hundred milliseconds natively */
+static const bench_t benches[] = {
+    {"malloc",    8000000},
+    {"memcpy",    100000},
+    {"strlen",    4000000},
+    {"loadstore", 300},
+    {"recursion", 10000},
+    {"syscall",   2000000},
+    {"leakscan",  1000000},
+};
+#define NUM_BENCHES (sizeof(benches)/sizeof(benches[0]))
+
+int
+main(int argc, char **argv)
+{
+    const char *name;
+    int iters = 0, threads = 1;
+    timestamp_t start;
+    size_t i;
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <name> [iters] [threads]\n", argv[0]);
+        return 1;
+    }
+    name = argv[1];
+    if (argc > 2)
+        iters = atoi(argv[2]);
+    if (argc > 3)
+        threads = atoi(argv[3]);
+    for (i = 0; i < NUM_BENCHES; i++) {
+        if (strcmp(name, benches[i].name) == 0)
+            break;
+    }
+    if (i == NUM_BENCHES || threads < 1) {
+        fprintf(stderr, "unknown benchmark %s\n", name);
+        return 1;
+    }
+    if (iters <= 0)
+        iters = benches[i].default_iters;
+
+    start = get_usecs();
+    if (strcmp(name, "malloc") == 0)
+        bench_malloc(iters, threads);
+    else if (strcmp(name, "memcpy") == 0)
+        bench_memcpy(iters);
+    else if (strcmp(name, "strlen") == 0)
+        bench_strlen(iters);
+    else if (strcmp(name, "loadstore") == 0)
+        bench_loadstore(iters);
+    else if (strcmp(name, "recursion") == 0)
+        bench_recursion(iters);
+    else if (strcmp(name, "syscall") == 0)
+        bench_syscall(iters);
+    else if (strcmp(name, "leakscan") == 0)
+        bench_leakscan(iters);
+    printf("%s: %llu us\n", name, get_usecs() - start);
+    return 0;
+}
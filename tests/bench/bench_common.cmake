@@ -0,0 +1,62 @@
+# **********************************************************
+# Copyright (c) 2014 Google, Inc.  All rights reserved.
+# **********************************************************
+
+# Dr. Memory: the memory debugger
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation;
+# version 2.1 of the License, and no later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# Library General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+# Routines shared by runbench.cmake and runoverhead.cmake.
+
+# Sets outvar to the current time in microseconds.  The %f timestamp code
+# only exists from cmake 3.23 on: before that we have whole seconds only,
+# and bench_usecs is OFF so callers can skip or caveat fine-grained timings.
+if (CMAKE_VERSION VERSION_LESS "3.23")
+  set(bench_usecs OFF)
+else ()
+  set(bench_usecs ON)
+endif ()
+function (now_usecs outvar)
+  if (NOT bench_usecs)
+    string(TIMESTAMP secs "%s" UTC)
+    math(EXPR usecs "${secs} * 1000000")
+    set(${outvar} ${usecs} PARENT_SCOPE)
+    return ()
+  endif ()
+  # one call so the two fields are from the same instant
+  string(TIMESTAMP now "%s %f" UTC)
+  string(REGEX REPLACE " .*$" "" secs "${now}")
+  string(REGEX REPLACE "^.* 0*" "" frac "${now}")
+  if ("${frac}" STREQUAL "")
+    set(frac 0)
+  endif ()
+  math(EXPR usecs "${secs} * 1000000 + ${frac}")
+  set(${outvar} ${usecs} PARENT_SCOPE)
+endfunction (now_usecs)
+
+# cmake has only integer math, so we print the ratio to 2 decimal places
+# by hand.
+function (format_ratio num denom outvar)
+  if (denom EQUAL 0)
+    set(denom 1)
+  endif ()
+  math(EXPR hundredths "(${num} * 100 + ${denom} / 2) / ${denom}")
+  math(EXPR whole "${hundredths} / 100")
+  math(EXPR frac "${hundredths} % 100")
+  if (frac LESS 10)
+    set(frac "0${frac}")
+  endif ()
+  set(${outvar} "${whole}.${frac}" PARENT_SCOPE)
+endfunction (format_ratio)
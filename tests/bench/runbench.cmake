@@ -0,0 +1,153 @@
+# **********************************************************
+# Copyright (c) 2014 Google, Inc.  All rights reserved.
+# **********************************************************
+
+# Dr. Memory: the memory debugger
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation;
+# version 2.1 of the License, and no later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# Library General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+# Runs the microbenchmarks in bench.c natively and under the tool and
+# writes the timings and overhead ratios as JSON.
+#
+# input:
+# * exe = path to the bench executable
+# * tool = tool command, with intra-arg space=@@ and inter-arg space=@
+# * outfile = path of the JSON file to write
+# * reps = runs of each benchmark and config; the fastest is kept (default 3)
+# * configs = extra configs to measure besides the default options, as a
+#     ,-separated list of name=ops where ops use @ between args,
+#     e.g. "light=-light,xl8=-shadow_inline_xl8"
+# * threads = ,-separated thread counts for the malloc benchmark (default 1,4)
+#
+# Every benchmark except leakscan times only its own loop, so startup and
+# exit are excluded.  leakscan's work happens at exit, so for it we time the
+# whole process, which needs the %f (microseconds) timestamp code from
+# cmake 3.23: with an older cmake leakscan is skipped.
+
+cmake_minimum_required(VERSION 2.6)
+
+include("${CMAKE_CURRENT_LIST_DIR}/bench_common.cmake")
+
+if (NOT DEFINED reps)
+  set(reps 3)
+endif ()
+if (NOT DEFINED threads)
+  set(threads 1,4)
+endif ()
+# , rather than ; so that they pass through add_custom_target unscathed
+string(REPLACE "," ";" threads "${threads}")
+string(REPLACE "," ";" configs "${configs}")
+
+string(REGEX REPLACE "@@" " " tool "${tool}")
+string(REGEX REPLACE "@" ";" tool "${tool}")
+
+set(config_names default)
+set(config_default_ops "")
+foreach (config ${configs})
+  string(REGEX REPLACE "=.*$" "" name "${config}")
+  string(REGEX REPLACE "^[^=]*=" "" ops "${config}")
+  string(REGEX REPLACE "@" ";" ops "${ops}")
+  list(APPEND config_names ${name})
+  set(config_${name}_ops ${ops})
+endforeach ()
+
+set(benches "")
+foreach (nthreads ${threads})
+  list(APPEND benches "malloc_t${nthreads}=malloc@0@${nthreads}")
+endforeach ()
+list(APPEND benches memcpy=memcpy strlen=strlen loadstore=loadstore
+  recursion=recursion syscall=syscall)
+if (bench_usecs)
+  list(APPEND benches leakscan=leakscan)
+else ()
+  message("skipping leakscan: timing the whole process needs cmake 3.23")
+endif ()
+
+# Sets outvar to the fastest of ${reps} runs of cmd, in microseconds,
+# taken from the app's own output or, if whole_process, from our clock.
+function (time_runs cmd whole_process outvar)
+  set(best "")
+  foreach (rep RANGE 1 ${reps})
+    if (whole_process)
+      now_usecs(start)
+    endif ()
+    execute_process(COMMAND ${cmd}
+      RESULT_VARIABLE cmd_result
+      ERROR_VARIABLE cmd_err
+      OUTPUT_VARIABLE cmd_out)
+    if (whole_process)
+      now_usecs(end)
+    endif ()
+    if (cmd_result)
+      message(FATAL_ERROR "*** ${cmd} failed (${cmd_result}): ${cmd_err}***\n")
+    endif (cmd_result)
+    if (whole_process)
+      math(EXPR usecs "${end} - ${start}")
+    else ()
+      if (NOT "${cmd_out}" MATCHES ": ([0-9]+) us")
+        message(FATAL_ERROR "*** no timing in output of ${cmd}: ${cmd_out}***\n")
+      endif ()
+      set(usecs ${CMAKE_MATCH_1})
+    endif ()
+    if ("${best}" STREQUAL "" OR usecs LESS best)
+      set(best ${usecs})
+    endif ()
+  endforeach ()
+  set(${outvar} ${best} PARENT_SCOPE)
+endfunction (time_runs)
+
+set(json "{\n  \"reps\": ${reps},\n  \"benchmarks\": [")
+set(first_bench ON)
+foreach (bench ${benches})
+  string(REGEX REPLACE "=.*$" "" name "${bench}")
+  string(REGEX REPLACE "^[^=]*=" "" args "${bench}")
+  string(REGEX REPLACE "@" ";" args "${args}")
+  if ("${name}" STREQUAL "leakscan")
+    set(whole_process ON)
+    set(metric "process")
+  else ()
+    set(whole_process OFF)
+    set(metric "loop")
+  endif ()
+
+  time_runs("${exe};${args}" ${whole_process} native)
+  message("${name}: native ${native} us")
+  if (first_bench)
+    set(first_bench OFF)
+  else ()
+    set(json "${json},")
+  endif ()
+  set(json "${json}\n    {\"name\": \"${name}\", \"metric\": \"${metric}\", ")
+  set(json "${json}\"native_us\": ${native}, \"configs\": {")
+
+  set(first_config ON)
+  foreach (config ${config_names})
+    set(cmd ${tool} ${config_${config}_ops} -- ${exe} ${args})
+    time_runs("${cmd}" ${whole_process} tooltime)
+    format_ratio(${tooltime} ${native} ratio)
+    message("${name}: ${config} ${tooltime} us = ${ratio}x")
+    if (first_config)
+      set(first_config OFF)
+    else ()
+      set(json "${json}, ")
+    endif ()
+    set(json "${json}\"${config}\": {\"us\": ${tooltime}, \"ratio\": ${ratio}}")
+  endforeach ()
+  set(json "${json}}}")
+endforeach ()
+set(json "${json}\n  ]\n}\n")
+
+file(WRITE "${outfile}" "${json}")
+message("wrote ${outfile}")
@@ -0,0 +1,212 @@
+# **********************************************************
+# Copyright (c) 2014 Google, Inc.  All rights reserved.
+# **********************************************************
+
+# Dr. Memory: the memory debugger
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation;
+# version 2.1 of the License, and no later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# Library General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+# Runs whole test apps natively and under each tool mode, recording the
+# total time and, for Dr. Memory, the -phase_times breakdown into startup,
+# instrumentation, steady state, leak scan, report, and exit.  Writes the
+# results as JSON and, given a baseline from an earlier run, compares
+# against it.
+#
+# input:
+# * tool = tool command, with intra-arg space=@@ and inter-arg space=@
+# * heapstat_tool = optional Dr. Heapstat command, encoded like tool,
+#     run as the "drheapstat" mode
+# * apps = ,-separated list of name=path with @ between any app args
+# * modes = ,-separated list of name=ops with @ between args (default
+#     full, -light, -leaks_only, and -pattern)
+# * logdir = base directory for the tool's log dirs
+# * outfile = path of the JSON file to write
+# * reps = runs of each app and mode; the fastest is kept (default 1, or 3
+#     with a baseline so that one noisy run does not fail the comparison)
+# * baseline = optional JSON file written by an earlier run to compare with
+# * threshold = percentage slowdown versus the baseline in any app and
+#     mode's total time that fails the run (default 10)
+#
+# Before cmake 3.23 there is no %f timestamp code, so the totals are only
+# to the second and the baseline comparison is skipped.
+
+cmake_minimum_required(VERSION 2.6)
+
+include("${CMAKE_CURRENT_LIST_DIR}/bench_common.cmake")
+
+if (NOT DEFINED reps)
+  if ("${baseline}" STREQUAL "")
+    set(reps 1)
+  else ()
+    set(reps 3)
+  endif ()
+endif ()
+if (NOT bench_usecs)
+  message("cmake ${CMAKE_VERSION} has no %f timestamps: totals are to the second")
+endif ()
+if (NOT DEFINED threshold)
+  set(threshold 10)
+endif ()
+if (NOT DEFINED modes)
+  set(modes "full=,light=-light,leaks_only=-leaks_only,pattern=-pattern@0xf1fd")
+endif ()
+# , rather than ; so that they pass through add_custom_target unscathed
+string(REPLACE "," ";" apps "${apps}")
+string(REPLACE "," ";" modes "${modes}")
+
+foreach (var tool heapstat_tool)
+  string(REGEX REPLACE "@@" " " ${var} "${${var}}")
+  string(REGEX REPLACE "@" ";" ${var} "${${var}}")
+endforeach ()
+
+set(mode_names "")
+foreach (mode ${modes})
+  string(REGEX REPLACE "=.*$" "" name "${mode}")
+  string(REGEX REPLACE "^[^=]*=" "" ops "${mode}")
+  string(REGEX REPLACE "@" ";" ops "${ops}")
+  list(APPEND mode_names ${name})
+  set(mode_${name}_cmd ${tool} -phase_times ${ops})
+endforeach ()
+if (NOT "${heapstat_tool}" STREQUAL "")
+  list(APPEND mode_names drheapstat)
+  set(mode_drheapstat_cmd ${heapstat_tool})
+endif ()
+
+set(phases startup instrument steady leakscan report exit)
+
+# Runs the app ${reps} times under the given tool command (none for native)
+# and sets total_ms to the fastest.  For tool runs, the PHASE TIMES line
+# from that run's global log, if any, is returned in phase_line.
+function (time_app app_cmd tool_cmd rundir)
+  set(best "")
+  set(best_line "")
+  foreach (rep RANGE 1 ${reps})
+    if ("${tool_cmd}" STREQUAL "")
+      set(cmd ${app_cmd})
+    else ()
+      file(REMOVE_RECURSE "${rundir}")
+      file(MAKE_DIRECTORY "${rundir}")
+      set(cmd ${tool_cmd} -logdir ${rundir} -- ${app_cmd})
+    endif ()
+    now_usecs(start)
+    execute_process(COMMAND ${cmd}
+      RESULT_VARIABLE cmd_result
+      ERROR_VARIABLE cmd_err
+      OUTPUT_VARIABLE cmd_out)
+    now_usecs(end)
+    # We only want timings, and test apps may legitimately exit non-zero
+    if (cmd_result)
+      message("warning: ${cmd} exited with ${cmd_result}")
+    endif (cmd_result)
+    math(EXPR ms "(${end} - ${start}) / 1000")
+    set(line "")
+    if (NOT "${tool_cmd}" STREQUAL "")
+      file(GLOB_RECURSE logs "${rundir}/*/global.*.log")
+      foreach (log ${logs})
+        file(STRINGS "${log}" line REGEX "^PHASE TIMES")
+        if (NOT "${line}" STREQUAL "")
+          break ()
+        endif ()
+      endforeach ()
+    endif ()
+    if ("${best}" STREQUAL "" OR ms LESS best)
+      set(best ${ms})
+      set(best_line "${line}")
+    endif ()
+  endforeach ()
+  set(total_ms ${best} PARENT_SCOPE)
+  set(phase_line "${best_line}" PARENT_SCOPE)
+endfunction (time_app)
+
+set(json "{\n  \"reps\": ${reps},\n  \"runs\": [")
+set(first_run ON)
+foreach (app ${apps})
+  string(REGEX REPLACE "=.*$" "" app_name "${app}")
+  string(REGEX REPLACE "^[^=]*=" "" app_cmd "${app}")
+  string(REGEX REPLACE "@" ";" app_cmd "${app_cmd}")
+
+  time_app("${app_cmd}" "" "")
+  set(native ${total_ms})
+  message("${app_name}: native ${native} ms")
+  set(total_${app_name}.native ${native})
+  if (first_run)
+    set(first_run OFF)
+  else ()
+    set(json "${json},")
+  endif ()
+  set(json "${json}\n    {\"app\": \"${app_name}\", \"mode\": \"native\", ")
+  set(json "${json}\"total_ms\": ${native}}")
+
+  foreach (mode ${mode_names})
+    time_app("${app_cmd}" "${mode_${mode}_cmd}" "${logdir}/${app_name}.${mode}")
+    format_ratio(${total_ms} ${native} ratio)
+    set(key ${app_name}.${mode})
+    set(total_${key} ${total_ms})
+    set(json "${json},\n    {\"app\": \"${app_name}\", \"mode\": \"${mode}\", ")
+    set(json "${json}\"total_ms\": ${total_ms}, \"ratio\": ${ratio}")
+    set(msg "${app_name}: ${mode} ${total_ms} ms = ${ratio}x")
+    if (NOT "${phase_line}" STREQUAL "")
+      set(json "${json}, \"phases\": {")
+      set(sep "")
+      foreach (phase ${phases})
+        string(REGEX MATCH " ${phase}=([0-9]+)" match "${phase_line}")
+        set(json "${json}${sep}\"${phase}\": ${CMAKE_MATCH_1}")
+        set(msg "${msg} ${phase}=${CMAKE_MATCH_1}")
+        set(sep ", ")
+      endforeach ()
+      set(json "${json}}")
+    endif ()
+    set(json "${json}}")
+    message("${msg}")
+  endforeach ()
+endforeach ()
+set(json "${json}\n  ]\n}\n")
+
+file(WRITE "${outfile}" "${json}")
+message("wrote ${outfile}")
+
+##################################################
+# compare against the baseline
+
+if (NOT "${baseline}" STREQUAL "" AND NOT bench_usecs)
+  message("skipping the baseline comparison: it needs cmake 3.23")
+elseif (NOT "${baseline}" STREQUAL "")
+  file(READ "${baseline}" base)
+  string(JSON num_runs LENGTH "${base}" runs)
+  set(regressions "")
+  math(EXPR last "${num_runs} - 1")
+  foreach (i RANGE ${last})
+    string(JSON app_name GET "${base}" runs ${i} app)
+    string(JSON mode GET "${base}" runs ${i} mode)
+    string(JSON base_ms GET "${base}" runs ${i} total_ms)
+    set(key ${app_name}.${mode})
+    if (NOT DEFINED total_${key})
+      continue ()
+    endif ()
+    format_ratio(${total_${key}} ${base_ms} ratio)
+    message("${key}: ${total_${key}} ms vs baseline ${base_ms} ms = ${ratio}x")
+    # natives tell us how noisy the machine is but are not regressions
+    if (NOT "${mode}" STREQUAL "native")
+      math(EXPR limit "${base_ms} * (100 + ${threshold}) / 100")
+      if (total_${key} GREATER limit)
+        list(APPEND regressions "${key} (${ratio}x)")
+      endif ()
+    endif ()
+  endforeach ()
+  if (NOT "${regressions}" STREQUAL "")
+    message(FATAL_ERROR "*** slower than baseline by more than ${threshold}%: "
+      "${regressions}***\n")
+  endif ()
+endif ()
@@ -0,0 +1,92 @@
+/* **********************************************************
+ * Copyright (c) 2026 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/* Dr. Memory: the memory debugger
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Tests -lazy_stack, where stack beyond the top of the stack is kept
+ * undefined rather than unaddressable and new stack is only marked when it
+ * goes below a per-thread low-water mark.  Reads of uninitialized locals must
+ * still be reported whether the frame reuses stack above the mark or extends
+ * it, and a read of a frame just popped off the stack reads as undefined.
+ */
+#include <stdio.h>
+
+#define DEPTH 64
+#define FRAME_INTS 32
+
+static int sink;
+static int *dangling;
+
+/* Defines the stack used by each level, so that later frames reusing it
+ * would read defined values if de-allocation did not mark it undefined.
+ */
+static int
+recurse(int depth, int (*leaf)(void))
+{
+    volatile int buf[FRAME_INTS];
+    int i;
+    for (i = 0; i < FRAME_INTS; i++)
+        buf[i] = depth;
+    if (depth == 0)
+        return (leaf == NULL) ? 0 : (*leaf)();
+    return recurse(depth - 1, leaf) + buf[0];
+}
+
+static int
+uninit_above_mark(void)
+{
+    int x;
+    if (x == 0) /* error: uninitialized */
+        return 1;
+    return 0;
+}
+
+static int
+uninit_below_mark(void)
+{
+    int x;
+    if (x == 0) /* error: uninitialized */
+        return 1;
+    return 0;
+}
+
+static void
+leave_dangling(void)
+{
+    int local = 42;
+    dangling = &local;
+    sink = local;
+}
+
+int
+main()
+{
+    /* sets the low-water mark */
+    sink = recurse(DEPTH, NULL);
+    /* reuses stack recurse() defined and then freed, above the mark */
+    sink = uninit_above_mark();
+    /* goes twice as deep, below the mark */
+    sink = recurse(DEPTH * 2, uninit_below_mark);
+    /* the popped frame right below xsp is undefined, not unaddressable */
+    leave_dangling();
+    if (*dangling == 42) /* error: uninitialized */
+        sink++;
+    printf("done\n");
+    return 0;
+}
@@ -0,0 +1,64 @@
+/* **********************************************************
+ * Copyright (c) 2026 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/* Dr. Memory: the memory debugger
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Tests that with -malloc_callstack_samples, callers that reach the same
+ * malloc call at different stack depths keep distinct callstacks, so
+ * their leaks are reported separately.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Well past the samples the test runs with, so both sites reuse */
+#define NUM_LEAKS 50
+
+/* The one allocation site both callers share */
+static void *
+leak(size_t size)
+{
+    return malloc(size);
+}
+
+static void
+caller_a(void)
+{
+    leak(16);
+}
+
+static void
+caller_b(void)
+{
+    /* Puts the call to leak() at a different stack depth */
+    volatile char pad[256];
+    pad[0] = 0;
+    leak(32);
+}
+
+int
+main()
+{
+    int i;
+    for (i = 0; i < NUM_LEAKS; i++) {
+        caller_a();
+        caller_b();
+    }
+    printf("done\n");
+    return 0;
+}
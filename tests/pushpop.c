@@ -0,0 +1,64 @@
+/* **********************************************************
+ * Copyright (c) 2014 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/* Dr. Memory: the memory debugger
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Tests that 64-bit pushes and pops carry the shadow of all 8 bytes of
+ * the stack slot.  Only built for 64-bit Linux.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* We step over the red zone so the push doesn't clobber the compiler's locals */
+static unsigned long long
+push_pop(unsigned long long *src)
+{
+    unsigned long long val;
+    __asm__ __volatile__("sub $128, %%rsp\n\t"
+                         "mov (%1), %%rax\n\t"
+                         "push %%rax\n\t"
+                         "pop %0\n\t"
+                         "add $128, %%rsp\n\t"
+                         : "=r"(val) : "r"(src) : "rax", "memory");
+    return val;
+}
+
+int
+main()
+{
+    unsigned long long *p = (unsigned long long *) malloc(sizeof(*p));
+    unsigned long long val;
+
+    /* only the bottom half is defined */
+    *(unsigned int *)p = 0;
+    val = push_pop(p);
+    if (val == 0) /* error: top half is uninitialized */
+        *p = 1;
+
+    /* no error once the whole slot is defined */
+    *p = 42;
+    val = push_pop(p);
+    if (val == 42)
+        printf("forty-two\n");
+
+    free(p);
+    printf("all done\n");
+    return 0;
+}
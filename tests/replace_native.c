@@ -0,0 +1,137 @@
+/* **********************************************************
+ * Copyright (c) 2026 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/* Dr. Memory: the memory debugger
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Tests that a large memcpy or memset, which the libc replacements hand to a
+ * native op when the shadow shows no error is possible, falls back to the
+ * instrumented loop and reports at the first bad byte when its operands are
+ * partly undefined, run off the end of a malloc, or touch freed memory.
+ * Also tests that the string routines, which scan natively past a short
+ * prefix, still report an undefined byte beyond that prefix.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Past the size at which the replacements try a native op.  A global so
+ * the compiler emits real library calls.
+ */
+size_t op_size = 512;
+/* The valid prefix of each operand */
+#define GOOD 300
+
+static void
+copy_partly_undefined(void)
+{
+    char *src = (char *) malloc(op_size);
+    char *dst = (char *) malloc(op_size);
+    memset(src, 'x', GOOD); /* the rest of src stays undefined */
+    memcpy(dst, src, op_size);
+    /* The copy must carry src's shadow over byte for byte. */
+    if (dst[GOOD - 1] != 'x')
+        printf("copy failed\n");
+    if (dst[GOOD] == 'x') /* error: uninitialized, at the first undefined byte */
+        printf("undefined byte matched\n");
+    free(src);
+    free(dst);
+}
+
+static void
+copy_beyond_bounds(void)
+{
+    char *src = (char *) malloc(GOOD);
+    char *dst = (char *) malloc(op_size);
+    memset(src, 'x', GOOD);
+    memcpy(dst, src, op_size); /* error: reads past the end of src */
+    free(src);
+    free(dst);
+}
+
+static void
+set_beyond_bounds(void)
+{
+    char *dst = (char *) malloc(GOOD);
+    memset(dst, 0, op_size); /* error: writes past the end of dst */
+    free(dst);
+}
+
+static void
+copy_into_freed(void)
+{
+    char *src = (char *) malloc(GOOD);
+    char *freed = (char *) malloc(op_size);
+    char *dst = (char *) malloc(op_size);
+    memset(src, 'x', GOOD);
+    free(freed);
+    /* Runs off the end of src toward the freed chunk above it: the first
+     * bad byte is still the one just past src.
+     */
+    memcpy(dst, src, op_size); /* error: reads past the end of src */
+    free(src);
+    free(dst);
+}
+
+static void
+copy_from_freed(void)
+{
+    char *freed = (char *) malloc(op_size);
+    char *dst = (char *) malloc(op_size);
+    memset(freed, 'x', op_size);
+    free(freed);
+    memcpy(dst, freed, op_size); /* error: the very first byte read was freed */
+    free(dst);
+}
+
+/* Past the prefix the string replacements scan before going native */
+#define STR_DEFINED 40
+#define STR_SIZE 64
+
+static void
+str_partly_undefined(void)
+{
+    char *s = (char *) malloc(STR_SIZE);
+    char other[STR_DEFINED + 2];
+    size_t len;
+    int cmp;
+    memset(s, 'a', STR_DEFINED);
+    s[STR_SIZE - 1] = '\0'; /* the bytes in between stay undefined */
+    memset(other, 'a', STR_DEFINED);
+    other[STR_DEFINED] = 'b';
+    other[STR_DEFINED + 1] = '\0';
+    len = strlen(s); /* error: uninitialized, at s[STR_DEFINED] */
+    cmp = strcmp(s, other); /* error: uninitialized, at s[STR_DEFINED] */
+    /* Neither result is printed: both depend on the undefined bytes. */
+    (void) len;
+    (void) cmp;
+    free(s);
+}
+
+int
+main()
+{
+    copy_partly_undefined();
+    copy_beyond_bounds();
+    set_beyond_bounds();
+    copy_into_freed();
+    copy_from_freed();
+    str_partly_undefined();
+    printf("done\n");
+    return 0;
+}
@@ -0,0 +1,38 @@
+# **********************************************************
+# Copyright (c) 2026 Google, Inc.  All rights reserved.
+# **********************************************************
+#
+# Dr. Memory: the memory debugger
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation;
+# version 2.1 of the License, and no later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# Library General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+#
+Error #1: UNINITIALIZED READ: reading 1 byte(s)
+replace_native.c:50
+Error #2: UNADDRESSABLE ACCESS beyond heap bounds: reading
+replace_native.c:62
+refers to 0 byte(s) beyond last valid byte in prior malloc
+Error #3: UNADDRESSABLE ACCESS beyond heap bounds: writing
+replace_native.c:71
+refers to 0 byte(s) beyond last valid byte in prior malloc
+Error #4: UNADDRESSABLE ACCESS beyond heap bounds: reading
+replace_native.c:86
+refers to 0 byte(s) beyond last valid byte in prior malloc
+Error #5: UNADDRESSABLE ACCESS of freed memory: reading
+replace_native.c:98
+overlaps memory that was freed
+Error #6: UNINITIALIZED READ: reading
+replace_native.c:118
+Error #7: UNINITIALIZED READ: reading
+replace_native.c:119
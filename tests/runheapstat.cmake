@@ -0,0 +1,149 @@
+# **********************************************************
+# Copyright (c) 2026 Google, Inc.  All rights reserved.
+# **********************************************************
+
+# Dr. Memory: the memory debugger
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation;
+# version 2.1 of the License, and no later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# Library General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+# Runs Dr. Heapstat and checks one of the raw logs it writes, which
+# runtest.cmake does not look at, or compares the postprocessed logs of
+# two runs.
+#
+# input:
+# * cmd = command to run, with intra-arg space=@@ and inter-arg space=@
+# * logname = name of the log in the app's log dir to wait for and check.
+#     It must be closed after the others at exit.
+# * logpat = optional file of regexes, one per line, that must match the log
+#     in order.  A line beginning with # is a comment and is ignored.
+# * refcmd = optional second command, encoded like cmd
+# * postcmd = for refcmd, a command, encoded like cmd, that is run with
+#     "-profdir <logdir>" appended for each of the two runs: its outputs
+#     must be identical
+#
+# these allow for parameterization for more portable tests (PR 544430)
+# env vars will override; else passed-in default settings will be used:
+# * DRMEMORY_CTEST_SRC_DIR = source dir
+# * DRMEMORY_CTEST_DR_DIR = DynamoRIO cmake dir
+
+if (NOT "$ENV{DRMEMORY_CTEST_SRC_DIR}" STREQUAL "")
+  set(DRMEMORY_CTEST_SRC_DIR "$ENV{DRMEMORY_CTEST_SRC_DIR}")
+endif ()
+if (NOT "$ENV{DRMEMORY_CTEST_DR_DIR}" STREQUAL "")
+  set(DRMEMORY_CTEST_DR_DIR "$ENV{DRMEMORY_CTEST_DR_DIR}")
+endif ()
+foreach (var cmd logpat refcmd postcmd)
+  string(REGEX REPLACE "{DRMEMORY_CTEST_SRC_DIR}"
+    "${DRMEMORY_CTEST_SRC_DIR}" ${var} "${${var}}")
+  string(REGEX REPLACE "{DRMEMORY_CTEST_DR_DIR}"
+    "${DRMEMORY_CTEST_DR_DIR}" ${var} "${${var}}")
+endforeach ()
+
+find_program(PERL perl)
+if (NOT PERL)
+  message(FATAL_ERROR "cannot find perl")
+endif (NOT PERL)
+set(SLEEP_SHORT ${PERL} -e "select(undef, undef, undef, 0.1)")
+set(TIMEOUT_SHORT "100")  # *0.1 = 10 seconds
+
+# Runs cmd and sets logdir to its log dir and log to the contents of
+# ${logname} once that is complete.
+function (run_heapstat cmd)
+  string(REGEX REPLACE "@@" " " cmd "${cmd}")
+  string(REGEX REPLACE "@" ";" cmd "${cmd}")
+  execute_process(COMMAND ${cmd}
+    RESULT_VARIABLE cmd_result
+    ERROR_VARIABLE cmd_err
+    OUTPUT_VARIABLE cmd_out)
+  if (cmd_result)
+    message(FATAL_ERROR "*** ${cmd} failed (${cmd_result}): ${cmd_err}***\n")
+  endif (cmd_result)
+  set(cmd_err "${cmd_out}${cmd_err}")
+
+  string(REGEX MATCH "Data is in ([^\n]+)/\n" logdir "${cmd_err}")
+  if ("${logdir}" STREQUAL "")
+    message(FATAL_ERROR "no log dir in output:\n${cmd_err}")
+  endif ()
+  string(REGEX REPLACE "Data is in ([^\n]+)/\n" "\\1" logdir "${logdir}")
+
+  # the logs are closed at exit, which may be after the front-end returns
+  set(iters 0)
+  set(log "")
+  while (NOT "${log}" MATCHES "LOG END\n")
+    if (EXISTS "${logdir}/${logname}")
+      file(READ "${logdir}/${logname}" log)
+    endif ()
+    if (NOT "${log}" MATCHES "LOG END\n")
+      execute_process(COMMAND ${SLEEP_SHORT})
+      math(EXPR iters "${iters} + 1")
+      if ("${iters}" STREQUAL "${TIMEOUT_SHORT}")
+        message(FATAL_ERROR "Timed out waiting for ${logdir}/${logname}")
+      endif ()
+    endif ()
+  endwhile ()
+  set(logdir "${logdir}" PARENT_SCOPE)
+  set(log "${log}" PARENT_SCOPE)
+endfunction (run_heapstat)
+
+# Runs postcmd on the logs in dir and sets outvar to its output.
+function (postprocess dir outvar)
+  string(REGEX REPLACE "@@" " " cmd "${postcmd}")
+  string(REGEX REPLACE "@" ";" cmd "${cmd}")
+  execute_process(COMMAND ${cmd} -profdir ${dir}
+    RESULT_VARIABLE cmd_result
+    ERROR_VARIABLE cmd_err
+    OUTPUT_VARIABLE cmd_out)
+  if (cmd_result)
+    message(FATAL_ERROR "*** ${cmd} failed (${cmd_result}): ${cmd_err}***\n")
+  endif (cmd_result)
+  set(${outvar} "${cmd_out}" PARENT_SCOPE)
+endfunction (postprocess)
+
+run_heapstat("${cmd}")
+
+if (NOT "${refcmd}" STREQUAL "")
+  set(cmd_logdir "${logdir}")
+  set(cmd_log "${log}")
+  run_heapstat("${refcmd}")
+  postprocess("${cmd_logdir}" cmd_res)
+  postprocess("${logdir}" ref_res)
+  if ("${cmd_res}" STREQUAL "")
+    message(FATAL_ERROR "no output from ${postcmd} for ${cmd_logdir}")
+  endif ()
+  if (NOT "${cmd_res}" STREQUAL "${ref_res}")
+    message(FATAL_ERROR "postprocessed logs differ:\n"
+      "${cmd_logdir}:\n${cmd_res}\n${logdir}:\n${ref_res}")
+  endif ()
+  set(log "${cmd_log}")
+endif ()
+
+if ("${logpat}" STREQUAL "")
+  return ()
+endif ()
+
+file(STRINGS "${logpat}" patterns)
+set(tomatch "${log}")
+foreach (pattern ${patterns})
+  if (NOT "${pattern}" MATCHES "^#")
+    string(REGEX MATCH "${pattern}" found "${tomatch}")
+    if ("${found}" STREQUAL "")
+      message(FATAL_ERROR "${logname} failed to match \"${pattern}\":\n${log}")
+    endif ()
+    string(FIND "${tomatch}" "${found}" pos)
+    string(LENGTH "${found}" len)
+    math(EXPR pos "${pos} + ${len}")
+    string(SUBSTRING "${tomatch}" ${pos} -1 tomatch)
+  endif ()
+endforeach (pattern)
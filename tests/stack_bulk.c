@@ -0,0 +1,74 @@
+/* **********************************************************
+ * Copyright (c) 2026 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/* Dr. Memory: the memory debugger
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Tests a stack allocation larger than -stack_bulk_threshold, which the
+ * esp-adjust fastpath hands off to a single out-of-line update: in full mode
+ * the new stack must read as undefined, and for -leaks_only it must have been
+ * zeroed so that stale pointers left there do not hide leaks (PR 520916).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef WINDOWS
+# include <malloc.h>
+# define alloca _alloca
+#else
+# include <alloca.h>
+#endif
+
+/* Above the default -stack_bulk_threshold of 0x4000 but below the default
+ * -stack_swap_threshold.  A global so the alloca size is not a constant.
+ */
+size_t big_size = 0x8000;
+
+/* Leaves pointers all over the stack below our caller's frame */
+static void
+leave_pointers(void)
+{
+    void **buf = (void **) alloca(big_size);
+    size_t i;
+    for (i = 0; i < big_size / sizeof(void *); i++)
+        buf[i] = (void *) &big_size;
+}
+
+/* Returns how many of the stale pointers are still there */
+static size_t
+count_pointers(void)
+{
+    void **buf = (void **) alloca(big_size);
+    size_t i, count = 0;
+    for (i = 0; i < big_size / sizeof(void *); i++) {
+        if (buf[i] != NULL) /* uninit in full mode */
+            count++;
+    }
+    return count;
+}
+
+int
+main()
+{
+    size_t count;
+    leave_pointers();
+    count = count_pointers();
+    /* only meaningful for -leaks_only, where the stack is zeroed */
+    printf("stale pointers: %d\n", (int) count);
+    printf("done\n");
+    return 0;
+}
@@ -0,0 +1,104 @@
+/* **********************************************************
+ * Copyright (c) 2026 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/* Dr. Memory: the memory debugger
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Tests that readv's many output buffers, which Dr. Memory commits together
+ * post-syscall, are all marked defined, including those after a buffer that
+ * is unaddressable.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+/* More than one post-syscall batch's worth */
+#define NUM_IOV 100
+#define IOV_LEN 2
+#define FREED_IOV 50
+#define PADSZ 64
+
+/* Padding keeps native malloc from using the freed buffer */
+typedef struct _padded_buf_t {
+    char pad1[PADSZ];
+    char buf[IOV_LEN];
+    char pad2[PADSZ];
+} padded_buf_t;
+
+static padded_buf_t *bufs[NUM_IOV];
+static struct iovec iov[NUM_IOV];
+
+/* Fills the pipe and reads it back with one readv into every buffer */
+static void
+fill_and_readv(int fds[2])
+{
+    char data[NUM_IOV * IOV_LEN];
+    ssize_t res;
+    memset(data, 'x', sizeof(data));
+    if (write(fds[1], data, sizeof(data)) != sizeof(data))
+        perror("write");
+    res = readv(fds[0], iov, NUM_IOV);
+    if (res != sizeof(data))
+        perror("readv");
+}
+
+/* Reads into freshly allocated, so undefined, buffers, after freeing the
+ * buffer at index freed if it is not -1.  Then uses every other buffer: none
+ * of them should be uninitialized.  Returns how many were filled.
+ */
+static int
+readv_round(int fds[2], int freed)
+{
+    int i, count = 0;
+    for (i = 0; i < NUM_IOV; i++) {
+        bufs[i] = (padded_buf_t *) malloc(sizeof(*bufs[i]));
+        iov[i].iov_base = bufs[i]->buf;
+        iov[i].iov_len = IOV_LEN;
+    }
+    if (freed >= 0)
+        free(bufs[freed]);
+    fill_and_readv(fds);
+    for (i = 0; i < NUM_IOV; i++) {
+        if (i == freed)
+            continue;
+        if (bufs[i]->buf[0] == 'x' && bufs[i]->buf[IOV_LEN - 1] == 'x')
+            count++;
+        free(bufs[i]);
+    }
+    return count;
+}
+
+int
+main(void)
+{
+    int fds[2];
+    if (pipe(fds) != 0) {
+        perror("pipe");
+        return 1;
+    }
+    printf("filled %d\n", readv_round(fds, -1));
+    /* The write to the freed buffer is reported, and the rest are still defined */
+    printf("filled %d\n", readv_round(fds, FREED_IOV));
+    close(fds[0]);
+    close(fds[1]);
+    printf("done\n");
+    return 0;
+}
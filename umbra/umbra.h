@@ -118,6 +118,19 @@ typedef enum {
      * exceptions that should be handled by the user.
      */
     UMBRA_MAP_SHADOW_SHARED_READONLY = 0x2,
+    /**
+     * 32-bit only: Umbra tries to reserve a single region holding the
+     * shadow memory for the whole address space, so that the code inserted by
+     * umbra_insert_app_to_shadow() is a shift and an add with no memory load.
+     * Shadow memory in the region is committed on its first access, and
+     * shared shadow memory blocks are replaced by private ones when first
+     * accessed via the inserted code.  If the region cannot be reserved, or
+     * the mapping scale is not a scale-down, Umbra silently uses its
+     * table-based translation instead.  The region has no redzones between
+     * its blocks.  This flag is ignored on 64-bit, whose translation never
+     * loads from memory.
+     */
+    UMBRA_MAP_INLINE_TRANSLATION = 0x4,
 } umbra_map_flags_t;
 
 /** Shadow memory creation flags used in umbra_create_shadow_memory. */
@@ -68,6 +68,11 @@ struct _umbra_map_t {
     uint num_special_blocks;
     special_block_t default_block;
     special_block_t special_blocks[MAX_NUM_SPECIAL_BLOCKS];
+    /* For UMBRA_MAP_INLINE_TRANSLATION: the region holding the shadow of
+     * the whole address space, or NULL if only the table is used.
+     */
+    byte *flat_base;
+    size_t flat_size;
 #else
     ptr_uint_t disp;
     ptr_uint_t mask;
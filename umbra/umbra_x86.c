@@ -52,6 +52,15 @@
  *   read-only blocks for all-identical 64KB chunks.
  * - XXX: we do not support allocating a shadow memory across 64KB
  *   boundary to simplify the code.
+ * - with UMBRA_MAP_INLINE_TRANSLATION, we reserve one region holding the
+ *   shadow of the whole address space, so that the shadow of app address
+ *   addr is always at flat_base + scale(addr).  All normal blocks are placed
+ *   at their spots in that region, so the table displacement of each of them
+ *   is just flat_base, and the inserted code can add flat_base directly
+ *   instead of loading from the table.  The table stays in place for
+ *   default and special blocks and for all the non-inlined routines: their
+ *   spots in the region are left uncommitted, and when the inserted code
+ *   touches one we turn the block into a normal block in umbra_handle_fault.
  */
 
 /***************************************************************************
@@ -70,6 +79,87 @@
 static ptr_int_t static_shadow_table[SHADOW_TABLE_ENTRIES];
 static bool      static_shadow_table_is_used = false;
 
+/* The map using UMBRA_MAP_INLINE_TRANSLATION, if any.  Its region takes
+ * 1GB for a 4-to-1 scale, so we only try to place one.
+ */
+static umbra_map_t *flat_map;
+
+/***************************************************************************
+ * FLAT REGION ROUTINES
+ */
+
+static inline bool
+shadow_flat_contains(umbra_map_t *map, byte *shadow_addr)
+{
+    return (map->flat_base != NULL && shadow_addr >= map->flat_base &&
+            shadow_addr < map->flat_base + map->flat_size);
+}
+
+static void
+shadow_flat_init(umbra_map_t *map)
+{
+    size_t size;
+    map->flat_base = NULL;
+    map->flat_size = 0;
+    if (!TEST(UMBRA_MAP_INLINE_TRANSLATION, map->options.flags) ||
+        !UMBRA_MAP_SCALE_IS_DOWN(map->options.scale) || flat_map != NULL)
+        return;
+    size = map->shadow_block_size * SHADOW_TABLE_ENTRIES;
+    /* We only reserve here: each block is committed when first needed.
+     * Reserving rather than committing also keeps the region out of the
+     * commit limit on Windows.
+     */
+    map->flat_base = dr_custom_alloc(NULL, DR_ALLOC_NON_HEAP
+                                     IF_WINDOWS(| DR_ALLOC_RESERVE_ONLY),
+                                     size, DR_MEMPROT_NONE, NULL);
+    if (map->flat_base == NULL) {
+        LOG(UMBRA_VERBOSE, "unable to reserve "PIFX" bytes for inline translation: "
+            "using the shadow table\n", size);
+        return;
+    }
+    map->flat_size = size;
+    flat_map = map;
+    LOG(UMBRA_VERBOSE, "shadow of the whole address space is at ["PFX", "PFX")\n",
+        map->flat_base, map->flat_base + map->flat_size);
+}
+
+static void
+shadow_flat_exit(umbra_map_t *map)
+{
+    if (map->flat_base == NULL)
+        return;
+    dr_custom_free(NULL, DR_ALLOC_NON_HEAP, map->flat_base, map->flat_size);
+    map->flat_base = NULL;
+    map->flat_size = 0;
+    if (flat_map == map)
+        flat_map = NULL;
+}
+
+static byte *
+shadow_flat_commit_block(umbra_map_t *map, app_pc app_base)
+{
+    byte *block = map->flat_base +
+        umbra_map_scale_app_to_shadow(map, ALIGN_BACKWARD(app_base,
+                                                          APP_BLOCK_SIZE));
+    bool ok;
+#ifdef WINDOWS
+    ok = (dr_custom_alloc(NULL, DR_ALLOC_NON_HEAP | DR_ALLOC_COMMIT_ONLY |
+                          DR_ALLOC_FIXED_LOCATION, map->shadow_block_size,
+                          DR_MEMPROT_READ | DR_MEMPROT_WRITE, block) != NULL);
+#else
+    ok = dr_memory_protect(block, map->shadow_block_size,
+                           DR_MEMPROT_READ | DR_MEMPROT_WRITE);
+#endif
+    if (!ok) {
+        /* The inserted code always goes to the region, so falling back to
+         * a separate block would just fault again.
+         */
+        NOTIFY_ERROR("Out of memory: failed to commit shadow memory"NL);
+        dr_abort();
+    }
+    return block;
+}
+
 /***************************************************************************
  * SHADOW TABLE ROUTINES
  */
@@ -85,6 +175,9 @@ shadow_table_get_block_offset(umbra_map_t *map, app_pc app_addr)
 static void
 shadow_table_delete_block(umbra_map_t *map, byte *shadow_start)
 {
+    /* blocks in the flat region go away with the region */
+    if (shadow_flat_contains(map, shadow_start))
+        return;
     global_free(shadow_start - map->options.redzone_size,
                 map->shadow_block_alloc_size, HEAPSTAT_SHADOW);
 }
@@ -104,9 +197,14 @@ shadow_table_init_redzone(umbra_map_t *map, byte *block)
 }
 
 static byte *
-shadow_table_create_block(umbra_map_t *map)
+shadow_table_create_block(umbra_map_t *map, app_pc app_base)
 {
     byte *block;
+    if (map->flat_base != NULL) {
+        block = shadow_flat_commit_block(map, app_base);
+        LOG(UMBRA_VERBOSE, "committed shadow block "PFX"\n", block);
+        return block;
+    }
     block = global_alloc(map->shadow_block_alloc_size, HEAPSTAT_SHADOW);
     block = shadow_table_init_redzone(map, block);
     LOG(UMBRA_VERBOSE, "created new shadow block "PFX"\n", block);
@@ -249,6 +347,27 @@ shadow_table_app_to_shadow(umbra_map_t *map, app_pc app_addr)
             shadow_table_get_block_offset(map, app_addr));
 }
 
+/* code sequence with a flat region:
+ * %reg_addr >>= map->scale;
+ * %reg_addr  += flat_base;
+ */
+static void
+shadow_flat_insert_app_to_shadow(void *drcontext,
+                                 umbra_map_t *map,
+                                 instrlist_t *ilist,
+                                 instr_t *where,
+                                 reg_id_t reg_addr)
+{
+    ASSERT(UMBRA_MAP_SCALE_IS_DOWN(map->options.scale), "flat needs scale down");
+    PRE(ilist, where, INSTR_CREATE_shr(drcontext,
+                                       opnd_create_reg(reg_addr),
+                                       OPND_CREATE_INT8(map->shift)));
+    PRE(ilist, where, INSTR_CREATE_add(drcontext,
+                                       opnd_create_reg(reg_addr),
+                                       OPND_CREATE_INT32((ptr_int_t)
+                                                         map->flat_base)));
+}
+
 /* code sequence:
  * %reg_index   = %reg_addr;
  * %reg_index >>= 16;
@@ -389,7 +508,7 @@ shadow_table_replace_block(umbra_map_t *map, app_pc app_base)
         shadow_table_use_special_block(map, app_base, &value, &value_size)) {
         ASSERT(value <= USHRT_MAX && value_size == 1,
                "value_size > 1 is not supported");
-        block = shadow_table_create_block(map);
+        block = shadow_table_create_block(map, app_base);
         memset(block, value, map->shadow_block_size);
         shadow_table_set_block(map, SHADOW_TABLE_INDEX(app_base), block);
     }
@@ -483,6 +602,7 @@ umbra_map_arch_init(umbra_map_t *map, umbra_map_options_t *ops)
     map->shadow_block_size = umbra_map_scale_app_to_shadow(map, APP_BLOCK_SIZE);
     map->shadow_block_alloc_size =
         map->shadow_block_size + 2 * map->options.redzone_size;
+    shadow_flat_init(map);
     shadow_table_init(map);
     return DRMF_SUCCESS;
 }
@@ -491,6 +611,7 @@ void
 umbra_map_arch_exit(umbra_map_t *map)
 {
     shadow_table_exit(map);
+    shadow_flat_exit(map);
 }
 
 drmf_status_t
@@ -822,6 +943,11 @@ umbra_insert_app_to_shadow_arch(void *drcontext,
 {
     if (num_scratch_regs < 1 || scratch_regs == NULL)
         return DRMF_ERROR_INVALID_PARAMETER;
+    if (map->flat_base != NULL) {
+        /* the scratch reg is not needed, but we keep the interface the same */
+        shadow_flat_insert_app_to_shadow(drcontext, map, ilist, where, addr_reg);
+        return DRMF_SUCCESS;
+    }
     shadow_table_insert_app_to_shadow(drcontext, map, ilist, where,
                                       addr_reg, scratch_regs[0]);
     return DRMF_SUCCESS;
@@ -888,6 +1014,18 @@ umbra_get_shadow_memory_type_arch(umbra_map_t *map,
     }
     if (*shadow_type == UMBRA_SHADOW_MEMORY_TYPE_SHARED)
         return DRMF_SUCCESS;
+    if (shadow_flat_contains(map, shadow_addr)) {
+        /* blocks are adjacent here so the redzone walk below does not apply */
+        app_pc app_addr = (app_pc)
+            umbra_map_scale_shadow_to_app(map, shadow_addr - map->flat_base);
+        if (shadow_table_is_in_normal_block(map,
+                                            shadow_table_app_to_shadow(map,
+                                                                       app_addr)))
+            *shadow_type = UMBRA_SHADOW_MEMORY_TYPE_NORMAL;
+        else
+            *shadow_type = UMBRA_SHADOW_MEMORY_TYPE_SHADOW_NOT_ALLOC;
+        return DRMF_SUCCESS;
+    }
     if (umbra_address_is_app_memory(shadow_addr)) {
         *shadow_type = UMBRA_SHADOW_MEMORY_TYPE_UNKNOWN;
         return DRMF_SUCCESS;
@@ -944,6 +1082,8 @@ umbra_address_is_app_memory(app_pc pc)
     /* in x86, shadow memory is allocated within DR */
     if (dr_memory_is_dr_internal(pc) || dr_memory_is_in_client(pc))
         return false;
+    if (flat_map != NULL && shadow_flat_contains(flat_map, pc))
+        return false;
     return true;
 }
 
@@ -990,5 +1130,17 @@ bool
 umbra_handle_fault(void *drcontext, byte *target, dr_mcontext_t *raw_mc,
                    dr_mcontext_t *mc)
 {
+    /* With a flat region the inserted code goes straight to the spot of a
+     * default or special block, which is not committed: we make it a normal
+     * block holding the same value, and the faulting instr is re-executed.
+     */
+    if (flat_map != NULL && shadow_flat_contains(flat_map, target)) {
+        app_pc app_addr = (app_pc)
+            umbra_map_scale_shadow_to_app(flat_map, target - flat_map->flat_base);
+        LOG(UMBRA_VERBOSE, "fault on flat shadow "PFX" for app "PFX"\n",
+            target, app_addr);
+        shadow_table_replace_block(flat_map, app_addr);
+        return true;
+    }
     return false;
 }